@@ -100,21 +100,33 @@
 #include <time.h>
 #include <fcntl.h>
 
+#if !defined(TELETONE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TELETONE_GOERTZEL_SSE2 1
+#include <emmintrin.h>
+#endif
+
 #define LOW_ENG 10000000
 #define ZC 2
-static teletone_detection_descriptor_t dtmf_detect_row[GRID_FACTOR];
-static teletone_detection_descriptor_t dtmf_detect_col[GRID_FACTOR];
-static teletone_detection_descriptor_t dtmf_detect_row_2nd[GRID_FACTOR];
-static teletone_detection_descriptor_t dtmf_detect_col_2nd[GRID_FACTOR];
 
 static float dtmf_row[] = {697.0f,	770.0f,	 852.0f,  941.0f};
 static float dtmf_col[] = {1209.0f, 1336.0f, 1477.0f, 1633.0f};
 
 static char dtmf_positions[] = "123A" "456B" "789C" "*0#D";
 
-static void goertzel_init(teletone_goertzel_state_t *goertzel_state, teletone_detection_descriptor_t *tdesc) {
-	goertzel_state->v2 = goertzel_state->v3 = 0.0;
-	goertzel_state->fac = tdesc->fac;
+static void goertzel_bank_reset(teletone_goertzel_bank_t *bank)
+{
+	memset(bank->v2, 0, sizeof(bank->v2));
+	memset(bank->v3, 0, sizeof(bank->v3));
+}
+
+static void goertzel_bank_set(teletone_goertzel_bank_t *bank, int slot, float theta)
+{
+	bank->fac[slot] = (float)(2.0*cos(theta));
+	bank->v2[slot] = bank->v3[slot] = 0.0;
+
+	if (slot >= bank->count) {
+		bank->count = slot + 1;
+	}
 }
 
 TELETONE_API(void) teletone_goertzel_update(teletone_goertzel_state_t *goertzel_state,
@@ -130,11 +142,61 @@ TELETONE_API(void) teletone_goertzel_update(teletone_goertzel_state_t *goertzel_
 		goertzel_state->v3 = (float)(goertzel_state->fac*goertzel_state->v2 - v1 + sample_buffer[i]);
 	}
 }
+
+/* 
+ * Every filter performs the same arithmetic as teletone_goertzel_update():
+ * the recurrence is evaluated in double precision and rounded to float after
+ * each sample, so the vector and scalar paths produce identical results.
+ * The whole bank is stepped once per sample so the independent filters can
+ * be pipelined (and vectorised) against each other.
+ */
+TELETONE_API(void) teletone_goertzel_bank_update(teletone_goertzel_bank_t *bank,
+									   int16_t sample_buffer[],
+									   int samples)
+{
+	int i, x;
+#ifdef TELETONE_GOERTZEL_SSE2
+	__m128d v2[TELETONE_GOERTZEL_BANK_SIZE / 2], v3[TELETONE_GOERTZEL_BANK_SIZE / 2], fac[TELETONE_GOERTZEL_BANK_SIZE / 2];
+	int groups = (bank->count + 1) / 2;
+
+	for (x = 0; x < groups; x++) {
+		v2[x] = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((double *) &bank->v2[x * 2])));
+		v3[x] = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((double *) &bank->v3[x * 2])));
+		fac[x] = _mm_loadu_pd(&bank->fac[x * 2]);
+	}
+
+	for (i = 0; i < samples; i++) {
+		__m128d famp = _mm_set1_pd((double) sample_buffer[i]);
+
+		for (x = 0; x < groups; x++) {
+			__m128d v1 = v2[x];
+			v2[x] = v3[x];
+			v3[x] = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_add_pd(_mm_sub_pd(_mm_mul_pd(fac[x], v2[x]), v1), famp)));
+		}
+	}
+
+	for (x = 0; x < groups; x++) {
+		_mm_store_sd((double *) &bank->v2[x * 2], _mm_castps_pd(_mm_cvtpd_ps(v2[x])));
+		_mm_store_sd((double *) &bank->v3[x * 2], _mm_castps_pd(_mm_cvtpd_ps(v3[x])));
+	}
+#else
+	float v1;
+
+	for (i = 0; i < samples; i++) {
+		for (x = 0; x < bank->count; x++) {
+			v1 = bank->v2[x];
+			bank->v2[x] = bank->v3[x];
+			bank->v3[x] = (float)(bank->fac[x]*bank->v2[x] - v1 + sample_buffer[i]);
+		}
+	}
+#endif
+}
+
 #ifdef _MSC_VER
 #pragma warning(disable:4244)
 #endif
 
-#define teletone_goertzel_result(gs) (double)(((gs)->v3 * (gs)->v3 + (gs)->v2 * (gs)->v2 - (gs)->v2 * (gs)->v3 * (gs)->fac))
+#define teletone_goertzel_bank_result(b, i) (double)(((b)->v3[i] * (b)->v3[i] + (b)->v2[i] * (b)->v2[i] - (b)->v2[i] * (b)->v3[i] * (b)->fac[i]))
 
 TELETONE_API(void) teletone_dtmf_detect_init (teletone_dtmf_detect_state_t *dtmf_detect_state, int sample_rate)
 {
@@ -142,24 +204,20 @@ TELETONE_API(void) teletone_dtmf_detect_init (teletone_dtmf_detect_state_t *dtmf
 	float theta;
 
 	dtmf_detect_state->hit1 = dtmf_detect_state->hit2 = 0;
+	memset(&dtmf_detect_state->bank, 0, sizeof(dtmf_detect_state->bank));
 
 	for (i = 0;	 i < GRID_FACTOR;  i++) {
 		theta = (float)(M_TWO_PI*(dtmf_row[i]/(float)sample_rate));
-		dtmf_detect_row[i].fac = (float)(2.0*cos(theta));
+		goertzel_bank_set(&dtmf_detect_state->bank, TELETONE_DTMF_ROW + i, theta);
 
 		theta = (float)(M_TWO_PI*(dtmf_col[i]/(float)sample_rate));
-		dtmf_detect_col[i].fac = (float)(2.0*cos(theta));
+		goertzel_bank_set(&dtmf_detect_state->bank, TELETONE_DTMF_COL + i, theta);
 	
 		theta = (float)(M_TWO_PI*(dtmf_row[i]*2.0/(float)sample_rate));
-		dtmf_detect_row_2nd[i].fac = (float)(2.0*cos(theta));
+		goertzel_bank_set(&dtmf_detect_state->bank, TELETONE_DTMF_ROW_2ND + i, theta);
 
 		theta = (float)(M_TWO_PI*(dtmf_col[i]*2.0/(float)sample_rate));
-		dtmf_detect_col_2nd[i].fac = (float)(2.0*cos(theta));
-	
-		goertzel_init (&dtmf_detect_state->row_out[i], &dtmf_detect_row[i]);
-		goertzel_init (&dtmf_detect_state->col_out[i], &dtmf_detect_col[i]);
-		goertzel_init (&dtmf_detect_state->row_out2nd[i], &dtmf_detect_row_2nd[i]);
-		goertzel_init (&dtmf_detect_state->col_out2nd[i], &dtmf_detect_col_2nd[i]);
+		goertzel_bank_set(&dtmf_detect_state->bank, TELETONE_DTMF_COL_2ND + i, theta);
 	
 		dtmf_detect_state->energy = 0.0;
 	}
@@ -197,6 +255,8 @@ TELETONE_API(void) teletone_multi_tone_init(teletone_multi_tone_t *mt, teletone_
 		mt->hit_factor = 2;
 	}
 
+	memset(&mt->bank, 0, sizeof(mt->bank));
+
 	for(x = 0; x < TELETONE_MAX_TONES; x++) {
 		if ((int) map->freqs[x] == 0) {
 			break;
@@ -204,8 +264,7 @@ TELETONE_API(void) teletone_multi_tone_init(teletone_multi_tone_t *mt, teletone_
 		mt->tone_count++;
 		theta = (float)(M_TWO_PI*(map->freqs[x]/(float)mt->sample_rate));
 		mt->tdd[x].fac = (float)(2.0 * cos(theta));
-		goertzel_init (&mt->gs[x], &mt->tdd[x]);
-		goertzel_init (&mt->gs2[x], &mt->tdd[x]);
+		goertzel_bank_set(&mt->bank, x, theta);
 	}
 
 }
@@ -215,7 +274,7 @@ TELETONE_API(int) teletone_multi_tone_detect (teletone_multi_tone_t *mt,
 								int samples)
 {
 	int sample, limit = 0, j, x = 0;
-	float v1, famp;
+	float famp;
 	float eng_sum = 0, eng_all[TELETONE_MAX_TONES] = {0.0};
 	int gtest = 0, see_hit = 0;
 
@@ -233,20 +292,11 @@ TELETONE_API(int) teletone_multi_tone_detect (teletone_multi_tone_t *mt,
 
 		for (j = sample;  j < limit;  j++) {
 			famp = sample_buffer[j];
-			
 			mt->energy += famp*famp;
-
-			for(x = 0; x < TELETONE_MAX_TONES && x < mt->tone_count; x++) {
-				v1 = mt->gs[x].v2;
-				mt->gs[x].v2 = mt->gs[x].v3;
-				mt->gs[x].v3 = (float)(mt->gs[x].fac * mt->gs[x].v2 - v1 + famp);
-	
-				v1 = mt->gs2[x].v2;
-				mt->gs2[x].v2 = mt->gs2[x].v3;
-				mt->gs2[x].v3 = (float)(mt->gs2[x].fac*mt->gs2[x].v2 - v1 + famp);
-			}
 		}
 
+		teletone_goertzel_bank_update(&mt->bank, &sample_buffer[sample], limit - sample);
+
 		mt->current_sample += (limit - sample);
 		if (mt->current_sample < mt->min_samples) {
 			continue;
@@ -254,13 +304,14 @@ TELETONE_API(int) teletone_multi_tone_detect (teletone_multi_tone_t *mt,
 
 		eng_sum = 0;
 		for(x = 0; x < TELETONE_MAX_TONES && x < mt->tone_count; x++) {
-			eng_all[x] = (float)(teletone_goertzel_result (&mt->gs[x]));
+			eng_all[x] = (float)(teletone_goertzel_bank_result (&mt->bank, x));
 			eng_sum += eng_all[x];
 		}
 
+		/* The second filter set shares the first one's frequencies so its energy is recomputed from the same bank */
 		gtest = 0;
 		for(x = 0; x < TELETONE_MAX_TONES && x < mt->tone_count; x++) {
-			gtest += teletone_goertzel_result (&mt->gs2[x]) < eng_all[x] ? 1 : 0;
+			gtest += teletone_goertzel_bank_result (&mt->bank, x) < eng_all[x] ? 1 : 0;
 		}
 
 		if ((gtest >= 2 || gtest == mt->tone_count) && eng_sum > 42.0 * mt->energy) {
@@ -287,10 +338,7 @@ TELETONE_API(int) teletone_multi_tone_detect (teletone_multi_tone_t *mt,
 		}
 
 		/* Reinitialise the detector for the next block */
-		for(x = 0; x < TELETONE_MAX_TONES && x < mt->tone_count; x++) {
-			goertzel_init (&mt->gs[x], &mt->tdd[x]);
-			goertzel_init (&mt->gs2[x], &mt->tdd[x]);
-		}
+		goertzel_bank_reset(&mt->bank);
 
 		mt->energy = 0.0;
 		mt->current_sample = 0;
@@ -307,7 +355,6 @@ TELETONE_API(teletone_hit_type_t) teletone_dtmf_detect (teletone_dtmf_detect_sta
 	float row_energy[GRID_FACTOR];
 	float col_energy[GRID_FACTOR];
 	float famp;
-	float v1;
 	int i;
 	int j;
 	int sample;
@@ -327,42 +374,18 @@ TELETONE_API(teletone_hit_type_t) teletone_dtmf_detect (teletone_dtmf_detect_sta
 		}
 
 		for (j = sample;  j < limit;  j++) {
-			int x = 0;
 			famp = sample_buffer[j];
-			
 			dtmf_detect_state->energy += famp*famp;
-
-			for(x = 0; x < GRID_FACTOR; x++) {
-				v1 = dtmf_detect_state->row_out[x].v2;
-				dtmf_detect_state->row_out[x].v2 = dtmf_detect_state->row_out[x].v3;
-				dtmf_detect_state->row_out[x].v3 = (float)(dtmf_detect_state->row_out[x].fac*dtmf_detect_state->row_out[x].v2 - v1 + famp);
-	
-				v1 = dtmf_detect_state->col_out[x].v2;
-				dtmf_detect_state->col_out[x].v2 = dtmf_detect_state->col_out[x].v3;
-				dtmf_detect_state->col_out[x].v3 = (float)(dtmf_detect_state->col_out[x].fac*dtmf_detect_state->col_out[x].v2 - v1 + famp);
-
-				v1 = dtmf_detect_state->col_out2nd[x].v2;
-				dtmf_detect_state->col_out2nd[x].v2 = dtmf_detect_state->col_out2nd[x].v3;
-				dtmf_detect_state->col_out2nd[x].v3 = (float)(dtmf_detect_state->col_out2nd[x].fac*dtmf_detect_state->col_out2nd[x].v2 - v1 + famp);
-		
-				v1 = dtmf_detect_state->row_out2nd[x].v2;
-				dtmf_detect_state->row_out2nd[x].v2 = dtmf_detect_state->row_out2nd[x].v3;
-				dtmf_detect_state->row_out2nd[x].v3 = (float)(dtmf_detect_state->row_out2nd[x].fac*dtmf_detect_state->row_out2nd[x].v2 - v1 + famp);
-			}
-
 		}
 
+		teletone_goertzel_bank_update(&dtmf_detect_state->bank, &sample_buffer[sample], limit - sample);
+
 		if (dtmf_detect_state->zc > 0) {
 			if (dtmf_detect_state->energy < LOW_ENG && dtmf_detect_state->lenergy < LOW_ENG) {
 				if (!--dtmf_detect_state->zc) {
 					/* Reinitialise the detector for the next block */
 					dtmf_detect_state->hit1 = dtmf_detect_state->hit2 = 0;
-					for (i = 0;	 i < GRID_FACTOR;  i++) {
-						goertzel_init (&dtmf_detect_state->row_out[i], &dtmf_detect_row[i]);
-						goertzel_init (&dtmf_detect_state->col_out[i], &dtmf_detect_col[i]);
-						goertzel_init (&dtmf_detect_state->row_out2nd[i], &dtmf_detect_row_2nd[i]);
-						goertzel_init (&dtmf_detect_state->col_out2nd[i], &dtmf_detect_col_2nd[i]);
-					}
+					goertzel_bank_reset(&dtmf_detect_state->bank);
 					dtmf_detect_state->dur -= samples;
 					return TT_HIT_END;
 				}
@@ -384,15 +407,15 @@ TELETONE_API(teletone_hit_type_t) teletone_dtmf_detect (teletone_dtmf_detect_sta
 		}
 		/* We are at the end of a DTMF detection block */
 		/* Find the peak row and the peak column */
-		row_energy[0] = teletone_goertzel_result (&dtmf_detect_state->row_out[0]);
-		col_energy[0] = teletone_goertzel_result (&dtmf_detect_state->col_out[0]);
+		row_energy[0] = teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_ROW);
+		col_energy[0] = teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_COL);
 
 		for (best_row = best_col = 0, i = 1;  i < GRID_FACTOR;	i++) {
-			row_energy[i] = teletone_goertzel_result (&dtmf_detect_state->row_out[i]);
+			row_energy[i] = teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_ROW + i);
 			if (row_energy[i] > row_energy[best_row]) {
 				best_row = i;
 			}
-			col_energy[i] = teletone_goertzel_result (&dtmf_detect_state->col_out[i]);
+			col_energy[i] = teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_COL + i);
 			if (col_energy[i] > col_energy[best_col]) {
 				best_col = i;
 			}
@@ -412,8 +435,8 @@ TELETONE_API(teletone_hit_type_t) teletone_dtmf_detect (teletone_dtmf_detect_sta
 			}
 			/* ... and second harmonic test */
 			if (i >= GRID_FACTOR && (row_energy[best_row] + col_energy[best_col]) > 42.0*dtmf_detect_state->energy &&
-				teletone_goertzel_result (&dtmf_detect_state->col_out2nd[best_col])*DTMF_2ND_HARMONIC_COL < col_energy[best_col] &&
-				teletone_goertzel_result (&dtmf_detect_state->row_out2nd[best_row])*DTMF_2ND_HARMONIC_ROW < row_energy[best_row]) {
+				teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_COL_2ND + best_col)*DTMF_2ND_HARMONIC_COL < col_energy[best_col] &&
+				teletone_goertzel_bank_result (&dtmf_detect_state->bank, TELETONE_DTMF_ROW_2ND + best_row)*DTMF_2ND_HARMONIC_ROW < row_energy[best_row]) {
 				hit = dtmf_positions[(best_row << 2) + best_col];
 				/* Look for two successive similar results */
 				/* The logic in the next test is:
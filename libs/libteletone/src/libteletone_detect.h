@@ -148,6 +148,26 @@ extern "C" {
 		float v3;
 		double fac;
 	} teletone_goertzel_state_t;
+
+	/*! \brief Number of filter slots in a Goertzel bank (a multiple of 4 large enough for DTMF and TELETONE_MAX_TONES) */
+#define TELETONE_GOERTZEL_BANK_SIZE 20
+
+	/*! \brief A bank of Goertzel filters stepped together over the same samples.
+	  The filter state is kept as parallel arrays so that the whole bank can be
+	  updated several filters at a time with SIMD instructions when available.
+	*/
+	typedef struct {
+		float v2[TELETONE_GOERTZEL_BANK_SIZE];
+		float v3[TELETONE_GOERTZEL_BANK_SIZE];
+		double fac[TELETONE_GOERTZEL_BANK_SIZE];
+		int count;
+	} teletone_goertzel_bank_t;
+
+	/*! \brief Slot layout of the DTMF Goertzel bank */
+#define TELETONE_DTMF_ROW 0
+#define TELETONE_DTMF_COL (GRID_FACTOR)
+#define TELETONE_DTMF_ROW_2ND (GRID_FACTOR * 2)
+#define TELETONE_DTMF_COL_2ND (GRID_FACTOR * 3)
 	
 	/*! \brief A container for a DTMF detection state.*/
 	typedef struct {
@@ -159,10 +179,7 @@ extern "C" {
 		int zc;
 		
 
-		teletone_goertzel_state_t row_out[GRID_FACTOR];
-		teletone_goertzel_state_t col_out[GRID_FACTOR];
-		teletone_goertzel_state_t row_out2nd[GRID_FACTOR];
-		teletone_goertzel_state_t col_out2nd[GRID_FACTOR];
+		teletone_goertzel_bank_t bank;
 		float energy;
 		float lenergy;
 	
@@ -187,8 +204,7 @@ extern "C" {
 		int sample_rate;
 
 		teletone_detection_descriptor_t tdd[TELETONE_MAX_TONES];
-		teletone_goertzel_state_t gs[TELETONE_MAX_TONES];
-		teletone_goertzel_state_t gs2[TELETONE_MAX_TONES];
+		teletone_goertzel_bank_t bank;
 		int tone_count;
 
 		float energy;
@@ -262,6 +278,16 @@ TELETONE_API(void) teletone_goertzel_update(teletone_goertzel_state_t *goertzel_
 								  int16_t sample_buffer[],
 								  int samples);
 
+	/*! 
+	  \brief Step through the Goertzel Algorithm for every filter in a bank for each sample in a buffer
+	  \param bank the goertzel bank to step the samples through
+	  \param sample_buffer an array aof 16 bit signed linear samples
+	  \param samples the number of samples present in sample_buffer
+	*/
+TELETONE_API(void) teletone_goertzel_bank_update(teletone_goertzel_bank_t *bank,
+									   int16_t sample_buffer[],
+									   int samples);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,284 @@
+
+#include <libteletone_detect.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static int fail_count;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+static const char *digits = "123A456B789C*0#D";
+static const float rows[] = { 697.0f, 770.0f, 852.0f, 941.0f };
+static const float cols[] = { 1209.0f, 1336.0f, 1477.0f, 1633.0f };
+
+/**
+ * Deterministic noise so every run sees the same corpus
+ */
+static uint32_t noise_seed = 12345;
+
+static int16_t noise(int amplitude)
+{
+	noise_seed = noise_seed * 1103515245 + 12345;
+	return (int16_t) ((int) ((noise_seed >> 16) % (2 * amplitude + 1)) - amplitude);
+}
+
+/**
+ * Append len_ms of the sum of the given frequencies plus noise to buf
+ */
+static int add_tone(int16_t *buf, int pos, int rate, int len_ms, const float *freqs, int nfreqs, double amplitude, int noise_amp)
+{
+	int i, x, samples = rate * len_ms / 1000;
+
+	for (i = 0; i < samples; i++) {
+		double v = 0;
+
+		for (x = 0; x < nfreqs; x++) {
+			v += amplitude * sin(2.0 * M_PI * freqs[x] * (pos + i) / rate);
+		}
+
+		if (noise_amp) {
+			v += noise(noise_amp);
+		}
+
+		buf[pos + i] = (int16_t) v;
+	}
+
+	return pos + samples;
+}
+
+/**
+ * Feed buf through a DTMF detector in 20ms frames the way inband_dtmf_callback does and collect the digits
+ */
+static int run_dtmf(int16_t *buf, int len, int rate, char *out, int outlen)
+{
+	teletone_dtmf_detect_state_t dtmf;
+	int pos, n = 0, frame = rate / 50;
+
+	teletone_dtmf_detect_init(&dtmf, rate);
+
+	for (pos = 0; pos + frame <= len; pos += frame) {
+		if (teletone_dtmf_detect(&dtmf, buf + pos, frame) == TT_HIT_END) {
+			char digit;
+			unsigned int dur;
+
+			if (teletone_dtmf_get(&dtmf, &digit, &dur) && n < outlen - 1) {
+				out[n++] = digit;
+			}
+		}
+	}
+
+	out[n] = '\0';
+	return n;
+}
+
+/**
+ * Every bank slot must match teletone_goertzel_update() on the same samples bit for bit
+ */
+static void test_bank_matches_scalar(void)
+{
+	int16_t buf[1000];
+	int counts[] = { 1, 7, 16, TELETONE_GOERTZEL_BANK_SIZE };
+	int chunks[] = { 1, 13, 102, 160, 724 };
+	int c, i, x, pos, k;
+
+	for (i = 0; i < 1000; i++) {
+		buf[i] = noise(32767);
+	}
+
+	for (c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+		teletone_goertzel_bank_t bank;
+		teletone_goertzel_state_t gs[TELETONE_GOERTZEL_BANK_SIZE];
+		int mismatch = 0;
+
+		memset(&bank, 0, sizeof(bank));
+		bank.count = counts[c];
+
+		for (x = 0; x < bank.count; x++) {
+			double theta = 2.0 * M_PI * (300.0 + 97.0 * x) / 8000.0;
+			gs[x].fac = bank.fac[x] = (float) (2.0 * cos(theta));
+			gs[x].v2 = gs[x].v3 = 0;
+		}
+
+		for (pos = 0, k = 0; pos < 1000; k++) {
+			int n = chunks[k % 5];
+
+			if (pos + n > 1000) {
+				n = 1000 - pos;
+			}
+
+			teletone_goertzel_bank_update(&bank, buf + pos, n);
+
+			for (x = 0; x < bank.count; x++) {
+				teletone_goertzel_update(&gs[x], buf + pos, n);
+				if (memcmp(&gs[x].v2, &bank.v2[x], sizeof(float)) || memcmp(&gs[x].v3, &bank.v3[x], sizeof(float))) {
+					mismatch++;
+				}
+			}
+
+			pos += n;
+		}
+
+		CHECK(!mismatch, "bank of %d filters differs from the scalar filter %d times", counts[c], mismatch);
+	}
+
+	printf("test_bank_matches_scalar() : %s\n", fail_count ? "FAIL" : "PASS");
+}
+
+/**
+ * Every digit must be detected exactly once, with and without background noise
+ */
+static void test_dtmf(int rate, int noise_amp)
+{
+	int16_t *buf = calloc(rate * 4, sizeof(int16_t));
+	char got[64];
+	int i, pos = 0, before = fail_count;
+
+	pos = add_tone(buf, pos, rate, 100, NULL, 0, 0, noise_amp);
+
+	for (i = 0; i < 16; i++) {
+		float freqs[2];
+
+		freqs[0] = rows[i / 4];
+		freqs[1] = cols[i % 4];
+		pos = add_tone(buf, pos, rate, 80, freqs, 2, 6000, noise_amp);
+		pos = add_tone(buf, pos, rate, 80, NULL, 0, 0, noise_amp);
+	}
+
+	run_dtmf(buf, pos, rate, got, sizeof(got));
+	CHECK(!strcmp(got, digits), "rate %d noise %d: expected %s got %s", rate, noise_amp, digits, got);
+
+	printf("test_dtmf(%d, %d) : %s\n", rate, noise_amp, fail_count == before ? "PASS" : "FAIL");
+	free(buf);
+}
+
+/**
+ * Tones too short, off frequency or absent must not produce digits
+ */
+static void test_dtmf_reject(int rate)
+{
+	int16_t *buf = calloc(rate * 4, sizeof(int16_t));
+	char got[64];
+	float off[2] = { 697.0f * 1.05f, 1209.0f * 1.05f };
+	float speech[3] = { 220.0f, 440.0f, 660.0f };
+	float one[1] = { 1000.0f };
+	int pos = 0, before = fail_count;
+
+	pos = add_tone(buf, pos, rate, 500, NULL, 0, 0, 8000);
+	pos = add_tone(buf, pos, rate, 200, off, 2, 6000, 0);
+	pos = add_tone(buf, pos, rate, 100, NULL, 0, 0, 0);
+	pos = add_tone(buf, pos, rate, 400, speech, 3, 5000, 0);
+	pos = add_tone(buf, pos, rate, 400, one, 1, 10000, 0);
+
+	run_dtmf(buf, pos, rate, got, sizeof(got));
+	CHECK(!*got, "rate %d: expected no digits got %s", rate, got);
+
+	printf("test_dtmf_reject(%d) : %s\n", rate, fail_count == before ? "PASS" : "FAIL");
+	free(buf);
+}
+
+/**
+ * The dial tone map must hit on dial tone and stay quiet on silence, noise and a single tone
+ */
+static void test_multi_tone(int rate)
+{
+	teletone_multi_tone_t mt;
+	teletone_tone_map_t map;
+	int16_t *buf = calloc(rate * 2, sizeof(int16_t));
+	float dial[2] = { 350.0f, 440.0f };
+	float one[1] = { 1000.0f };
+	int pos, len, frame = rate / 50, hits, before = fail_count;
+
+	memset(&map, 0, sizeof(map));
+	map.freqs[0] = 350;
+	map.freqs[1] = 440;
+
+	memset(&mt, 0, sizeof(mt));
+	mt.sample_rate = rate;
+	teletone_multi_tone_init(&mt, &map);
+
+	len = add_tone(buf, 0, rate, 1000, dial, 2, 5000, 200);
+	for (hits = 0, pos = 0; pos + frame <= len; pos += frame) {
+		hits += teletone_multi_tone_detect(&mt, buf + pos, frame);
+	}
+	CHECK(hits > 0, "rate %d: dial tone not detected", rate);
+
+	len = add_tone(buf, 0, rate, 500, NULL, 0, 0, 4000);
+	len = add_tone(buf, len, rate, 500, one, 1, 8000, 0);
+	for (hits = 0, pos = 0; pos + frame <= len; pos += frame) {
+		hits += teletone_multi_tone_detect(&mt, buf + pos, frame);
+	}
+	CHECK(hits == 0, "rate %d: %d false dial tone hits", rate, hits);
+
+	printf("test_multi_tone(%d) : %s\n", rate, fail_count == before ? "PASS" : "FAIL");
+	free(buf);
+}
+
+/**
+ * Report how many 8k sessions running inband DTMF detection one core can sustain
+ */
+static void bench_dtmf(void)
+{
+	int rate = 8000, seconds = 10, frame = rate / 50, runs = 200, pos, i, len;
+	int16_t *buf = calloc(rate * seconds, sizeof(int16_t));
+	teletone_dtmf_detect_state_t dtmf;
+	clock_t start;
+	double cpu;
+	float tone[2] = { 770.0f, 1336.0f };
+
+	for (len = 0; len < rate * (seconds - 1); ) {
+		len = add_tone(buf, len, rate, 900, NULL, 0, 0, 1000);
+		len = add_tone(buf, len, rate, 100, tone, 2, 6000, 1000);
+	}
+
+	teletone_dtmf_detect_init(&dtmf, rate);
+	start = clock();
+
+	for (i = 0; i < runs; i++) {
+		for (pos = 0; pos + frame <= len; pos += frame) {
+			if (teletone_dtmf_detect(&dtmf, buf + pos, frame) == TT_HIT_END) {
+				char digit;
+				unsigned int dur;
+				teletone_dtmf_get(&dtmf, &digit, &dur);
+			}
+		}
+	}
+
+	cpu = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	if (cpu > 0) {
+		printf("bench_dtmf() : %.0f seconds of audio in %.3fs cpu, %.0f sessions per core\n",
+			   (double) runs * len / rate, cpu, (double) runs * len / rate / cpu);
+	}
+
+	free(buf);
+}
+
+/**
+ * Main program
+ *
+ */
+int main(int argc, char **argv)
+{
+	int rates[] = { 8000, 16000, 48000 };
+	int i;
+
+	test_bank_matches_scalar();
+
+	for (i = 0; i < 3; i++) {
+		test_dtmf(rates[i], 0);
+		test_dtmf(rates[i], 300);
+		test_dtmf_reject(rates[i]);
+		test_multi_tone(rates[i]);
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench_dtmf();
+	}
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+
+	return fail_count ? 1 : 0;
+}
@@ -48,6 +48,236 @@
 #pragma warning (disable:167)
 #endif
 
+/* one leg of a native .rtpdump recording decoded onto its own timeline */
+typedef struct {
+	switch_codec_t codec;
+	int16_t *pcm;
+	switch_size_t len;
+	switch_size_t alloc;
+	uint32_t ts0;
+	switch_size_t pos0;
+	int started;
+} rtpdump_leg_t;
+
+static const char *rtpdump_codec_name(int pt)
+{
+	switch (pt) {
+	case 0:
+		return "PCMU";
+	case 3:
+		return "GSM";
+	case 8:
+		return "PCMA";
+	case 9:
+		return "G722";
+	case 18:
+		return "G729";
+	default:
+		return NULL;
+	}
+}
+
+static int rtpdump_leg_put(rtpdump_leg_t *leg, switch_size_t pos, const int16_t *data, switch_size_t samples)
+{
+	if (pos + samples > leg->alloc) {
+		switch_size_t alloc = leg->alloc ? leg->alloc : 8000 * 60;
+		int16_t *pcm;
+
+		while (alloc < pos + samples) {
+			alloc *= 2;
+		}
+
+		if (!(pcm = realloc(leg->pcm, alloc * sizeof(int16_t)))) {
+			return -1;
+		}
+
+		memset(pcm + leg->alloc, 0, (alloc - leg->alloc) * sizeof(int16_t));
+		leg->pcm = pcm;
+		leg->alloc = alloc;
+	}
+
+	memcpy(leg->pcm + pos, data, samples * sizeof(int16_t));
+
+	if (pos + samples > leg->len) {
+		leg->len = pos + samples;
+	}
+
+	return 0;
+}
+
+/* 
+   Mix the two legs of a native recording made with record_session to a .rtpdump file.
+   Payload types outside the static table need the codec named with -c.
+*/
+static int rtpdump_mix(const char *input, const char *output, const char *codec_name, const char *fmtp, int rate, int ptime, int stereo,
+					   switch_bool_t verbose, switch_memory_pool_t *pool)
+{
+	switch_file_t *fd = NULL;
+	switch_file_handle_t fh = { 0 };
+	rtpdump_leg_t legs[2] = { { { 0 } } };
+	uint8_t packet[65536];
+	int16_t decoded[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	uint32_t out_rate = 0;
+	switch_size_t len, total = 0, x;
+	char c = 0;
+	int r = 1, i, packets = 0;
+
+	if (switch_file_open(&fd, input, SWITCH_FOPEN_READ | SWITCH_FOPEN_BINARY | SWITCH_FOPEN_BUFFERED, SWITCH_FPROT_OS_DEFAULT, pool) != SWITCH_STATUS_SUCCESS) {
+		fprintf(stderr, "Couldn't open %s\n", input);
+		return 1;
+	}
+
+	/* #!rtpplay1.0 address/port line followed by the 16 byte RD_hdr_t */
+	do {
+		len = 1;
+		if (switch_file_read(fd, &c, &len) != SWITCH_STATUS_SUCCESS || !len) {
+			fprintf(stderr, "%s is not an rtpdump file\n", input);
+			goto end;
+		}
+	} while (c != '\n');
+
+	len = 16;
+	if (switch_file_read(fd, packet, &len) != SWITCH_STATUS_SUCCESS || len != 16) {
+		fprintf(stderr, "%s is not an rtpdump file\n", input);
+		goto end;
+	}
+
+	for (;;) {
+		uint16_t plen, hlen;
+		uint32_t offset, ts, ssrc;
+		uint32_t dlen = sizeof(decoded), drate = rate;
+		unsigned int flags = 0;
+		rtpdump_leg_t *leg;
+		const char *name;
+		int pt;
+
+		len = 8;
+		if (switch_file_read(fd, packet, &len) != SWITCH_STATUS_SUCCESS || len != 8) {
+			break;
+		}
+
+		plen = ntohs(*(uint16_t *) (packet + 2));
+		offset = ntohl(*(uint32_t *) (packet + 4));
+
+		len = plen;
+		if (!plen || switch_file_read(fd, packet, &len) != SWITCH_STATUS_SUCCESS || len != plen) {
+			break;
+		}
+
+		hlen = 12 + (packet[0] & 0x0f) * 4;
+		if (plen <= hlen || (packet[0] & 0xc0) != 0x80) {
+			continue;
+		}
+
+		pt = packet[1] & 0x7f;
+		ts = ntohl(*(uint32_t *) (packet + 4));
+		ssrc = ntohl(*(uint32_t *) (packet + 8));
+		leg = &legs[ssrc & 1];
+
+		if (!leg->codec.implementation) {
+			if (!(name = codec_name ? codec_name : rtpdump_codec_name(pt))) {
+				fprintf(stderr, "Unknown payload type %d, name the codec with -c\n", pt);
+				goto end;
+			}
+
+			if (switch_core_codec_init(&leg->codec, name, fmtp, rate, ptime, 1, SWITCH_CODEC_FLAG_DECODE, NULL, pool) != SWITCH_STATUS_SUCCESS) {
+				fprintf(stderr, "Couldn't initialize codec for %s@%dh@%di\n", name, rate, ptime);
+				goto end;
+			}
+
+			if (!out_rate) {
+				out_rate = leg->codec.implementation->actual_samples_per_second;
+			} else if (out_rate != leg->codec.implementation->actual_samples_per_second) {
+				fprintf(stderr, "Legs decode at different rates, can't mix them\n");
+				goto end;
+			}
+		}
+
+		if (switch_core_codec_decode(&leg->codec, NULL, packet + hlen, plen - hlen, rate, decoded, &dlen, &drate, &flags) != SWITCH_STATUS_SUCCESS) {
+			continue;
+		}
+
+		if (!leg->started) {
+			leg->ts0 = ts;
+			leg->pos0 = (switch_size_t) offset * out_rate / 1000;
+			leg->started = 1;
+		}
+
+		if (ts - leg->ts0 > 0x7fffffff) {
+			continue;
+		}
+
+		if (rtpdump_leg_put(leg, leg->pos0 + (ts - leg->ts0), decoded, dlen / 2)) {
+			fprintf(stderr, "Out of memory\n");
+			goto end;
+		}
+
+		packets++;
+	}
+
+	if (verbose) {
+		fprintf(stderr, "Mixed %d packets\n", packets);
+	}
+
+	if (!out_rate) {
+		fprintf(stderr, "No audio in %s\n", input);
+		goto end;
+	}
+
+	if (switch_core_file_open(&fh, output, stereo ? 2 : 1, out_rate, SWITCH_FILE_FLAG_WRITE | SWITCH_FILE_DATA_SHORT, NULL) != SWITCH_STATUS_SUCCESS) {
+		fprintf(stderr, "Couldn't open %s\n", output);
+		goto end;
+	}
+
+	total = legs[0].len > legs[1].len ? legs[0].len : legs[1].len;
+
+	for (x = 0; x < total; x += len) {
+		int16_t out[2048];
+		switch_size_t n;
+
+		len = total - x > 1024 ? 1024 : total - x;
+
+		for (n = 0; n < len; n++) {
+			int16_t in_s = x + n < legs[0].len ? legs[0].pcm[x + n] : 0;
+			int16_t out_s = x + n < legs[1].len ? legs[1].pcm[x + n] : 0;
+
+			if (stereo) {
+				out[n * 2] = in_s;
+				out[n * 2 + 1] = out_s;
+			} else {
+				int32_t mixed = in_s + out_s;
+				switch_normalize_to_16bit(mixed);
+				out[n] = (int16_t) mixed;
+			}
+		}
+
+		n = len;
+		if (switch_core_file_write(&fh, out, &n) != SWITCH_STATUS_SUCCESS) {
+			fprintf(stderr, "Write error\n");
+			goto end;
+		}
+	}
+
+	r = 0;
+
+end:
+
+	if (fh.file_interface) {
+		switch_core_file_close(&fh);
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (legs[i].codec.implementation) {
+			switch_core_codec_destroy(&legs[i].codec);
+		}
+		switch_safe_free(legs[i].pcm);
+	}
+
+	switch_file_close(fd);
+
+	return r;
+}
+
 int main(int argc, char *argv[]) 
 {
 	int r = 1;
@@ -73,6 +303,8 @@ int main(int argc, char *argv[])
 	int in_asis = 0;
 	int out_asis = 0;
 	int out_flags = SWITCH_FILE_FLAG_WRITE;
+	const char *codec_name = NULL;
+	int stereo = 0;
 
 	for (i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
@@ -102,6 +334,12 @@ int main(int argc, char *argv[])
 				case 'v':
 					verbose = SWITCH_TRUE;
 					break;
+				case 'c':
+					codec_name = argv[++i];
+					break;
+				case 's':
+					stereo = 1;
+					break;
 				default:
 					printf("Command line option not recognized: %s\n", argv[i]);
 					cmd_fail = 1;
@@ -153,6 +391,12 @@ int main(int argc, char *argv[])
 	}
 
 	switch_core_new_memory_pool(&pool);
+
+	if (switch_stristr(".rtpdump", input)) {
+		r = rtpdump_mix(input, output, codec_name, fmtp, rate, ptime, stereo, verbose, pool);
+		goto end;
+	}
+
 	if (verbose) {
 		fprintf(stderr, "Opening file %s\n", input);
 	}
@@ -290,11 +534,14 @@ end:
 usage:
 	printf("Usage: %s [options] input output\n\n", argv[0]);
 	printf("The output must end in the format, e.g., myfile.SPEEX\n");
+	printf("An .rtpdump input from a native recording is decoded and mixed to the output\n");
 	printf("\t\t -l module[,module]\t Load additional modules (comma-separated)\n");
 	printf("\t\t -f format\t\t fmtp to pass to the codec\n");
 	printf("\t\t -p ptime\t\t ptime to use while encoding\n");
 	printf("\t\t -r rate\t\t sampling rate\n");
 	printf("\t\t -b bitrate\t\t codec bitrate (if supported)\n");
+	printf("\t\t -c codec\t\t codec of an .rtpdump input with a dynamic payload type\n");
+	printf("\t\t -s\t\t\t write an .rtpdump input as stereo, in left and out right\n");
 	printf("\t\t -v\t\t\t verbose\n");
 	return 1;
 }
@@ -176,11 +176,72 @@ struct switch_core_session {
 	plc_state_t *plc;
 	uint8_t recur_buffer[SWITCH_RECOMMENDED_BUFFER_SIZE];
 	switch_size_t recur_buffer_len;
+	struct switch_media_tap *tap;
 };
 
+/* one direction of a session's audio captured once for every media bug subscribed to it */
+typedef struct switch_media_tap_stream {
+	uint8_t *data;
+	uint64_t size;
+	uint64_t head;
+	/* oldest position still held, raised when the buffer is regrown */
+	uint64_t floor;
+	int subscribers;
+} switch_media_tap_stream_t;
+
+/* per-session tap hub, bugs that only listen keep a cursor into it instead of their own buffers */
+struct switch_media_tap {
+	switch_mutex_t *mutex;
+	switch_media_tap_stream_t read;
+	switch_media_tap_stream_t write;
+	/* the last mix produced by switch_core_media_bug_read, reused by any bug asking for the same audio */
+	int mix_valid;
+	uint64_t mix_read_pos;
+	uint64_t mix_write_pos;
+	switch_size_t mix_read_len;
+	switch_size_t mix_write_len;
+	uint32_t mix_flags;
+	uint32_t mix_bytes;
+	uint32_t mix_len;
+	switch_status_t mix_status;
+	int16_t mix_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+};
+
+typedef struct switch_media_tap switch_media_tap_t;
+
+#define SWITCH_MEDIA_TAP_MAX_GAPS 8
+
+/* spans of a tap stream fed while a subscriber was paused or otherwise ineligible but still had older audio queued */
+typedef struct switch_media_tap_gaps {
+	uint64_t start[SWITCH_MEDIA_TAP_MAX_GAPS];
+	uint64_t end[SWITCH_MEDIA_TAP_MAX_GAPS];
+	uint32_t count;
+} switch_media_tap_gaps_t;
+
+/* 
+   private copy of one stream for a bug, the media thread is the only writer and the bug consumer the only reader
+   so head and tail each have a single owner and no lock is needed; size is a power of two.
+   A flush may come from any thread, it only posts flush_to/flush_req and the consumer moves tail itself.
+*/
+typedef struct switch_media_bug_ring {
+	uint8_t *data;
+	uint32_t size;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t flush_to;
+	volatile uint32_t flush_req;
+	uint32_t flush_seen;
+} switch_media_bug_ring_t;
+
 struct switch_media_bug {
-	switch_buffer_t *raw_write_buffer;
-	switch_buffer_t *raw_read_buffer;
+	switch_media_bug_ring_t *raw_write_buffer;
+	switch_media_bug_ring_t *raw_read_buffer;
+	uint64_t tap_read_pos;
+	uint64_t tap_write_pos;
+	switch_media_tap_gaps_t tap_read_gaps;
+	switch_media_tap_gaps_t tap_write_gaps;
+	uint8_t tap_read;
+	uint8_t tap_write;
 	switch_frame_t *read_replace_frame_in;
 	switch_frame_t *read_replace_frame_out;
 	switch_frame_t *write_replace_frame_in;
@@ -188,8 +249,6 @@ struct switch_media_bug {
 	switch_frame_t *native_read_frame;
 	switch_frame_t *native_write_frame;
 	switch_media_bug_callback_t callback;
-	switch_mutex_t *read_mutex;
-	switch_mutex_t *write_mutex;
 	switch_core_session_t *session;
 	void *user_data;
 	uint32_t flags;
@@ -207,6 +266,11 @@ struct switch_media_bug {
 	uint32_t record_pre_buffer_max;
 	switch_frame_t *ping_frame;
 	switch_frame_t *read_demux_frame;
+	uint32_t batch_frames;
+	uint32_t batch_read;
+	uint32_t batch_write;
+	/* set while a thread is inside switch_core_media_bug_read, the rings behind it allow a single consumer */
+	volatile uint32_t reader;
 	struct switch_media_bug *next;
 };
 
@@ -263,6 +327,10 @@ struct switch_runtime {
 	int multiple_registrations;
 	uint32_t max_db_handles;
 	uint32_t db_handle_timeout;
+	uint32_t user_cache_ttl;
+	uint32_t user_cache_negative_ttl;
+	uint32_t user_cache_stale_ttl;
+	uint32_t user_cache_max;
 	int cpu_count;
 	uint32_t time_sync;
 	char *core_db_pre_trans_execute;
@@ -274,9 +342,17 @@ struct switch_runtime {
 extern struct switch_runtime runtime;
 
 
+#define SWITCH_SESSION_TABLE_STRIPES 64
+
+/* one slice of the session table, uuids are spread over the stripes so lookups only contend per stripe */
+struct switch_session_stripe {
+	switch_thread_rwlock_t *rwlock;
+	switch_hash_t *table;
+};
+
 struct switch_session_manager {
 	switch_memory_pool_t *memory_pool;
-	switch_hash_t *session_table;
+	struct switch_session_stripe stripes[SWITCH_SESSION_TABLE_STRIPES];
 	uint32_t session_count;
 	uint32_t session_limit;
 	switch_size_t session_id;
@@ -298,5 +374,9 @@ void switch_core_sqldb_stop(void);
 void switch_core_session_init(switch_memory_pool_t *pool);
 void switch_core_session_uninit(void);
 void switch_core_state_machine_init(switch_memory_pool_t *pool);
+uint64_t switch_core_media_bug_tap_feed(switch_core_session_t *session, switch_media_bug_flag_t stream, const void *data, uint32_t datalen);
+void switch_core_media_bug_tap_skip(switch_media_bug_t *bug, switch_media_bug_flag_t stream, uint64_t mark);
+uint32_t switch_core_media_bug_ring_write(switch_media_bug_ring_t *ring, const void *data, uint32_t datalen);
+switch_bool_t switch_core_media_bug_batch_ready(switch_media_bug_t *bug, switch_abc_type_t type);
 switch_memory_pool_t *switch_core_memory_init(void);
 void switch_core_memory_stop(void);
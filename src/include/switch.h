@@ -143,6 +143,7 @@
 #include "switch_pgsql.h"
 #include "switch_json.h"
 #include "switch_limit.h"
+#include "switch_spool.h"
 #include <libteletone.h>
 
 
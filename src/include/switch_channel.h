@@ -94,6 +94,39 @@ SWITCH_DECLARE(int) switch_channel_test_ready(switch_channel_t *channel, switch_
 #define switch_channel_media_ack(_channel) (!switch_channel_test_cap(_channel, CC_MEDIA_ACK) || switch_channel_test_flag(_channel, CF_MEDIA_ACK))
 
 SWITCH_DECLARE(void) switch_channel_wait_for_state(switch_channel_t *channel, switch_channel_t *other_channel, switch_channel_state_t want_state);
+
+/*!
+  \brief Create a waiter that can be attached to channels to be woken on their state and flag changes
+  \param waiter the new waiter
+  \param pool the pool to allocate it from, it must outlive every channel it is attached to
+  \return SWITCH_STATUS_SUCCESS if successful
+*/
+SWITCH_DECLARE(switch_status_t) switch_channel_waiter_create(switch_channel_waiter_t **waiter, switch_memory_pool_t *pool);
+
+/*!
+  \brief Attach a waiter to a channel (or detach with NULL), a channel holds at most one waiter
+*/
+SWITCH_DECLARE(void) switch_channel_set_waiter(switch_channel_t *channel, switch_channel_waiter_t *waiter);
+
+/*!
+  \brief Read the change counter of a waiter, pass it to switch_channel_waiter_wait after checking the channels
+*/
+SWITCH_DECLARE(uint32_t) switch_channel_waiter_seq(switch_channel_waiter_t *waiter);
+
+/*!
+  \brief Block until an attached channel changes after seq was read or the timeout expires
+  \param waiter the waiter
+  \param seq the counter read before the channels were last checked
+  \param timeout the longest time to wait in microseconds
+  \return SWITCH_STATUS_SUCCESS if woken by a change, SWITCH_STATUS_TIMEOUT otherwise
+*/
+SWITCH_DECLARE(switch_status_t) switch_channel_waiter_wait(switch_channel_waiter_t *waiter, uint32_t seq, switch_interval_time_t timeout);
+
+/*!
+  \brief Wake a waiter by hand
+*/
+SWITCH_DECLARE(void) switch_channel_waiter_wake(switch_channel_waiter_t *waiter);
+
 SWITCH_DECLARE(void) switch_channel_wait_for_state_timeout(switch_channel_t *other_channel, switch_channel_state_t want_state, uint32_t timeout);
 SWITCH_DECLARE(switch_status_t) switch_channel_wait_for_flag(switch_channel_t *channel,
 															 switch_channel_flag_t want_flag,
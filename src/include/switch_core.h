@@ -287,6 +287,9 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_transfer_recordings(switch
   \param bug the bug to read from
   \param frame the frame to write the data to
   \return the amount of data 
+  \note a bug has a single consumer: only one thread at a time may read it, usually the bug callback or the one thread
+         the callback hands the audio to.  The buffers behind it are lock free and a second concurrent reader is a bug,
+         it is logged and asserted.
 */
 SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(_In_ switch_media_bug_t *bug, _In_ switch_frame_t *frame, switch_bool_t fill);
 
@@ -304,6 +307,15 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_flush_all(_In_ switch_core
 
 SWITCH_DECLARE(switch_status_t) switch_core_media_bug_set_pre_buffer_framecount(switch_media_bug_t *bug, uint32_t framecount);
 
+/*!
+  \brief Deliver READ and WRITE callbacks once every framecount frames instead of every frame
+  \param bug the bug to batch
+  \param framecount the number of frames per callback, 0 or 1 for every frame
+  \note the callback must drain the bug with switch_core_media_bug_read until it stops returning SWITCH_STATUS_SUCCESS
+  \note READ_PING is still delivered every frame, ping_frame only holds the frame being read
+*/
+SWITCH_DECLARE(switch_status_t) switch_core_media_bug_set_batch_framecount(switch_media_bug_t *bug, uint32_t framecount);
+
 ///\}
 
 ///\defgroup pa1 Port Allocation
@@ -103,6 +103,26 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_generate_xml_cdr(switch_core_session_
 SWITCH_DECLARE(int) switch_ivr_set_xml_profile_data(switch_xml_t xml, switch_caller_profile_t *caller_profile, int off);
 SWITCH_DECLARE(int) switch_ivr_set_xml_chan_vars(switch_xml_t xml, switch_channel_t *channel, int off);
 
+/*!
+  \brief Generate an XML CDR report as text without building an xml tree.
+  \param session the session to get the data from.
+  \param xml_text pointer to the resulting text, identical to switch_xml_toxml() of switch_ivr_generate_xml_cdr()
+  \param prn_header add <?xml version..> header too
+  \return SWITCH_STATUS_SUCCESS if successful
+  \note on success the text must be freed
+*/
+SWITCH_DECLARE(switch_status_t) switch_ivr_generate_xml_cdr_text(switch_core_session_t *session, char **xml_text, switch_bool_t prn_header);
+
+/*!
+  \brief Generate a JSON CDR report as text without building a json object.
+  \param session the session to get the data from.
+  \param json_text pointer to the resulting text, identical to cJSON_PrintUnformatted() of switch_ivr_generate_json_cdr()
+  \param urlencode url encode the channel variables
+  \return SWITCH_STATUS_SUCCESS if successful
+  \note on success the text must be freed
+*/
+SWITCH_DECLARE(switch_status_t) switch_ivr_generate_json_cdr_text(switch_core_session_t *session, char **json_text, switch_bool_t urlencode);
+
 /*!
   \brief Parse command from an event
   \param session the session on which to parse the event
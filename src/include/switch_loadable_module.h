@@ -301,6 +301,12 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_exists(const char *mod);
 */
 SWITCH_DECLARE(switch_status_t) switch_loadable_module_unload_module(char *dir, char *fname, switch_bool_t force, const char **err);
 
+/*!
+  \brief Write the startup timeline (per module load start and duration) to a stream
+  \param stream the stream to write to
+*/
+SWITCH_DECLARE(void) switch_loadable_module_timeline(switch_stream_handle_t *stream);
+
 /* Prototypes of module interface functions */
 
 /*!
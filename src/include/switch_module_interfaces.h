@@ -353,6 +353,8 @@ struct switch_file_handle {
 	const char *prefix;
 	int max_samples;
 	switch_event_t *params;
+	/*! codec implementation the reader can consume without transcoding (a hint for streaming formats) */
+	const switch_codec_implementation_t *native_impl;
 };
 
 /*! \brief Abstract interface to an asr module */
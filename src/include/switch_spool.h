@@ -0,0 +1,117 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2012, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * The Initial Developer of the Original Code is
+ * Anthony Minessale II <anthm@freeswitch.org>
+ * Portions created by the Initial Developer are Copyright (C)
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ *
+ * switch_spool.h - Disk spool with batching delivery workers
+ *
+ */
+/*!
+  \defgroup spool1 Delivery spool
+  \ingroup core1
+  \{
+*/
+#ifndef _SWITCH_SPOOL_H
+#define _SWITCH_SPOOL_H
+
+SWITCH_BEGIN_EXTERN_C
+
+#define SWITCH_SPOOL_MAX_WORKERS 16
+#define SWITCH_SPOOL_MAX_BATCH 500
+
+typedef struct switch_spool switch_spool_t;
+
+/*! \brief A record read back from the spool for delivery */
+typedef struct {
+	/*! the name it was written with */
+	const char *name;
+	/*! the payload, NUL terminated */
+	char *data;
+	switch_size_t len;
+} switch_spool_record_t;
+
+/*! \brief Build the body for a batch of more than one record; a batch of one is posted as the record itself */
+typedef char *(*switch_spool_render_func_t) (switch_spool_record_t *records, uint32_t count, void *user_data);
+/*!
+  \brief Deliver a body
+  \return SWITCH_STATUS_SUCCESS when delivered, SWITCH_STATUS_BREAK to leave the records in the spool
+  for the next start, anything else hands each record to the failed callback
+*/
+typedef switch_status_t (*switch_spool_post_func_t) (void *worker_data, const char *body, switch_spool_record_t *records, uint32_t count,
+													 void *user_data);
+typedef void (*switch_spool_failed_func_t) (switch_spool_record_t *record, void *user_data);
+/*! \brief State owned by one delivery worker, e.g. a curl handle kept alive between posts */
+typedef void *(*switch_spool_worker_init_func_t) (void *user_data);
+typedef void (*switch_spool_worker_destroy_func_t) (void *worker_data, void *user_data);
+
+typedef struct {
+	/*! directory holding the <seq>.spool segments */
+	const char *dir;
+	/*! tags every record so segments of another spool or a torn write are recognised */
+	uint32_t magic;
+	uint32_t workers;
+	uint32_t batch_size;
+	switch_spool_render_func_t render;
+	switch_spool_post_func_t post;
+	switch_spool_failed_func_t failed;
+	switch_spool_worker_init_func_t worker_init;
+	switch_spool_worker_destroy_func_t worker_destroy;
+	void *user_data;
+} switch_spool_settings_t;
+
+/*!
+  \brief Open a spool, queue what a previous run left undelivered in it and start the delivery workers
+  \param spool the new spool
+  \param settings directory, record magic, worker count, batch size and callbacks
+  \param pool the pool the spool lives in
+  \return SWITCH_STATUS_SUCCESS or SWITCH_STATUS_FALSE if the directory cannot be created
+*/
+SWITCH_DECLARE(switch_status_t) switch_spool_create(switch_spool_t **spool, const switch_spool_settings_t *settings, switch_memory_pool_t *pool);
+
+/*!
+  \brief Append a record to the spool and queue it for the workers
+  \return SWITCH_STATUS_FALSE if the spool is stopping or the write failed; the caller delivers it itself
+*/
+SWITCH_DECLARE(switch_status_t) switch_spool_write(switch_spool_t *spool, const char *name, const char *data);
+
+/*! \brief Write the backlog, the age of the oldest queued record and the delivery counters to a stream */
+SWITCH_DECLARE(void) switch_spool_status(switch_spool_t *spool, switch_stream_handle_t *stream);
+
+/*!
+  \brief Stop the workers and close the spool; anything undelivered stays on disk for the next start
+*/
+SWITCH_DECLARE(void) switch_spool_destroy(switch_spool_t **spool);
+
+SWITCH_END_EXTERN_C
+#endif
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4:
+ */
@@ -101,6 +101,20 @@ struct switch_xml {
 	uint32_t refs;
 };
 
+/*! \brief Incremental XML text writer producing the same layout as switch_xml_toxml() without building a tree */
+typedef struct {
+	/*! output buffer, malloced */
+	char *data;
+	/*! bytes used in data */
+	switch_size_t len;
+	/*! bytes allocated for data */
+	switch_size_t max;
+	/*! current nesting depth */
+	uint32_t depth;
+	/*! the last open tag still needs its closing '>' */
+	switch_bool_t in_tag;
+} switch_xml_writer_t;
+
 /*! 
  * \brief Parses a string into a switch_xml_t, ensuring the memory will be freed with switch_xml_free
  * \param s The string to parse
@@ -227,6 +241,44 @@ SWITCH_DECLARE(char *) switch_xml_tohtml(_In_ switch_xml_t xml, _In_ switch_bool
 SWITCH_DECLARE(char *) switch_xml_toxml_buf(_In_ switch_xml_t xml, _In_z_ char *buf, _In_ switch_size_t buflen, _In_ switch_size_t offset,
 											_In_ switch_bool_t prn_header);
 
+///\brief Starts a streaming xml document.  Tags written with the switch_xml_writer_* calls are
+///\ laid out exactly as switch_xml_toxml() would lay out the equivalent tree.
+///\param writer the writer to initialize
+///\param prn_header add <?xml version..> header too
+SWITCH_DECLARE(void) switch_xml_writer_init(_In_ switch_xml_writer_t *writer, _In_ switch_bool_t prn_header);
+
+///\brief Opens a tag; attributes may be added until text or a child tag is written
+///\param writer the writer
+///\param name the tag name
+SWITCH_DECLARE(void) switch_xml_writer_open(_In_ switch_xml_writer_t *writer, _In_z_ const char *name);
+
+///\brief Adds an attribute to the tag just opened. A NULL value is written as an empty string.
+///\param writer the writer
+///\param name the attribute name
+///\param value the attribute value
+SWITCH_DECLARE(void) switch_xml_writer_attr(_In_ switch_xml_writer_t *writer, _In_z_ const char *name, _In_opt_z_ const char *value);
+
+///\brief Writes character content for the current tag
+///\param writer the writer
+///\param txt the text
+SWITCH_DECLARE(void) switch_xml_writer_text(_In_ switch_xml_writer_t *writer, _In_opt_z_ const char *txt);
+
+///\brief Closes the current tag
+///\param writer the writer
+///\param name the tag name, must match the matching switch_xml_writer_open()
+SWITCH_DECLARE(void) switch_xml_writer_close(_In_ switch_xml_writer_t *writer, _In_z_ const char *name);
+
+///\brief Writes a complete <name>txt</name> tag
+///\param writer the writer
+///\param name the tag name
+///\param txt the text
+SWITCH_DECLARE(void) switch_xml_writer_leaf(_In_ switch_xml_writer_t *writer, _In_z_ const char *name, _In_opt_z_ const char *txt);
+
+///\brief Finishes the document and returns the text, which must be freed. The writer may not be used afterwards.
+///\param writer the writer
+///\return the xml text string
+SWITCH_DECLARE(char *) switch_xml_writer_finish(_In_ switch_xml_writer_t *writer);
+
 ///\brief returns a NULL terminated array of processing instructions for the given
 ///\ target
 ///\param xml the xml node
@@ -387,6 +439,7 @@ SWITCH_DECLARE(switch_status_t) switch_xml_locate_user_in_domain(_In_z_ const ch
 SWITCH_DECLARE(switch_status_t) switch_xml_locate_user_merged(const char *key, const char *user_name, const char *domain_name,
 															  const char *ip, switch_xml_t *user, switch_event_t *params);
 SWITCH_DECLARE(uint32_t) switch_xml_clear_user_cache(const char *key, const char *user_name, const char *domain_name);
+SWITCH_DECLARE(void) switch_xml_user_cache_stats(switch_stream_handle_t *stream);
 SWITCH_DECLARE(void) switch_xml_merge_user(switch_xml_t user, switch_xml_t domain, switch_xml_t group);
 
 SWITCH_DECLARE(switch_xml_t) switch_xml_dup(switch_xml_t xml);
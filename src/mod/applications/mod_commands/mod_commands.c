@@ -5497,6 +5497,18 @@ SWITCH_STANDARD_API(xml_flush_function)
 	return SWITCH_STATUS_SUCCESS;
 }
 
+SWITCH_STANDARD_API(xml_cache_stats_function)
+{
+	switch_xml_user_cache_stats(stream);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_STANDARD_API(module_timeline_function)
+{
+	switch_loadable_module_timeline(stream);
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_STANDARD_API(escape_function)
 {
 	int len;
@@ -6058,6 +6070,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_commands_load)
 	SWITCH_ADD_API(commands_api_interface, "uuid_jitterbuffer", "uuid_jitterbuffer", uuid_jitterbuffer_function, JITTERBUFFER_SYNTAX);
 	SWITCH_ADD_API(commands_api_interface, "uuid_zombie_exec", "Set zombie_exec flag on the specified uuid", uuid_zombie_exec_function, "<uuid>");
 	SWITCH_ADD_API(commands_api_interface, "xml_flush_cache", "Clear xml cache", xml_flush_function, "<id> <key> <val>");
+	SWITCH_ADD_API(commands_api_interface, "xml_cache_stats", "Show user directory cache stats", xml_cache_stats_function, "");
+	SWITCH_ADD_API(commands_api_interface, "module_timeline", "Show how long each module took to load", module_timeline_function, "");
 	SWITCH_ADD_API(commands_api_interface, "xml_locate", "Find some xml", xml_locate_function, "[root | <section> <tag> <tag_attr_name> <tag_attr_val>]");
 	SWITCH_ADD_API(commands_api_interface, "xml_wrap", "Wrap another api command in xml", xml_wrap_api_function, "<command> <args>");
 	SWITCH_ADD_API(commands_api_interface, "file_exists", "Check if a file exists on server", file_exists_function, "<file>");
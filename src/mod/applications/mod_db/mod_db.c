@@ -39,6 +39,27 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_db_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_db_shutdown);
 SWITCH_MODULE_DEFINITION(mod_db, mod_db_load, mod_db_shutdown, NULL);
 
+#define DB_SHARDS 16
+#define DB_LATENCY_BUCKETS 16
+
+typedef struct db_group_member {
+	char *url;
+	struct db_group_member *next;
+} db_group_member_t;
+
+/* db and group data live in memory, spread over shards so lookups on different keys don't contend */
+typedef struct {
+	switch_mutex_t *mutex;
+	switch_hash_t *data_hash;
+	switch_hash_t *group_hash;
+} db_shard_t;
+
+/* bucket 0 is under 1us, bucket n covers [2^(n-1), 2^n) us, the last one is everything slower */
+typedef struct {
+	switch_atomic_t bucket[DB_LATENCY_BUCKETS];
+	switch_atomic_t total;
+} db_latency_t;
+
 static struct {
 	switch_memory_pool_t *pool;
 	char hostname[256];
@@ -47,6 +68,10 @@ static struct {
 	switch_mutex_t *mutex;
 	switch_mutex_t *db_hash_mutex;
 	switch_hash_t *db_hash;
+	db_shard_t shards[DB_SHARDS];
+	switch_sql_queue_manager_t *qm;
+	db_latency_t db_latency;
+	db_latency_t group_latency;
 } globals;
 
 typedef struct {
@@ -161,6 +186,301 @@ static char * limit_execute_sql2str(char *sql, char *str, size_t len)
 	return cbt.buf;
 }
 
+/* MEMORY STORE */
+
+static db_shard_t *db_shard(const char *key)
+{
+	uint32_t hash = 2166136261U;
+	const unsigned char *p;
+
+	for (p = (const unsigned char *) key; *p; p++) {
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+
+	return &globals.shards[hash % DB_SHARDS];
+}
+
+static void db_latency_add(db_latency_t *latency, switch_time_t start)
+{
+	switch_time_t elapsed = switch_time_ref() - start;
+	uint32_t x = 0;
+
+	while (elapsed > 0 && x < DB_LATENCY_BUCKETS - 1) {
+		elapsed >>= 1;
+		x++;
+	}
+
+	switch_atomic_inc(&latency->bucket[x]);
+	switch_atomic_inc(&latency->total);
+}
+
+static void db_latency_print(db_latency_t *latency, const char *name, switch_stream_handle_t *stream)
+{
+	uint32_t x;
+
+	stream->write_function(stream, "%s lookups: %u\n", name, switch_atomic_read(&latency->total));
+
+	for (x = 0; x < DB_LATENCY_BUCKETS; x++) {
+		uint32_t count = switch_atomic_read(&latency->bucket[x]);
+
+		if (!count) {
+			continue;
+		}
+
+		if (x == DB_LATENCY_BUCKETS - 1) {
+			stream->write_function(stream, "  >= %6uus: %u\n", 1 << (x - 1), count);
+		} else {
+			stream->write_function(stream, "  <  %6uus: %u\n", 1 << x, count);
+		}
+	}
+}
+
+/* Queue a statement for the db; sql must come from switch_mprintf, the queue manager frees it */
+static void db_persist(char *sql)
+{
+	switch_assert(sql);
+
+	if (globals.qm) {
+		switch_sql_queue_manager_push(globals.qm, sql, 0, SWITCH_FALSE);
+	} else {
+		free(sql);
+	}
+}
+
+static void db_store_set(const char *realm, const char *key, const char *val)
+{
+	char *hkey = switch_mprintf("%s/%s", realm, key);
+	db_shard_t *shard = db_shard(hkey);
+	char *old;
+
+	switch_mutex_lock(shard->mutex);
+	if ((old = switch_core_hash_find(shard->data_hash, hkey))) {
+		free(old);
+	}
+	switch_core_hash_insert(shard->data_hash, hkey, strdup(val));
+	switch_mutex_unlock(shard->mutex);
+
+	free(hkey);
+}
+
+static void db_store_del(const char *realm, const char *key)
+{
+	char *hkey = switch_mprintf("%s/%s", realm, key);
+	db_shard_t *shard = db_shard(hkey);
+	char *old;
+
+	switch_mutex_lock(shard->mutex);
+	if ((old = switch_core_hash_find(shard->data_hash, hkey))) {
+		switch_core_hash_delete(shard->data_hash, hkey);
+		free(old);
+	}
+	switch_mutex_unlock(shard->mutex);
+
+	free(hkey);
+}
+
+static void db_store_get(const char *realm, const char *key, switch_stream_handle_t *stream)
+{
+	switch_time_t start = switch_time_ref();
+	char *hkey = switch_mprintf("%s/%s", realm, key);
+	db_shard_t *shard = db_shard(hkey);
+	char *val;
+
+	switch_mutex_lock(shard->mutex);
+	if ((val = switch_core_hash_find(shard->data_hash, hkey))) {
+		stream->write_function(stream, "%s", val);
+	}
+	switch_mutex_unlock(shard->mutex);
+
+	free(hkey);
+
+	db_latency_add(&globals.db_latency, start);
+}
+
+static void db_insert(const char *realm, const char *key, const char *val)
+{
+	db_store_set(realm, key, val);
+
+	db_persist(switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", realm, key));
+	db_persist(switch_mprintf("insert into db_data (hostname, realm, data_key, data) values('%q','%q','%q','%q');",
+							  globals.hostname, realm, key, val));
+}
+
+static void db_delete(const char *realm, const char *key)
+{
+	db_store_del(realm, key);
+
+	db_persist(switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", realm, key));
+}
+
+/* Appends url to the group; a url already there moves to the end, as the delete and insert did in the db */
+static void group_store_add(const char *group, const char *url)
+{
+	db_shard_t *shard = db_shard(group);
+	db_group_member_t *head, *mp, *last = NULL, *member = NULL;
+
+	switch_mutex_lock(shard->mutex);
+
+	head = switch_core_hash_find(shard->group_hash, group);
+
+	for (mp = head; mp; last = mp, mp = mp->next) {
+		if (!strcmp(mp->url, url)) {
+			member = mp;
+			if (last) {
+				last->next = mp->next;
+			} else {
+				head = mp->next;
+			}
+			member->next = NULL;
+			break;
+		}
+	}
+
+	if (!member) {
+		switch_zmalloc(member, sizeof(*member));
+		member->url = strdup(url);
+	}
+
+	if (head) {
+		for (mp = head; mp->next; mp = mp->next);
+		mp->next = member;
+	} else {
+		head = member;
+	}
+
+	switch_core_hash_insert(shard->group_hash, group, head);
+
+	switch_mutex_unlock(shard->mutex);
+}
+
+/* Drops one url from the group, or the whole group when url is NULL */
+static void group_store_del(const char *group, const char *url)
+{
+	db_shard_t *shard = db_shard(group);
+	db_group_member_t *head, *mp, *last = NULL, *next;
+
+	switch_mutex_lock(shard->mutex);
+
+	head = switch_core_hash_find(shard->group_hash, group);
+
+	for (mp = head; mp; mp = next) {
+		next = mp->next;
+
+		if (url && strcmp(mp->url, url)) {
+			last = mp;
+			continue;
+		}
+
+		if (last) {
+			last->next = next;
+		} else {
+			head = next;
+		}
+
+		free(mp->url);
+		free(mp);
+	}
+
+	if (head) {
+		switch_core_hash_insert(shard->group_hash, group, head);
+	} else {
+		switch_core_hash_delete(shard->group_hash, group);
+	}
+
+	switch_mutex_unlock(shard->mutex);
+}
+
+static void group_store_call(const char *group, const char *how, char *buf, switch_size_t len)
+{
+	switch_time_t start = switch_time_ref();
+	db_shard_t *shard = db_shard(group);
+	db_group_member_t *mp;
+
+	switch_mutex_lock(shard->mutex);
+	for (mp = switch_core_hash_find(shard->group_hash, group); mp; mp = mp->next) {
+		switch_snprintf(buf + strlen(buf), len - strlen(buf), "%s%c", mp->url, *how);
+	}
+	switch_mutex_unlock(shard->mutex);
+
+	db_latency_add(&globals.group_latency, start);
+}
+
+static void group_insert(const char *group, const char *url)
+{
+	group_store_add(group, url);
+
+	db_persist(switch_mprintf("delete from group_data where groupname='%q' and url='%q';", group, url));
+	db_persist(switch_mprintf("insert into group_data (hostname, groupname, url) values('%q','%q','%q');", globals.hostname, group, url));
+}
+
+static void group_delete(const char *group, const char *url)
+{
+	group_store_del(group, url);
+
+	if (url) {
+		db_persist(switch_mprintf("delete from group_data where groupname='%q' and url='%q';", group, url));
+	} else {
+		db_persist(switch_mprintf("delete from group_data where groupname='%q';", group));
+	}
+}
+
+static int db_load_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	if (argc > 2 && !zstr(argv[0]) && !zstr(argv[1])) {
+		db_store_set(argv[0], argv[1], switch_str_nil(argv[2]));
+	}
+
+	return 0;
+}
+
+static int group_load_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	if (argc > 1 && !zstr(argv[0]) && !zstr(argv[1])) {
+		group_store_add(argv[0], argv[1]);
+	}
+
+	return 0;
+}
+
+static void db_store_count(uint32_t *records, uint32_t *groups)
+{
+	switch_hash_index_t *hi;
+	uint32_t x;
+
+	*records = *groups = 0;
+
+	for (x = 0; x < DB_SHARDS; x++) {
+		switch_mutex_lock(globals.shards[x].mutex);
+		for (hi = switch_hash_first(NULL, globals.shards[x].data_hash); hi; hi = switch_hash_next(hi)) {
+			(*records)++;
+		}
+		for (hi = switch_hash_first(NULL, globals.shards[x].group_hash); hi; hi = switch_hash_next(hi)) {
+			(*groups)++;
+		}
+		switch_mutex_unlock(globals.shards[x].mutex);
+	}
+}
+
+static switch_bool_t db_store_free_callback(const void *key, const void *val, void *pData)
+{
+	free((void *) val);
+	return SWITCH_TRUE;
+}
+
+static switch_bool_t group_store_free_callback(const void *key, const void *val, void *pData)
+{
+	db_group_member_t *mp, *next;
+
+	for (mp = (db_group_member_t *) val; mp; mp = next) {
+		next = mp->next;
+		free(mp->url);
+		free(mp);
+	}
+
+	return SWITCH_TRUE;
+}
+
 /* \brief Enforces limit restrictions
  * \param session current session
  * \param realm limit realm
@@ -333,6 +653,14 @@ static switch_status_t do_config()
 		sql = switch_mprintf("delete from limit_data where hostname='%q';", globals.hostname);
 		limit_execute_sql(sql);
 		switch_safe_free(sql);
+
+		limit_execute_sql_callback("select realm, data_key, data from db_data", db_load_callback, NULL);
+		limit_execute_sql_callback("select groupname, url from group_data", group_load_callback, NULL);
+
+		/* one queue so a delete and the insert replacing it reach the db in order */
+		switch_sql_queue_manager_init_name("db", &globals.qm, 1, !zstr(globals.odbc_dsn) ? globals.odbc_dsn : globals.dbname,
+										   SWITCH_MAX_TRANS, NULL, NULL, NULL, NULL);
+		switch_sql_queue_manager_start(globals.qm);
 	}
 
 	return status;
@@ -347,7 +675,6 @@ SWITCH_STANDARD_API(db_api_function)
 	int argc = 0;
 	char *argv[4] = { 0 };
 	char *mydata = NULL;
-	char *sql;
 
 	if (!zstr(cmd)) {
 		mydata = strdup(cmd);
@@ -363,37 +690,30 @@ SWITCH_STANDARD_API(db_api_function)
 		if (argc < 4) {
 			goto error;
 		}
-		sql = switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
-		sql =
-			switch_mprintf("insert into db_data (hostname, realm, data_key, data) values('%q','%q','%q','%q');", globals.hostname, argv[1], argv[2],
-						   argv[3]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		db_insert(argv[1], argv[2], argv[3]);
 		stream->write_function(stream, "+OK");
 		goto done;
 	} else if (!strcasecmp(argv[0], "delete")) {
-		if (argc < 2) {
+		if (argc < 3) {
 			goto error;
 		}
-		sql = switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		db_delete(argv[1], argv[2]);
 		stream->write_function(stream, "+OK");
 		goto done;
 	} else if (!strcasecmp(argv[0], "select")) {
-		char buf[256] = "";
 		if (argc < 3) {
 			goto error;
 		}
-		sql = switch_mprintf("select data from db_data where realm='%q' and data_key='%q'", argv[1], argv[2]);
-		limit_execute_sql2str(sql, buf, sizeof(buf));
-		switch_safe_free(sql);
-		stream->write_function(stream, "%s", buf);
+		db_store_get(argv[1], argv[2], stream);
+		goto done;
+	} else if (!strcasecmp(argv[0], "stats")) {
+		uint32_t records, groups;
+
+		db_store_count(&records, &groups);
+		stream->write_function(stream, "records: %u\ngroups: %u\npending writes: %d\n",
+							   records, groups, globals.qm ? switch_sql_queue_manager_size(globals.qm, 0) : 0);
+		db_latency_print(&globals.db_latency, "db", stream);
+		db_latency_print(&globals.group_latency, "group", stream);
 		goto done;
 	}
 
@@ -414,7 +734,6 @@ SWITCH_STANDARD_APP(db_function)
 	int argc = 0;
 	char *argv[4] = { 0 };
 	char *mydata = NULL;
-	char *sql = NULL;
 
 	if (!zstr(data)) {
 		mydata = switch_core_session_strdup(session, data);
@@ -431,43 +750,22 @@ SWITCH_STANDARD_APP(db_function)
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "USAGE: db %s\n", DB_USAGE);
 			return;
 		}
-		sql = switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
-
-		sql =
-			switch_mprintf("insert into db_data (hostname, realm, data_key, data) values('%q','%q','%q','%q');", globals.hostname, argv[1], argv[2],
-						   argv[3]);
+		db_insert(argv[1], argv[2], argv[3]);
 	} else if (!strcasecmp(argv[0], "delete")) {
-		sql = switch_mprintf("delete from db_data where realm='%q' and data_key='%q'", argv[1], argv[2]);
+		db_delete(argv[1], argv[2]);
 	} else {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "USAGE: db %s\n", DB_USAGE);
 		return;
 	}
-
-	if (sql) {
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
-	}
 }
 
 /* GROUP STUFF */
 
-static int group_callback(void *pArg, int argc, char **argv, char **columnNames)
-{
-	callback_t *cbt = (callback_t *) pArg;
-	switch_snprintf(cbt->buf + strlen(cbt->buf), cbt->len - strlen(cbt->buf), "%s%c", argv[0], *argv[1]);
-	cbt->matches++;
-	return 0;
-}
-
 SWITCH_STANDARD_API(group_api_function)
 {
 	int argc = 0;
 	char *argv[4] = { 0 };
 	char *mydata = NULL;
-	char *sql;
 
 	if (!zstr(cmd)) {
 		mydata = strdup(cmd);
@@ -482,37 +780,19 @@ SWITCH_STANDARD_API(group_api_function)
 		if (argc < 3) {
 			goto error;
 		}
-		sql = switch_mprintf("delete from group_data where groupname='%q' and url='%q';", argv[1], argv[2]);
-		switch_assert(sql);
-
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
-		sql = switch_mprintf("insert into group_data (hostname, groupname, url) values('%q','%q','%q');", globals.hostname, argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		group_insert(argv[1], argv[2]);
 		stream->write_function(stream, "+OK");
 		goto done;
 	} else if (!strcasecmp(argv[0], "delete")) {
 		if (argc < 3) {
 			goto error;
 		}
-		if (!strcmp(argv[2], "*")) {
-			sql = switch_mprintf("delete from group_data where groupname='%q';", argv[1]);
-		} else {
-			sql = switch_mprintf("delete from group_data where groupname='%q' and url='%q';", argv[1], argv[2]);
-		}
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		group_delete(argv[1], strcmp(argv[2], "*") ? argv[2] : NULL);
 		stream->write_function(stream, "+OK");
 		goto done;
 	} else if (!strcasecmp(argv[0], "call")) {
 		char buf[4096] = "";
 		char *how = ",";
-		callback_t cbt = { 0 };
-		cbt.buf = buf;
-		cbt.len = sizeof(buf);
 
 		if (argc > 2) {
 			if (!strcasecmp(argv[2], "order")) {
@@ -520,11 +800,7 @@ SWITCH_STANDARD_API(group_api_function)
 			}
 		}
 
-		sql = switch_mprintf("select url,'%q' from group_data where groupname='%q'", how, argv[1]);
-		switch_assert(sql);
-
-		limit_execute_sql_callback(sql, group_callback, &cbt);
-		switch_safe_free(sql);
+		group_store_call(argv[1], how, buf, sizeof(buf));
 
 		if (!zstr(buf)) {
 			*(buf + (strlen(buf) - 1)) = '\0';
@@ -552,7 +828,6 @@ SWITCH_STANDARD_APP(group_function)
 	int argc = 0;
 	char *argv[3] = { 0 };
 	char *mydata = NULL;
-	char *sql;
 
 	if (!zstr(data)) {
 		mydata = switch_core_session_strdup(session, data);
@@ -565,15 +840,9 @@ SWITCH_STANDARD_APP(group_function)
 	}
 
 	if (!strcasecmp(argv[0], "insert")) {
-		sql = switch_mprintf("insert into group_data (hostname, groupname, url) values('%q','%q','%q');", globals.hostname, argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		group_insert(argv[1], argv[2]);
 	} else if (!strcasecmp(argv[0], "delete")) {
-		sql = switch_mprintf("delete from group_data where groupname='%q' and url='%q';", argv[1], argv[2]);
-		switch_assert(sql);
-		limit_execute_sql(sql);
-		switch_safe_free(sql);
+		group_delete(argv[1], argv[2]);
 	}
 }
 
@@ -585,11 +854,17 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_db_load)
 	switch_application_interface_t *app_interface;
 	switch_api_interface_t *commands_api_interface;
 	switch_limit_interface_t *limit_interface;
+	int x;
 
 	memset(&globals, 0, sizeof(globals));
 	strncpy(globals.hostname, switch_core_get_switchname(), sizeof(globals.hostname));
 	globals.pool = pool;
 
+	for (x = 0; x < DB_SHARDS; x++) {
+		switch_mutex_init(&globals.shards[x].mutex, SWITCH_MUTEX_NESTED, globals.pool);
+		switch_core_hash_init(&globals.shards[x].data_hash, globals.pool);
+		switch_core_hash_init(&globals.shards[x].group_hash, globals.pool);
+	}
 
 	if ((status = do_config() != SWITCH_STATUS_SUCCESS)) {
 		return status;
@@ -613,10 +888,11 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_db_load)
 
 	SWITCH_ADD_APP(app_interface, "db", "Insert to the db", DB_DESC, db_function, DB_USAGE, SAF_SUPPORT_NOMEDIA | SAF_ZOMBIE_EXEC);
 	SWITCH_ADD_APP(app_interface, "group", "Manage a group", GROUP_DESC, group_function, GROUP_USAGE, SAF_SUPPORT_NOMEDIA | SAF_ZOMBIE_EXEC);
-	SWITCH_ADD_API(commands_api_interface, "db", "db get/set", db_api_function, "[insert|delete|select]/<realm>/<key>/<value>");
+	SWITCH_ADD_API(commands_api_interface, "db", "db get/set", db_api_function, "[insert|delete|select]/<realm>/<key>/<value> | stats");
 	switch_console_set_complete("add db insert");
 	switch_console_set_complete("add db delete");
 	switch_console_set_complete("add db select");
+	switch_console_set_complete("add db stats");
 	SWITCH_ADD_API(commands_api_interface, "group", "group [insert|delete|call]", group_api_function, "[insert|delete|call]:<group name>:<url>");
 	switch_console_set_complete("add group insert");
 	switch_console_set_complete("add group delete");
@@ -630,6 +906,23 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_db_load)
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_db_shutdown)
 {
+	int x, sanity = 100;
+
+	if (globals.qm) {
+		/* give the pending writes a chance to land, destroying the queue drops whatever is left */
+		while (--sanity && switch_sql_queue_manager_size(globals.qm, 0) > 0) {
+			switch_yield(100000);
+		}
+		switch_sql_queue_manager_destroy(&globals.qm);
+	}
+
+	for (x = 0; x < DB_SHARDS; x++) {
+		switch_core_hash_delete_multi(globals.shards[x].data_hash, db_store_free_callback, NULL);
+		switch_core_hash_delete_multi(globals.shards[x].group_hash, group_store_free_callback, NULL);
+		switch_core_hash_destroy(&globals.shards[x].data_hash);
+		switch_core_hash_destroy(&globals.shards[x].group_hash);
+		switch_mutex_destroy(globals.shards[x].mutex);
+	}
 
 	switch_xml_config_cleanup(config_settings);
 
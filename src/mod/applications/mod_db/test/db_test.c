@@ -0,0 +1,672 @@
+/*
+ * Loads mod_db over an SQLite file, runs random db and group operations through its API and dialplan apps and
+ * compares every answer from the in-memory store with what the old SQL query returns once the queued writes landed.
+ * The core pieces mod_db calls into (pools, events, cache db, SQL queue manager, module interfaces) are faked below;
+ * see README.
+ */
+#include "../mod_db.c"
+#include <sqlite3.h>
+
+static int fail_count;
+static int verbose;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+static char db_path[256];
+static sqlite3 *db;
+static uint32_t rnd = 1;
+
+static uint32_t rand_below(uint32_t n)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return (rnd >> 8) % n;
+}
+
+/* pools are never freed before exit here, the allocations just leak */
+
+switch_status_t switch_core_perform_new_memory_pool(switch_memory_pool_t **pool, const char *file, const char *func, int line)
+{
+	*pool = (switch_memory_pool_t *) calloc(1, 16);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory, const char *file, const char *func, int line)
+{
+	return calloc(1, memory);
+}
+
+char *switch_core_perform_session_strdup(switch_core_session_t *session, const char *todup, const char *file, const char *func, int line)
+{
+	return strdup(todup);
+}
+
+char *switch_core_session_get_uuid(switch_core_session_t *session)
+{
+	return "test-session";
+}
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	*lock = (switch_mutex_t *) mutex;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	pthread_mutex_lock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_destroy(switch_mutex_t *lock)
+{
+	pthread_mutex_destroy((pthread_mutex_t *) lock);
+	free(lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_atomic_inc(volatile switch_atomic_t *mem)
+{
+	__sync_fetch_and_add(mem, 1);
+}
+
+uint32_t switch_atomic_read(volatile switch_atomic_t *mem)
+{
+	return *mem;
+}
+
+switch_time_t switch_time_ref(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (switch_time_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+					   const char *userdata, switch_log_level_t level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (verbose || level <= SWITCH_LOG_CRIT) {
+		va_start(ap, fmt);
+		printf("[%d] ", level);
+		vprintf(fmt, ap);
+		va_end(ap);
+	}
+}
+
+int switch_snprintf(char *buf, switch_size_t len, const char *format, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(buf, len, format, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size)
+{
+	if (!dst_size) {
+		return dst;
+	}
+	strncpy(dst, src, dst_size - 1);
+	dst[dst_size - 1] = '\0';
+
+	return dst;
+}
+
+switch_status_t switch_console_stream_raw_write(switch_stream_handle_t *handle, uint8_t *data, switch_size_t datalen)
+{
+	switch_size_t need = handle->data_len + datalen + 1;
+
+	if (need > handle->data_size) {
+		handle->data_size = need * 2;
+		handle->data = realloc(handle->data, handle->data_size);
+	}
+	memcpy((char *) handle->data + handle->data_len, data, datalen);
+	handle->data_len += datalen;
+	handle->end = (char *) handle->data + handle->data_len;
+	*(char *) handle->end = '\0';
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_console_stream_write(switch_stream_handle_t *handle, const char *fmt, ...)
+{
+	va_list ap;
+	char *data;
+	switch_status_t status;
+
+	va_start(ap, fmt);
+	data = switch_vmprintf(fmt, ap);
+	va_end(ap);
+
+	status = switch_console_stream_raw_write(handle, (uint8_t *) data, strlen(data));
+	free(data);
+
+	return status;
+}
+
+/* events: switch_core_hash_delete_multi keeps its list of keys in one */
+
+switch_status_t switch_event_create_subclass_detailed(const char *file, const char *func, int line,
+													  switch_event_t **event, switch_event_types_t event_id, const char *subclass_name)
+{
+	*event = calloc(1, sizeof(switch_event_t));
+	(*event)->event_id = event_id;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_event_destroy(switch_event_t **event)
+{
+	switch_event_header_t *hp;
+
+	if (!*event) {
+		return;
+	}
+
+	while ((hp = (*event)->headers)) {
+		(*event)->headers = hp->next;
+		free(hp->name);
+		free(hp->value);
+		free(hp);
+	}
+	free(*event);
+	*event = NULL;
+}
+
+switch_status_t switch_event_add_header_string(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *data)
+{
+	switch_event_header_t *hp = calloc(1, sizeof(*hp));
+
+	hp->name = strdup(header_name);
+	hp->value = strdup(data);
+	hp->next = event->headers;
+	event->headers = hp;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_event_reserve_subclass_detailed(const char *owner, const char *subclass_name)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* module interfaces: mod_db_load only fills them in */
+
+switch_loadable_module_interface_t *switch_loadable_module_create_module_interface(switch_memory_pool_t *pool, const char *name)
+{
+	return calloc(1, sizeof(switch_loadable_module_interface_t));
+}
+
+void *switch_loadable_module_create_interface(switch_loadable_module_interface_t *mod, switch_module_interface_name_t iname)
+{
+	return calloc(1, 4096);
+}
+
+switch_status_t switch_console_set_complete(const char *string)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+const char *switch_core_get_switchname(void)
+{
+	return "test-host";
+}
+
+switch_status_t switch_xml_config_parse_module_settings(const char *file, switch_bool_t reload, switch_xml_config_item_t *instructions)
+{
+	return SWITCH_STATUS_FALSE;
+}
+
+void switch_xml_config_cleanup(switch_xml_config_item_t *instructions)
+{
+}
+
+/* cache db: every dsn is the one SQLite file, kept open the way the cache db keeps its handles */
+
+switch_status_t _switch_cache_db_get_db_handle_dsn(switch_cache_db_handle_t **dbh, const char *dsn, const char *file, const char *func, int line)
+{
+	*dbh = (switch_cache_db_handle_t *) db;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_cache_db_release_db_handle(switch_cache_db_handle_t **dbh)
+{
+	*dbh = NULL;
+}
+
+switch_status_t switch_cache_db_execute_sql(switch_cache_db_handle_t *dbh, char *sql, char **err)
+{
+	return sqlite3_exec((sqlite3 *) dbh, sql, NULL, NULL, NULL) == SQLITE_OK ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+}
+
+switch_status_t switch_cache_db_execute_sql_callback(switch_cache_db_handle_t *dbh, const char *sql,
+													 switch_core_db_callback_func_t callback, void *pdata, char **err)
+{
+	return sqlite3_exec((sqlite3 *) dbh, sql, callback, pdata, NULL) == SQLITE_OK ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+}
+
+switch_bool_t switch_cache_db_test_reactive(switch_cache_db_handle_t *dbh, const char *test_sql, const char *drop_sql, const char *reactive_sql)
+{
+	if (sqlite3_exec((sqlite3 *) dbh, test_sql, NULL, NULL, NULL) != SQLITE_OK) {
+		sqlite3_exec((sqlite3 *) dbh, reactive_sql, NULL, NULL, NULL);
+	}
+	return SWITCH_TRUE;
+}
+
+/* SQL queue manager: one queue that reaches the database only when drained, by the test or by a yield */
+
+static struct {
+	char **sql;
+	int head;
+	int count;
+	int size;
+	int running;
+	int dropped;
+} fake_qm;
+
+switch_status_t switch_sql_queue_manager_init_name(const char *name, switch_sql_queue_manager_t **qmp, uint32_t numq, const char *dsn,
+												   uint32_t max_trans, const char *pre_trans_execute, const char *post_trans_execute,
+												   const char *inner_pre_trans_execute, const char *inner_post_trans_execute)
+{
+	memset(&fake_qm, 0, sizeof(fake_qm));
+	*qmp = (switch_sql_queue_manager_t *) &fake_qm;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_sql_queue_manager_start(switch_sql_queue_manager_t *qm)
+{
+	fake_qm.running = 1;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_sql_queue_manager_push(switch_sql_queue_manager_t *qm, const char *sql, uint32_t pos, switch_bool_t dup)
+{
+	if (!fake_qm.running) {
+		if (!dup) free((char *) sql);
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	if (fake_qm.count == fake_qm.size) {
+		fake_qm.size = fake_qm.size ? fake_qm.size * 2 : 64;
+		fake_qm.sql = realloc(fake_qm.sql, fake_qm.size * sizeof(char *));
+	}
+	fake_qm.sql[fake_qm.count++] = dup ? strdup(sql) : (char *) sql;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+int switch_sql_queue_manager_size(switch_sql_queue_manager_t *qm, uint32_t index)
+{
+	return fake_qm.count - fake_qm.head;
+}
+
+static void qm_drain(void)
+{
+	for (; fake_qm.head < fake_qm.count; fake_qm.head++) {
+		if (sqlite3_exec(db, fake_qm.sql[fake_qm.head], NULL, NULL, NULL) != SQLITE_OK) {
+			CHECK(0, "queued sql failed: %s", fake_qm.sql[fake_qm.head]);
+		}
+		free(fake_qm.sql[fake_qm.head]);
+	}
+	fake_qm.head = fake_qm.count = 0;
+}
+
+switch_status_t switch_sql_queue_manager_destroy(switch_sql_queue_manager_t **qmp)
+{
+	/* like the real one, whatever is still queued is dropped */
+	for (; fake_qm.head < fake_qm.count; fake_qm.head++) {
+		free(fake_qm.sql[fake_qm.head]);
+		fake_qm.dropped++;
+	}
+	free(fake_qm.sql);
+	fake_qm.sql = NULL;
+	fake_qm.head = fake_qm.count = fake_qm.size = fake_qm.running = 0;
+	*qmp = NULL;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* the writer thread gets to run while mod_db_shutdown waits */
+void switch_sleep(switch_interval_time_t t)
+{
+	qm_drain();
+}
+
+/* what the old code answered: its SQL run on the database */
+
+static int old_group_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	callback_t *cbt = (callback_t *) pArg;
+	switch_snprintf(cbt->buf + strlen(cbt->buf), cbt->len - strlen(cbt->buf), "%s%c", argv[0], *argv[1]);
+	cbt->matches++;
+	return 0;
+}
+
+static void old_db_select(const char *realm, const char *key, char *buf, size_t len)
+{
+	char *sql = switch_mprintf("select data from db_data where realm='%q' and data_key='%q'", realm, key);
+
+	*buf = '\0';
+	limit_execute_sql2str(sql, buf, len);
+	free(sql);
+}
+
+static void old_group_call(const char *group, const char *how, char *buf, size_t len)
+{
+	callback_t cbt = { 0 };
+	char *sql = switch_mprintf("select url,'%q' from group_data where groupname='%q'", how, group);
+
+	*buf = '\0';
+	cbt.buf = buf;
+	cbt.len = len;
+	limit_execute_sql_callback(sql, old_group_callback, &cbt);
+	free(sql);
+
+	if (!zstr(buf)) {
+		*(buf + (strlen(buf) - 1)) = '\0';
+	}
+}
+
+static char *api(switch_status_t (*func) (const char *, switch_core_session_t *, switch_stream_handle_t *), const char *fmt, ...)
+{
+	switch_stream_handle_t stream = { 0 };
+	va_list ap;
+	char *cmd;
+
+	va_start(ap, fmt);
+	cmd = switch_vmprintf(fmt, ap);
+	va_end(ap);
+
+	SWITCH_STANDARD_STREAM(stream);
+	func(cmd, NULL, &stream);
+	free(cmd);
+
+	return stream.data;
+}
+
+static void app(void (*func) (switch_core_session_t *, const char *), const char *fmt, ...)
+{
+	va_list ap;
+	char *data;
+
+	va_start(ap, fmt);
+	data = switch_vmprintf(fmt, ap);
+	va_end(ap);
+
+	func((switch_core_session_t *) 1, data);
+	free(data);
+}
+
+static void db_sql_exec(const char *sql)
+{
+	if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+		printf("sql failed: %s\n", sql);
+		exit(1);
+	}
+}
+
+static int count_rows(const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int n = -1;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+		n = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	return n;
+}
+
+static void module_load(void)
+{
+	switch_loadable_module_interface_t *module_interface = NULL;
+	switch_memory_pool_t *pool;
+
+	switch_core_new_memory_pool(&pool);
+	CHECK(mod_db_load(&module_interface, pool) == SWITCH_STATUS_SUCCESS, "mod_db_load failed");
+}
+
+/* rows from a previous run are served without a write */
+static void test_load(void)
+{
+	char *res;
+
+	db_sql_exec("create table db_data (hostname varchar(255), realm varchar(255), data_key varchar(255), data varchar(255));"
+				"create table group_data (hostname varchar(255), groupname varchar(255), url varchar(255));"
+				"insert into db_data values ('old-host', 'features', 'dnd', 'true'), ('old-host', 'features', 'cf', '');"
+				"insert into group_data values ('old-host', 'sales', 'user/1001'), ('old-host', 'support', 'user/2001'),"
+				"('old-host', 'sales', 'user/1002'), ('old-host', 'sales', 'user/1003');");
+
+	module_load();
+
+	res = api(db_api_function, "select/features/dnd");
+	CHECK(!strcmp(res, "true"), "db select/features/dnd after load: [%s]", res);
+	free(res);
+
+	res = api(db_api_function, "select/features/cf");
+	CHECK(!strcmp(res, ""), "db select/features/cf after load: [%s]", res);
+	free(res);
+
+	res = api(group_api_function, "call:sales:order");
+	CHECK(!strcmp(res, "user/1001|user/1002|user/1003"), "group call:sales:order after load: [%s]", res);
+	free(res);
+
+	res = api(db_api_function, "stats");
+	CHECK(strstr(res, "records: 2\ngroups: 2\npending writes: 0\n") != NULL, "db stats after load: [%s]", res);
+	free(res);
+
+	CHECK(switch_sql_queue_manager_size(globals.qm, 0) == 0, "load queued %d writes", switch_sql_queue_manager_size(globals.qm, 0));
+
+	printf("test_load() : %s\n", fail_count ? "FAIL" : "PASS");
+}
+
+#define REALMS 4
+#define GROUPS 8
+#define URLS 12
+
+/* random operations through the API and the apps, every answer compared with the old SQL on the drained database */
+static void test_compare(int keys, int ops)
+{
+	int x, selects = 0, calls = 0, mismatches = 0, fails = fail_count;
+	char realm[32], key[32], group[32], url[32], old[4096];
+	char *res;
+
+	for (x = 0; x < ops; x++) {
+		uint32_t op = rand_below(100);
+		int via_app = rand_below(2);
+
+		switch_snprintf(realm, sizeof(realm), "realm%u", rand_below(REALMS));
+		switch_snprintf(key, sizeof(key), "key%u", rand_below(keys));
+		switch_snprintf(group, sizeof(group), "group%u", rand_below(GROUPS));
+		switch_snprintf(url, sizeof(url), "user/%u", 1000 + rand_below(URLS));
+
+		if (op < 30) {
+			uint32_t val = rand_below(1000000);
+
+			if (via_app) {
+				app(db_function, "insert/%s/%s/v%u", realm, key, val);
+			} else {
+				free(api(db_api_function, "insert/%s/%s/v%u", realm, key, val));
+			}
+		} else if (op < 40) {
+			if (via_app) {
+				app(db_function, "delete/%s/%s", realm, key);
+			} else {
+				free(api(db_api_function, "delete/%s/%s", realm, key));
+			}
+		} else if (op < 60) {
+			res = api(db_api_function, "select/%s/%s", realm, key);
+			qm_drain();
+			old_db_select(realm, key, old, 256);
+			if (strcmp(res, old)) {
+				if (mismatches++ < 5) {
+					printf("db select/%s/%s: store [%s] sql [%s]\n", realm, key, res, old);
+				}
+			}
+			selects++;
+			free(res);
+		} else if (op < 75) {
+			if (via_app) {
+				app(group_function, "insert:%s:%s", group, url);
+			} else {
+				free(api(group_api_function, "insert:%s:%s", group, url));
+			}
+		} else if (op < 83) {
+			if (via_app) {
+				app(group_function, "delete:%s:%s", group, url);
+			} else {
+				free(api(group_api_function, "delete:%s:%s", group, rand_below(5) ? url : "*"));
+			}
+		} else {
+			int order = rand_below(2);
+
+			res = api(group_api_function, "call:%s%s", group, order ? ":order" : "");
+			qm_drain();
+			old_group_call(group, order ? "|" : ",", old, sizeof(old));
+			if (strcmp(res, old)) {
+				if (mismatches++ < 5) {
+					printf("group call:%s%s: store [%s] sql [%s]\n", group, order ? ":order" : "", res, old);
+				}
+			}
+			calls++;
+			free(res);
+		}
+
+		/* let the writer fall behind by a random amount */
+		if (!rand_below(50)) {
+			qm_drain();
+		}
+	}
+
+	CHECK(!mismatches, "%d of %d answers differ from the sql", mismatches, selects + calls);
+	printf("test_compare() : %d ops, %d selects and %d group calls, %d mismatches : %s\n", ops, selects, calls, mismatches,
+		   fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* the store and the database agree row for row once the queue is drained */
+static void test_rows(void)
+{
+	uint32_t records, groups;
+	int rows, group_rows, members = 0, x, fails = fail_count;
+	switch_hash_index_t *hi;
+
+	qm_drain();
+	db_store_count(&records, &groups);
+	rows = count_rows("select count(*) from db_data");
+	group_rows = count_rows("select count(distinct groupname) from group_data");
+
+	for (x = 0; x < DB_SHARDS; x++) {
+		for (hi = switch_hash_first(NULL, globals.shards[x].group_hash); hi; hi = switch_hash_next(hi)) {
+			void *val;
+			db_group_member_t *mp;
+
+			switch_hash_this(hi, NULL, NULL, &val);
+			for (mp = (db_group_member_t *) val; mp; mp = mp->next) {
+				members++;
+			}
+		}
+	}
+
+	CHECK((int) records == rows, "store has %u records, db_data has %d rows", records, rows);
+	CHECK((int) groups == group_rows, "store has %u groups, group_data has %d", groups, group_rows);
+	CHECK(members == count_rows("select count(*) from group_data"), "store has %d members, group_data has %d rows", members,
+		  count_rows("select count(*) from group_data"));
+	printf("test_rows() : %u records, %u groups, %d members : %s\n", records, groups, members, fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* db select from the store against the SQL select it replaced */
+static void measure_select(int keys, int lookups)
+{
+	switch_time_t start, store_us, sql_us;
+	char key[32], buf[256];
+	char *res;
+	int x;
+	uint32_t seed = rnd;
+
+	for (x = 0; x < keys; x++) {
+		free(api(db_api_function, "insert/bench/key%d/value%d", x, x));
+	}
+	qm_drain();
+
+	start = switch_time_ref();
+	for (x = 0; x < lookups; x++) {
+		switch_snprintf(key, sizeof(key), "key%u", rand_below(keys));
+		res = api(db_api_function, "select/bench/%s", key);
+		free(res);
+	}
+	store_us = switch_time_ref() - start;
+
+	rnd = seed;
+	start = switch_time_ref();
+	for (x = 0; x < lookups; x++) {
+		switch_snprintf(key, sizeof(key), "key%u", rand_below(keys));
+		old_db_select("bench", key, buf, sizeof(buf));
+	}
+	sql_us = switch_time_ref() - start;
+
+	printf("measure_select() : %d lookups over %d keys, store %.2fus/lookup, sql %.2fus/lookup\n", lookups,
+		   count_rows("select count(*) from db_data where realm='bench'"), (double) store_us / lookups, (double) sql_us / lookups);
+}
+
+/* writes still queued at shutdown reach the database */
+static void test_shutdown(void)
+{
+	int fails = fail_count;
+
+	free(api(db_api_function, "insert/last/key/value"));
+	free(api(group_api_function, "insert:last:user/9999"));
+	CHECK(switch_sql_queue_manager_size(globals.qm, 0) == 4, "%d writes queued", switch_sql_queue_manager_size(globals.qm, 0));
+
+	mod_db_shutdown();
+
+	CHECK(!fake_qm.dropped, "%d writes dropped at shutdown", fake_qm.dropped);
+	CHECK(count_rows("select count(*) from db_data where realm='last' and data='value'") == 1, "db insert lost at shutdown");
+	CHECK(count_rows("select count(*) from group_data where groupname='last'") == 1, "group insert lost at shutdown");
+	printf("test_shutdown() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+int main(int argc, char **argv)
+{
+	int keys = argc > 1 ? atoi(argv[1]) : 2000;
+	int ops = argc > 2 ? atoi(argv[2]) : 20000;
+
+	verbose = getenv("DB_TEST_VERBOSE") != NULL;
+
+	switch_snprintf(db_path, sizeof(db_path), "/tmp/db_test_%d.db", (int) getpid());
+	unlink(db_path);
+	if (sqlite3_open(db_path, &db) != SQLITE_OK) {
+		printf("can't open %s\n", db_path);
+		return 1;
+	}
+
+	test_load();
+	test_compare(keys, ops);
+	test_rows();
+	measure_select(keys, ops);
+	test_shutdown();
+
+	sqlite3_close(db);
+	unlink(db_path);
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+	return fail_count ? 1 : 0;
+}
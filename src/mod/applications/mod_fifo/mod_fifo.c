@@ -323,13 +323,6 @@ static void fifo_caller_del(const char *uuid);
 
 
 
-struct callback {
-	char *buf;
-	size_t len;
-	int matches;
-};
-typedef struct callback callback_t;
-
 static const char *strat_parse(outbound_strategy_t s)
 {
 	switch (s) {
@@ -357,6 +350,13 @@ static outbound_strategy_t parse_strat(const char *name)
 	return NODE_STRATEGY_INVALID;
 }
 
+struct callback {
+	char *buf;
+	size_t len;
+	int matches;
+};
+typedef struct callback callback_t;
+
 static int sql2str_callback(void *pArg, int argc, char **argv, char **columnNames)
 {
 	callback_t *cbt = (callback_t *) pArg;
@@ -579,6 +579,11 @@ static struct {
 	switch_mutex_t *caller_orig_mutex;
 	switch_mutex_t *consumer_orig_mutex;
 	switch_mutex_t *bridge_mutex;
+	switch_hash_t *member_hash;
+	switch_hash_t *member_fifo_hash;
+	switch_mutex_t *member_mutex;
+	/* odbc-dsn may be shared with other hosts, whose members and counters are only in fifo_outbound */
+	switch_bool_t shared_members;
 	switch_hash_t *fifo_hash;
 	switch_mutex_t *mutex;
 	switch_mutex_t *sql_mutex;
@@ -839,14 +844,262 @@ static switch_bool_t fifo_execute_sql_callback(switch_mutex_t *mutex, char *sql,
 	return ret;
 }
 
-static fifo_node_t *create_node(const char *name, uint32_t importance, switch_mutex_t *mutex)
+/*
+   Outbound members live here; fifo_outbound is only a mirror of this registry for reporting.
+   Every member is linked twice: into the per-fifo list walked by find_consumers and into the
+   per-uuid chain used by the state changes, which like the old sql apply to every fifo a uuid is in.
+*/
+
+struct fifo_member {
+	char *uuid;
+	char *fifo_name;
+	char *originate_string;
+	int simo_count;
+	int use_count;
+	int ring_count;
+	int timeout;
+	int lag;
+	long next_avail;
+	long expires;
+	int is_static;
+	int taking_calls;
+	int outbound_call_count;
+	int outbound_fail_count;
+	struct fifo_member *next;
+	struct fifo_member *uuid_next;
+};
+typedef struct fifo_member fifo_member_t;
+
+typedef enum {
+	MEMBER_RING_START,
+	MEMBER_RING_STOP,
+	MEMBER_RING_FAIL,
+	MEMBER_USE_START,
+	MEMBER_USE_STOP,
+	MEMBER_CALL_DONE
+} member_action_t;
+
+static void member_unlink(switch_hash_t *hash, const char *key, fifo_member_t *member, switch_bool_t by_uuid)
+{
+	fifo_member_t *head, *mp, *last = NULL;
+
+	if (!(head = (fifo_member_t *) switch_core_hash_find(hash, key))) {
+		return;
+	}
+
+	for (mp = head; mp; mp = by_uuid ? mp->uuid_next : mp->next) {
+		if (mp == member) {
+			break;
+		}
+		last = mp;
+	}
+
+	if (!mp) {
+		return;
+	}
+
+	if (last) {
+		if (by_uuid) {
+			last->uuid_next = member->uuid_next;
+		} else {
+			last->next = member->next;
+		}
+	} else if ((head = by_uuid ? member->uuid_next : member->next)) {
+		switch_core_hash_insert(hash, key, head);
+	} else {
+		switch_core_hash_delete(hash, key);
+	}
+}
+
+static void member_free(fifo_member_t *mp)
+{
+	switch_safe_free(mp->uuid);
+	switch_safe_free(mp->fifo_name);
+	switch_safe_free(mp->originate_string);
+	free(mp);
+}
+
+static void member_destroy(fifo_member_t **member)
+{
+	fifo_member_t *mp = *member;
+
+	*member = NULL;
+
+	member_unlink(globals.member_fifo_hash, mp->fifo_name, mp, SWITCH_FALSE);
+	member_unlink(globals.member_hash, mp->uuid, mp, SWITCH_TRUE);
+
+	member_free(mp);
+}
+
+static void fifo_member_store(const char *fifo_name, const char *uuid, const char *originate_string,
+							  int simo_count, int timeout, int lag, long expires, int is_static, int taking_calls)
+{
+	fifo_member_t *member, *mp;
+
+	switch_zmalloc(member, sizeof(*member));
+	member->uuid = strdup(uuid);
+	member->fifo_name = strdup(fifo_name);
+	member->originate_string = strdup(originate_string);
+	member->simo_count = simo_count;
+	member->timeout = timeout;
+	member->lag = lag;
+	member->expires = expires;
+	member->is_static = is_static;
+	member->taking_calls = taking_calls;
+
+	switch_mutex_lock(globals.member_mutex);
+
+	for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, fifo_name); mp; mp = mp->next) {
+		if (!strcmp(mp->uuid, uuid)) {
+			member_destroy(&mp);
+			break;
+		}
+	}
+
+	/* append so the walk order matches the insertion order the table used to give us */
+	if ((mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, fifo_name))) {
+		while (mp->next) {
+			mp = mp->next;
+		}
+		mp->next = member;
+	} else {
+		switch_core_hash_insert(globals.member_fifo_hash, fifo_name, member);
+	}
+
+	member->uuid_next = (fifo_member_t *) switch_core_hash_find(globals.member_hash, uuid);
+	switch_core_hash_insert(globals.member_hash, uuid, member);
+
+	switch_mutex_unlock(globals.member_mutex);
+}
+
+static void fifo_member_remove(const char *fifo_name, const char *uuid)
+{
+	fifo_member_t *mp;
+
+	switch_mutex_lock(globals.member_mutex);
+	for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, fifo_name); mp; mp = mp->next) {
+		if (!strcmp(mp->uuid, uuid)) {
+			member_destroy(&mp);
+			break;
+		}
+	}
+	switch_mutex_unlock(globals.member_mutex);
+}
+
+static void fifo_member_remove_all(switch_bool_t static_only)
+{
+	switch_hash_index_t *hi;
+	void *val;
+	fifo_member_t *mp, *next;
+	int found;
+
+	switch_mutex_lock(globals.member_mutex);
+	do {
+		found = 0;
+		/* deleting can drop the bucket we are iterating, so start over after each list */
+		for (hi = switch_hash_first(NULL, globals.member_fifo_hash); hi; hi = switch_hash_next(hi)) {
+			switch_hash_this(hi, NULL, NULL, &val);
+			for (mp = (fifo_member_t *) val; mp; mp = next) {
+				next = mp->next;
+				if (!static_only || mp->is_static) {
+					member_destroy(&mp);
+					found++;
+				}
+			}
+			if (found) {
+				break;
+			}
+		}
+	} while (found);
+	switch_mutex_unlock(globals.member_mutex);
+}
+
+static int fifo_member_count(const char *fifo_name)
+{
+	fifo_member_t *mp;
+	int count = 0;
+
+	if (globals.shared_members) {
+		char outbound_count[80] = "";
+		callback_t cbt = { 0 };
+		char *sql;
+
+		/* other hosts' members count too, they are dialed from here as well */
+		cbt.buf = outbound_count;
+		cbt.len = sizeof(outbound_count);
+		sql = switch_mprintf("select count(*) from fifo_outbound where fifo_name = '%q'", fifo_name);
+		fifo_execute_sql_callback(globals.sql_mutex, sql, sql2str_callback, &cbt);
+		switch_safe_free(sql);
+
+		return atoi(outbound_count);
+	}
+
+	switch_mutex_lock(globals.member_mutex);
+	for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, fifo_name); mp; mp = mp->next) {
+		count++;
+	}
+	switch_mutex_unlock(globals.member_mutex);
+
+	return count;
+}
+
+static void fifo_member_update(const char *uuid, member_action_t action)
+{
+	fifo_member_t *mp;
+	long now = (long) switch_epoch_time_now(NULL);
+
+	if (!uuid) return;
+
+	switch_mutex_lock(globals.member_mutex);
+	for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_hash, uuid); mp; mp = mp->uuid_next) {
+		switch (action) {
+		case MEMBER_RING_START:
+			mp->ring_count++;
+			break;
+		case MEMBER_RING_STOP:
+			if (mp->ring_count > 0) {
+				mp->ring_count--;
+			}
+			break;
+		case MEMBER_RING_FAIL:
+			if (mp->ring_count > 0) {
+				mp->ring_count--;
+			}
+			mp->outbound_fail_count++;
+			mp->next_avail = now + mp->lag + 1;
+			break;
+		case MEMBER_USE_START:
+			mp->use_count++;
+			mp->outbound_fail_count = 0;
+			break;
+		case MEMBER_USE_STOP:
+		case MEMBER_CALL_DONE:
+			if (mp->use_count > 0) {
+				mp->use_count--;
+				mp->next_avail = now + mp->lag + 1;
+				if (action == MEMBER_CALL_DONE) {
+					mp->outbound_call_count++;
+				}
+			}
+			break;
+		}
+	}
+	switch_mutex_unlock(globals.member_mutex);
+}
+
+static int fifo_member_load_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	fifo_member_store(argv[1], argv[0], switch_str_nil(argv[2]), atoi(switch_str_nil(argv[3])), atoi(switch_str_nil(argv[4])),
+					  atoi(switch_str_nil(argv[5])), atol(switch_str_nil(argv[6])), 0, atoi(switch_str_nil(argv[7])));
+
+	return 0;
+}
+
+static fifo_node_t *create_node(const char *name, uint32_t importance)
 {
 	fifo_node_t *node;
 	int x = 0;
 	switch_memory_pool_t *pool;
-	char outbound_count[80] = "";
-	callback_t cbt = { 0 };
-	char *sql = NULL;
 	char *domain_name = NULL;
 	
 	if (!globals.running) {
@@ -875,17 +1128,12 @@ static fifo_node_t *create_node(const char *name, uint32_t importance, switch_mu
 	switch_thread_rwlock_create(&node->rwlock, node->pool);
 	switch_mutex_init(&node->mutex, SWITCH_MUTEX_NESTED, node->pool);
 	switch_mutex_init(&node->update_mutex, SWITCH_MUTEX_NESTED, node->pool);
-	cbt.buf = outbound_count;
-	cbt.len = sizeof(outbound_count);
-	sql = switch_mprintf("select count(*) from fifo_outbound where fifo_name = '%q'", name);
-	fifo_execute_sql_callback(mutex, sql, sql2str_callback, &cbt);
-    node->member_count = atoi(outbound_count);
+	node->member_count = fifo_member_count(name);
 	if (node->member_count > 0) {
 		node->has_outbound = 1;
 	} else {
-        node->has_outbound = 0;
-    }
-	switch_safe_free(sql);
+		node->has_outbound = 0;
+	}
 
 	node->importance = importance;
 
@@ -1409,7 +1657,8 @@ static void *SWITCH_THREAD_FUNC ringall_thread_run(switch_thread_t *thread, void
 		struct call_helper *h = cbh->rows[i];
 		char *sql = switch_mprintf("update fifo_outbound set ring_count=ring_count+1 where uuid='%s'", h->uuid);
 
-		fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+		fifo_member_update(h->uuid, MEMBER_RING_START);
+		fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 	}
 
@@ -1451,7 +1700,8 @@ static void *SWITCH_THREAD_FUNC ringall_thread_run(switch_thread_t *thread, void
 					struct call_helper *h = cbh->rows[i];
 					char *sql = switch_mprintf("update fifo_outbound set ring_count=ring_count-1 "
 											   "where uuid='%q' and ring_count > 0", h->uuid);
-					fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+					fifo_member_update(h->uuid, MEMBER_RING_STOP);
+					fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 				}
 
 			}
@@ -1465,7 +1715,8 @@ static void *SWITCH_THREAD_FUNC ringall_thread_run(switch_thread_t *thread, void
 											   "outbound_fail_total_count = outbound_fail_total_count+1, "
 											   "next_avail=%ld + lag + 1 where uuid='%q' and ring_count > 0",
 											   (long) switch_epoch_time_now(NULL), h->uuid);
-					fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+					fifo_member_update(h->uuid, MEMBER_RING_FAIL);
+					fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 				}
 			}
@@ -1522,7 +1773,8 @@ static void *SWITCH_THREAD_FUNC ringall_thread_run(switch_thread_t *thread, void
 	for (i = 0; i < cbh->rowcount; i++) {
 		struct call_helper *h = cbh->rows[i];
 		char *sql = switch_mprintf("update fifo_outbound set ring_count=ring_count-1 where uuid='%q' and ring_count > 0",  h->uuid);
-		fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+		fifo_member_update(h->uuid, MEMBER_RING_STOP);
+		fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 	}
 
   end:
@@ -1632,7 +1884,8 @@ static void *SWITCH_THREAD_FUNC o_thread_run(switch_thread_t *thread, void *obj)
 
 
 	sql = switch_mprintf("update fifo_outbound set ring_count=ring_count+1 where uuid='%s'", h->uuid);
-	fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+	fifo_member_update(h->uuid, MEMBER_RING_START);
+	fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 	status = switch_ivr_originate(NULL, &session, &cause, originate_string, h->timeout, NULL, NULL, NULL, NULL, ovars, SOF_NONE, NULL);
 	free(originate_string);
@@ -1642,7 +1895,8 @@ static void *SWITCH_THREAD_FUNC o_thread_run(switch_thread_t *thread, void *obj)
 		sql = switch_mprintf("update fifo_outbound set ring_count=ring_count-1, "
 							 "outbound_fail_count=outbound_fail_count+1, next_avail=%ld + lag + 1 where uuid='%q'",
 							 (long) switch_epoch_time_now(NULL), h->uuid);
-		fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+		fifo_member_update(h->uuid, MEMBER_RING_FAIL);
+		fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 		if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, FIFO_EVENT) == SWITCH_STATUS_SUCCESS) {
 			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "FIFO-Name", node->name);
@@ -1708,74 +1962,109 @@ static void *SWITCH_THREAD_FUNC o_thread_run(switch_thread_t *thread, void *obj)
 	return NULL;
 }
 
-static int place_call_ringall_callback(void *pArg, int argc, char **argv, char **columnNames)
+static struct call_helper *member_call_helper(fifo_member_t *member, switch_memory_pool_t *pool)
 {
-	struct callback_helper *cbh = (struct callback_helper *) pArg;
 	struct call_helper *h;
 
-	h = switch_core_alloc(cbh->pool, sizeof(*h));
-	h->pool = cbh->pool;
-	h->uuid = switch_core_strdup(h->pool, argv[0]);
-	h->node_name = switch_core_strdup(h->pool, argv[1]);
-	h->originate_string = switch_core_strdup(h->pool, argv[2]);
-	h->timeout = atoi(argv[5]);
+	h = switch_core_alloc(pool, sizeof(*h));
+	h->pool = pool;
+	h->uuid = switch_core_strdup(h->pool, member->uuid);
+	h->node_name = switch_core_strdup(h->pool, member->fifo_name);
+	h->originate_string = switch_core_strdup(h->pool, member->originate_string);
+	h->timeout = member->timeout;
 
-	cbh->rows[cbh->rowcount++] = h;
+	return h;
+}
 
-	if (cbh->rowcount == MAX_ROWS) return -1;
+/* same order the old "order by next_avail, outbound_fail_count, outbound_call_count" gave us */
+static int member_cmp(const void *a, const void *b)
+{
+	const fifo_member_t *ma = *(fifo_member_t * const *) a;
+	const fifo_member_t *mb = *(fifo_member_t * const *) b;
 
-	if (cbh->need) {
-		cbh->need--;
-		return cbh->need ? 0 : -1;
+	if (ma->next_avail != mb->next_avail) {
+		return ma->next_avail < mb->next_avail ? -1 : 1;
 	}
 
-	return 0;
-
-}
-
-static int place_call_enterprise_callback(void *pArg, int argc, char **argv, char **columnNames)
-{
+	if (ma->outbound_fail_count != mb->outbound_fail_count) {
+		return ma->outbound_fail_count < mb->outbound_fail_count ? -1 : 1;
+	}
 
-	int *need = (int *) pArg;
+	if (ma->outbound_call_count != mb->outbound_call_count) {
+		return ma->outbound_call_count < mb->outbound_call_count ? -1 : 1;
+	}
 
-	switch_thread_t *thread;
-	switch_threadattr_t *thd_attr = NULL;
-	switch_memory_pool_t *pool;
-	struct call_helper *h;
+	return 0;
+}
 
-	switch_core_new_memory_pool(&pool);
-	h = switch_core_alloc(pool, sizeof(*h));
-	h->pool = pool;
-	h->uuid = switch_core_strdup(h->pool, argv[0]);
-	h->node_name = switch_core_strdup(h->pool, argv[1]);
-	h->originate_string = switch_core_strdup(h->pool, argv[2]);
-	h->timeout = atoi(argv[5]);
+struct member_rows {
+	fifo_member_t **members;
+	int count;
+	int size;
+};
 
+static int member_row_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	struct member_rows *rows = (struct member_rows *) pArg;
+	fifo_member_t *member;
 
-	switch_threadattr_create(&thd_attr, h->pool);
-	switch_threadattr_detach_set(thd_attr, 1);
-	switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-	switch_thread_create(&thread, thd_attr, o_thread_run, h, h->pool);
+	if (rows->count == rows->size) {
+		rows->size = rows->size ? rows->size * 2 : 16;
+		rows->members = realloc(rows->members, rows->size * sizeof(*rows->members));
+		switch_assert(rows->members);
+	}
 
-	(*need)--;
+	switch_zmalloc(member, sizeof(*member));
+	member->uuid = strdup(argv[0]);
+	member->fifo_name = strdup(argv[1]);
+	member->originate_string = strdup(switch_str_nil(argv[2]));
+	member->timeout = atoi(switch_str_nil(argv[3]));
+	rows->members[rows->count++] = member;
 
-	return *need ? 0 : -1;
+	return 0;
 }
 
 static void find_consumers(fifo_node_t *node)
 {
-	char *sql;
+	fifo_member_t *mp, **members = NULL;
+	struct call_helper **helpers = NULL;
+	struct member_rows rows = { 0 };
+	int i, total = 0, ready = 0, placed = 0;
+	long now = (long) switch_epoch_time_now(NULL);
+
+	if (globals.shared_members) {
+		/* other hosts ring and use the same members and only tell fifo_outbound, so ask it */
+		char *sql = switch_mprintf("select uuid, fifo_name, originate_string, timeout "
+								   "from fifo_outbound "
+								   "where taking_calls = 1 and (fifo_name = '%q') and ((use_count+ring_count) < simo_count) and (next_avail = 0 or next_avail <= %ld) "
+								   "order by next_avail, outbound_fail_count, outbound_call_count",
+								   node->name, now);
+
+		fifo_execute_sql_callback(globals.sql_mutex, sql, member_row_callback, &rows);
+		switch_safe_free(sql);
+		members = rows.members;
+		ready = rows.count;
+	}
 
+	switch_mutex_lock(globals.member_mutex);
 
-	sql = switch_mprintf("select uuid, fifo_name, originate_string, simo_count, use_count, timeout, lag, "
-						 "next_avail, expires, static, outbound_call_count, outbound_fail_count, hostname "
-						 "from fifo_outbound "
-						 "where taking_calls = 1 and (fifo_name = '%q') and ((use_count+ring_count) < simo_count) and (next_avail = 0 or next_avail <= %ld) "
-						 "order by next_avail, outbound_fail_count, outbound_call_count",
-						 node->name, (long) switch_epoch_time_now(NULL)
-						 );
+	if (!globals.shared_members) {
+		for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, node->name); mp; mp = mp->next) {
+			total++;
+		}
+
+		if (total) {
+			switch_zmalloc(members, total * sizeof(*members));
 
+			for (mp = (fifo_member_t *) switch_core_hash_find(globals.member_fifo_hash, node->name); mp; mp = mp->next) {
+				if (mp->taking_calls == 1 && (mp->use_count + mp->ring_count) < mp->simo_count && (mp->next_avail == 0 || mp->next_avail <= now)) {
+					members[ready++] = mp;
+				}
+			}
 
+			qsort(members, ready, sizeof(*members), member_cmp);
+		}
+	}
 
 	switch(node->outbound_strategy) {
 	case NODE_STRATEGY_ENTERPRISE:
@@ -1786,7 +2075,33 @@ static void find_consumers(fifo_node_t *node)
 				need = node->outbound_per_cycle;
 			}
 
-			fifo_execute_sql_callback(globals.sql_mutex, sql, place_call_enterprise_callback, &need);
+			if (ready) {
+				switch_zmalloc(helpers, ready * sizeof(*helpers));
+			}
+
+			for (i = 0; i < ready; i++) {
+				switch_memory_pool_t *pool;
+
+				switch_core_new_memory_pool(&pool);
+				helpers[placed++] = member_call_helper(members[i], pool);
+
+				if (!--need) {
+					break;
+				}
+			}
+
+			switch_mutex_unlock(globals.member_mutex);
+
+			for (i = 0; i < placed; i++) {
+				switch_thread_t *thread;
+				switch_threadattr_t *thd_attr = NULL;
+				struct call_helper *h = helpers[i];
+
+				switch_threadattr_create(&thd_attr, h->pool);
+				switch_threadattr_detach_set(thd_attr, 1);
+				switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+				switch_thread_create(&thread, thd_attr, o_thread_run, h, h->pool);
+			}
 
 		}
 		break;
@@ -1806,7 +2121,15 @@ static void find_consumers(fifo_node_t *node)
 				cbh->need = node->outbound_per_cycle;
 			}
 
-			fifo_execute_sql_callback(globals.sql_mutex, sql, place_call_ringall_callback, cbh);
+			for (i = 0; i < ready; i++) {
+				cbh->rows[cbh->rowcount++] = member_call_helper(members[i], cbh->pool);
+
+				if (cbh->rowcount == MAX_ROWS) break;
+
+				if (cbh->need && !--cbh->need) break;
+			}
+
+			switch_mutex_unlock(globals.member_mutex);
 
 			if (cbh->rowcount) {
 				switch_threadattr_create(&thd_attr, cbh->pool);
@@ -1820,11 +2143,15 @@ static void find_consumers(fifo_node_t *node)
 		}
 		break;
 	default:
+		switch_mutex_unlock(globals.member_mutex);
 		break;
 	}
 
-
-	switch_safe_free(sql);
+	for (i = 0; i < rows.count; i++) {
+		member_free(rows.members[i]);
+	}
+	switch_safe_free(members);
+	switch_safe_free(helpers);
 }
 
 static void *SWITCH_THREAD_FUNC node_thread_run(switch_thread_t *thread, void *obj)
@@ -2034,7 +2361,7 @@ static void pres_event_handler(switch_event_t *event)
 
 	switch_mutex_lock(globals.mutex);
 	if (!(node = switch_core_hash_find(globals.fifo_hash, node_name)) && !(node = switch_core_hash_find(globals.fifo_hash, dup_node_name))) {
-		node = create_node(node_name, 0, globals.sql_mutex);
+		node = create_node(node_name, 0);
 		node->domain_name = switch_core_strdup(node->pool, domain_name);
 		node->ready = 1;
 	}
@@ -2064,7 +2391,7 @@ static uint32_t fifo_add_outbound(const char *node_name, const char *url, uint32
 	switch_mutex_lock(globals.mutex);
 
 	if (!(node = switch_core_hash_find(globals.fifo_hash, node_name))) {
-		node = create_node(node_name, 0, globals.sql_mutex);
+		node = create_node(node_name, 0);
 	}
 
 	switch_thread_rwlock_rdlock(node->rwlock);
@@ -2150,7 +2477,8 @@ static void dec_use_count(switch_core_session_t *session, switch_bool_t send_eve
 		del_bridge_call(outbound_id);
 		sql = switch_mprintf("update fifo_outbound set use_count=use_count-1, stop_time=%ld, next_avail=%ld + lag + 1 where use_count > 0 and uuid='%q'",
 							 now, now, outbound_id);
-		fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+		fifo_member_update(outbound_id, MEMBER_USE_STOP);
+		fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 	}
 
 	if (send_event) {
@@ -2217,7 +2545,8 @@ SWITCH_STANDARD_APP(fifo_track_call_function)
 
 	sql = switch_mprintf("update fifo_outbound set stop_time=0,start_time=%ld,outbound_fail_count=0,use_count=use_count+1,%s=%s+1,%s=%s+1 where uuid='%q'",
 						 (long) switch_epoch_time_now(NULL), col1, col1, col2, col2, data);
-	fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+	fifo_member_update(data, MEMBER_USE_START);
+	fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 
 	if (switch_channel_direction(channel) == SWITCH_CALL_DIRECTION_INBOUND) {
@@ -2358,7 +2687,7 @@ SWITCH_STANDARD_APP(fifo_function)
 
 
 		if (!(node = switch_core_hash_find(globals.fifo_hash, nlist[i]))) {
-			node = create_node(nlist[i], importance, globals.sql_mutex);
+			node = create_node(nlist[i], importance);
 			node->ready = 1;
 		}
 
@@ -3067,8 +3396,8 @@ SWITCH_STANDARD_APP(fifo_function)
 					sql = switch_mprintf("update fifo_outbound set stop_time=0,start_time=%ld,use_count=use_count+1,outbound_fail_count=0 where uuid='%s'",
 										 switch_epoch_time_now(NULL), outbound_id);
 
-
-					fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+					fifo_member_update(outbound_id, MEMBER_USE_START);
+					fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 				}
 
 				add_bridge_call(switch_core_session_get_uuid(other_session));
@@ -3113,7 +3442,8 @@ SWITCH_STANDARD_APP(fifo_function)
 										 "outbound_call_count=outbound_call_count+1, next_avail=%ld + lag + 1 where uuid='%s' and use_count > 0",
 										 now, now, outbound_id);
 
-					fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
+					fifo_member_update(outbound_id, MEMBER_CALL_DONE);
+					fifo_execute_sql_queued(&sql, SWITCH_TRUE, globals.shared_members);
 
 					del_bridge_call(outbound_id);
 
@@ -4082,6 +4412,7 @@ static switch_status_t load_config(int reload, int del_all)
 		}
 	}
 
+	globals.shared_members = !zstr(globals.odbc_dsn);
 
 	if (!(dbh = fifo_get_db_handle())) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Cannot open DB!\n");
@@ -4132,14 +4463,23 @@ static switch_status_t load_config(int reload, int del_all)
 
 	if ((reload && del_all) || (!reload && delete_all_outbound_member_on_startup)) {
 		sql = switch_mprintf("delete from fifo_outbound where hostname='%q'", globals.hostname);
+		fifo_member_remove_all(SWITCH_FALSE);
 	} else {
 		sql = switch_mprintf("delete from fifo_outbound where static=1 and hostname='%q'", globals.hostname);
+		fifo_member_remove_all(SWITCH_TRUE);
 	}
 
 	fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
 
+	if (!reload) {
+		sql = switch_mprintf("select uuid, fifo_name, originate_string, simo_count, timeout, lag, expires, taking_calls "
+							 "from fifo_outbound where hostname='%q'", globals.hostname);
+		fifo_execute_sql_callback(globals.sql_mutex, sql, fifo_member_load_callback, NULL);
+		switch_safe_free(sql);
+	}
+
 	if (!(node = switch_core_hash_find(globals.fifo_hash, MANUAL_QUEUE_NAME))) {
-		node = create_node(MANUAL_QUEUE_NAME, 0, globals.sql_mutex);
+		node = create_node(MANUAL_QUEUE_NAME, 0);
 		node->ready = 2;
 		node->is_static = 0;
 	}
@@ -4177,7 +4517,7 @@ static switch_status_t load_config(int reload, int del_all)
 
 			switch_mutex_lock(globals.mutex);
 			if (!(node = switch_core_hash_find(globals.fifo_hash, name))) {
-				node = create_node(name, imp, globals.sql_mutex);
+				node = create_node(name, imp);
 			}
 
 			if ((val = switch_xml_attr(fifo, "outbound_name")) && !zstr(val)) {
@@ -4290,6 +4630,7 @@ static switch_status_t load_config(int reload, int del_all)
 
 				switch_assert(sql);
 				fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_FALSE);
+				fifo_member_store(node->name, digest, member->txt, simo_i, timeout_i, lag_i, 0, 1, taking_calls_i);
 				free(name_dup);
 				node->has_outbound = 1;
 				node->member_count++;
@@ -4330,8 +4671,6 @@ static void fifo_member_add(char *fifo_name, char *originate_string, int simo_co
 {
 	char digest[SWITCH_MD5_DIGEST_STRING_SIZE] = { 0 };
 	char *sql, *name_dup, *p;
-    char outbound_count[80] = "";
-    callback_t cbt = { 0 };
 	fifo_node_t *node = NULL;
 
 	if (!fifo_name) return;
@@ -4349,7 +4688,7 @@ static void fifo_member_add(char *fifo_name, char *originate_string, int simo_co
 
 	switch_mutex_lock(globals.mutex);
 	if (!(node = switch_core_hash_find(globals.fifo_hash, fifo_name))) {
-		node = create_node(fifo_name, 0, globals.sql_mutex);
+		node = create_node(fifo_name, 0);
 		node->ready = 1;
 	}
 	switch_mutex_unlock(globals.mutex);
@@ -4369,25 +4708,20 @@ static void fifo_member_add(char *fifo_name, char *originate_string, int simo_co
 	fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
 	free(name_dup);
 
-    cbt.buf = outbound_count; 
-    cbt.len = sizeof(outbound_count);
-    sql = switch_mprintf("select count(*) from fifo_outbound where fifo_name = '%q'", fifo_name);
-    fifo_execute_sql_callback(globals.sql_mutex, sql, sql2str_callback, &cbt);
-    node->member_count = atoi(outbound_count);
-    if (node->member_count > 0) {
-        node->has_outbound = 1;
-    } else {
-        node->has_outbound = 0;
-    }
-    switch_safe_free(sql);
+	fifo_member_store(fifo_name, digest, originate_string, simo_count, timeout, lag, (long) expires, 0, taking_calls);
+
+	node->member_count = fifo_member_count(fifo_name);
+	if (node->member_count > 0) {
+		node->has_outbound = 1;
+	} else {
+		node->has_outbound = 0;
+	}
 }
 
 static void fifo_member_del(char *fifo_name, char *originate_string)
 {
 	char digest[SWITCH_MD5_DIGEST_STRING_SIZE] = { 0 };
 	char *sql;
-	char outbound_count[80] = "";
-	callback_t cbt = { 0 };
 	fifo_node_t *node = NULL;
 
 	if (!fifo_name) return;
@@ -4403,24 +4737,21 @@ static void fifo_member_del(char *fifo_name, char *originate_string)
 	switch_assert(sql);
 	fifo_execute_sql_queued(&sql, SWITCH_TRUE, SWITCH_TRUE);
 
+	fifo_member_remove(fifo_name, digest);
+
 	switch_mutex_lock(globals.mutex);
 	if (!(node = switch_core_hash_find(globals.fifo_hash, fifo_name))) {
-		node = create_node(fifo_name, 0, globals.sql_mutex);
+		node = create_node(fifo_name, 0);
 		node->ready = 1;
 	}
 	switch_mutex_unlock(globals.mutex);
 
-	cbt.buf = outbound_count;
-	cbt.len = sizeof(outbound_count);
-	sql = switch_mprintf("select count(*) from fifo_outbound where fifo_name = '%q'", node->name);
-	fifo_execute_sql_callback(globals.sql_mutex, sql, sql2str_callback, &cbt);
-    node->member_count = atoi(outbound_count);
+	node->member_count = fifo_member_count(node->name);
 	if (node->member_count > 0) {
-        node->has_outbound = 1;
+		node->has_outbound = 1;
 	} else {
-        node->has_outbound = 0;
+		node->has_outbound = 0;
 	}
-	switch_safe_free(sql);
 }
 
 #define FIFO_MEMBER_API_SYNTAX "[add <fifo_name> <originate_string> [<simo_count>] [<timeout>] [<lag>] [<expires>] [<taking_calls>] | del <fifo_name> <originate_string>]"
@@ -4535,6 +4866,9 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_fifo_load)
 	switch_mutex_init(&globals.caller_orig_mutex, SWITCH_MUTEX_NESTED, globals.pool);
 	switch_mutex_init(&globals.consumer_orig_mutex, SWITCH_MUTEX_NESTED, globals.pool);
 	switch_mutex_init(&globals.bridge_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+	switch_core_hash_init(&globals.member_hash, globals.pool);
+	switch_core_hash_init(&globals.member_fifo_hash, globals.pool);
+	switch_mutex_init(&globals.member_mutex, SWITCH_MUTEX_NESTED, globals.pool);
 
 	switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, globals.pool);
 	switch_mutex_init(&globals.sql_mutex, SWITCH_MUTEX_NESTED, globals.pool);
@@ -4618,6 +4952,10 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_fifo_shutdown)
 		switch_core_destroy_memory_pool(&this_node->pool);
 	}
 
+	fifo_member_remove_all(SWITCH_FALSE);
+	switch_core_hash_destroy(&globals.member_hash);
+	switch_core_hash_destroy(&globals.member_fifo_hash);
+
 	switch_core_hash_destroy(&globals.fifo_hash);
 	memset(&globals, 0, sizeof(globals));
 	switch_mutex_unlock(mutex);
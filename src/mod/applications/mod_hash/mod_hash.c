@@ -37,6 +37,10 @@
 #include "esl.h"
 
 #define LIMIT_HASH_CLEANUP_INTERVAL 900
+#define LIMIT_HASH_EVENT_DELTA "mod_hash::delta"
+#define LIMIT_REMOTE_RECV_TIMEOUT 1000
+#define LIMIT_REMOTE_CHECKSUM_INTERVAL 30000
+#define LIMIT_REMOTE_MAX_VERIFY_SKIP 3
 
 SWITCH_MODULE_LOAD_FUNCTION(mod_hash_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_hash_shutdown);
@@ -51,6 +55,8 @@ static struct {
 	switch_hash_t *db_hash;
 	switch_thread_rwlock_t *remote_hash_rwlock;
 	switch_hash_t *remote_hash;
+	uint32_t delta_seq;		/* < Sequence of the last delta event fired, protected by limit_hash_rwlock */
+	switch_bool_t delta_events;	/* < Fire mod_hash::delta events for remotes in delta mode (delta-events setting) */
 } globals;
 
 typedef struct {
@@ -58,7 +64,8 @@ typedef struct {
 	uint32_t rate_usage;	/* < Current rate usage */
 	time_t last_check;		/* < Last rate check */
 	uint32_t interval;		/* < Interval used on last rate check */
-	uint32_t last_update;	/* < Last updated timestamp (rate or total) */
+	uint32_t last_update;	/* < Last updated timestamp (rate or total), sync generation for remote entries */
+	uint32_t seq;			/* < Delta sequence last applied (remote entries only) */
 } limit_hash_item_t;
 
 struct callback {
@@ -92,6 +99,21 @@ static inline const char *state_str(limit_remote_state_t state) {
 	return "";
 }
 
+typedef enum {
+	LIMIT_SYNC_POLL = 0,	/* < Pull a full hash_dump every interval */
+	LIMIT_SYNC_DELTA		/* < Apply delta events, verify with a periodic checksum */
+} limit_sync_t;
+
+static inline const char *sync_str(limit_sync_t sync) {
+	switch (sync) {
+		case LIMIT_SYNC_POLL:
+			return "poll";
+		case LIMIT_SYNC_DELTA:
+			return "delta";
+	}
+	return "";
+}
+
 typedef struct {
 	const char *name;
 	const char *host;
@@ -100,9 +122,30 @@ typedef struct {
 	int port;
 	
 	int interval;
+	int checksum_interval;
+	limit_sync_t sync;
 	
 	esl_handle_t handle;
 
+	/* Replication state, owned by the remote thread */
+	char node_id[SWITCH_UUID_FORMATTED_LENGTH + 1];
+	uint32_t generation;		/* < Bumped on every full sync, entries not refreshed by it are stale */
+	uint32_t sync_seq;			/* < Delta sequence covered by the last full sync */
+	uint32_t delta_seq;			/* < Highest delta sequence applied */
+	uint32_t missing;			/* < Sequences below delta_seq not received yet */
+	uint32_t verify_seq;		/* < Sequence of the checksum last asked for, 0 once one was compared */
+	switch_bool_t resync;
+	int verify_skipped;
+	switch_time_t next_verify;
+
+	/* Replication stats, reported by hash_remote list */
+	switch_time_t last_sync;	/* < Last time the index was known to be current */
+	uint32_t lag_ms;			/* < Lag of the last delta (or age of the last poll) */
+	uint32_t max_lag_ms;
+	uint64_t deltas;
+	uint64_t gaps;
+	uint64_t resyncs;
+
 	switch_hash_t *index;
 	switch_thread_rwlock_t *rwlock;
 	switch_memory_pool_t *pool;
@@ -117,6 +160,96 @@ static limit_hash_item_t get_remote_usage(const char *key);
 void limit_remote_destroy(limit_remote_t **r);
 static void do_config(switch_bool_t reload);
 
+/* !\brief Starts a pending delta, it stays empty unless delta events are enabled */
+static void limit_hash_delta_init(switch_stream_handle_t *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+
+	if (globals.delta_events) {
+		SWITCH_STANDARD_STREAM((*stream));
+	}
+}
+
+/* !\brief Appends the current state of a limit entry to a pending delta */
+static void limit_hash_delta_add(switch_stream_handle_t *stream, const char *key, limit_hash_item_t *item)
+{
+	if (!stream->data) {
+		return;
+	}
+
+	stream->write_function(stream, "L/%s/%d/%d/%d/%d\n", key, item->total_usage, item->rate_usage, item->interval, (int) item->last_check);
+}
+
+/* !\brief Gives a pending delta its sequence, caller holds limit_hash_rwlock for writing. Returns 0 if there is nothing to fire */
+static uint32_t limit_hash_delta_seal(switch_stream_handle_t *stream)
+{
+	if (!globals.delta_events || zstr((char *) stream->data)) {
+		return 0;
+	}
+
+	/* Bump even if the event can't be sent, the gap makes remotes verify early */
+	return ++globals.delta_seq;
+}
+
+/* !\brief Fires a sealed delta once limit_hash_rwlock is released, remotes order deltas by their sequence.
+ * A checksum ("count/sum") describes the hash as it was right after this sequence. */
+static void limit_hash_delta_fire(uint32_t seq, const char *body, const char *checksum)
+{
+	switch_event_t *event;
+
+	if (!seq) {
+		return;
+	}
+
+	if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, LIMIT_HASH_EVENT_DELTA) == SWITCH_STATUS_SUCCESS) {
+		switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Delta-Node", switch_core_get_uuid());
+		switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Delta-Seq", "%u", seq);
+		switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Delta-Stamp", "%" SWITCH_TIME_T_FMT, switch_micro_time_now());
+		if (checksum) {
+			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Delta-Checksum", checksum);
+		}
+		if (!zstr(body)) {
+			switch_event_add_body(event, "%s", body);
+		}
+		switch_event_fire(&event);
+	}
+}
+
+/* !\brief Order independent checksum of the non-empty entries of a limit hash, caller holds its lock */
+static void limit_hash_checksum(switch_hash_t *hash, uint32_t *count, uint32_t *sum)
+{
+	switch_hash_index_t *hi;
+
+	*count = 0;
+	*sum = 0;
+
+	for (hi = switch_hash_first(NULL, hash); hi; hi = switch_hash_next(hi)) {
+		void *val = NULL;
+		const void *key;
+		switch_ssize_t keylen;
+		limit_hash_item_t *item;
+		const unsigned char *p;
+		uint32_t h = 2166136261U;
+
+		switch_hash_this(hi, &key, &keylen, &val);
+		item = (limit_hash_item_t *) val;
+
+		if (item->total_usage == 0 && item->rate_usage == 0) {
+			continue;
+		}
+
+		/* FNV-1a over the key and both counters */
+		for (p = (const unsigned char *) key; *p; p++) {
+			h = (h ^ *p) * 16777619U;
+		}
+		h = (h ^ item->total_usage) * 16777619U;
+		h = (h ^ item->rate_usage) * 16777619U;
+
+		(*count)++;
+		*sum += h;
+	}
+}
+
 
 /* \brief Enforces limit_hash restrictions
  * \param session current session
@@ -135,10 +268,15 @@ SWITCH_LIMIT_INCR(limit_incr_hash)
 	time_t now = switch_epoch_time_now(NULL);
 	limit_hash_private_t *pvt = NULL;
 	uint8_t increment = 1;
+	switch_bool_t changed = SWITCH_FALSE;
 	limit_hash_item_t remote_usage;
+	switch_stream_handle_t delta = { 0 };
+	uint32_t delta_seq = 0;
 
 	hashkey = switch_core_session_sprintf(session, "%s_%s", realm, resource);
 
+	limit_hash_delta_init(&delta);
+
 	switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
 	/* Check if that realm+resource has ever been checked */
 	if (!(item = (limit_hash_item_t *) switch_core_hash_find(globals.limit_hash, hashkey))) {
@@ -193,6 +331,7 @@ SWITCH_LIMIT_INCR(limit_incr_hash)
 
 	if (increment) {
 		item->total_usage++;
+		changed = SWITCH_TRUE;
 
 		switch_core_hash_insert(pvt->hash, hashkey, item);
 
@@ -221,18 +360,30 @@ SWITCH_LIMIT_INCR(limit_incr_hash)
 	}
 
   end:
+	/* Rate counters move on every check, totals only when incremented */
+	if (interval > 0 || changed) {
+		limit_hash_delta_add(&delta, hashkey, item);
+		delta_seq = limit_hash_delta_seal(&delta);
+	}
+
 	switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
+
+	limit_hash_delta_fire(delta_seq, (char *) delta.data, NULL);
+	switch_safe_free(delta.data);
+
 	return status;
 }
 
 /* !\brief Determines whether a given entry is ready to be removed. */
 SWITCH_HASH_DELETE_FUNC(limit_hash_cleanup_delete_callback) {
 	limit_hash_item_t *item = (limit_hash_item_t *) val;
+	switch_stream_handle_t *delta = (switch_stream_handle_t *) pData;
 	time_t now = switch_epoch_time_now(NULL);
 
 	/* reset to 0 if window has passed so we can clean it up */
 	if (item->rate_usage > 0 && (item->last_check <= (now - item->interval))) {
 		item->rate_usage = 0;
+		limit_hash_delta_add(delta, (const char *) key, item);
 	}
 
 	if (item->total_usage == 0 && item->rate_usage == 0) {
@@ -249,9 +400,9 @@ SWITCH_HASH_DELETE_FUNC(limit_hash_cleanup_delete_callback) {
 SWITCH_HASH_DELETE_FUNC(limit_hash_remote_cleanup_callback) 
 {
 	limit_hash_item_t *item = (limit_hash_item_t *) val;
-	switch_time_t now = (switch_time_t)(intptr_t)pData;
+	uint32_t generation = (uint32_t)(intptr_t)pData;
 	
-	if (item->last_update != now) {
+	if (item->last_update != generation) {
 		free(item);
 		return SWITCH_TRUE;
 	}
@@ -259,15 +410,37 @@ SWITCH_HASH_DELETE_FUNC(limit_hash_remote_cleanup_callback)
 	return SWITCH_FALSE;
 }
 
+/* !\brief Drops released remote entries once a checksum confirmed no older delta can still refer to them */
+SWITCH_HASH_DELETE_FUNC(limit_hash_remote_prune_callback)
+{
+	limit_hash_item_t *item = (limit_hash_item_t *) val;
+
+	if (item->total_usage == 0 && item->rate_usage == 0) {
+		free(item);
+		return SWITCH_TRUE;
+	}
+
+	return SWITCH_FALSE;
+}
+
 /* !\brief Periodically checks for unused limit entries and frees them */
 SWITCH_STANDARD_SCHED_FUNC(limit_hash_cleanup_callback)
 {
+	switch_stream_handle_t delta = { 0 };
+	uint32_t delta_seq = 0;
+
+	limit_hash_delta_init(&delta);
+
 	switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
 	if (globals.limit_hash) {
-		switch_core_hash_delete_multi(globals.limit_hash, limit_hash_cleanup_delete_callback, NULL);
+		switch_core_hash_delete_multi(globals.limit_hash, limit_hash_cleanup_delete_callback, &delta);
+		delta_seq = limit_hash_delta_seal(&delta);
 	}
 	switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
 
+	limit_hash_delta_fire(delta_seq, (char *) delta.data, NULL);
+	switch_safe_free(delta.data);
+
 	if (globals.limit_hash) {	
 		task->runtime = switch_epoch_time_now(NULL) + LIMIT_HASH_CLEANUP_INTERVAL;
 	}
@@ -281,11 +454,15 @@ SWITCH_LIMIT_RELEASE(limit_release_hash)
 	limit_hash_item_t *item = NULL;
 	switch_hash_index_t *hi;
 	char *hashkey = NULL;
+	switch_stream_handle_t delta = { 0 };
+	uint32_t delta_seq;
 
 	if (!pvt || !pvt->hash) {
 		return SWITCH_STATUS_SUCCESS;
 	}
 
+	limit_hash_delta_init(&delta);
+
 	switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
 
 	/* clear for uuid */
@@ -302,6 +479,7 @@ SWITCH_LIMIT_RELEASE(limit_release_hash)
 			item = (limit_hash_item_t *) val;
 			item->total_usage--;
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Usage for %s is now %d\n", (const char *) key, item->total_usage);
+			limit_hash_delta_add(&delta, (const char *) key, item);
 
 			if (item->total_usage == 0 && item->rate_usage == 0) {
 				/* Noone is using this item anymore */
@@ -317,6 +495,7 @@ SWITCH_LIMIT_RELEASE(limit_release_hash)
 		if ((item = (limit_hash_item_t *) switch_core_hash_find(pvt->hash, hashkey))) {
 			item->total_usage--;
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Usage for %s is now %d\n", (const char *) hashkey, item->total_usage);
+			limit_hash_delta_add(&delta, hashkey, item);
 
 			switch_core_hash_delete(pvt->hash, hashkey);
 
@@ -328,7 +507,12 @@ SWITCH_LIMIT_RELEASE(limit_release_hash)
 		}
 	}
 
+	delta_seq = limit_hash_delta_seal(&delta);
+
 	switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
+
+	limit_hash_delta_fire(delta_seq, (char *) delta.data, NULL);
+	switch_safe_free(delta.data);
 	
 	return SWITCH_STATUS_SUCCESS;
 }
@@ -368,17 +552,28 @@ SWITCH_LIMIT_INTERVAL_RESET(limit_interval_reset_hash)
 {
 	char *hash_key = NULL;
 	limit_hash_item_t *item = NULL;
+	switch_stream_handle_t delta = { 0 };
+	uint32_t delta_seq = 0;
 
-	switch_thread_rwlock_rdlock(globals.limit_hash_rwlock);
+	limit_hash_delta_init(&delta);
+
+	switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
 
 	hash_key = switch_mprintf("%s_%s", realm, resource);
 	if ((item = switch_core_hash_find(globals.limit_hash, hash_key))) {
 		item->rate_usage = 0;
 		item->last_check = switch_epoch_time_now(NULL);
+
+		limit_hash_delta_add(&delta, hash_key, item);
+		delta_seq = limit_hash_delta_seal(&delta);
 	}
 
  	switch_safe_free(hash_key);
 	switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
+
+	limit_hash_delta_fire(delta_seq, (char *) delta.data, NULL);
+	switch_safe_free(delta.data);
+
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -582,7 +777,7 @@ SWITCH_STANDARD_API(hash_api_function)
 	return SWITCH_STATUS_SUCCESS;
 }
 
-#define HASH_DUMP_SYNTAX "all|limit|db [<realm>]"
+#define HASH_DUMP_SYNTAX "all|limit|limit_sync|limit_checksum|db [<realm>]"
 SWITCH_STANDARD_API(hash_dump_function) 
 {
 	int mode;
@@ -616,6 +811,10 @@ SWITCH_STANDARD_API(hash_dump_function)
 		mode = 1;
 	} else if (!strcmp(cmd, "db")) {
 		mode = 2;
+	} else if (!strcmp(cmd, "limit_sync")) {
+		mode = 5;
+	} else if (!strcmp(cmd, "limit_checksum")) {
+		mode = 8;
 	} else {
 		stream->write_function(stream, "Usage: "HASH_DUMP_SYNTAX"\n");
 		return SWITCH_STATUS_SUCCESS;
@@ -623,6 +822,11 @@ SWITCH_STANDARD_API(hash_dump_function)
 	
 	if (mode & 1) {
 		switch_thread_rwlock_rdlock(globals.limit_hash_rwlock);
+		if ((mode & 4) && globals.delta_events) {
+			/* Sequence the snapshot is consistent with, so delta remotes know which events it already covers.
+			   Without it they fall back to polling */
+			stream->write_function(stream, "S/%s/%u\n", switch_core_get_uuid(), globals.delta_seq);
+		}
 		for (hi = switch_hash_first(NULL, globals.limit_hash); hi; hi = switch_hash_next(hi)) {
 			void *val = NULL;
 			const void *key;
@@ -654,7 +858,27 @@ SWITCH_STANDARD_API(hash_dump_function)
 		}
 		switch_thread_rwlock_unlock(globals.db_hash_rwlock);
 	}
-	
+
+	if (mode & 8) {
+		uint32_t count = 0, sum = 0, seq = 0;
+		char checksum[32];
+
+		/* The checksum travels as a delta of its own so remotes compare it right after applying everything before it */
+		switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
+		if (globals.delta_events) {
+			limit_hash_checksum(globals.limit_hash, &count, &sum);
+			seq = ++globals.delta_seq;
+		}
+		switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
+
+		if (seq) {
+			switch_snprintf(checksum, sizeof(checksum), "%u/%u", count, sum);
+			limit_hash_delta_fire(seq, NULL, checksum);
+			stream->write_function(stream, "+OK %u\n", seq);
+		} else {
+			stream->write_function(stream, "-ERR delta-events is off\n");
+		}
+	}
 	
 	return SWITCH_STATUS_SUCCESS;
 }
@@ -676,7 +900,8 @@ SWITCH_STANDARD_API(hash_remote_function)
 	switch_split(dup, ' ', argv);
 	if (argv[0] && !strcmp(argv[0], "list")) {
 		switch_hash_index_t *hi;
-		stream->write_function(stream, "Remote connections:\nName\t\t\tState\n");
+		switch_time_t now = switch_micro_time_now();
+		stream->write_function(stream, "Remote connections:\nName\t\t\tState\tSync\tSeq\tLag(ms)\tMax(ms)\tDeltas\tGaps\tResyncs\n");
 		
 		switch_thread_rwlock_rdlock(globals.remote_hash_rwlock);
 		for (hi = switch_hash_first(NULL, globals.remote_hash); hi; hi = switch_hash_next(hi)) {
@@ -684,10 +909,19 @@ SWITCH_STANDARD_API(hash_remote_function)
 			const void *key;
 			switch_ssize_t keylen;
 			limit_remote_t *item;
+			uint32_t lag_ms;
 			switch_hash_this(hi, &key, &keylen, &val);
 								
 			item = (limit_remote_t *)val;
-			stream->write_function(stream, "%s\t\t\t%s\n", item->name, state_str(item->state));	
+			if (item->sync == LIMIT_SYNC_DELTA) {
+				lag_ms = item->lag_ms;
+			} else {
+				/* Polled data is as old as the last dump */
+				lag_ms = item->last_sync ? (uint32_t) ((now - item->last_sync) / 1000) : 0;
+			}
+			stream->write_function(stream, "%s\t\t\t%s\t%s\t%u\t%u\t%u\t%" SWITCH_UINT64_T_FMT "\t%" SWITCH_UINT64_T_FMT "\t%" SWITCH_UINT64_T_FMT "\n",
+								   item->name, state_str(item->state), sync_str(item->sync), item->delta_seq, lag_ms, item->max_lag_ms,
+								   item->deltas, item->gaps, item->resyncs);
 		}
 		switch_thread_rwlock_unlock(globals.remote_hash_rwlock);
 		stream->write_function(stream, "+OK\n");
@@ -832,6 +1066,360 @@ static limit_hash_item_t get_remote_usage(const char *key) {
 	return usage;
 }
 
+/* !\brief Parses a "L/key/usage/rate/interval/last_check" line, key points into the line */
+static switch_bool_t limit_remote_parse_line(limit_remote_t *remote, char *line, char **key, limit_hash_item_t *data)
+{
+	char *argv[5];
+	int argc = switch_split(line + 2, '/', argv);
+
+	if (argc < 5) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Protocol error: missing argument in line: %s\n", 
+			remote->name, line);
+		return SWITCH_FALSE;
+	}
+
+	memset(data, 0, sizeof(*data));
+	*key = argv[0];
+	data->total_usage = atoi(argv[1]);
+	data->rate_usage = atoi(argv[2]);
+	data->interval = atoi(argv[3]);
+	data->last_check = atoi(argv[4]);
+
+	return SWITCH_TRUE;
+}
+
+/* !\brief Stores parsed counters in the remote index, caller holds remote->rwlock for writing */
+static void limit_remote_store(limit_remote_t *remote, const char *key, limit_hash_item_t *data, uint32_t seq)
+{
+	limit_hash_item_t *item;
+
+	if (!(item = switch_core_hash_find(remote->index, key))) {
+		item = malloc(sizeof(*item));
+		switch_assert(item);
+		switch_core_hash_insert(remote->index, key, item);
+	}
+
+	*item = *data;
+	item->seq = seq;
+	item->last_update = remote->generation;
+}
+
+/* !\brief Stops delta mode, nothing reads the events anymore so stop receiving them too */
+static void limit_remote_poll_fallback(limit_remote_t *remote)
+{
+	remote->sync = LIMIT_SYNC_POLL;
+	esl_send_recv_timed(&remote->handle, "noevents", 5000);
+}
+
+/* !\brief Rebuilds the remote index from a full dump of the remote limit hash */
+static switch_status_t limit_remote_full_sync(limit_remote_t *remote)
+{
+	const char *cmd = remote->sync == LIMIT_SYNC_DELTA ? "api hash_dump limit_sync" : "api hash_dump limit";
+	char *data, *p, *p2;
+	uint32_t seq = 0;
+	switch_bool_t have_seq = SWITCH_FALSE;
+
+	if (esl_send_recv_timed(&remote->handle, cmd, 5000) != ESL_SUCCESS) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	data = strdup(switch_str_nil(remote->handle.last_sr_event->body));
+	switch_assert(data);
+
+	remote->generation++;
+
+	switch_thread_rwlock_wrlock(remote->rwlock);
+	for (p = data; p && *p; p = p2) {
+		/* We are getting the limit data as:
+			L/key/usage/rate/interval/last_checked 
+		   preceded in delta mode by:
+			S/node/seq
+		*/
+		if ((p2 = strchr(p, '\n'))) {
+			*p2++ = '\0';
+		}
+
+		/* Now p points at the beginning of the current line, 
+		p2 at the start of the next one */
+		if (*p == 'S') { /* Snapshot sequence */
+			char *argv[2];
+
+			if (switch_split(p + 2, '/', argv) == 2) {
+				switch_copy_string(remote->node_id, argv[0], sizeof(remote->node_id));
+				seq = (uint32_t) strtoul(argv[1], NULL, 10);
+				have_seq = SWITCH_TRUE;
+			}
+		} else if (*p == 'L') { /* Limit data */
+			char *key;
+			limit_hash_item_t item;
+
+			if (limit_remote_parse_line(remote, p, &key, &item)) {
+				limit_remote_store(remote, key, &item, seq);
+			}
+		}
+	}
+
+	/* Now free up anything that wasn't in this update since it means their usage is 0 */
+	switch_core_hash_delete_multi(remote->index, limit_hash_remote_cleanup_callback, (void*)(intptr_t)remote->generation);
+	switch_thread_rwlock_unlock(remote->rwlock);
+
+	free(data);
+
+	remote->last_sync = switch_micro_time_now();
+
+	if (remote->sync == LIMIT_SYNC_DELTA) {
+		if (!have_seq) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Remote does not support delta sync, falling back to polling\n", remote->name);
+			limit_remote_poll_fallback(remote);
+		} else {
+			remote->sync_seq = remote->delta_seq = seq;
+			remote->missing = 0;
+			remote->verify_seq = 0;
+			remote->next_verify = remote->last_sync + (switch_time_t) remote->checksum_interval * 1000;
+			remote->verify_skipped = 0;
+			remote->resyncs++;
+		}
+		remote->resync = SWITCH_FALSE;
+	}
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* !\brief The checksum asked for could not be compared, ask again or give up and resync */
+static void limit_remote_verify_skipped(limit_remote_t *remote, switch_time_t now)
+{
+	remote->verify_seq = 0;
+
+	if (++remote->verify_skipped >= LIMIT_REMOTE_MAX_VERIFY_SKIP) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "[%s] No checksum could be compared after %d tries, resyncing\n",
+			remote->name, remote->verify_skipped);
+		remote->resync = SWITCH_TRUE;
+	} else {
+		remote->next_verify = now;
+	}
+}
+
+/* !\brief Compares a checksum carried by delta seq against the index, schedules a full sync when they differ */
+static void limit_remote_check(limit_remote_t *remote, uint32_t seq, const char *checksum)
+{
+	char *data, *argv[2];
+	uint32_t count, sum, local_count, local_sum;
+	switch_time_t now = switch_micro_time_now();
+
+	if (seq != remote->delta_seq || remote->missing) {
+		/* A later delta is already applied or an earlier one is still missing, the index is not at seq */
+		if (remote->verify_seq && seq >= remote->verify_seq) {
+			limit_remote_verify_skipped(remote, now);
+		}
+		return;
+	}
+
+	data = strdup(checksum);
+	switch_assert(data);
+
+	if (switch_split(data, '/', argv) < 2) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Protocol error: malformed Delta-Checksum\n", remote->name);
+		free(data);
+		return;
+	}
+
+	count = (uint32_t) strtoul(argv[0], NULL, 10);
+	sum = (uint32_t) strtoul(argv[1], NULL, 10);
+	free(data);
+
+	remote->verify_seq = 0;
+	remote->verify_skipped = 0;
+	remote->next_verify = now + (switch_time_t) remote->checksum_interval * 1000;
+
+	switch_thread_rwlock_wrlock(remote->rwlock);
+	limit_hash_checksum(remote->index, &local_count, &local_sum);
+	if (local_count == count && local_sum == sum) {
+		/* Nothing at or below seq is missing, released entries are no longer needed to order late deltas */
+		switch_core_hash_delete_multi(remote->index, limit_hash_remote_prune_callback, NULL);
+		remote->sync_seq = seq;
+	}
+	switch_thread_rwlock_unlock(remote->rwlock);
+
+	if (local_count != count || local_sum != sum) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Checksum mismatch at sequence %u (%u entries, remote has %u), resyncing\n",
+			remote->name, seq, local_count, count);
+		remote->resync = SWITCH_TRUE;
+	} else {
+		remote->last_sync = now;
+	}
+}
+
+/* !\brief Applies a mod_hash::delta event received from the remote */
+static void limit_remote_apply_delta(limit_remote_t *remote, esl_event_t *event)
+{
+	const char *node = esl_event_get_header(event, "Delta-Node");
+	const char *sseq = esl_event_get_header(event, "Delta-Seq");
+	const char *sstamp = esl_event_get_header(event, "Delta-Stamp");
+	const char *checksum = esl_event_get_header(event, "Delta-Checksum");
+	switch_time_t now = switch_micro_time_now();
+	char *data, *p, *p2;
+	uint32_t seq;
+
+	if (zstr(node) || zstr(sseq) || (zstr(event->body) && zstr(checksum))) {
+		return;
+	}
+
+	if (strcmp(node, remote->node_id)) {
+		/* The remote restarted, its sequence numbers can't be compared to ours anymore */
+		remote->resync = SWITCH_TRUE;
+		return;
+	}
+
+	seq = (uint32_t) strtoul(sseq, NULL, 10);
+
+	if (seq <= remote->sync_seq) {
+		/* Already covered by the last full sync or verified checksum */
+		return;
+	}
+
+	if (seq > remote->delta_seq + 1) {
+		/* Lost or reordered, have a checksum settle it early unless one is on its way already */
+		remote->gaps++;
+		remote->missing += seq - remote->delta_seq - 1;
+		if (!remote->verify_seq) {
+			remote->next_verify = now;
+		}
+	} else if (seq < remote->delta_seq && remote->missing) {
+		/* A reordered one arriving late */
+		remote->missing--;
+	}
+
+	if (seq > remote->delta_seq) {
+		remote->delta_seq = seq;
+	}
+
+	if (!zstr(event->body)) {
+		data = strdup(event->body);
+		switch_assert(data);
+
+		switch_thread_rwlock_wrlock(remote->rwlock);
+		for (p = data; p && *p; p = p2) {
+			char *key;
+			limit_hash_item_t item_data, *item;
+
+			if ((p2 = strchr(p, '\n'))) {
+				*p2++ = '\0';
+			}
+
+			if (*p != 'L' || !limit_remote_parse_line(remote, p, &key, &item_data)) {
+				continue;
+			}
+
+			/* Events may be dispatched out of order, never let an older delta win */
+			if ((item = switch_core_hash_find(remote->index, key)) && item->seq > seq) {
+				continue;
+			}
+
+			limit_remote_store(remote, key, &item_data, seq);
+		}
+		switch_thread_rwlock_unlock(remote->rwlock);
+
+		free(data);
+	}
+
+	remote->deltas++;
+	remote->last_sync = now;
+
+	if (!zstr(sstamp)) {
+		switch_time_t stamp = (switch_time_t) strtoll(sstamp, NULL, 10);
+
+		remote->lag_ms = now > stamp ? (uint32_t) ((now - stamp) / 1000) : 0;
+		if (remote->lag_ms > remote->max_lag_ms) {
+			remote->max_lag_ms = remote->lag_ms;
+		}
+	}
+
+	if (!zstr(checksum)) {
+		limit_remote_check(remote, seq, checksum);
+	}
+}
+
+/* !\brief Asks the remote to put a checksum in its delta stream, limit_remote_check() compares it when it arrives */
+static switch_status_t limit_remote_verify(limit_remote_t *remote)
+{
+	const char *body;
+	switch_time_t now = switch_micro_time_now();
+
+	if (remote->verify_seq) {
+		/* The last one never arrived */
+		limit_remote_verify_skipped(remote, now);
+		if (remote->resync) {
+			return SWITCH_STATUS_SUCCESS;
+		}
+	}
+
+	if (esl_send_recv_timed(&remote->handle, "api hash_dump limit_checksum", 5000) != ESL_SUCCESS) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	body = remote->handle.last_sr_event->body;
+
+	if (zstr(body) || strncmp(body, "+OK ", 4)) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Remote does not send checksums (%s), falling back to polling\n",
+			remote->name, switch_str_nil(body));
+		limit_remote_poll_fallback(remote);
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	/* The checksum itself follows in the delta stream, give it one interval to get here */
+	remote->verify_seq = (uint32_t) strtoul(body + 4, NULL, 10);
+	remote->next_verify = now + (switch_time_t) remote->checksum_interval * 1000;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* !\brief One step of delta mode: resync if needed, apply a pending event, verify when due */
+static switch_status_t limit_remote_delta_run(limit_remote_t *remote)
+{
+	esl_status_t status;
+
+	if (remote->resync && limit_remote_full_sync(remote) != SWITCH_STATUS_SUCCESS) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	if (remote->sync != LIMIT_SYNC_DELTA) {
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	if ((status = esl_recv_event_timed(&remote->handle, LIMIT_REMOTE_RECV_TIMEOUT, 1, NULL)) == ESL_FAIL) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	if (status == ESL_SUCCESS && remote->handle.last_ievent) {
+		const char *subclass = esl_event_get_header(remote->handle.last_ievent, "Event-Subclass");
+
+		if (subclass && !strcmp(subclass, LIMIT_HASH_EVENT_DELTA)) {
+			limit_remote_apply_delta(remote, remote->handle.last_ievent);
+		}
+	}
+
+	if (!remote->resync && switch_micro_time_now() >= remote->next_verify) {
+		return limit_remote_verify(remote);
+	}
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+static void limit_remote_disconnect(limit_remote_t *remote)
+{
+	esl_disconnect(&remote->handle);
+	memset(&remote->handle, 0, sizeof(remote->handle));
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Disconnected from remote FreeSWITCH (%s) at %s:%d\n",
+		remote->name, remote->host, remote->port);
+	if (remote->state == REMOTE_UP) {
+		remote->state = REMOTE_DOWN;
+	}
+	/* Delete all remote tracking entries */
+	switch_thread_rwlock_wrlock(remote->rwlock);
+	switch_core_hash_delete_multi(remote->index, limit_hash_remote_cleanup_callback, NULL);
+	switch_thread_rwlock_unlock(remote->rwlock);
+}
+
 static void *SWITCH_THREAD_FUNC limit_remote_thread(switch_thread_t *thread, void *obj)
 {
 	limit_remote_t *remote = (limit_remote_t*)obj;
@@ -840,76 +1428,42 @@ static void *SWITCH_THREAD_FUNC limit_remote_thread(switch_thread_t *thread, voi
 			if  (esl_connect_timeout(&remote->handle, remote->host, remote->port, remote->username, remote->password, 5000) == ESL_SUCCESS) {
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Connected to remote FreeSWITCH (%s) at %s:%d\n",
 					remote->name, remote->host, remote->port);
-				
-				remote->state = REMOTE_UP;
+
+				if (remote->sync == LIMIT_SYNC_DELTA && esl_events(&remote->handle, ESL_EVENT_TYPE_PLAIN, "CUSTOM " LIMIT_HASH_EVENT_DELTA) != ESL_SUCCESS) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Cannot subscribe to delta events, falling back to polling\n", remote->name);
+					remote->sync = LIMIT_SYNC_POLL;
+				}
+
+				remote->resync = SWITCH_TRUE;
+				remote->max_lag_ms = 0;
+
+				if (remote->state == REMOTE_DOWN) {
+					remote->state = REMOTE_UP;
+				}
+
+				if (remote->sync == LIMIT_SYNC_DELTA) {
+					continue;
+				}
 			} else {
 				esl_disconnect(&remote->handle);
 				memset(&remote->handle, 0, sizeof(remote->handle));
 			}
-		} else {
-			if (esl_send_recv_timed(&remote->handle, "api hash_dump limit", 5000) != ESL_SUCCESS) {
-				esl_disconnect(&remote->handle);
-				memset(&remote->handle, 0, sizeof(remote->handle));
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Disconnected from remote FreeSWITCH (%s) at %s:%d\n",
-					remote->name, remote->host, remote->port);
-				memset(&remote->handle, 0, sizeof(remote->handle));
-				remote->state = REMOTE_DOWN;
-				/* Delete all remote tracking entries */
-				switch_thread_rwlock_wrlock(remote->rwlock);
-				switch_core_hash_delete_multi(remote->index, limit_hash_remote_cleanup_callback, NULL);
-				switch_thread_rwlock_unlock(remote->rwlock);
-			} else {
-				if (!zstr(remote->handle.last_sr_event->body)) {
-					char *data = strdup(remote->handle.last_sr_event->body);
-					char *p = data, *p2;
-					switch_time_t now = switch_epoch_time_now(NULL);
-					while (p && *p) {
-						/* We are getting the limit data as:
-							L/key/usage/rate/interval/last_checked 
-						*/
-						if ((p2 = strchr(p, '\n'))) {
-							*p2++ = '\0';
-						}
-						
-						/* Now p points at the beginning of the current line, 
-						p2 at the start of the next one */
-						if (*p == 'L') { /* Limit data */
-							char *argv[5]; 
-							int argc = switch_split(p+2, '/', argv);
-							
-							if (argc < 5) {
-								switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "[%s] Protocol error: missing argument in line: %s\n", 
-									remote->name, p);
-							} else {
-								limit_hash_item_t *item;
-								switch_thread_rwlock_wrlock(remote->rwlock);
-								if (!(item = switch_core_hash_find(remote->index, argv[0]))) {
-									item = malloc(sizeof(*item));
-									switch_core_hash_insert(remote->index, argv[0], item);
-								}
-								item->total_usage = atoi(argv[1]);
-								item->rate_usage = atoi(argv[2]);
-								item->interval = atoi(argv[3]);
-								item->last_check = atoi(argv[4]);
-								item->last_update = now;
-								switch_thread_rwlock_unlock(remote->rwlock);
-							}
-						}
-						
-						p = p2;
-					}
-					free(data);
-					
-					/* Now free up anything that wasn't in this update since it means their usage is 0 */
-					switch_thread_rwlock_wrlock(remote->rwlock);
-					switch_core_hash_delete_multi(remote->index, limit_hash_remote_cleanup_callback, (void*)(intptr_t)now);
-					switch_thread_rwlock_unlock(remote->rwlock);
-				}
+		} else if (remote->sync == LIMIT_SYNC_DELTA) {
+			/* Blocks for at most LIMIT_REMOTE_RECV_TIMEOUT waiting for deltas */
+			if (limit_remote_delta_run(remote) == SWITCH_STATUS_SUCCESS) {
+				continue;
 			}
+			limit_remote_disconnect(remote);
+		} else if (limit_remote_full_sync(remote) != SWITCH_STATUS_SUCCESS) {
+			limit_remote_disconnect(remote);
 		}
 		
 		switch_yield(remote->interval * 1000);
 	}
+
+	if (remote->handle.connected) {
+		esl_disconnect(&remote->handle);
+	}
 	
 	remote->thread = NULL;
 	
@@ -918,8 +1472,25 @@ static void *SWITCH_THREAD_FUNC limit_remote_thread(switch_thread_t *thread, voi
 
 static void do_config(switch_bool_t reload)
 {
-	switch_xml_t xml = NULL, x_lists = NULL, x_list = NULL, cfg = NULL;
+	switch_xml_t xml = NULL, x_lists = NULL, x_list = NULL, cfg = NULL, x_settings, x_param;
 	if ((xml = switch_xml_open_cfg("hash.conf", &cfg, NULL))) {
+		switch_bool_t delta_events = SWITCH_FALSE;
+
+		if ((x_settings = switch_xml_child(cfg, "settings"))) {
+			for (x_param = switch_xml_child(x_settings, "param"); x_param; x_param = x_param->next) {
+				const char *var = switch_xml_attr_soft(x_param, "name");
+				const char *val = switch_xml_attr_soft(x_param, "value");
+
+				if (!strcasecmp(var, "delta-events")) {
+					delta_events = switch_true(val);
+				}
+			}
+		}
+
+		switch_thread_rwlock_wrlock(globals.limit_hash_rwlock);
+		globals.delta_events = delta_events;
+		switch_thread_rwlock_unlock(globals.limit_hash_rwlock);
+
 		if ((x_lists = switch_xml_child(cfg, "remotes"))) {
 			for (x_list = switch_xml_child(x_lists, "remote"); x_list; x_list = x_list->next) {
 				const char *name = switch_xml_attr(x_list, "name");
@@ -928,6 +1499,8 @@ static void do_config(switch_bool_t reload)
 				const char *username = switch_xml_attr(x_list, "username");
 				const char *password = switch_xml_attr(x_list, "password");
 				const char *szinterval = switch_xml_attr(x_list, "interval");
+				const char *szsync = switch_xml_attr(x_list, "sync");
+				const char *szchecksum = switch_xml_attr(x_list, "checksum-interval");
 				uint16_t port = 0;
 				int	interval = 0;
 				limit_remote_t *remote;
@@ -950,7 +1523,18 @@ static void do_config(switch_bool_t reload)
 					interval = atoi(szinterval);
 				}
 				
-				remote = limit_remote_create(name, host, port, username, password, interval);
+				if (!(remote = limit_remote_create(name, host, port, username, password, interval))) {
+					continue;
+				}
+
+				if (!zstr(szsync) && !strcasecmp(szsync, "delta")) {
+					remote->sync = LIMIT_SYNC_DELTA;
+				}
+
+				remote->checksum_interval = LIMIT_REMOTE_CHECKSUM_INTERVAL;
+				if (!zstr(szchecksum) && atoi(szchecksum) > 0) {
+					remote->checksum_interval = atoi(szchecksum);
+				}
 				
 				remote->state = REMOTE_DOWN;	
 				
@@ -980,6 +1564,11 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_hash_load)
 		return SWITCH_STATUS_FALSE;
 	}
 
+	if (switch_event_reserve_subclass(LIMIT_HASH_EVENT_DELTA) != SWITCH_STATUS_SUCCESS) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register event subclass \"%s\"\n", LIMIT_HASH_EVENT_DELTA);
+		return SWITCH_STATUS_FALSE;
+	}
+
 	switch_thread_rwlock_create(&globals.limit_hash_rwlock, globals.pool);
 	switch_thread_rwlock_create(&globals.db_hash_rwlock, globals.pool);
 	switch_thread_rwlock_create(&globals.remote_hash_rwlock, globals.pool);
@@ -1023,6 +1612,8 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_hash_shutdown)
 	
 	switch_scheduler_del_task_group("mod_hash");
 
+	switch_event_free_subclass(LIMIT_HASH_EVENT_DELTA);
+
 	/* Kill remote connections, destroy needs a wrlock so we unlock after finding a pointer */
 	while(remote_clean) {
 		void *val;	
@@ -34,7 +34,7 @@
 #include <switch.h>
 
 #define LCR_SYNTAX "lcr <digits> [<lcr profile>] [caller_id] [intrastate] [as xml]"
-#define LCR_ADMIN_SYNTAX "lcr_admin show profiles"
+#define LCR_ADMIN_SYNTAX "lcr_admin show profiles|reload index [<lcr profile>]"
 
 #define LCR_HEADERS_COUNT 7
 
@@ -100,6 +100,75 @@ typedef lcr_obj_t *lcr_route;
 typedef struct max_obj max_obj_t;
 typedef max_obj_t *max_len;
 
+/* columns of the rate deck kept by the in-memory index */
+#define LCR_RATE_FIELDS 3
+#define LCR_RATE_INTERSTATE 0
+#define LCR_RATE_INTRASTATE 1
+#define LCR_RATE_INTRALATA 2
+
+#define LCR_ORDER_MAX 16
+
+typedef enum {
+	LCR_ORDER_RATE,
+	LCR_ORDER_QUALITY,
+	LCR_ORDER_RELIABILITY
+} lcr_order_t;
+
+/* one row of the default query, strings are interned in the index pool */
+struct lcr_index_route {
+	const char *digits;
+	size_t digits_len;
+	const char *carrier_name;
+	const char *rate_str[LCR_RATE_FIELDS];
+	double rate[LCR_RATE_FIELDS];
+	const char *gw_prefix;
+	const char *gw_suffix;
+	const char *lead_strip;
+	const char *trail_strip;
+	const char *prefix;
+	const char *suffix;
+	const char *codec;
+	const char *cid;
+	double quality;
+	double reliability;
+	switch_bool_t lrn;
+	uint32_t ordinal;
+};
+typedef struct lcr_index_route lcr_index_route_t;
+
+/* path compressed digit trie, each node owns the rows whose digits end there */
+struct lcr_trie_node {
+	const char *label;
+	size_t label_len;
+	lcr_index_route_t **routes;
+	uint32_t route_count;
+	uint32_t child_count;
+	struct lcr_trie_node *children;
+};
+typedef struct lcr_trie_node lcr_trie_node_t;
+
+struct lcr_npanxx {
+	const char *state;
+	const char *lata;
+	switch_bool_t state_multi;
+	switch_bool_t lata_multi;
+};
+typedef struct lcr_npanxx lcr_npanxx_t;
+
+struct lcr_index {
+	switch_memory_pool_t *pool;
+	lcr_trie_node_t root;
+	lcr_index_route_t **rows;
+	uint32_t row_count;
+	uint32_t node_count;
+	switch_hash_t *npanxx;
+	uint32_t npanxx_count;
+	switch_time_t built;
+	switch_time_t build_time;
+	volatile switch_atomic_t refs;
+};
+typedef struct lcr_index lcr_index_t;
+
 struct profile_obj {
 	char *name;
 	uint16_t id;
@@ -120,6 +189,12 @@ struct profile_obj {
 	switch_bool_t single_bridge;
 	switch_bool_t info_in_headers;
 	switch_bool_t enable_sip_redir;
+
+	switch_bool_t memory_index;
+	uint32_t memory_index_refresh;
+	lcr_order_t order[LCR_ORDER_MAX];
+	int order_cnt;
+	lcr_index_t *index;
 };
 typedef struct profile_obj profile_t;
 
@@ -145,6 +220,7 @@ static struct {
 	char *dbname;
 	char *odbc_dsn;
 	switch_mutex_t *mutex;
+	switch_mutex_t *index_mutex;
 	switch_hash_t *profile_hash;
 	profile_t *default_profile;
 	void *filler1;
@@ -834,10 +910,8 @@ static int intrastatelata_callback(void *pArg, int argc, char **argv, char **col
 	return SWITCH_STATUS_SUCCESS;
 }
 
-static switch_status_t is_intrastatelata(callback_t *cb_struct)
+static switch_bool_t is_nanp_pair(callback_t *cb_struct)
 {
-	char *sql = NULL;
-	
 	/* extract npa nxx - make some assumptions about format:
 	   e164 format without the +
 	   NANP only (so 11 digits starting with 1)
@@ -847,12 +921,23 @@ static switch_status_t is_intrastatelata(callback_t *cb_struct)
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(cb_struct->session), SWITCH_LOG_DEBUG, 
 						  "%s doesn't appear to be a NANP number\n", cb_struct->lookup_number);
 		/* dest doesn't appear to be NANP number */
-		return SWITCH_STATUS_GENERR;
+		return SWITCH_FALSE;
 	}
 	if (!cb_struct->cid || strlen(cb_struct->cid) != 11 || *cb_struct->cid != '1' || !switch_is_number(cb_struct->cid)) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(cb_struct->session), SWITCH_LOG_DEBUG, 
 						  "%s doesn't appear to be a NANP number\n", cb_struct->cid);
 		/* cid not NANP */
+		return SWITCH_FALSE;
+	}
+
+	return SWITCH_TRUE;
+}
+
+static switch_status_t is_intrastatelata(callback_t *cb_struct)
+{
+	char *sql = NULL;
+
+	if (!is_nanp_pair(cb_struct)) {
 		return SWITCH_STATUS_GENERR;
 	}
 	
@@ -880,6 +965,534 @@ static switch_status_t is_intrastatelata(callback_t *cb_struct)
 	
 }
 
+/* IN-MEMORY INDEX */
+
+/* digits the SQL path would match with IN (...) are at most this long */
+#define LCR_INDEX_MAX_DEPTH 64
+#define LCR_INDEX_COLUMNS 16
+
+struct lcr_index_builder {
+	lcr_index_t *index;
+	switch_hash_t *strings;
+	uint32_t size;
+};
+typedef struct lcr_index_builder lcr_index_builder_t;
+
+struct lcr_index_candidate {
+	lcr_index_route_t *row;
+	profile_t *profile;
+	int rate_field;
+	uint32_t rnd;
+};
+typedef struct lcr_index_candidate lcr_index_candidate_t;
+
+/* carriers, gateways and rates repeat across millions of rows, keep one copy of each */
+static const char *lcr_index_intern(lcr_index_builder_t *builder, const char *str)
+{
+	char *interned;
+
+	if (!str) {
+		return NULL;
+	}
+
+	if (!(interned = switch_core_hash_find(builder->strings, str))) {
+		interned = switch_core_strdup(builder->index->pool, str);
+		switch_core_hash_insert(builder->strings, interned, interned);
+	}
+
+	return interned;
+}
+
+static int lcr_index_load_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	lcr_index_builder_t *builder = (lcr_index_builder_t *) pArg;
+	lcr_index_t *index = builder->index;
+	lcr_index_route_t *row;
+	int i;
+
+	if (argc < LCR_INDEX_COLUMNS || zstr(argv[0])) {
+		return 0;
+	}
+
+	if (index->row_count == builder->size) {
+		lcr_index_route_t **rows;
+
+		builder->size = builder->size ? builder->size * 2 : 1024;
+		if (!(rows = realloc(index->rows, builder->size * sizeof(*rows)))) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Memory Error!\n");
+			return -1;
+		}
+		index->rows = rows;
+	}
+
+	row = switch_core_alloc(index->pool, sizeof(*row));
+	row->digits = switch_core_strdup(index->pool, argv[0]);
+	row->digits_len = strlen(row->digits);
+	row->carrier_name = lcr_index_intern(builder, argv[1]);
+	for (i = 0; i < LCR_RATE_FIELDS; i++) {
+		row->rate_str[i] = lcr_index_intern(builder, argv[2 + i]);
+		row->rate[i] = argv[2 + i] ? atof(argv[2 + i]) : 0;
+	}
+	row->gw_prefix = lcr_index_intern(builder, argv[5]);
+	row->gw_suffix = lcr_index_intern(builder, argv[6]);
+	row->lead_strip = lcr_index_intern(builder, argv[7]);
+	row->trail_strip = lcr_index_intern(builder, argv[8]);
+	row->prefix = lcr_index_intern(builder, argv[9]);
+	row->suffix = lcr_index_intern(builder, argv[10]);
+	row->codec = lcr_index_intern(builder, argv[11]);
+	row->cid = lcr_index_intern(builder, argv[12]);
+	row->lrn = switch_true(argv[13]) ? SWITCH_TRUE : SWITCH_FALSE;
+	row->quality = argv[14] ? atof(argv[14]) : 0;
+	row->reliability = argv[15] ? atof(argv[15]) : 0;
+	row->ordinal = index->row_count;
+
+	index->rows[index->row_count++] = row;
+
+	return 0;
+}
+
+/* count(DISTINCT ...) ignores NULL, remember when an npa-nxx maps to more than one value */
+static void lcr_index_npanxx_merge(const char **value, switch_bool_t *multi, const char *add)
+{
+	if (!add) {
+		return;
+	}
+
+	if (!*value) {
+		*value = add;
+	} else if (strcmp(*value, add)) {
+		*multi = SWITCH_TRUE;
+	}
+}
+
+static int lcr_index_npanxx_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	lcr_index_builder_t *builder = (lcr_index_builder_t *) pArg;
+	lcr_index_t *index = builder->index;
+	lcr_npanxx_t *npanxx;
+	char key[16];
+
+	if (argc < 4 || zstr(argv[0]) || zstr(argv[1])) {
+		return 0;
+	}
+
+	switch_snprintf(key, sizeof(key), "%03d%03d", atoi(argv[0]), atoi(argv[1]));
+
+	if (!(npanxx = switch_core_hash_find(index->npanxx, key))) {
+		npanxx = switch_core_alloc(index->pool, sizeof(*npanxx));
+		switch_core_hash_insert(index->npanxx, key, npanxx);
+		index->npanxx_count++;
+	}
+
+	lcr_index_npanxx_merge(&npanxx->state, &npanxx->state_multi, lcr_index_intern(builder, argv[2]));
+	lcr_index_npanxx_merge(&npanxx->lata, &npanxx->lata_multi, lcr_index_intern(builder, argv[3]));
+
+	return 0;
+}
+
+/* same answer as SELECT count(DISTINCT x) over the rows of both npa-nxx */
+static int lcr_index_count_distinct(const char *a, switch_bool_t a_multi, const char *b, switch_bool_t b_multi)
+{
+	if (a_multi || b_multi) {
+		return 2;
+	}
+
+	if (a && b) {
+		return strcmp(a, b) ? 2 : 1;
+	}
+
+	return (a || b) ? 1 : 0;
+}
+
+static void lcr_index_intrastatelata(lcr_index_t *index, callback_t *cb_struct)
+{
+	lcr_npanxx_t *dst, *src;
+	char key[7];
+	int count;
+
+	if (!is_nanp_pair(cb_struct)) {
+		return;
+	}
+
+	switch_copy_string(key, cb_struct->lookup_number + 1, sizeof(key));
+	dst = switch_core_hash_find(index->npanxx, key);
+	switch_copy_string(key, cb_struct->cid + 1, sizeof(key));
+	src = switch_core_hash_find(index->npanxx, key);
+
+	count = lcr_index_count_distinct(dst ? dst->state : NULL, dst && dst->state_multi, src ? src->state : NULL, src && src->state_multi);
+	if (count == 1) {
+		cb_struct->intrastate = SWITCH_TRUE;
+	}
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Type: state, Count: %d\n", count);
+
+	count = lcr_index_count_distinct(dst ? dst->lata : NULL, dst && dst->lata_multi, src ? src->lata : NULL, src && src->lata_multi);
+	if (count == 1) {
+		cb_struct->intralata = SWITCH_TRUE;
+	}
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Type: lata, Count: %d\n", count);
+}
+
+static int lcr_index_row_cmp(const void *a, const void *b)
+{
+	const lcr_index_route_t *ra = *(const lcr_index_route_t **) a;
+	const lcr_index_route_t *rb = *(const lcr_index_route_t **) b;
+	int r;
+
+	if ((r = strcmp(ra->digits, rb->digits))) {
+		return r;
+	}
+
+	return ra->ordinal < rb->ordinal ? -1 : ra->ordinal > rb->ordinal;
+}
+
+/* rows are sorted by digits, so every subtree is a contiguous slice of them */
+static void lcr_trie_build(lcr_index_t *index, lcr_trie_node_t *node, lcr_index_route_t **rows, uint32_t count, size_t depth)
+{
+	uint32_t i = 0, start, end, n = 0;
+
+	/* rows ending here sort before the longer ones sharing the prefix */
+	while (i < count && rows[i]->digits_len == depth) {
+		i++;
+	}
+	node->routes = rows;
+	node->route_count = i;
+
+	for (start = i; start < count; start = end) {
+		for (end = start + 1; end < count && rows[end]->digits[depth] == rows[start]->digits[depth]; end++);
+		n++;
+	}
+
+	if (!n) {
+		return;
+	}
+
+	node->children = switch_core_alloc(index->pool, n * sizeof(lcr_trie_node_t));
+	node->child_count = n;
+
+	for (start = i, n = 0; start < count; start = end) {
+		lcr_trie_node_t *child = &node->children[n++];
+		const char *first = rows[start]->digits, *last;
+		size_t lcp = depth;
+
+		for (end = start + 1; end < count && rows[end]->digits[depth] == first[depth]; end++);
+
+		/* the label runs to where the first and last rows of the slice part */
+		last = rows[end - 1]->digits;
+		while (first[lcp] && first[lcp] == last[lcp]) {
+			lcp++;
+		}
+
+		child->label = first + depth;
+		child->label_len = lcp - depth;
+		index->node_count++;
+
+		lcr_trie_build(index, child, rows + start, end - start, lcp);
+	}
+}
+
+/* nodes along the path of digits, shortest prefix first */
+static int lcr_trie_path(lcr_trie_node_t *root, const char *digits, lcr_trie_node_t **path, int max)
+{
+	lcr_trie_node_t *node = root;
+	const char *p = digits;
+	int n = 0;
+
+	path[n++] = root;
+
+	while (*p && n < max) {
+		lcr_trie_node_t *next = NULL;
+		uint32_t i;
+
+		for (i = 0; i < node->child_count; i++) {
+			if (node->children[i].label[0] == *p) {
+				next = &node->children[i];
+				break;
+			}
+		}
+
+		if (!next || strncmp(next->label, p, next->label_len)) {
+			break;
+		}
+
+		path[n++] = next;
+		p += next->label_len;
+		node = next;
+	}
+
+	return n;
+}
+
+/* ORDER BY digits DESC, <order_by>, random() of the default query */
+static int lcr_index_candidate_cmp(const void *a, const void *b)
+{
+	const lcr_index_candidate_t *ca = (const lcr_index_candidate_t *) a;
+	const lcr_index_candidate_t *cb = (const lcr_index_candidate_t *) b;
+	int i, r;
+
+	if ((r = strcmp(cb->row->digits, ca->row->digits))) {
+		return r;
+	}
+
+	for (i = 0; i < ca->profile->order_cnt; i++) {
+		double x = 0, y = 0;
+		int dir = 1;
+
+		switch (ca->profile->order[i]) {
+		case LCR_ORDER_RATE:
+			x = ca->row->rate[ca->rate_field];
+			y = cb->row->rate[cb->rate_field];
+			break;
+		case LCR_ORDER_QUALITY:
+			x = ca->row->quality;
+			y = cb->row->quality;
+			dir = -1;
+			break;
+		case LCR_ORDER_RELIABILITY:
+			x = ca->row->reliability;
+			y = cb->row->reliability;
+			dir = -1;
+			break;
+		}
+
+		if (x != y) {
+			return x < y ? -dir : dir;
+		}
+	}
+
+	if (ca->rnd != cb->rnd) {
+		return ca->rnd < cb->rnd ? -1 : 1;
+	}
+
+	return ca->row->ordinal < cb->row->ordinal ? -1 : ca->row->ordinal > cb->row->ordinal;
+}
+
+static switch_bool_t lcr_index_lookup(lcr_index_t *index, callback_t *cb_struct, const char *digits, const char *lrn_digits, int rate_field)
+{
+	static char *columns[] = { "lcr_digits", "lcr_carrier_name", "lcr_rate_field", "lcr_gw_prefix", "lcr_gw_suffix",
+							   "lcr_lead_strip", "lcr_trail_strip", "lcr_prefix", "lcr_suffix", "lcr_codec", "lcr_cid" };
+	lcr_trie_node_t *path[LCR_INDEX_MAX_DEPTH], *lrn_path[LCR_INDEX_MAX_DEPTH];
+	lcr_index_candidate_t *candidates;
+	int depth, lrn_depth, i;
+	uint32_t j, total = 0, count = 0;
+
+	depth = lcr_trie_path(&index->root, digits, path, LCR_INDEX_MAX_DEPTH);
+	lrn_depth = lcr_trie_path(&index->root, lrn_digits, lrn_path, LCR_INDEX_MAX_DEPTH);
+
+	for (i = 0; i < depth; i++) {
+		total += path[i]->route_count;
+	}
+	for (i = 0; i < lrn_depth; i++) {
+		total += lrn_path[i]->route_count;
+	}
+
+	if (!total) {
+		return SWITCH_TRUE;
+	}
+
+	candidates = switch_core_alloc(cb_struct->pool, total * sizeof(*candidates));
+
+	/* (digits IN (expanded digits) AND lrn = false) OR (digits IN (expanded lrn digits) AND lrn = true) */
+	for (i = 0; i < depth + lrn_depth; i++) {
+		lcr_trie_node_t *node = i < depth ? path[i] : lrn_path[i - depth];
+		switch_bool_t lrn = i < depth ? SWITCH_FALSE : SWITCH_TRUE;
+
+		for (j = 0; j < node->route_count; j++) {
+			if (node->routes[j]->lrn != lrn) {
+				continue;
+			}
+			candidates[count].row = node->routes[j];
+			candidates[count].profile = cb_struct->profile;
+			candidates[count].rate_field = rate_field;
+			candidates[count].rnd = db_random ? (uint32_t) rand() : 0;
+			count++;
+		}
+	}
+
+	qsort(candidates, count, sizeof(*candidates), lcr_index_candidate_cmp);
+
+	/* feed the rows through the same callback as the query so dedup, max_rate and dialstrings match */
+	for (j = 0; j < count; j++) {
+		lcr_index_route_t *row = candidates[j].row;
+		char *argv[11];
+
+		argv[0] = (char *) row->digits;
+		argv[1] = (char *) row->carrier_name;
+		argv[2] = (char *) row->rate_str[rate_field];
+		argv[3] = (char *) row->gw_prefix;
+		argv[4] = (char *) row->gw_suffix;
+		argv[5] = (char *) row->lead_strip;
+		argv[6] = (char *) row->trail_strip;
+		argv[7] = (char *) row->prefix;
+		argv[8] = (char *) row->suffix;
+		argv[9] = (char *) row->codec;
+		argv[10] = (char *) row->cid;
+
+		if (route_add_callback(cb_struct, 11, argv, columns)) {
+			return SWITCH_FALSE;
+		}
+	}
+
+	return SWITCH_TRUE;
+}
+
+static void lcr_index_destroy(lcr_index_t **index)
+{
+	switch_memory_pool_t *pool;
+
+	if (!index || !*index) {
+		return;
+	}
+
+	if ((*index)->npanxx) {
+		switch_core_hash_destroy(&(*index)->npanxx);
+	}
+	switch_safe_free((*index)->rows);
+
+	pool = (*index)->pool;
+	*index = NULL;
+	switch_core_destroy_memory_pool(&pool);
+}
+
+static lcr_index_t *lcr_index_create(profile_t *profile)
+{
+	lcr_index_builder_t builder = { 0 };
+	switch_stream_handle_t sql_stream = { 0 };
+	switch_memory_pool_t *pool = NULL;
+	lcr_index_t *index;
+	switch_time_t start = switch_micro_time_now();
+
+	if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+		return NULL;
+	}
+
+	index = switch_core_alloc(pool, sizeof(*index));
+	index->pool = pool;
+	builder.index = index;
+	switch_core_hash_init(&builder.strings, NULL);
+
+	/* the default query without the digits, CURRENT_TIMESTAMP is evaluated at build time */
+	SWITCH_STANDARD_STREAM(sql_stream);
+	sql_stream.write_function(&sql_stream, "SELECT l.digits, c.carrier_name, l.rate, %s, %s, cg.prefix, cg.suffix, l.lead_strip, l.trail_strip, "
+							  "l.prefix, l.suffix, cg.codec, l.cid, l.lrn, l.quality, l.reliability "
+							  "FROM lcr l JOIN carriers c ON l.carrier_id=c.id JOIN carrier_gateway cg ON c.id=cg.carrier_id "
+							  "WHERE c.enabled = '1' AND cg.enabled = '1' AND l.enabled = '1' AND CURRENT_TIMESTAMP BETWEEN date_start AND date_end",
+							  profile->profile_has_intrastate ? "l.intrastate_rate" : "NULL",
+							  profile->profile_has_intralata ? "l.intralata_rate" : "NULL");
+	if (profile->id > 0) {
+		sql_stream.write_function(&sql_stream, " AND lcr_profile=%d", profile->id);
+	}
+	sql_stream.write_function(&sql_stream, ";");
+
+	if (!lcr_execute_sql_callback((char *) sql_stream.data, lcr_index_load_callback, &builder)) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to load the rate deck of profile %s into memory\n", profile->name);
+		goto fail;
+	}
+
+	if (profile->profile_has_npanxx) {
+		switch_core_hash_init(&index->npanxx, NULL);
+		if (!lcr_execute_sql_callback("SELECT npa, nxx, state, lata FROM npa_nxx_company_ocn;", lcr_index_npanxx_callback, &builder)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unable to load npa_nxx_company_ocn into memory, intrastate detection stays in SQL\n");
+			switch_core_hash_destroy(&index->npanxx);
+		}
+	}
+
+	switch_core_hash_destroy(&builder.strings);
+	switch_safe_free(sql_stream.data);
+
+	if (index->row_count) {
+		qsort(index->rows, index->row_count, sizeof(*index->rows), lcr_index_row_cmp);
+		lcr_trie_build(index, &index->root, index->rows, index->row_count, 0);
+	}
+
+	switch_atomic_set(&index->refs, 1);
+	index->built = switch_micro_time_now();
+	index->build_time = index->built - start;
+
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Indexed %u routes in %u trie nodes and %u npa-nxx for profile %s in %" SWITCH_TIME_T_FMT "ms\n",
+					  index->row_count, index->node_count, index->npanxx_count, profile->name, index->build_time / 1000);
+
+	return index;
+
+  fail:
+	switch_core_hash_destroy(&builder.strings);
+	switch_safe_free(sql_stream.data);
+	lcr_index_destroy(&index);
+	return NULL;
+}
+
+/* readers take a reference and walk the trie without holding any lock */
+static lcr_index_t *lcr_index_acquire(profile_t *profile)
+{
+	lcr_index_t *index;
+
+	switch_mutex_lock(globals.index_mutex);
+	if ((index = profile->index)) {
+		switch_atomic_inc(&index->refs);
+	}
+	switch_mutex_unlock(globals.index_mutex);
+
+	return index;
+}
+
+static void lcr_index_release(lcr_index_t *index)
+{
+	if (index && !switch_atomic_dec(&index->refs)) {
+		lcr_index_destroy(&index);
+	}
+}
+
+/* build a fresh index and swap it in, lookups in flight keep the old one until they release it */
+static switch_status_t lcr_index_rebuild(profile_t *profile)
+{
+	lcr_index_t *index, *old;
+
+	switch_mutex_lock(globals.mutex);
+	index = lcr_index_create(profile);
+	switch_mutex_unlock(globals.mutex);
+
+	if (!index) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	switch_mutex_lock(globals.index_mutex);
+	old = profile->index;
+	profile->index = index;
+	switch_mutex_unlock(globals.index_mutex);
+
+	lcr_index_release(old);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_STANDARD_SCHED_FUNC(lcr_index_refresh_callback)
+{
+	profile_t *profile = (profile_t *) task->cmd_arg;
+
+	if (!profile->memory_index) {
+		/* the profile was dropped after scheduling, an unchanged runtime makes the scheduler remove the task */
+		return;
+	}
+
+	lcr_index_rebuild(profile);
+
+	task->runtime = switch_epoch_time_now(NULL) + profile->memory_index_refresh;
+}
+
+/* mirror of the ORDER BY built for the default query, -1 marks a column the index can't sort by */
+static void lcr_order_add(lcr_order_t *order, int *order_cnt, int key)
+{
+	if (*order_cnt < 0) {
+		return;
+	}
+
+	if (key < 0 || *order_cnt == LCR_ORDER_MAX) {
+		*order_cnt = -1;
+		return;
+	}
+
+	order[(*order_cnt)++] = (lcr_order_t) key;
+}
+
 static switch_status_t lcr_do_lookup(callback_t *cb_struct)
 {
 	switch_stream_handle_t sql_stream = { 0 };
@@ -894,6 +1507,8 @@ static switch_status_t lcr_do_lookup(callback_t *cb_struct)
 	char *safe_sql = NULL;
 	char *rate_field = NULL;
 	char *user_rate_field = NULL;
+	int rate_idx = LCR_RATE_INTERSTATE;
+	lcr_index_t *index = NULL;
 	
 	switch_assert(cb_struct->lookup_number != NULL);
 
@@ -907,6 +1522,10 @@ static switch_status_t lcr_do_lookup(callback_t *cb_struct)
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(cb_struct->session), SWITCH_LOG_ERROR, "Error initializing the dedup hash\n");
 		return SWITCH_STATUS_GENERR;
 	}
+
+	if (profile->memory_index) {
+		index = lcr_index_acquire(profile);
+	}
 	
 	digits_expanded = expand_digits(cb_struct->pool, digits_copy, cb_struct->profile->quote_in_list);
 	if (cb_struct->lrn_number) {
@@ -917,16 +1536,22 @@ static switch_status_t lcr_do_lookup(callback_t *cb_struct)
 	
 	switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(cb_struct->session), SWITCH_LOG_DEBUG, "Has NPA NXX: [%u == %u]\n", profile->profile_has_npanxx, SWITCH_TRUE);
 	if (profile->profile_has_npanxx == SWITCH_TRUE) {
-		is_intrastatelata(cb_struct);
+		if (index && index->npanxx) {
+			lcr_index_intrastatelata(index, cb_struct);
+		} else {
+			is_intrastatelata(cb_struct);
+		}
 	}
 	
 	/* set our rate field based on env and profile */
 	if (cb_struct->intralata == SWITCH_TRUE && profile->profile_has_intralata == SWITCH_TRUE) {
 		rate_field = switch_core_strdup(cb_struct->pool, "intralata_rate");
 		user_rate_field = switch_core_strdup(cb_struct->pool, "user_intralata_rate");
+		rate_idx = LCR_RATE_INTRALATA;
 	} else if (cb_struct->intrastate == SWITCH_TRUE && profile->profile_has_intrastate == SWITCH_TRUE) {
 		rate_field = switch_core_strdup(cb_struct->pool, "intrastate_rate");
 		user_rate_field = switch_core_strdup(cb_struct->pool, "user_intrastate_rate");
+		rate_idx = LCR_RATE_INTRASTATE;
 	} else {
 		rate_field = switch_core_strdup(cb_struct->pool, "rate");
 		user_rate_field = switch_core_strdup(cb_struct->pool, "user_rate");
@@ -968,6 +1593,14 @@ static switch_status_t lcr_do_lookup(callback_t *cb_struct)
 		}
 	}
 
+	if (index) {
+		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(cb_struct->session), SWITCH_LOG_DEBUG, "Using the in-memory index of profile %s\n", profile->name);
+		lookup_status = lcr_index_lookup(index, cb_struct, digits_copy, cb_struct->lrn_number ? cb_struct->lrn_number : digits_copy, rate_idx);
+		lcr_index_release(index);
+		switch_core_hash_destroy(&cb_struct->dedup_hash);
+		return lookup_status ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_GENERR;
+	}
+
 	/* set up the query to be executed */
 	/* format the custom_sql */
 	safe_sql = format_custom_sql(profile->custom_sql, cb_struct, digits_copy);
@@ -1082,6 +1715,10 @@ static switch_status_t lcr_load_config()
 			char *custom_sql = NULL;
 			char *export_fields = NULL;
 			char *limit_type = NULL;
+			char *memory_index = NULL;
+			char *memory_index_refresh = NULL;
+			lcr_order_t order[LCR_ORDER_MAX];
+			int order_cnt = 0;
 			int argc, x = 0;
 			char *argv[32] = { 0 };
 			
@@ -1102,12 +1739,16 @@ static switch_status_t lcr_load_config()
 							if (!zstr(argv[x])) {
 								if (!strcasecmp(argv[x], "quality")) {
 									thisorder->write_function(thisorder, "%s quality DESC", comma);
+									lcr_order_add(order, &order_cnt, LCR_ORDER_QUALITY);
 								} else if (!strcasecmp(argv[x], "reliability")) {
 									thisorder->write_function(thisorder, "%s reliability DESC", comma);
+									lcr_order_add(order, &order_cnt, LCR_ORDER_RELIABILITY);
 								} else if (!strcasecmp(argv[x], "rate")) {
 									thisorder->write_function(thisorder, "%s ${lcr_rate_field}", comma);
+									lcr_order_add(order, &order_cnt, LCR_ORDER_RATE);
 								} else {
 									thisorder->write_function(thisorder, "%s %s", comma, argv[x]);
+									lcr_order_add(order, &order_cnt, -1);
 								}
 							} else {
 								switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "arg #%d is empty\n", x);
@@ -1116,10 +1757,13 @@ static switch_status_t lcr_load_config()
 					} else {
 						if (!strcasecmp(val, "quality")) {
 							thisorder->write_function(thisorder, "%s quality DESC", comma);
+							lcr_order_add(order, &order_cnt, LCR_ORDER_QUALITY);
 						} else if (!strcasecmp(val, "reliability")) {
 							thisorder->write_function(thisorder, "%s reliability DESC", comma);
+							lcr_order_add(order, &order_cnt, LCR_ORDER_RELIABILITY);
 						} else {
 							thisorder->write_function(thisorder, "%s %s", comma, val);
+							lcr_order_add(order, &order_cnt, -1);
 						}
 					}
 				} else if (!strcasecmp(var, "id") && !zstr(val)) {
@@ -1141,6 +1785,10 @@ static switch_status_t lcr_load_config()
 					limit_type = val;
 				} else if (!strcasecmp(var, "enable_sip_redir") && !zstr(val)) {
 					enable_sip_redir = val;
+				} else if (!strcasecmp(var, "memory_index") && !zstr(val)) {
+					memory_index = val;
+				} else if (!strcasecmp(var, "memory_index_refresh") && !zstr(val)) {
+					memory_index_refresh = val;
 				}
 			}
 			
@@ -1156,6 +1804,23 @@ static switch_status_t lcr_load_config()
 				} else {
 					/* default to rate */
 					profile->order_by = ", ${lcr_rate_field}";
+					order_cnt = 0;
+					lcr_order_add(order, &order_cnt, LCR_ORDER_RATE);
+				}
+
+				if (!zstr(memory_index) && switch_true(memory_index)) {
+					if (!zstr(custom_sql)) {
+						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "memory_index only works with the default query, ignoring it for profile %s\n", name);
+					} else if (order_cnt < 0) {
+						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "memory_index can only order by rate, quality and reliability, ignoring it for profile %s\n", name);
+					} else {
+						profile->memory_index = SWITCH_TRUE;
+						memcpy(profile->order, order, sizeof(order));
+						profile->order_cnt = order_cnt;
+						if (!zstr(memory_index_refresh) && atoi(memory_index_refresh) > 0) {
+							profile->memory_index_refresh = atoi(memory_index_refresh);
+						}
+					}
 				}
 
 				if (!zstr(id_s)) {
@@ -1295,6 +1960,11 @@ static switch_status_t lcr_load_config()
 					profile->limit_type = "db";
 				}
 				
+				if (profile->memory_index) {
+					/* on failure lookups fall back to SQL until a reload succeeds */
+					lcr_index_rebuild(profile);
+				}
+
 				switch_core_hash_insert(globals.profile_hash, profile->name, profile);
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Loaded lcr profile %s.\n", profile->name);
 				/* test the profile */
@@ -1312,6 +1982,17 @@ static switch_status_t lcr_load_config()
 				} else {
 					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Removing INVALID Profile %s.\n", profile->name);
 					switch_core_hash_delete(globals.profile_hash, profile->name);
+					if (profile->memory_index) {
+						profile->memory_index = SWITCH_FALSE;
+						lcr_index_release(profile->index);
+						profile->index = NULL;
+					}
+				}
+
+				/* only profiles that survived the test get refreshed */
+				if (profile->memory_index && profile->memory_index_refresh) {
+					switch_scheduler_add_task(switch_epoch_time_now(NULL) + profile->memory_index_refresh, lcr_index_refresh_callback,
+											  "lcr_index_refresh", "mod_lcr", 0, profile, SSHF_OWN_THREAD);
 				}
 				
 			}
@@ -2058,8 +2739,41 @@ SWITCH_STANDARD_API(dialplan_lcr_admin_function)
 				stream->write_function(stream, " Sip Redirection Mode:\t%s\n", profile->enable_sip_redir ? "enabled" : "disabled");
 				stream->write_function(stream, " Import fields:\t%s\n", profile->export_fields_str ? profile->export_fields_str : "(null)");
 				stream->write_function(stream, " Limit type:\t%s\n", profile->limit_type);
+				if (profile->memory_index) {
+					lcr_index_t *index = lcr_index_acquire(profile);
+
+					if (index) {
+						stream->write_function(stream, " Memory index:\t%u routes, %u nodes, %u npa-nxx, built in %" SWITCH_TIME_T_FMT "ms\n",
+											   index->row_count, index->node_count, index->npanxx_count, index->build_time / 1000);
+						lcr_index_release(index);
+					} else {
+						stream->write_function(stream, " Memory index:\tnot loaded, using SQL\n");
+					}
+				}
 				stream->write_function(stream, "\n");
 			}
+		} else if (!strcasecmp(argv[0], "reload") && !strcasecmp(argv[1], "index")) {
+			int count = 0;
+
+			for (hi = switch_hash_first(NULL, globals.profile_hash); hi; hi = switch_hash_next(hi)) {
+				switch_hash_this(hi, NULL, NULL, &val);
+				profile = (profile_t *) val;
+
+				if (!profile->memory_index || (argc > 2 && strcasecmp(argv[2], profile->name))) {
+					continue;
+				}
+
+				count++;
+				if (lcr_index_rebuild(profile) == SWITCH_STATUS_SUCCESS) {
+					stream->write_function(stream, "+OK %s\n", profile->name);
+				} else {
+					stream->write_function(stream, "-ERR %s, keeping the previous index\n", profile->name);
+				}
+			}
+
+			if (!count) {
+				stream->write_function(stream, "-ERR No profile with memory_index\n");
+			}
 		} else {
 			goto usage;
 		}
@@ -2087,6 +2801,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lcr_load)
 	if (switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, globals.pool) != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "failed to initialize mutex\n");
 	}
+	switch_mutex_init(&globals.index_mutex, SWITCH_MUTEX_NESTED, globals.pool);
 	if (lcr_load_config() != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to load lcr config file\n");
 		return SWITCH_STATUS_FALSE;
@@ -2108,6 +2823,25 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lcr_load)
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_lcr_shutdown)
 {
+	switch_hash_index_t *hi;
+	void *val;
+
+	switch_scheduler_del_task_group("mod_lcr");
+
+	for (hi = switch_hash_first(NULL, globals.profile_hash); hi; hi = switch_hash_next(hi)) {
+		profile_t *profile;
+		lcr_index_t *index;
+
+		switch_hash_this(hi, NULL, NULL, &val);
+		profile = (profile_t *) val;
+
+		switch_mutex_lock(globals.index_mutex);
+		index = profile->index;
+		profile->index = NULL;
+		switch_mutex_unlock(globals.index_mutex);
+
+		lcr_index_release(index);
+	}
 
 	switch_core_hash_destroy(&globals.profile_hash);
 
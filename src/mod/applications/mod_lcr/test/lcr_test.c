@@ -0,0 +1,729 @@
+/*
+ * Loads a generated rate deck into SQLite, runs the same lookups through a memory_index profile and its SQL twin
+ * and compares the routes they return.  Also checks that only profiles which survive loading keep a refresh task.
+ * The core pieces mod_lcr calls into (pools, events, cache db, scheduler, config) are faked below; see README.
+ */
+/* the real switch_xml_open_cfg is linked in with switch_xml.c, mod_lcr reads the config below instead */
+#define switch_xml_open_cfg fake_xml_open_cfg
+#include "../mod_lcr.c"
+#include <sqlite3.h>
+#include <sys/time.h>
+
+static int fail_count;
+static int verbose;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+static char db_path[256];
+static uint32_t rnd = 1;
+
+static uint32_t rand_below(uint32_t n)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return (rnd >> 8) % n;
+}
+
+/* pools: every allocation is kept on a list and freed with the pool */
+
+struct fake_pool_chunk {
+	struct fake_pool_chunk *next;
+};
+
+struct fake_pool {
+	struct fake_pool_chunk *chunks;
+};
+
+switch_status_t switch_core_perform_new_memory_pool(switch_memory_pool_t **pool, const char *file, const char *func, int line)
+{
+	*pool = (switch_memory_pool_t *) calloc(1, sizeof(struct fake_pool));
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_perform_destroy_memory_pool(switch_memory_pool_t **pool, const char *file, const char *func, int line)
+{
+	struct fake_pool *fp = (struct fake_pool *) *pool;
+	struct fake_pool_chunk *chunk;
+
+	while ((chunk = fp->chunks)) {
+		fp->chunks = chunk->next;
+		free(chunk);
+	}
+	free(fp);
+	*pool = NULL;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory, const char *file, const char *func, int line)
+{
+	struct fake_pool *fp = (struct fake_pool *) pool;
+	struct fake_pool_chunk *chunk = calloc(1, sizeof(*chunk) + memory + 16);
+
+	chunk->next = fp->chunks;
+	fp->chunks = chunk;
+
+	return (char *) chunk + 16;
+}
+
+char *switch_core_perform_strdup(switch_memory_pool_t *pool, const char *todup, const char *file, const char *func, int line)
+{
+	char *dup;
+
+	if (!todup) {
+		return NULL;
+	}
+
+	dup = switch_core_perform_alloc(pool, strlen(todup) + 1, file, func, line);
+	strcpy(dup, todup);
+
+	return dup;
+}
+
+char *switch_core_sprintf(switch_memory_pool_t *pool, const char *fmt, ...)
+{
+	va_list ap;
+	char *data, *dup;
+
+	va_start(ap, fmt);
+	data = switch_vmprintf(fmt, ap);
+	va_end(ap);
+
+	dup = switch_core_perform_strdup(pool, data, __FILE__, __SWITCH_FUNC__, __LINE__);
+	free(data);
+
+	return dup;
+}
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	*lock = (switch_mutex_t *) mutex;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	pthread_mutex_lock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_atomic_set(volatile switch_atomic_t *mem, uint32_t val)
+{
+	*mem = val;
+}
+
+void switch_atomic_inc(volatile switch_atomic_t *mem)
+{
+	__sync_fetch_and_add(mem, 1);
+}
+
+int switch_atomic_dec(volatile switch_atomic_t *mem)
+{
+	return __sync_sub_and_fetch(mem, 1) != 0;
+}
+
+switch_time_t switch_micro_time_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (switch_time_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+time_t switch_epoch_time_now(time_t *t)
+{
+	return time(t);
+}
+
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+					   const char *userdata, switch_log_level_t level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (verbose || level <= SWITCH_LOG_CRIT) {
+		va_start(ap, fmt);
+		printf("[%d] ", level);
+		vprintf(fmt, ap);
+		va_end(ap);
+	}
+}
+
+int switch_snprintf(char *buf, switch_size_t len, const char *format, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(buf, len, format, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size)
+{
+	if (!dst_size) {
+		return dst;
+	}
+	strncpy(dst, src, dst_size - 1);
+	dst[dst_size - 1] = '\0';
+
+	return dst;
+}
+
+switch_status_t switch_console_stream_raw_write(switch_stream_handle_t *handle, uint8_t *data, switch_size_t datalen)
+{
+	switch_size_t need = handle->data_len + datalen + 1;
+
+	if (need > handle->data_size) {
+		handle->data_size = need * 2;
+		handle->data = realloc(handle->data, handle->data_size);
+	}
+	memcpy((char *) handle->data + handle->data_len, data, datalen);
+	handle->data_len += datalen;
+	handle->end = (char *) handle->data + handle->data_len;
+	*(char *) handle->end = '\0';
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_console_stream_write(switch_stream_handle_t *handle, const char *fmt, ...)
+{
+	va_list ap;
+	char *data;
+	switch_status_t status;
+
+	va_start(ap, fmt);
+	data = switch_vmprintf(fmt, ap);
+	va_end(ap);
+
+	status = switch_console_stream_raw_write(handle, (uint8_t *) data, strlen(data));
+	free(data);
+
+	return status;
+}
+
+/*
+   Lookups here never carry a session and the deck never has a cid rewrite, so the channel and regex calls in
+   mod_lcr.c are linked but never made; if a change to the test reaches one, it stops rather than runs on.
+*/
+static void unreached(const char *func)
+{
+	printf("FAIL %s() is faked and should not be called\n", func);
+	abort();
+}
+
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session)
+{
+	unreached(__func__);
+	return NULL;
+}
+
+const char *switch_channel_get_variable_dup(switch_channel_t *channel, const char *varname, switch_bool_t dup, int idx)
+{
+	unreached(__func__);
+	return NULL;
+}
+
+switch_status_t switch_channel_set_variable_var_check(switch_channel_t *channel, const char *varname, const char *value, switch_bool_t var_check)
+{
+	unreached(__func__);
+	return SWITCH_STATUS_FALSE;
+}
+
+char *switch_channel_expand_variables_check(switch_channel_t *channel, const char *in, switch_event_t *var_list, switch_event_t *api_list, uint32_t recur)
+{
+	unreached(__func__);
+	return NULL;
+}
+
+int switch_regex_perform(const char *field, const char *expression, switch_regex_t **new_re, int *ovector, uint32_t olen)
+{
+	unreached(__func__);
+	return 0;
+}
+
+void switch_perform_substitution(switch_regex_t *re, int match_count, const char *data, const char *field_data,
+								 char *substituted, switch_size_t len, int *ovector)
+{
+	unreached(__func__);
+}
+
+void switch_regex_free(void *data)
+{
+	unreached(__func__);
+}
+
+/* events: a header list and ${name} expansion is all mod_lcr asks of them */
+
+switch_status_t switch_event_create_subclass_detailed(const char *file, const char *func, int line,
+													  switch_event_t **event, switch_event_types_t event_id, const char *subclass_name)
+{
+	*event = calloc(1, sizeof(switch_event_t));
+	(*event)->event_id = event_id;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_event_destroy(switch_event_t **event)
+{
+	switch_event_header_t *hp;
+
+	if (!*event) {
+		return;
+	}
+
+	while ((hp = (*event)->headers)) {
+		(*event)->headers = hp->next;
+		free(hp->name);
+		free(hp->value);
+		free(hp);
+	}
+	free(*event);
+	*event = NULL;
+}
+
+switch_status_t switch_event_add_header_string(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *data)
+{
+	switch_event_header_t *hp;
+
+	if (!event || !data) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	for (hp = event->headers; hp; hp = hp->next) {
+		if (!strcasecmp(hp->name, header_name)) {
+			free(hp->value);
+			hp->value = strdup(data);
+			return SWITCH_STATUS_SUCCESS;
+		}
+	}
+
+	hp = calloc(1, sizeof(*hp));
+	hp->name = strdup(header_name);
+	hp->value = strdup(data);
+	hp->next = event->headers;
+	event->headers = hp;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+char *switch_event_get_header_idx(switch_event_t *event, const char *header_name, int idx)
+{
+	switch_event_header_t *hp;
+
+	for (hp = event ? event->headers : NULL; hp; hp = hp->next) {
+		if (!strcasecmp(hp->name, header_name)) {
+			return hp->value;
+		}
+	}
+
+	return NULL;
+}
+
+char *switch_event_expand_headers_check(switch_event_t *event, const char *in, switch_event_t *var_list, switch_event_t *api_list, uint32_t recur)
+{
+	switch_stream_handle_t stream = { 0 };
+	const char *p = in, *end;
+
+	SWITCH_STANDARD_STREAM(stream);
+	while (*p) {
+		if (p[0] == '$' && p[1] == '{' && (end = strchr(p, '}'))) {
+			char name[128];
+
+			switch_copy_string(name, p + 2, end - p - 1 < (int) sizeof(name) ? end - p - 1 : sizeof(name));
+			stream.write_function(&stream, "%s", switch_str_nil(switch_event_get_header(event, name)));
+			p = end + 1;
+		} else {
+			stream.write_function(&stream, "%c", *p++);
+		}
+	}
+
+	return stream.data;
+}
+
+/* cache db: the dsn is an SQLite file, queries for lcr_profile 99 fail so that profile can't build its index */
+
+switch_status_t _switch_cache_db_get_db_handle_dsn(switch_cache_db_handle_t **dbh, const char *dsn, const char *file, const char *func, int line)
+{
+	sqlite3 *db;
+
+	if (sqlite3_open(dsn, &db) != SQLITE_OK) {
+		return SWITCH_STATUS_FALSE;
+	}
+	*dbh = (switch_cache_db_handle_t *) db;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_cache_db_release_db_handle(switch_cache_db_handle_t **dbh)
+{
+	if (*dbh) {
+		sqlite3_close((sqlite3 *) *dbh);
+		*dbh = NULL;
+	}
+}
+
+static int sql_fails(const char *sql)
+{
+	return strstr(sql, "lcr_profile=99") != NULL;
+}
+
+switch_status_t switch_cache_db_execute_sql(switch_cache_db_handle_t *dbh, char *sql, char **err)
+{
+	if (sql_fails(sql) || sqlite3_exec((sqlite3 *) dbh, sql, NULL, NULL, NULL) != SQLITE_OK) {
+		return SWITCH_STATUS_FALSE;
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_cache_db_execute_sql_callback(switch_cache_db_handle_t *dbh, const char *sql,
+													 switch_core_db_callback_func_t callback, void *pdata, char **err)
+{
+	if (sql_fails(sql) || sqlite3_exec((sqlite3 *) dbh, sql, callback, pdata, NULL) != SQLITE_OK) {
+		return SWITCH_STATUS_FALSE;
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* scheduler: tasks are only recorded, the test runs them */
+
+#define MAX_TASKS 16
+
+static switch_scheduler_task_t tasks[MAX_TASKS];
+static switch_scheduler_func_t task_funcs[MAX_TASKS];
+static int task_count;
+
+uint32_t switch_scheduler_add_task(time_t task_runtime, switch_scheduler_func_t func, const char *desc, const char *group,
+								   uint32_t cmd_id, void *cmd_arg, switch_scheduler_flag_t flags)
+{
+	switch_scheduler_task_t *task = &tasks[task_count];
+
+	memset(task, 0, sizeof(*task));
+	task->runtime = task_runtime;
+	task->cmd_arg = cmd_arg;
+	task->task_id = task_count + 1;
+	task_funcs[task_count++] = func;
+
+	return task->task_id;
+}
+
+/* config */
+
+static const char *config_xml =
+	"<configuration name=\"lcr.conf\">"
+	"  <settings><param name=\"odbc-dsn\" value=\"%s\"/></settings>"
+	"  <profiles>"
+	"    <profile name=\"default\"/>"
+	"    <profile name=\"rate_index\">"
+	"      <param name=\"memory_index\" value=\"true\"/><param name=\"memory_index_refresh\" value=\"60\"/>"
+	"    </profile>"
+	"    <profile name=\"rate_sql\"/>"
+	"    <profile name=\"quality_index\">"
+	"      <param name=\"id\" value=\"2\"/><param name=\"order_by\" value=\"quality,reliability,rate\"/>"
+	"      <param name=\"quote_in_list\" value=\"true\"/><param name=\"single_bridge\" value=\"true\"/>"
+	"      <param name=\"memory_index\" value=\"true\"/><param name=\"memory_index_refresh\" value=\"60\"/>"
+	"    </profile>"
+	"    <profile name=\"quality_sql\">"
+	"      <param name=\"id\" value=\"2\"/><param name=\"order_by\" value=\"quality,reliability,rate\"/>"
+	"      <param name=\"quote_in_list\" value=\"true\"/><param name=\"single_bridge\" value=\"true\"/>"
+	"    </profile>"
+	"    <profile name=\"unindexed\">"
+	"      <param name=\"id\" value=\"99\"/>"
+	"      <param name=\"memory_index\" value=\"true\"/><param name=\"memory_index_refresh\" value=\"60\"/>"
+	"    </profile>"
+	"  </profiles>"
+	"</configuration>";
+
+switch_xml_t fake_xml_open_cfg(const char *file_path, switch_xml_t *node, switch_event_t *params)
+{
+	char *text = switch_mprintf(config_xml, db_path);
+	switch_xml_t xml = switch_xml_parse_str_dynamic(text, SWITCH_FALSE);
+
+	*node = xml;
+	return xml;
+}
+
+/* the deck */
+
+#define NPAS 5
+#define NXXS 5
+
+static const char *npas[NPAS] = { "212", "305", "415", "702", "808" };
+static const char *nxxs[NXXS] = { "200", "333", "456", "555", "901" };
+
+static void rand_number(char *buf)
+{
+	if (rand_below(8)) {
+		sprintf(buf, "1%s%s%04u", npas[rand_below(NPAS)], nxxs[rand_below(NXXS)], rand_below(10000));
+	} else {
+		/* not NANP, never intrastate */
+		sprintf(buf, "44%u%07u", 1 + rand_below(9), rand_below(10000000));
+	}
+}
+
+static void rand_rate(char *buf, uint32_t *next)
+{
+	/* every rate is distinct so ORDER BY never falls through to random() */
+	if (!rand_below(20)) {
+		strcpy(buf, "NULL");
+	} else {
+		sprintf(buf, "%u.%05u", *next / 100000, *next % 100000);
+		*next += 1 + rand_below(7);
+	}
+}
+
+static void db_exec(sqlite3 *db, const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		printf("sqlite: %s\n%s\n", err, sql);
+		exit(1);
+	}
+}
+
+static void create_deck(int rows)
+{
+	sqlite3 *db;
+	uint32_t rate = 100, quality = 1000;
+	int i, j;
+
+	unlink(db_path);
+	sqlite3_open(db_path, &db);
+
+	db_exec(db, "CREATE TABLE carriers (id INTEGER PRIMARY KEY, carrier_name VARCHAR(255), enabled BOOLEAN NOT NULL DEFAULT '1');"
+			"CREATE TABLE carrier_gateway (id INTEGER PRIMARY KEY, carrier_id INTEGER, prefix VARCHAR(255) NOT NULL, "
+			"suffix VARCHAR(255) NOT NULL, codec VARCHAR(255) NOT NULL, enabled BOOLEAN NOT NULL DEFAULT '1');"
+			"CREATE TABLE lcr (id INTEGER PRIMARY KEY, digits VARCHAR(15), rate FLOAT, intrastate_rate FLOAT, intralata_rate FLOAT, "
+			"carrier_id INTEGER NOT NULL, lead_strip INTEGER NOT NULL, trail_strip INTEGER NOT NULL, prefix VARCHAR(16) NOT NULL, "
+			"suffix VARCHAR(16) NOT NULL, lcr_profile INTEGER NOT NULL DEFAULT 0, date_start DATETIME NOT NULL DEFAULT '1970-01-01', "
+			"date_end DATETIME NOT NULL DEFAULT '2030-12-31', quality FLOAT NOT NULL, reliability FLOAT NOT NULL, "
+			"cid VARCHAR(32) NOT NULL DEFAULT '', enabled BOOLEAN NOT NULL DEFAULT '1', lrn BOOLEAN NOT NULL DEFAULT false);"
+			"CREATE TABLE npa_nxx_company_ocn (npa INTEGER, nxx INTEGER, company_type TEXT, ocn TEXT, company_name TEXT, "
+			"lata INTEGER, ratecenter TEXT, state TEXT);"
+			"BEGIN;");
+
+	for (i = 1; i <= 8; i++) {
+		/* one enabled gateway per carrier, two would tie and leave the pick to random() */
+		char *sql = switch_mprintf("INSERT INTO carriers VALUES (%d, 'carrier%d', '%d');"
+								   "INSERT INTO carrier_gateway VALUES (%d, %d, 'sofia/gateway/gw%d/', '', 'PCMU', '%d');"
+								   "INSERT INTO carrier_gateway VALUES (%d, %d, 'sofia/gateway/gw%db/', ';x=%d', '', '%d');",
+								   i, i, i != 8, 2 * i, i, i, i % 3 != 0, 2 * i + 1, i, i, i, i % 3 == 0);
+		db_exec(db, sql);
+		free(sql);
+	}
+
+	for (i = 0; i < NPAS; i++) {
+		for (j = 0; j < NXXS; j++) {
+			char *sql;
+
+			if (!rand_below(6)) {
+				continue;
+			}
+			sql = switch_mprintf("INSERT INTO npa_nxx_company_ocn (npa, nxx, lata, state) VALUES (%s, %s, %u, '%s');",
+								 npas[i], nxxs[j], 100 + rand_below(3), rand_below(2) ? "CA" : "NV");
+			db_exec(db, sql);
+			free(sql);
+			if (!rand_below(8)) {
+				/* an npa-nxx spanning two states */
+				sql = switch_mprintf("INSERT INTO npa_nxx_company_ocn (npa, nxx, lata, state) VALUES (%s, %s, %u, 'AZ');",
+									 npas[i], nxxs[j], 100 + rand_below(3));
+				db_exec(db, sql);
+				free(sql);
+			}
+		}
+	}
+
+	for (i = 0; i < rows; i++) {
+		char number[32], r1[32], r2[32], r3[32], *sql;
+		const char *window = "'1970-01-01', '2030-12-31'";
+
+		rand_number(number);
+		number[2 + rand_below(strlen(number) - 2)] = '\0';
+		rand_rate(r1, &rate);
+		rand_rate(r2, &rate);
+		rand_rate(r3, &rate);
+		switch (rand_below(20)) {
+		case 0:
+			window = "'2001-01-01', '2002-01-01'";
+			break;
+		case 1:
+			window = "'2029-01-01', '2030-12-31'";
+			break;
+		}
+		quality += 1 + rand_below(5);
+
+		sql = switch_mprintf("INSERT INTO lcr (digits, rate, intrastate_rate, intralata_rate, carrier_id, lead_strip, trail_strip, prefix, suffix, "
+							 "lcr_profile, date_start, date_end, quality, reliability, cid, enabled, lrn) "
+							 "VALUES ('%s', %s, %s, %s, %u, %u, %u, '%s', '%s', %u, %s, %u.%03u, %u, '', '%d', %d);",
+							 number, r1, r2, r3, 1 + rand_below(8), rand_below(5) ? 0 : 1, rand_below(5) ? 0 : 2,
+							 rand_below(3) ? "" : "011", rand_below(4) ? "" : "#", rand_below(3) ? 0 : 2, window,
+							 quality / 1000, quality % 1000, rand_below(100), rand_below(25) != 0, !rand_below(5));
+		db_exec(db, sql);
+		free(sql);
+	}
+
+	db_exec(db, "COMMIT;");
+	sqlite3_close(db);
+}
+
+/* run one lookup and flatten the routes it produced */
+static char *lookup(profile_t *profile, const char *number, const char *lrn, const char *cid)
+{
+	callback_t routes = { 0 };
+	switch_stream_handle_t stream = { 0 };
+	switch_memory_pool_t *pool;
+	switch_status_t status;
+	lcr_route route;
+
+	switch_core_new_memory_pool(&pool);
+	switch_event_create(&routes.event, SWITCH_EVENT_MESSAGE);
+	routes.pool = pool;
+	routes.profile = profile;
+	routes.lookup_number = (char *) number;
+	routes.lrn_number = (char *) lrn;
+	routes.cid = (char *) cid;
+
+	status = lcr_do_lookup(&routes);
+
+	SWITCH_STANDARD_STREAM(stream);
+	stream.write_function(&stream, "status %d intrastate %d intralata %d\n", status, routes.intrastate, routes.intralata);
+	for (route = routes.head; route; route = route->next) {
+		stream.write_function(&stream, "%s|%s|%s|%s|%s|%s\n", route->digit_str, route->carrier_name, route->rate_str,
+							  route->dialstring, switch_str_nil(route->codec), switch_str_nil(route->cid));
+	}
+
+	lcr_destroy(routes.head);
+	switch_event_destroy(&routes.event);
+	switch_core_destroy_memory_pool(&pool);
+
+	return stream.data;
+}
+
+static void test_compare(const char *index_name, const char *sql_name, int count)
+{
+	profile_t *index_profile = locate_profile(index_name);
+	profile_t *sql_profile = locate_profile(sql_name);
+	int i, mismatches = 0, routed = 0, intra = 0;
+
+	CHECK(index_profile && index_profile->memory_index && index_profile->index, "%s has no index", index_name);
+	CHECK(sql_profile && !sql_profile->memory_index, "%s is not a SQL profile", sql_name);
+	if (!index_profile || !index_profile->index || !sql_profile) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		char number[32], lrn[32], cid[32];
+		const char *use_lrn, *use_cid;
+		char *a, *b;
+
+		rand_number(number);
+		rand_number(lrn);
+		rand_number(cid);
+		if (!rand_below(10)) {
+			/* nothing in the deck starts with 3 */
+			*number = '3';
+		}
+		use_lrn = rand_below(4) ? NULL : lrn;
+		use_cid = rand_below(5) ? cid : NULL;
+
+		a = lookup(index_profile, number, use_lrn, use_cid);
+		b = lookup(sql_profile, number, use_lrn, use_cid);
+
+		if (strcmp(a, b)) {
+			if (mismatches++ < 3) {
+				printf("number %s lrn %s cid %s\nindex:\n%s\nsql:\n%s\n", number, switch_str_nil(use_lrn), switch_str_nil(use_cid), a, b);
+			}
+		} else {
+			routed += strchr(strchr(a, '\n') + 1, '|') != NULL;
+			intra += strstr(a, "intrastate 1") || strstr(a, "intralata 1");
+		}
+
+		free(a);
+		free(b);
+	}
+
+	CHECK(routed > count / 2 && routed < count, "%d of %d lookups found a route", routed, count);
+	CHECK(intra > 0, "no lookup was intrastate or intralata");
+	CHECK(!mismatches, "%d lookups differ", mismatches);
+
+	printf("test_compare(%s, %s) : %d lookups, %d routed, %d intrastate/lata, %d mismatches : %s\n", index_name, sql_name, count, routed, intra, mismatches,
+		   mismatches ? "FAIL" : "PASS");
+}
+
+/* every indexed profile keeps a refresh task, a profile whose index was dropped must not be rebuilt by it */
+static void test_refresh_tasks(void)
+{
+	profile_t *profile;
+	lcr_index_t *old;
+	time_t now = switch_epoch_time_now(NULL);
+	int i, before = fail_count;
+
+	CHECK(task_count == 3, "%d refresh tasks, expected rate_index, quality_index and unindexed", task_count);
+
+	for (i = 0; i < task_count; i++) {
+		profile = (profile_t *) tasks[i].cmd_arg;
+		old = profile->index;
+
+		CHECK(profile->memory_index, "task %d refreshes %s which has no index", i, profile->name);
+		CHECK(switch_core_hash_find(globals.profile_hash, profile->name) == profile, "task %d refreshes %s which was not loaded", i,
+			  profile->name);
+
+		/* due now, as the scheduler would run it */
+		tasks[i].runtime = now;
+		task_funcs[i](&tasks[i]);
+		CHECK(tasks[i].runtime > now, "%s was not rescheduled", profile->name);
+		if (!strcmp(profile->name, "unindexed")) {
+			CHECK(!profile->index, "the deck of unindexed loaded");
+		} else {
+			CHECK(profile->index && profile->index != old, "%s was not rebuilt", profile->name);
+		}
+	}
+
+	/* the profile was dropped after its task was added, as when it fails test_profile() */
+	profile = (profile_t *) tasks[0].cmd_arg;
+	old = profile->index;
+	profile->memory_index = SWITCH_FALSE;
+	tasks[0].runtime = now;
+	task_funcs[0](&tasks[0]);
+	CHECK(profile->index == old, "%s was rebuilt after its index was dropped", profile->name);
+	CHECK(tasks[0].runtime == now, "the task of %s was rescheduled after its index was dropped", profile->name);
+	profile->memory_index = SWITCH_TRUE;
+
+	printf("test_refresh_tasks() : %d tasks : %s\n", task_count, fail_count == before ? "PASS" : "FAIL");
+}
+
+int main(int argc, char *argv[])
+{
+	int rows = argc > 1 ? atoi(argv[1]) : 3000;
+	int lookups = argc > 2 ? atoi(argv[2]) : 2000;
+
+	verbose = getenv("LCR_TEST_VERBOSE") != NULL;
+	switch_snprintf(db_path, sizeof(db_path), "/tmp/lcr_test_%d.db", (int) getpid());
+	create_deck(rows);
+
+	switch_core_new_memory_pool(&globals.pool);
+	switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, globals.pool);
+	switch_mutex_init(&globals.index_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+	CHECK(lcr_load_config() == SWITCH_STATUS_SUCCESS, "lcr_load_config failed");
+
+	test_refresh_tasks();
+	test_compare("rate_index", "rate_sql", lookups);
+	test_compare("quality_index", "quality_sql", lookups);
+
+	unlink(db_path);
+
+	return fail_count ? 1 : 0;
+}
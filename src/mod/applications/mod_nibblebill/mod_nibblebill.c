@@ -58,8 +58,22 @@ typedef struct {
 	double bill_adjustments;	/* Adjustments to make to the next billing, based on pause/resume events */
 
 	int lowbal_action_executed;	/* Set to 1 once lowbal_action has been executed */
+
+	double reserved;			/* Amount this call holds against its account's cached balance */
 } nibble_data_t;
 
+/* Cached view of one billing account, see balance_cache */
+typedef struct nibblebill_account {
+	char *name;
+	double balance;				/* Balance as last read from the database */
+	double pending;				/* Debits recorded locally and not flushed yet */
+	double inflight;			/* Debits being flushed right now */
+	double reserved;			/* Held for the next billing interval of the account's live calls */
+	uint32_t calls;				/* Live calls holding a reservation */
+	switch_time_t loaded;		/* When balance was read, 0 if it never was */
+	struct nibblebill_account *next;	/* Work list link, only used by the flush thread */
+} nibblebill_account_t;
+
 
 typedef struct nibblebill_results {
 	double balance;
@@ -100,6 +114,17 @@ static struct {
 	char *custom_sql_save;
 	char *custom_sql_lookup;
 	switch_odbc_handle_t *master_odbc;
+
+	/* Balance cache: debits are aggregated per account and flushed in batches */
+	switch_bool_t balance_cache;
+	int flush_interval;			/* Seconds between flushes of aggregated debits */
+	int balance_ttl;			/* Seconds before a cached balance is read again */
+	char *journal_file;			/* Local record of debits not yet flushed */
+	int journal_fd;
+	switch_hash_t *accounts;
+	switch_mutex_t *cache_mutex;
+	switch_thread_t *flush_thread;
+	int running;
 } globals;
 
 static void nibblebill_pause(switch_core_session_t *session);
@@ -125,6 +150,7 @@ SWITCH_DECLARE_GLOBAL_STRING_FUNC(set_global_custom_sql_lookup, globals.custom_s
 SWITCH_DECLARE_GLOBAL_STRING_FUNC(set_global_percall_action, globals.percall_action);
 SWITCH_DECLARE_GLOBAL_STRING_FUNC(set_global_lowbal_action, globals.lowbal_action);
 SWITCH_DECLARE_GLOBAL_STRING_FUNC(set_global_nobal_action, globals.nobal_action);
+SWITCH_DECLARE_GLOBAL_STRING_FUNC(set_global_journal_file, globals.journal_file);
 
 static switch_cache_db_handle_t *nibblebill_get_db_handle(void)
 {
@@ -226,6 +252,14 @@ static switch_status_t nibblebill_load_config(void)
 				globals.nobal_amt = atof(val);
 			} else if (!strcasecmp(var, "global_heartbeat")) {
 				globals.global_heartbeat = atoi(val);
+			} else if (!strcasecmp(var, "balance_cache")) {
+				globals.balance_cache = switch_true(val);
+			} else if (!strcasecmp(var, "flush_interval")) {
+				globals.flush_interval = atoi(val);
+			} else if (!strcasecmp(var, "balance_ttl")) {
+				globals.balance_ttl = atoi(val);
+			} else if (!strcasecmp(var, "journal_file")) {
+				set_global_journal_file(val);
 			}
 		}
 	}
@@ -242,6 +276,17 @@ static switch_status_t nibblebill_load_config(void)
 	if (zstr(globals.nobal_action)) {
 		set_global_nobal_action("hangup");
 	}
+	if (globals.flush_interval < 1) {
+		globals.flush_interval = 5;
+	}
+	if (globals.balance_ttl < 1) {
+		globals.balance_ttl = 30;
+	}
+	if (zstr(globals.journal_file)) {
+		char *path = switch_mprintf("%s%snibblebill.journal", SWITCH_GLOBAL_dirs.db_dir, SWITCH_PATH_SEPARATOR);
+		set_global_journal_file(path);
+		switch_safe_free(path);
+	}
 
 	if (globals.odbc_dsn) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG
@@ -333,6 +378,25 @@ static void transfer_call(switch_core_session_t *session, char *destination)
 	free(mydup);
 }
 
+/* Expand custom sql for an account when there is no channel to take the variables from,
+   as when the balance cache flushes.  Only nibble_account and nibble_bill are available. */
+static char *expand_account_sql(const char *sql, const char *billaccount, double billamount)
+{
+	switch_event_t *event;
+	char *expanded;
+
+	if (switch_event_create_plain(&event, SWITCH_EVENT_CHANNEL_DATA) != SWITCH_STATUS_SUCCESS) {
+		return (char *) sql;
+	}
+
+	switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "nibble_account", billaccount);
+	switch_event_add_header(event, SWITCH_STACK_BOTTOM, "nibble_bill", "%f", billamount);
+	expanded = switch_event_expand_headers(event, sql);
+	switch_event_destroy(&event);
+
+	return expanded;
+}
+
 /* At this time, billing never succeeds if you don't have a database. */
 static switch_bool_t bill_event(double billamount, const char *billaccount, switch_channel_t *channel)
 {
@@ -340,7 +404,10 @@ static switch_bool_t bill_event(double billamount, const char *billaccount, swit
 	switch_status_t status = SWITCH_FALSE;
 
 	if (globals.custom_sql_save) {
-		if (switch_string_var_check_const(globals.custom_sql_save) || switch_string_has_escaped_data(globals.custom_sql_save)) {
+		if (!channel) {
+			sql = expand_account_sql(globals.custom_sql_save, billaccount, billamount);
+			if (sql != globals.custom_sql_save) dsql = sql;
+		} else if (switch_string_var_check_const(globals.custom_sql_save) || switch_string_has_escaped_data(globals.custom_sql_save)) {
 			switch_channel_set_variable_printf(channel, "nibble_bill", "%f", billamount, SWITCH_FALSE);
 			sql = switch_channel_expand_variables(channel, globals.custom_sql_save);
 			if (sql != globals.custom_sql_save) dsql = sql;
@@ -360,16 +427,19 @@ static switch_bool_t bill_event(double billamount, const char *billaccount, swit
 	return status;
 }
 
-static double get_balance(const char *billaccount, switch_channel_t *channel)
+static switch_bool_t query_balance(const char *billaccount, switch_channel_t *channel, double *balance)
 {
 	char *dsql = NULL, *sql = NULL;
 	nibblebill_results_t pdata;
-	double balance = 0.0;
+	switch_bool_t retval = SWITCH_FALSE;
 
 	memset(&pdata, 0, sizeof(pdata));
 
 	if (globals.custom_sql_lookup) {
-		if (switch_string_var_check_const(globals.custom_sql_lookup) || switch_string_has_escaped_data(globals.custom_sql_lookup)) {
+		if (!channel) {
+			sql = expand_account_sql(globals.custom_sql_lookup, billaccount, 0);
+			if (sql != globals.custom_sql_lookup) dsql = sql;
+		} else if (switch_string_var_check_const(globals.custom_sql_lookup) || switch_string_has_escaped_data(globals.custom_sql_lookup)) {
 			sql = switch_channel_expand_variables(channel, globals.custom_sql_lookup);
 			if (sql != globals.custom_sql_lookup) dsql = sql;
 		} else {
@@ -383,18 +453,405 @@ static double get_balance(const char *billaccount, switch_channel_t *channel)
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Doing lookup query\n[%s]\n", sql);
 	if (nibblebill_execute_sql_callback(sql, nibblebill_callback, &pdata) != SWITCH_TRUE) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error running this query: [%s]\n", sql);
-		/* Return -1 for safety */
-		balance = -1.0;
 	} else {
 		/* Successfully retrieved! */
-		balance = pdata.balance;
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Retrieved current balance for account %s (balance = %f)\n", billaccount, balance);
+		*balance = pdata.balance;
+		retval = SWITCH_TRUE;
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Retrieved current balance for account %s (balance = %f)\n", billaccount, *balance);
 	}
 	
 	switch_safe_free(dsql);
+	return retval;
+}
+
+static double get_balance(const char *billaccount, switch_channel_t *channel)
+{
+	double balance = 0.0;
+
+	if (query_balance(billaccount, channel, &balance) != SWITCH_TRUE) {
+		/* Return -1 for safety */
+		balance = -1.0;
+	}
+
 	return balance;
 }
 
+/* Balance cache.  With balance_cache on, heartbeats only touch memory: debits are added to the
+   account's pending amount and appended to the journal, and balance checks use the cached balance
+   less everything pending, being flushed or reserved by the account's other calls.  The flush
+   thread writes one aggregated debit per account every flush_interval seconds and then re-reads
+   the balance, so the database stays the authority and changes made to it directly (top ups,
+   other switches) are picked up.  Database load follows the number of active accounts rather
+   than the number of heartbeats. */
+
+static void journal_append(const char *type, double amount, const char *billaccount)
+{
+	char *line;
+
+	if (globals.journal_fd < 0) {
+		return;
+	}
+
+	if ((line = switch_mprintf("%s\t%.10f\t%s\n", type, amount, billaccount))) {
+		if (write(globals.journal_fd, line, (unsigned) strlen(line)) < 0) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error writing to journal %s\n", globals.journal_file);
+		}
+		free(line);
+	}
+}
+
+/* must be called with cache_mutex held */
+static nibblebill_account_t *cache_find_account(const char *billaccount, switch_bool_t create)
+{
+	nibblebill_account_t *acct;
+
+	if (!(acct = switch_core_hash_find(globals.accounts, billaccount)) && create) {
+		switch_zmalloc(acct, sizeof(*acct));
+		acct->name = strdup(billaccount);
+		switch_core_hash_insert(globals.accounts, acct->name, acct);
+	}
+
+	return acct;
+}
+
+/* Balance available to a call, not counting what the call has reserved for itself */
+static double cache_available(const char *billaccount, switch_channel_t *channel, nibble_data_t *nibble_data)
+{
+	nibblebill_account_t *acct;
+	double balance = 0.0, available;
+	switch_bool_t loaded = SWITCH_TRUE;
+
+	switch_mutex_lock(globals.cache_mutex);
+	acct = cache_find_account(billaccount, SWITCH_FALSE);
+	if (!acct || !acct->loaded) {
+		switch_mutex_unlock(globals.cache_mutex);
+		loaded = query_balance(billaccount, channel, &balance);
+		switch_mutex_lock(globals.cache_mutex);
+
+		if (!loaded) {
+			switch_mutex_unlock(globals.cache_mutex);
+			/* Return -1 for safety, like get_balance() */
+			return -1.0;
+		}
+
+		acct = cache_find_account(billaccount, SWITCH_TRUE);
+		if (!acct->loaded) {
+			acct->balance = balance;
+			acct->loaded = switch_micro_time_now();
+		}
+	}
+
+	available = acct->balance - acct->pending - acct->inflight - acct->reserved;
+	if (nibble_data) {
+		available += nibble_data->reserved;
+	}
+	switch_mutex_unlock(globals.cache_mutex);
+
+	return available;
+}
+
+static void cache_debit(const char *billaccount, double billamount)
+{
+	nibblebill_account_t *acct;
+
+	switch_mutex_lock(globals.cache_mutex);
+	acct = cache_find_account(billaccount, SWITCH_TRUE);
+	acct->pending += billamount;
+	journal_append("D", billamount, billaccount);
+	switch_mutex_unlock(globals.cache_mutex);
+}
+
+/* Replace the amount a call holds against its account, 0 releases it */
+static void cache_reserve(const char *billaccount, nibble_data_t *nibble_data, double amount)
+{
+	nibblebill_account_t *acct;
+
+	switch_mutex_lock(globals.cache_mutex);
+	acct = cache_find_account(billaccount, SWITCH_TRUE);
+
+	if (amount > 0 && nibble_data->reserved <= 0) {
+		acct->calls++;
+	} else if (amount <= 0 && nibble_data->reserved > 0 && acct->calls) {
+		acct->calls--;
+	}
+
+	acct->reserved += amount - nibble_data->reserved;
+	if (!acct->calls) {
+		acct->reserved = 0;
+	}
+	nibble_data->reserved = amount > 0 ? amount : 0;
+	switch_mutex_unlock(globals.cache_mutex);
+}
+
+/* must be called with cache_mutex held */
+static void journal_rewrite(void)
+{
+	switch_hash_index_t *hi;
+	char *tmp_path;
+	int fd;
+
+	if (!(tmp_path = switch_mprintf("%s.tmp", globals.journal_file))) {
+		return;
+	}
+
+	if ((fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR)) < 0) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error opening %s\n", tmp_path);
+		free(tmp_path);
+		return;
+	}
+
+	for (hi = switch_core_hash_first(globals.accounts); hi; hi = switch_core_hash_next(hi)) {
+		void *val;
+		nibblebill_account_t *acct;
+		char *line;
+
+		switch_core_hash_this(hi, NULL, NULL, &val);
+		acct = (nibblebill_account_t *) val;
+
+		if (acct->pending + acct->inflight != 0 && (line = switch_mprintf("D\t%.10f\t%s\n", acct->pending + acct->inflight, acct->name))) {
+			if (write(fd, line, (unsigned) strlen(line)) < 0) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error writing to %s\n", tmp_path);
+			}
+			free(line);
+		}
+	}
+
+	fsync(fd);
+	close(fd);
+
+	if (rename(tmp_path, globals.journal_file)) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error replacing journal %s\n", globals.journal_file);
+	} else {
+		if (globals.journal_fd > -1) {
+			close(globals.journal_fd);
+		}
+		globals.journal_fd = open(globals.journal_file, O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
+	}
+
+	free(tmp_path);
+}
+
+/* Pick up debits a previous run recorded but never flushed, they go out with the first flush */
+static void journal_replay(void)
+{
+	FILE *fp;
+	char line[1024];
+	int count = 0;
+
+	if (!(fp = fopen(globals.journal_file, "r"))) {
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *amount, *billaccount, *e;
+		nibblebill_account_t *acct;
+
+		if ((line[0] != 'D' && line[0] != 'F') || line[1] != '\t' || !(billaccount = strchr(line + 2, '\t'))) {
+			continue;
+		}
+
+		amount = line + 2;
+		*billaccount++ = '\0';
+		if ((e = strchr(billaccount, '\n'))) {
+			*e = '\0';
+		}
+
+		if (zstr(billaccount)) {
+			continue;
+		}
+
+		acct = cache_find_account(billaccount, SWITCH_TRUE);
+		acct->pending += line[0] == 'D' ? atof(amount) : -atof(amount);
+		count++;
+	}
+
+	fclose(fp);
+
+	if (count) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Recovered %d unflushed billing records from %s\n", count, globals.journal_file);
+	}
+}
+
+static void cache_flush(void)
+{
+	switch_hash_index_t *hi;
+	nibblebill_account_t *acct, *work = NULL, *prune = NULL;
+	switch_time_t now = switch_micro_time_now();
+	switch_time_t ttl = (switch_time_t) globals.balance_ttl * 1000000;
+	int flushed = 0;
+
+	switch_mutex_lock(globals.cache_mutex);
+	for (hi = switch_core_hash_first(globals.accounts); hi; hi = switch_core_hash_next(hi)) {
+		void *val;
+		int stale;
+
+		switch_core_hash_this(hi, NULL, NULL, &val);
+		acct = (nibblebill_account_t *) val;
+		stale = !acct->loaded || now - acct->loaded > ttl;
+
+		if (acct->pending != 0) {
+			acct->inflight = acct->pending;
+			acct->pending = 0;
+			acct->next = work;
+			work = acct;
+		} else if (stale && acct->calls) {
+			acct->next = work;
+			work = acct;
+		} else if (stale) {
+			acct->next = prune;
+			prune = acct;
+		}
+	}
+
+	while ((acct = prune)) {
+		prune = acct->next;
+		switch_core_hash_delete(globals.accounts, acct->name);
+		free(acct->name);
+		free(acct);
+	}
+	switch_mutex_unlock(globals.cache_mutex);
+
+	/* The flush thread is the only one that removes accounts, so the work list stays valid unlocked */
+	for (acct = work; acct; acct = acct->next) {
+		double balance = 0.0, amount = acct->inflight;
+		switch_bool_t billed = SWITCH_TRUE, loaded;
+
+		if (amount != 0) {
+			/* Mark the batch flushed on disk before the UPDATE runs.  Dying between the two loses the
+			   batch rather than debiting it a second time when the journal is replayed, and an UPDATE
+			   that fails puts it back with a new D record. */
+			switch_mutex_lock(globals.cache_mutex);
+			journal_append("F", amount, acct->name);
+			if (globals.journal_fd > -1) {
+				fsync(globals.journal_fd);
+			}
+			switch_mutex_unlock(globals.cache_mutex);
+
+			if ((billed = bill_event(amount, acct->name, NULL))) {
+				flushed++;
+			} else {
+				switch_mutex_lock(globals.cache_mutex);
+				journal_append("D", amount, acct->name);
+				switch_mutex_unlock(globals.cache_mutex);
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Failed to flush $%f for account %s, will retry\n", amount, acct->name);
+			}
+		}
+
+		loaded = query_balance(acct->name, NULL, &balance);
+
+		switch_mutex_lock(globals.cache_mutex);
+		if (!billed) {
+			acct->pending += amount;
+		} else if (!loaded) {
+			acct->balance -= amount;
+		}
+		acct->inflight = 0;
+
+		if (loaded) {
+			acct->balance = balance;
+			acct->loaded = switch_micro_time_now();
+		}
+		switch_mutex_unlock(globals.cache_mutex);
+	}
+
+	if (flushed) {
+		switch_mutex_lock(globals.cache_mutex);
+		journal_rewrite();
+		switch_mutex_unlock(globals.cache_mutex);
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Flushed debits for %d accounts\n", flushed);
+	}
+}
+
+static void *SWITCH_THREAD_FUNC cache_flush_thread(switch_thread_t *thread, void *obj)
+{
+	int sanity;
+
+	while (globals.running) {
+		for (sanity = globals.flush_interval * 10; globals.running && sanity > 0; sanity--) {
+			switch_yield(100000);
+		}
+
+		/* runs once more after shutdown is requested so nothing is left in memory */
+		cache_flush();
+	}
+
+	return NULL;
+}
+
+static void cache_start(void)
+{
+	switch_threadattr_t *thd_attr = NULL;
+
+	switch_mutex_init(&globals.cache_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+	switch_core_hash_init(&globals.accounts, globals.pool);
+
+	switch_mutex_lock(globals.cache_mutex);
+	journal_replay();
+	journal_rewrite();
+	switch_mutex_unlock(globals.cache_mutex);
+
+	globals.running = 1;
+	switch_threadattr_create(&thd_attr, globals.pool);
+	switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+	switch_thread_create(&globals.flush_thread, thd_attr, cache_flush_thread, NULL, globals.pool);
+
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Balance cache enabled, flushing every %d seconds to %s\n",
+					  globals.flush_interval, globals.odbc_dsn);
+}
+
+static void cache_stop(void)
+{
+	switch_status_t st;
+	switch_hash_index_t *hi;
+
+	if (!globals.flush_thread) {
+		return;
+	}
+
+	globals.running = 0;
+	switch_thread_join(&st, globals.flush_thread);
+	globals.flush_thread = NULL;
+
+	switch_mutex_lock(globals.cache_mutex);
+	journal_rewrite();
+	while ((hi = switch_core_hash_first(globals.accounts))) {
+		void *val;
+		nibblebill_account_t *acct;
+
+		switch_core_hash_this(hi, NULL, NULL, &val);
+		acct = (nibblebill_account_t *) val;
+		switch_core_hash_delete(globals.accounts, acct->name);
+		free(acct->name);
+		free(acct);
+	}
+	switch_mutex_unlock(globals.cache_mutex);
+
+	if (globals.journal_fd > -1) {
+		close(globals.journal_fd);
+		globals.journal_fd = -1;
+	}
+	switch_core_hash_destroy(&globals.accounts);
+}
+
+static switch_bool_t account_debit(double billamount, const char *billaccount, switch_channel_t *channel)
+{
+	if (globals.flush_thread) {
+		cache_debit(billaccount, billamount);
+		return SWITCH_TRUE;
+	}
+
+	return bill_event(billamount, billaccount, channel);
+}
+
+static double account_balance(const char *billaccount, switch_channel_t *channel, nibble_data_t *nibble_data)
+{
+	if (globals.flush_thread) {
+		return cache_available(billaccount, channel, nibble_data);
+	}
+
+	return get_balance(billaccount, channel);
+}
+
 /* This is where we actually charge the guy 
   This can be called anytime a call is in progress or at the end of a call before the session is destroyed */
 static switch_status_t do_billing(switch_core_session_t *session)
@@ -463,7 +920,7 @@ static switch_status_t do_billing(switch_core_session_t *session)
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "Not billing %s - call is not in answered state\n", billaccount);
 
 		/* See if this person has enough money left to continue the call */
-		balance = get_balance(billaccount, channel);
+		balance = account_balance(billaccount, channel, NULL);
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "Comparing %f to hangup balance of %f\n", balance, nobal_amt);
 		if (balance <= nobal_amt) {
 			/* Not enough money - reroute call to nobal location */
@@ -527,7 +984,7 @@ static switch_status_t do_billing(switch_core_session_t *session)
 						  uuid, nibble_data->total);
 
 		/* DO ODBC BILLING HERE and reset counters if it's successful! */
-		if (bill_event(billamount, billaccount, channel) == SWITCH_TRUE) {
+		if (account_debit(billamount, billaccount, channel) == SWITCH_TRUE) {
 			/* Increment total cost */
 			nibble_data->total += billamount;
 
@@ -550,8 +1007,14 @@ static switch_status_t do_billing(switch_core_session_t *session)
 
 		/* don't verify balance and transfer to nobal if we're done with call */
 		if (switch_channel_get_state(channel) != CS_REPORTING && switch_channel_get_state(channel) != CS_HANGUP) {
-			
-			balance = get_balance(billaccount, channel);
+
+			if (globals.flush_thread) {
+				/* Hold the next interval's worth against the account so concurrent calls can't overspend it */
+				double interval = !switch_strlen_zero(billincrement) ? atof(billincrement) : globals.global_heartbeat;
+				cache_reserve(billaccount, nibble_data, atof(billrate) / 60 * interval);
+			}
+
+			balance = account_balance(billaccount, channel, nibble_data);
 			
 			/* See if we've achieved low balance */
 			if (!nibble_data->lowbal_action_executed && balance <= lowbal_amt) {
@@ -790,7 +1253,7 @@ static void nibblebill_adjust(switch_core_session_t *session, double amount)
 	}
 
 	/* Add or remove amount from adjusted billing here. Note, we bill the OPPOSITE */
-	if (bill_event(-amount, billaccount, channel) == SWITCH_TRUE) {
+	if (account_debit(-amount, billaccount, channel) == SWITCH_TRUE) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Recorded adjustment to %s for $%f\n", billaccount, amount);
 	} else {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Failed to record adjustment to %s for $%f\n", billaccount, amount);
@@ -903,6 +1366,7 @@ static switch_status_t process_hangup(switch_core_session_t *session)
 {
 	const char* billaccount;
 	switch_channel_t *channel = NULL;
+	nibble_data_t *nibble_data;
 
 	channel = switch_core_session_get_channel(session);
 	
@@ -913,8 +1377,15 @@ static switch_status_t process_hangup(switch_core_session_t *session)
 	do_billing(session);
 
 	billaccount = switch_channel_get_variable(channel, "nibble_account");
+
+	/* The call is over, give back what it held against the cached balance */
+	if (billaccount && globals.flush_thread && switch_channel_get_state(channel) >= CS_HANGUP &&
+		(nibble_data = (nibble_data_t *) switch_channel_get_private(channel, "_nibble_data_")) && nibble_data->reserved > 0) {
+		cache_reserve(billaccount, nibble_data, 0);
+	}
+
 	if (billaccount) {
-		switch_channel_set_variable_printf(channel, "nibble_current_balance", "%f", get_balance(billaccount, channel));
+		switch_channel_set_variable_printf(channel, "nibble_current_balance", "%f", account_balance(billaccount, channel, NULL));
 	}			
 	
 	return SWITCH_STATUS_SUCCESS;
@@ -949,10 +1420,19 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_nibblebill_load)
 	/* Set every byte in this structure to 0 */
 	memset(&globals, 0, sizeof(globals));
 	globals.pool = pool;
+	globals.journal_fd = -1;
 	switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, globals.pool);
 
 	nibblebill_load_config();
 
+	if (globals.balance_cache) {
+		if (globals.odbc_dsn) {
+			cache_start();
+		} else {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "balance_cache needs odbc-dsn, billing directly\n");
+		}
+	}
+
 	/* connect my internal structure to the blank pointer passed to me */
 	*module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
@@ -982,6 +1462,7 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_nibblebill_shutdown)
 {
 	switch_event_unbind(&globals.node);
 	switch_core_remove_state_handler(&nibble_state_handler);
+	cache_stop();
 	switch_odbc_handle_disconnect(globals.master_odbc);
 	
 	switch_safe_free(globals.dbname);
@@ -994,6 +1475,7 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_nibblebill_shutdown)
 	switch_safe_free(globals.percall_action);
 	switch_safe_free(globals.lowbal_action);
 	switch_safe_free(globals.nobal_action);
+	switch_safe_free(globals.journal_file);
 
 	return SWITCH_STATUS_UNLOAD;
 }
@@ -173,6 +173,11 @@ struct vm_profile {
 	switch_bool_t auto_playback_recordings;
 	switch_bool_t db_password_override;
 	switch_bool_t allow_empty_password_auth;
+	uint32_t mwi_cache_ttl;
+	switch_hash_t *mwi_cache;
+	switch_mutex_t *mwi_cache_mutex;
+	uint32_t mwi_cache_gen;
+	time_t mwi_cache_swept;
 	switch_thread_rwlock_t *rwlock;
 	switch_memory_pool_t *pool;
 	uint32_t flags;
@@ -344,9 +349,42 @@ static char *vm_index_list[] = {
 	NULL
 };
 
+/* Cached message counts, one list of folders per user@domain */
+struct vm_mwi_folder {
+	char *name;
+	int total_new_messages;
+	int total_new_urgent_messages;
+	int total_saved_messages;
+	int total_saved_urgent_messages;
+	time_t expires;
+	struct vm_mwi_folder *next;
+};
+typedef struct vm_mwi_folder vm_mwi_folder_t;
+
+static void vm_mwi_folder_free(vm_mwi_folder_t *folder)
+{
+	vm_mwi_folder_t *next;
+
+	for (; folder; folder = next) {
+		next = folder->next;
+		switch_safe_free(folder->name);
+		free(folder);
+	}
+}
+
+static switch_bool_t vm_mwi_cache_free_callback(const void *key, const void *val, void *pData)
+{
+	vm_mwi_folder_free((vm_mwi_folder_t *) val);
+	return SWITCH_TRUE;
+}
+
 static void free_profile(vm_profile_t *profile)
 {
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Destroying Profile %s\n", profile->name);
+	if (profile->mwi_cache) {
+		switch_core_hash_delete_multi(profile->mwi_cache, vm_mwi_cache_free_callback, NULL);
+		switch_core_hash_destroy(&profile->mwi_cache);
+	}
 	switch_core_destroy_memory_pool(&profile->pool);
 }
 
@@ -391,6 +429,7 @@ static switch_xml_config_int_options_t config_int_0_1000 = { SWITCH_TRUE, 0, SWI
 static switch_xml_config_int_options_t config_int_digit_timeout = { SWITCH_TRUE, 0, SWITCH_TRUE, 30000 };
 static switch_xml_config_int_options_t config_int_max_logins = { SWITCH_TRUE, 0, SWITCH_TRUE, 10 };
 static switch_xml_config_int_options_t config_int_ht_0 = { SWITCH_TRUE, 0 };
+static switch_xml_config_int_options_t config_int_0_86400 = { SWITCH_TRUE, 0, SWITCH_TRUE, 86400 };
 
 static switch_xml_config_enum_item_t config_play_date_announcement[] = {
 	{"first", VM_DATE_FIRST},
@@ -675,6 +714,8 @@ vm_profile_t *profile_set_config(vm_profile_t *profile)
 	SWITCH_CONFIG_SET_ITEM(profile->config[i++], "allow-empty-password-auth", SWITCH_CONFIG_BOOL, CONFIG_RELOADABLE,
 						   &profile->allow_empty_password_auth, SWITCH_TRUE, NULL, NULL, NULL);
 	SWITCH_CONFIG_SET_ITEM(profile->config[i++], "auto-playback-recordings", SWITCH_CONFIG_BOOL, CONFIG_RELOADABLE, &profile->auto_playback_recordings, SWITCH_FALSE, NULL, NULL, NULL); 
+	SWITCH_CONFIG_SET_ITEM(profile->config[i++], "mwi-cache-ttl", SWITCH_CONFIG_INT, CONFIG_RELOADABLE,
+						   &profile->mwi_cache_ttl, 300, &config_int_0_86400, "seconds", NULL);
 
 	switch_assert(i < VM_PROFILE_CONFIGITEM_COUNT);
 
@@ -746,6 +787,11 @@ static vm_profile_t *load_profile(const char *profile_name)
 			goto end;
 		}
 
+		if (!zstr(profile->odbc_dsn) && !switch_event_get_header(event, "mwi-cache-ttl")) {
+			/* other hosts sharing the db change boxes without flushing our cache */
+			profile->mwi_cache_ttl = 0;
+		}
+
 		switch_thread_rwlock_create(&profile->rwlock, pool);
 		profile->name = switch_core_strdup(pool, profile_name);
 
@@ -774,6 +820,8 @@ static vm_profile_t *load_profile(const char *profile_name)
 		switch_cache_db_release_db_handle(&dbh);
 
 		switch_mutex_init(&profile->mutex, SWITCH_MUTEX_NESTED, profile->pool);
+		switch_mutex_init(&profile->mwi_cache_mutex, SWITCH_MUTEX_NESTED, profile->pool);
+		switch_core_hash_init(&profile->mwi_cache, profile->pool);
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Added Profile %s\n", profile->name);
 		switch_core_hash_insert(globals.profile_hash, profile->name, profile);
 	}
@@ -1350,6 +1398,198 @@ static char *resolve_id(const char *myid, const char *domain_name, const char *a
 	return ret;
 }
 
+static switch_bool_t vm_mwi_cache_sweep_callback(const void *key, const void *val, void *pData)
+{
+	vm_mwi_folder_t *folder;
+	time_t now = *(time_t *) pData;
+
+	for (folder = (vm_mwi_folder_t *) val; folder; folder = folder->next) {
+		if (folder->expires > now) {
+			return SWITCH_FALSE;
+		}
+	}
+
+	vm_mwi_folder_free((vm_mwi_folder_t *) val);
+	return SWITCH_TRUE;
+}
+
+static switch_bool_t vm_mwi_cache_domain_callback(const void *key, const void *val, void *pData)
+{
+	const char *domain_name = (const char *) pData;
+	const char *p;
+
+	if ((p = strrchr((const char *) key, '@')) && !strcasecmp(p + 1, domain_name)) {
+		vm_mwi_folder_free((vm_mwi_folder_t *) val);
+		return SWITCH_TRUE;
+	}
+
+	return SWITCH_FALSE;
+}
+
+/* Returns the generation the caller must hand back to vm_mwi_cache_set, or 0 on a hit */
+static uint32_t vm_mwi_cache_get(vm_profile_t *profile, const char *id, const char *domain_name, const char *myfolder, msg_cnt_callback_t *cbt)
+{
+	vm_mwi_folder_t *folder;
+	char *key;
+	time_t now = switch_epoch_time_now(NULL);
+	uint32_t gen = 0;
+
+	if (!profile->mwi_cache_ttl) {
+		return 1;
+	}
+
+	key = switch_mprintf("%s@%s", id, domain_name);
+
+	switch_mutex_lock(profile->mwi_cache_mutex);
+
+	/* entries are only revalidated on read, so drop the ones nobody asked for in a while */
+	if (now - profile->mwi_cache_swept >= (time_t) profile->mwi_cache_ttl) {
+		switch_core_hash_delete_multi(profile->mwi_cache, vm_mwi_cache_sweep_callback, &now);
+		profile->mwi_cache_swept = now;
+	}
+
+	for (folder = (vm_mwi_folder_t *) switch_core_hash_find(profile->mwi_cache, key); folder; folder = folder->next) {
+		if (!strcmp(folder->name, myfolder)) {
+			break;
+		}
+	}
+
+	if (folder && folder->expires > now) {
+		cbt->total_new_messages = folder->total_new_messages;
+		cbt->total_new_urgent_messages = folder->total_new_urgent_messages;
+		cbt->total_saved_messages = folder->total_saved_messages;
+		cbt->total_saved_urgent_messages = folder->total_saved_urgent_messages;
+	} else if (!(gen = ++profile->mwi_cache_gen)) {
+		gen = ++profile->mwi_cache_gen;
+	}
+
+	switch_mutex_unlock(profile->mwi_cache_mutex);
+
+	free(key);
+
+	return gen;
+}
+
+static void vm_mwi_cache_set(vm_profile_t *profile, const char *id, const char *domain_name, const char *myfolder, msg_cnt_callback_t *cbt, uint32_t gen)
+{
+	vm_mwi_folder_t *folder, *head;
+	char *key;
+
+	if (!profile->mwi_cache_ttl) {
+		return;
+	}
+
+	key = switch_mprintf("%s@%s", id, domain_name);
+
+	switch_mutex_lock(profile->mwi_cache_mutex);
+
+	/* something changed the box while we were counting, the next reader will count again */
+	if (gen != profile->mwi_cache_gen) {
+		goto end;
+	}
+
+	head = (vm_mwi_folder_t *) switch_core_hash_find(profile->mwi_cache, key);
+
+	for (folder = head; folder; folder = folder->next) {
+		if (!strcmp(folder->name, myfolder)) {
+			break;
+		}
+	}
+
+	if (!folder) {
+		switch_zmalloc(folder, sizeof(*folder));
+		folder->name = strdup(myfolder);
+		folder->next = head;
+		switch_core_hash_insert(profile->mwi_cache, key, folder);
+	}
+
+	folder->total_new_messages = cbt->total_new_messages;
+	folder->total_new_urgent_messages = cbt->total_new_urgent_messages;
+	folder->total_saved_messages = cbt->total_saved_messages;
+	folder->total_saved_urgent_messages = cbt->total_saved_urgent_messages;
+	folder->expires = switch_epoch_time_now(NULL) + profile->mwi_cache_ttl;
+
+  end:
+
+	switch_mutex_unlock(profile->mwi_cache_mutex);
+
+	free(key);
+}
+
+/* A new unread message landed in the folder, count it without asking the db */
+static void vm_mwi_cache_add(vm_profile_t *profile, const char *id, const char *domain_name, const char *myfolder, const char *read_flags)
+{
+	vm_mwi_folder_t *folder;
+	char *key;
+
+	if (!profile->mwi_cache_ttl) {
+		return;
+	}
+
+	key = switch_mprintf("%s@%s", id, domain_name);
+
+	switch_mutex_lock(profile->mwi_cache_mutex);
+	profile->mwi_cache_gen++;
+
+	for (folder = (vm_mwi_folder_t *) switch_core_hash_find(profile->mwi_cache, key); folder; folder = folder->next) {
+		if (!strcmp(folder->name, myfolder)) {
+			if (!strcasecmp(switch_str_nil(read_flags), URGENT_FLAG_STRING)) {
+				folder->total_new_urgent_messages++;
+			} else {
+				folder->total_new_messages++;
+			}
+			break;
+		}
+	}
+	switch_mutex_unlock(profile->mwi_cache_mutex);
+
+	free(key);
+}
+
+/* Forget the counts of one box, or of every box in the domain when id is NULL */
+static void vm_mwi_cache_flush(vm_profile_t *profile, const char *id, const char *domain_name)
+{
+	vm_mwi_folder_t *folder;
+	char *key;
+
+	if (!profile->mwi_cache || zstr(domain_name)) {
+		return;
+	}
+
+	switch_mutex_lock(profile->mwi_cache_mutex);
+	profile->mwi_cache_gen++;
+
+	if (id) {
+		key = switch_mprintf("%s@%s", id, domain_name);
+		if ((folder = (vm_mwi_folder_t *) switch_core_hash_find(profile->mwi_cache, key))) {
+			switch_core_hash_delete(profile->mwi_cache, key);
+			vm_mwi_folder_free(folder);
+		}
+		free(key);
+	} else {
+		switch_core_hash_delete_multi(profile->mwi_cache, vm_mwi_cache_domain_callback, (void *) domain_name);
+	}
+
+	switch_mutex_unlock(profile->mwi_cache_mutex);
+}
+
+/* For ids that did not come through resolve_id(), the cache is keyed by the id message_count() resolves */
+static void vm_mwi_cache_flush_id(vm_profile_t *profile, const char *id_in, const char *domain_name)
+{
+	char *myid;
+
+	if (!profile->mwi_cache || zstr(domain_name)) {
+		return;
+	}
+
+	myid = resolve_id(id_in, domain_name, "message-count");
+	vm_mwi_cache_flush(profile, myid, domain_name);
+
+	if (myid != id_in) {
+		free(myid);
+	}
+}
+
 static void message_count(vm_profile_t *profile, const char *id_in, const char *domain_name, const char *myfolder, int *total_new_messages,
 						  int *total_saved_messages, int *total_new_urgent_messages, int *total_saved_urgent_messages)
 {
@@ -1357,6 +1597,7 @@ static void message_count(vm_profile_t *profile, const char *id_in, const char *
 	msg_cnt_callback_t cbt = { 0 };
 	char *sql;
 	char *myid = NULL;
+	uint32_t gen;
 
 
 	cbt.buf = msg_count;
@@ -1369,6 +1610,10 @@ static void message_count(vm_profile_t *profile, const char *id_in, const char *
 
 	myid = resolve_id(id_in, domain_name, "message-count");
 
+	if (!(gen = vm_mwi_cache_get(profile, myid, domain_name, myfolder, &cbt))) {
+		goto done;
+	}
+
 	sql = switch_mprintf(
 						 "select 1, read_flags, count(read_epoch) from voicemail_msgs where "
 						 "username='%q' and domain='%q' and in_folder='%q' and read_epoch=0 "
@@ -1384,6 +1629,10 @@ static void message_count(vm_profile_t *profile, const char *id_in, const char *
 	vm_execute_sql_callback(profile, profile->mutex, sql, message_count_callback, &cbt);
 	free(sql);
 
+	vm_mwi_cache_set(profile, myid, domain_name, myfolder, &cbt, gen);
+
+  done:
+
 	*total_new_messages = cbt.total_new_messages + cbt.total_new_urgent_messages;
 	*total_new_urgent_messages = cbt.total_new_urgent_messages;
 	*total_saved_messages = cbt.total_saved_messages + cbt.total_saved_urgent_messages;
@@ -2108,6 +2357,7 @@ static void voicemail_check_main(switch_core_session_t *session, vm_profile_t *p
 				vm_execute_sql_callback(profile, profile->mutex, sql, unlink_callback, NULL);
 				switch_snprintfv(sql, sizeof(sql), "delete from voicemail_msgs where username='%q' and domain='%q' and flags='delete'", myid, domain_name);
 				vm_execute_sql(profile, sql, profile->mutex);
+				vm_mwi_cache_flush(profile, myid, domain_name);
 				vm_check_state = VM_CHECK_FOLDER_SUMMARY;
 
 				update_mwi(profile, myid, domain_name, myfolder, MWI_REASON_PURGE);
@@ -2793,6 +3043,7 @@ static switch_status_t deliver_vm(vm_profile_t *profile,
 
 		vm_execute_sql(profile, usql, profile->mutex);
 		switch_safe_free(usql);
+		vm_mwi_cache_add(profile, myid, domain_name, myfolder, read_flags);
 
 		update_mwi(profile, myid, domain_name, myfolder, MWI_REASON_NEW);
 	}
@@ -4101,6 +4352,7 @@ static void do_play(vm_profile_t *profile, char *user_in, char *domain, char *fi
 
 	vm_execute_sql(profile, sql, profile->mutex);
 	free(sql);
+	vm_mwi_cache_flush(profile, user, domain);
 
 	sql = switch_mprintf("select created_epoch, read_epoch, username, domain, uuid, cid_name, cid_number, in_folder, file_path, message_len, flags, read_flags, forwarded_by from voicemail_msgs where username='%s' and domain='%s' and file_path like '%%%s' order by created_epoch",
 						 user, domain, file);
@@ -4139,6 +4391,7 @@ static void do_del(vm_profile_t *profile, char *user_in, char *domain, char *fil
 	sql = switch_mprintf("delete from voicemail_msgs where username='%s' and domain='%s' and file_path like '%%%s'", user, domain, file);
 	vm_execute_sql(profile, sql, profile->mutex);
 	free(sql);
+	vm_mwi_cache_flush(profile, user, domain);
 
 	update_mwi(profile, user, domain, myfolder, MWI_REASON_DELETE);
 
@@ -4527,6 +4780,7 @@ SWITCH_STANDARD_API(voicemail_delete_api_function)
 
 		vm_execute_sql(profile, sql, profile->mutex);
 		switch_safe_free(sql);
+		vm_mwi_cache_flush_id(profile, id, domain);
 		
 		update_mwi(profile, id, domain, "inbox", MWI_REASON_DELETE);
 	
@@ -4609,6 +4863,11 @@ SWITCH_STANDARD_API(voicemail_read_api_function)
 
 		vm_execute_sql(profile, sql, profile->mutex);
 		switch_safe_free(sql);
+		if (uuid) {
+			vm_mwi_cache_flush_id(profile, id, domain);
+		} else {
+			vm_mwi_cache_flush(profile, NULL, domain);
+		}
 		
 		update_mwi(profile, id, domain, "inbox", MWI_REASON_READ);
 	
@@ -4931,6 +5190,7 @@ static int message_purge_callback(void *pArg, int argc, char **argv, char **colu
 		sql = switch_mprintf("DELETE FROM voicemail_msgs WHERE username='%q' AND domain='%q' AND uuid = '%q'", id, domain, uuid);
 		vm_execute_sql(profile, sql, profile->mutex);
 		switch_safe_free(sql);
+		vm_mwi_cache_flush_id(profile, id, domain);
 	}
 	profile_rwunlock(profile);
 
@@ -37,6 +37,8 @@
 #include <string.h>
 
 #define FRAME_QUEUE_LEN 3
+/* queued frames plus the one the reader is holding plus one spare */
+#define FRAME_RING_LEN (FRAME_QUEUE_LEN + 2)
 
 SWITCH_MODULE_LOAD_FUNCTION(mod_loopback_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_loopback_shutdown);
@@ -60,6 +62,16 @@ typedef enum {
 	TFLAG_CLEAR = (1 << 10)
 } TFLAGS;
 
+/* A preallocated frame slot.  The writing leg fills a free slot of its peer's ring and queues it,
+   the reading leg hands it to the core and releases it on the next read, so media moves between
+   the legs without any allocation. */
+typedef struct loopback_frame {
+	switch_frame_t frame;
+	unsigned char databuf[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	switch_time_t queued;
+	int refs;
+} loopback_frame_t;
+
 struct private_object {
 	unsigned int flags;
 	switch_mutex_t *flag_mutex;
@@ -74,9 +86,10 @@ struct private_object {
 	switch_frame_t read_frame;
 	unsigned char databuf[SWITCH_RECOMMENDED_BUFFER_SIZE];
 
-	switch_frame_t *x_write_frame;
-	switch_frame_t *write_frame;
-	unsigned char write_databuf[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	loopback_frame_t *write_frame;
+	loopback_frame_t frame_ring[FRAME_RING_LEN];
+	switch_mutex_t *ring_mutex;
+	uint32_t ring_pos;
 
 	switch_frame_t cng_frame;
 	unsigned char cng_databuf[SWITCH_RECOMMENDED_BUFFER_SIZE];
@@ -86,6 +99,9 @@ struct private_object {
 	char *other_uuid;
 	switch_queue_t *frame_queue;
 	int64_t packet_count;
+	/* bumped by the peer's write thread without ring_mutex held */
+	switch_atomic_t dropped_frames;
+	uint32_t late_frames;
 	int first_cng;
 };
 
@@ -93,6 +109,10 @@ typedef struct private_object private_t;
 
 static struct {
 	int debug;
+	switch_mutex_t *mutex;
+	uint64_t frames;
+	uint64_t dropped_frames;
+	uint64_t late_frames;
 } globals;
 
 static switch_status_t channel_on_init(switch_core_session_t *session);
@@ -110,15 +130,54 @@ static switch_status_t channel_write_frame(switch_core_session_t *session, switc
 static switch_status_t channel_kill_channel(switch_core_session_t *session, int sig);
 
 
-static void clear_queue(private_t *tech_pvt)
+static loopback_frame_t *ring_get(private_t *tech_pvt)
+{
+	loopback_frame_t *lf = NULL;
+	uint32_t i;
+
+	switch_mutex_lock(tech_pvt->ring_mutex);
+	for (i = 0; i < FRAME_RING_LEN; i++) {
+		loopback_frame_t *slot = &tech_pvt->frame_ring[(tech_pvt->ring_pos + i) % FRAME_RING_LEN];
+
+		if (!slot->refs) {
+			slot->refs++;
+			tech_pvt->ring_pos = (tech_pvt->ring_pos + i + 1) % FRAME_RING_LEN;
+			lf = slot;
+			break;
+		}
+	}
+	switch_mutex_unlock(tech_pvt->ring_mutex);
+
+	return lf;
+}
+
+static void ring_release(private_t *tech_pvt, loopback_frame_t **lf)
+{
+	if (!*lf) {
+		return;
+	}
+
+	switch_mutex_lock(tech_pvt->ring_mutex);
+	if ((*lf)->refs > 0) {
+		(*lf)->refs--;
+	}
+	switch_mutex_unlock(tech_pvt->ring_mutex);
+
+	*lf = NULL;
+}
+
+static uint32_t clear_queue(private_t *tech_pvt)
 {
 	void *pop;
+	uint32_t cleared = 0;
 
 	while (switch_queue_trypop(tech_pvt->frame_queue, &pop) == SWITCH_STATUS_SUCCESS && pop) {
-		switch_frame_t *frame = (switch_frame_t *) pop;
-		switch_frame_free(&frame);
+		loopback_frame_t *lf = (loopback_frame_t *) pop;
+		ring_release(tech_pvt, &lf);
+		cleared++;
 	}
 
+	return cleared;
 }
 
 static switch_status_t tech_init(private_t *tech_pvt, switch_core_session_t *session, switch_codec_t *codec)
@@ -129,6 +188,7 @@ static switch_status_t tech_init(private_t *tech_pvt, switch_core_session_t *ses
 	switch_status_t status = SWITCH_STATUS_SUCCESS;
 	switch_channel_t *channel = switch_core_session_get_channel(session);
 	const switch_codec_implementation_t *read_impl;
+	int i;
 
 	if (codec) {
 		iananame = codec->implementation->iananame;
@@ -206,7 +266,12 @@ static switch_status_t tech_init(private_t *tech_pvt, switch_core_session_t *ses
 		switch_mutex_init(&tech_pvt->flag_mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
 		switch_mutex_init(&tech_pvt->mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
 		switch_core_session_set_private(session, tech_pvt);
+		switch_mutex_init(&tech_pvt->ring_mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
 		switch_queue_create(&tech_pvt->frame_queue, FRAME_QUEUE_LEN, switch_core_session_get_pool(session));
+		for (i = 0; i < FRAME_RING_LEN; i++) {
+			tech_pvt->frame_ring[i].frame.data = tech_pvt->frame_ring[i].databuf;
+			tech_pvt->frame_ring[i].frame.buflen = sizeof(tech_pvt->frame_ring[i].databuf);
+		}
 		tech_pvt->session = session;
 		tech_pvt->channel = switch_core_session_get_channel(session);
 	}
@@ -460,7 +525,6 @@ static switch_status_t channel_on_destroy(switch_core_session_t *session)
 {
 	switch_channel_t *channel = NULL;
 	private_t *tech_pvt = NULL;
-	void *pop;
 	switch_event_t *vars;
 
 	channel = switch_core_session_get_channel(session);
@@ -484,14 +548,8 @@ static switch_status_t channel_on_destroy(switch_core_session_t *session)
 			switch_core_codec_destroy(&tech_pvt->write_codec);
 		}
 
-		if (tech_pvt->write_frame) {
-			switch_frame_free(&tech_pvt->write_frame);
-		}
-
-		while (switch_queue_trypop(tech_pvt->frame_queue, &pop) == SWITCH_STATUS_SUCCESS && pop) {
-			switch_frame_t *frame = (switch_frame_t *) pop;
-			switch_frame_free(&frame);
-		}
+		ring_release(tech_pvt, &tech_pvt->write_frame);
+		clear_queue(tech_pvt);
 	}
 
 
@@ -513,6 +571,15 @@ static switch_status_t channel_on_hangup(switch_core_session_t *session)
 
 	switch_clear_flag_locked(tech_pvt, TFLAG_LINKED);
 
+	switch_channel_set_variable_printf(channel, "loopback_dropped_frames", "%u", switch_atomic_read(&tech_pvt->dropped_frames));
+	switch_channel_set_variable_printf(channel, "loopback_late_frames", "%u", tech_pvt->late_frames);
+
+	switch_mutex_lock(globals.mutex);
+	globals.frames += tech_pvt->packet_count;
+	globals.dropped_frames += switch_atomic_read(&tech_pvt->dropped_frames);
+	globals.late_frames += tech_pvt->late_frames;
+	switch_mutex_unlock(globals.mutex);
+
 	switch_mutex_lock(tech_pvt->mutex);
 	if (tech_pvt->other_tech_pvt) {
 		switch_clear_flag_locked(tech_pvt->other_tech_pvt, TFLAG_LINKED);
@@ -672,15 +739,17 @@ static switch_status_t channel_read_frame(switch_core_session_t *session, switch
 	}
 
 	if (switch_queue_trypop(tech_pvt->frame_queue, &pop) == SWITCH_STATUS_SUCCESS && pop) {
-		if (tech_pvt->write_frame) {
-			switch_frame_free(&tech_pvt->write_frame);
+		/* the slot handed out on the last read is done with now */
+		ring_release(tech_pvt, &tech_pvt->write_frame);
+
+		tech_pvt->write_frame = (loopback_frame_t *) pop;
+		if (switch_micro_time_now() - tech_pvt->write_frame->queued > tech_pvt->read_codec.implementation->microseconds_per_packet * 2) {
+			tech_pvt->late_frames++;
 		}
-		
-		tech_pvt->write_frame = (switch_frame_t *) pop;
-		tech_pvt->write_frame->codec = &tech_pvt->read_codec;
-		*frame = tech_pvt->write_frame;
+		tech_pvt->write_frame->frame.codec = &tech_pvt->read_codec;
+		*frame = &tech_pvt->write_frame->frame;
 		tech_pvt->packet_count++;
-		switch_clear_flag(tech_pvt->write_frame, SFF_CNG);
+		switch_clear_flag((&tech_pvt->write_frame->frame), SFF_CNG);
 		tech_pvt->first_cng = 0;
 	} else {
 		*frame = &tech_pvt->cng_frame;
@@ -856,33 +925,50 @@ static switch_status_t channel_write_frame(switch_core_session_t *session, switc
 	}
 
 	if (switch_test_flag(tech_pvt, TFLAG_LINKED) && tech_pvt->other_tech_pvt) {
-		switch_frame_t *clone;
-		
+		private_t *peer = tech_pvt->other_tech_pvt;
+		loopback_frame_t *lf;
+
 		if (frame->codec->implementation != tech_pvt->write_codec.implementation) {
 			/* change codecs to match */
 			tech_init(tech_pvt, session, frame->codec);
-			tech_init(tech_pvt->other_tech_pvt, tech_pvt->other_session, frame->codec);
+			tech_init(peer, tech_pvt->other_session, frame->codec);
 		}
 
-
-		if (switch_frame_dup(frame, &clone) != SWITCH_STATUS_SUCCESS) {
-			abort();
+		if (frame->datalen > sizeof(peer->frame_ring[0].databuf) || !(lf = ring_get(peer))) {
+			switch_atomic_inc(&peer->dropped_frames);
+			status = SWITCH_STATUS_SUCCESS;
+			goto done;
 		}
-		
-		if ((status = switch_queue_trypush(tech_pvt->other_tech_pvt->frame_queue, clone)) != SWITCH_STATUS_SUCCESS) { 
-			clear_queue(tech_pvt->other_tech_pvt);
-			status = switch_queue_trypush(tech_pvt->other_tech_pvt->frame_queue, clone);
+
+		/* both legs run the same codec implementation from here on, so the frame goes across as is:
+		   one header assignment and one payload copy into a slot the peer already owns */
+		lf->frame = *frame;
+		lf->frame.data = lf->databuf;
+		lf->frame.buflen = sizeof(lf->databuf);
+		lf->frame.codec = NULL;
+		lf->frame.packet = NULL;
+		lf->frame.packetlen = 0;
+		switch_clear_flag((&lf->frame), SFF_DYNAMIC);
+		memcpy(lf->databuf, frame->data, frame->datalen);
+		lf->queued = switch_micro_time_now();
+
+		if ((status = switch_queue_trypush(peer->frame_queue, lf)) != SWITCH_STATUS_SUCCESS) { 
+			switch_atomic_add(&peer->dropped_frames, clear_queue(peer));
+			status = switch_queue_trypush(peer->frame_queue, lf);
 		}
 
 		if (status == SWITCH_STATUS_SUCCESS) {
-			switch_set_flag_locked(tech_pvt->other_tech_pvt, TFLAG_WRITE);
+			switch_set_flag_locked(peer, TFLAG_WRITE);
 		} else {
-			switch_frame_free(&clone);
+			switch_atomic_inc(&peer->dropped_frames);
+			ring_release(peer, &lf);
 		}
 
 		status = SWITCH_STATUS_SUCCESS;
 	}
 
+  done:
+
 	switch_mutex_unlock(tech_pvt->mutex);
 
 	return status;
@@ -1199,11 +1285,24 @@ static switch_io_routines_t channel_io_routines = {
 
 SWITCH_STANDARD_APP(unloop_function) { /* NOOP */}
 
+SWITCH_STANDARD_API(loopback_stats_function)
+{
+	switch_mutex_lock(globals.mutex);
+	stream->write_function(stream, "frames: %" SWITCH_UINT64_T_FMT "\n", globals.frames);
+	stream->write_function(stream, "dropped_frames: %" SWITCH_UINT64_T_FMT "\n", globals.dropped_frames);
+	stream->write_function(stream, "late_frames: %" SWITCH_UINT64_T_FMT "\n", globals.late_frames);
+	switch_mutex_unlock(globals.mutex);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_loopback_load)
 {
 	switch_application_interface_t *app_interface;
+	switch_api_interface_t *api_interface;
 
 	memset(&globals, 0, sizeof(globals));
+	switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
 
 	/* connect my internal structure to the blank pointer passed to me */
 	*module_interface = switch_loadable_module_create_module_interface(pool, modname);
@@ -1213,6 +1312,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_loopback_load)
 	loopback_endpoint_interface->state_handler = &channel_event_handlers;
 
 	SWITCH_ADD_APP(app_interface, "unloop", "Tell loopback to unfold", "Tell loopback to unfold", unloop_function, "", SAF_NO_LOOPBACK);
+	SWITCH_ADD_API(api_interface, "loopback_stats", "Show loopback frame counters for completed legs", loopback_stats_function, "");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
@@ -3048,6 +3048,33 @@ static int sql2str_callback(void *pArg, int argc, char **argv, char **columnName
 	return 0;
 }
 
+typedef struct {
+	uint64_t sent;
+	uint32_t rate;
+	uint32_t rtt_avg;
+	uint32_t rtt_last;
+	uint32_t loss;
+} nat_ping_stats_t;
+
+static void sofia_profile_nat_ping_stats(sofia_profile_t *profile, nat_ping_stats_t *stats)
+{
+	uint32_t interval = profile->nat_ping_seconds ? profile->nat_ping_seconds : (uint32_t) profile->ireg_seconds;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!profile->nat_ping.mutex) {
+		return;
+	}
+
+	switch_mutex_lock(profile->nat_ping.mutex);
+	stats->sent = profile->nat_ping.sent;
+	stats->rate = interval ? profile->nat_ping.last_round_sent / interval : 0;
+	stats->rtt_avg = profile->nat_ping.answered ? (uint32_t) (profile->nat_ping.rtt_total / profile->nat_ping.answered / 1000) : 0;
+	stats->rtt_last = (uint32_t) (profile->nat_ping.rtt_last / 1000);
+	stats->loss = profile->nat_ping.sent ? (uint32_t) ((profile->nat_ping.failed + profile->nat_ping.lost) * 100 / profile->nat_ping.sent) : 0;
+	switch_mutex_unlock(profile->nat_ping.mutex);
+}
+
 static uint32_t sofia_profile_reg_count(sofia_profile_t *profile)
 {
 	struct cb_helper_sql2str cb;
@@ -3237,6 +3264,15 @@ static switch_status_t cmd_status(char **argv, int argc, switch_stream_handle_t
 					stream->write_function(stream, "CALLS-OUT        \t%u\n", profile->ob_calls);
 					stream->write_function(stream, "FAILED-CALLS-OUT \t%u\n", profile->ob_failed_calls);
 					stream->write_function(stream, "REGISTRATIONS    \t%lu\n", sofia_profile_reg_count(profile));
+					if (sofia_test_pflag(profile, PFLAG_NAT_OPTIONS_PING) || sofia_test_pflag(profile, PFLAG_ALL_REG_OPTIONS_PING)) {
+						nat_ping_stats_t ping_stats;
+
+						sofia_profile_nat_ping_stats(profile, &ping_stats);
+						stream->write_function(stream, "NAT-PINGS-SENT   \t%" SWITCH_UINT64_T_FMT "\n", ping_stats.sent);
+						stream->write_function(stream, "NAT-PING-RATE    \t%u/sec\n", ping_stats.rate);
+						stream->write_function(stream, "NAT-PING-RTT     \t%ums avg, %ums last\n", ping_stats.rtt_avg, ping_stats.rtt_last);
+						stream->write_function(stream, "NAT-PING-LOSS    \t%u%%\n", ping_stats.loss);
+					}
 				}
 
 				cb.profile = profile;
@@ -3360,6 +3396,7 @@ static switch_status_t cmd_status(char **argv, int argc, switch_stream_handle_t
 	switch_mutex_unlock(mod_sofia_globals.hash_mutex);
 	stream->write_function(stream, "%s\n", line);
 	stream->write_function(stream, "%d profile%s %d alias%s\n", c, c == 1 ? "" : "s", ac, ac == 1 ? "" : "es");
+	sofia_presence_engine_status(stream);
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -3515,6 +3552,16 @@ static switch_status_t cmd_xml_status(char **argv, int argc, switch_stream_handl
 					stream->write_function(stream, "    <failed-calls-in>%u</failed-calls-in>\n", profile->ib_failed_calls);
 					stream->write_function(stream, "    <failed-calls-out>%u</failed-calls-out>\n", profile->ob_failed_calls);
 					stream->write_function(stream, "    <registrations>%lu</registrations>\n", sofia_profile_reg_count(profile));
+					if (sofia_test_pflag(profile, PFLAG_NAT_OPTIONS_PING) || sofia_test_pflag(profile, PFLAG_ALL_REG_OPTIONS_PING)) {
+						nat_ping_stats_t ping_stats;
+
+						sofia_profile_nat_ping_stats(profile, &ping_stats);
+						stream->write_function(stream, "    <nat-pings-sent>%" SWITCH_UINT64_T_FMT "</nat-pings-sent>\n", ping_stats.sent);
+						stream->write_function(stream, "    <nat-ping-rate>%u</nat-ping-rate>\n", ping_stats.rate);
+						stream->write_function(stream, "    <nat-ping-rtt-avg>%u</nat-ping-rtt-avg>\n", ping_stats.rtt_avg);
+						stream->write_function(stream, "    <nat-ping-rtt-last>%u</nat-ping-rtt-last>\n", ping_stats.rtt_last);
+						stream->write_function(stream, "    <nat-ping-loss>%u</nat-ping-loss>\n", ping_stats.loss);
+					}
 					stream->write_function(stream, "  </profile-info>\n");
 				}
 
@@ -4015,8 +4062,6 @@ SWITCH_STANDARD_API(sofia_count_reg_function)
 	}
 
 	if (user && profile_name) {
-		char *sql;
-
 		if (!(profile = sofia_glue_find_profile(profile_name))) {
 			profile_name = domain;
 			domain = NULL;
@@ -4027,34 +4072,21 @@ SWITCH_STANDARD_API(sofia_count_reg_function)
 		}
 
 		if (profile) {
-			struct cb_helper_sql2str cb;
-			char reg_count[80] = "";
-
-			cb.buf = reg_count;
-			cb.len = sizeof(reg_count);
+			sofia_registration_t *list, *np;
+			uint32_t reg_count = 0;
 
 			if (!domain || !strchr(domain, '.')) {
 				domain = profile->name;
 			}
 
-			if (zstr(user)) {
-				sql = switch_mprintf("select count(*) "
-									 "from sip_registrations where (sip_host='%q' or presence_hosts like '%%%q%%')",
-									 domain, domain);
-
-			} else {
-				sql = switch_mprintf("select count(*) "
-									 "from sip_registrations where sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-									 user, domain, domain);
-			}
-			switch_assert(sql);
-			sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sql2str_callback, &cb);
-			switch_safe_free(sql);
-			if (!zstr(reg_count)) {
-				stream->write_function(stream, "%s", reg_count);
-			} else {
-				stream->write_function(stream, "0");
+			/* the count always spanned every profile, sip_registrations trails the store so ask the stores */
+			list = sofia_reg_store_find_all(profile, zstr(user) ? NULL : user, domain, SOFIA_REG_FIND_PRESENCE_HOSTS);
+			for (np = list; np; np = np->next) {
+				reg_count++;
 			}
+			sofia_reg_store_free(&list);
+
+			stream->write_function(stream, "%u", reg_count);
 			reply = NULL;
 
 		}
@@ -4108,8 +4140,6 @@ SWITCH_STANDARD_API(sofia_username_of_function)
 	}
 
 	if (user && profile_name) {
-		char *sql;
-
 		if (!(profile = sofia_glue_find_profile(profile_name))) {
 			profile_name = domain;
 			domain = NULL;
@@ -4120,11 +4150,7 @@ SWITCH_STANDARD_API(sofia_username_of_function)
 		}
 
 		if (profile) {
-			struct cb_helper_sql2str cb;
-			char username[256] = "";
-
-			cb.buf = username;
-			cb.len = sizeof(username);
+			sofia_registration_t *list;
 
 			if (!domain || !strchr(domain, '.')) {
 				domain = profile->name;
@@ -4132,19 +4158,9 @@ SWITCH_STANDARD_API(sofia_username_of_function)
 
 			switch_assert(!zstr(user));
 
-			sql = switch_mprintf("select sip_username "
-									"from sip_registrations where sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-									user, domain, domain);
-
-			switch_assert(sql);
-
-			sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sql2str_callback, &cb);
-			switch_safe_free(sql);
-			if (!zstr(username)) {
-				stream->write_function(stream, "%s", username);
-			} else {
-				stream->write_function(stream, "");
-			}
+			list = sofia_reg_store_find_all(profile, user, domain, SOFIA_REG_FIND_PRESENCE_HOSTS);
+			stream->write_function(stream, "%s", list ? switch_str_nil(list->sip_username) : "");
+			sofia_reg_store_free(&list);
 			reply = NULL;
 
 		}
@@ -4172,7 +4188,8 @@ static void select_from_profile(sofia_profile_t *profile,
 								switch_bool_t dedup)
 {
 	struct cb_helper cb;
-	char *sql;
+	sofia_registration_t *list, *np;
+	char *argv[3];
 	
 	cb.row_process = 0;
 
@@ -4180,19 +4197,21 @@ static void select_from_profile(sofia_profile_t *profile,
 	cb.stream = stream;
 	cb.dedup = dedup;
 
-	if (exclude_contact) {
-		sql = switch_mprintf("select contact, profile_name, '%q' "
-							 "from sip_registrations where profile_name='%q' and sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%') "
-							 "and contact not like '%%%s%%'", (concat != NULL) ? concat : "", profile->name, user, domain, domain, exclude_contact);
-	} else {
-		sql = switch_mprintf("select contact, profile_name, '%q' "
-							 "from sip_registrations where profile_name='%q' and sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-							 (concat != NULL) ? concat : "", profile->name, user, domain, domain);
+	/* the store sees a REGISTER as soon as it is answered, sip_registrations only once the queued sql is flushed */
+	list = sofia_reg_store_find(profile, NULL, user, domain, NULL, SOFIA_REG_FIND_PRESENCE_HOSTS);
+
+	for (np = list; np; np = np->next) {
+		if (exclude_contact && switch_stristr(exclude_contact, np->contact)) {
+			continue;
+		}
+
+		argv[0] = np->contact;
+		argv[1] = profile->name;
+		argv[2] = (char *) ((concat != NULL) ? concat : "");
+		contact_callback(&cb, 3, argv, NULL);
 	}
 
-	switch_assert(sql);
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, contact_callback, &cb);
-	switch_safe_free(sql);
+	sofia_reg_store_free(&list);
 }
 
 SWITCH_STANDARD_API(sofia_contact_function)
@@ -393,6 +393,7 @@ struct mod_sofia_globals {
 	int presence_flush;
 	switch_thread_t *presence_thread;
 	uint32_t max_reg_threads;
+	uint32_t presence_coalesce_ms;
 };
 extern struct mod_sofia_globals mod_sofia_globals;
 
@@ -551,6 +552,67 @@ typedef enum {
 } sofia_paid_type_t;
 
 #define MAX_RTPIP 50
+#define SOFIA_REG_SHARDS 16
+#define SOFIA_REG_PING_SLOTS 64
+
+typedef struct sofia_registration sofia_registration_t;
+
+/* a sip_registrations row, the profile keeps these in memory and only mirrors them to the db */
+struct sofia_registration {
+	char *call_id;
+	char *sip_user;
+	char *sip_host;
+	char *presence_hosts;
+	char *contact;
+	char *status;
+	char *rpid;
+	char *user_agent;
+	char *server_user;
+	char *server_host;
+	char *network_ip;
+	char *network_port;
+	char *sip_username;
+	time_t expires;
+	uint32_t heap_pos;
+	switch_time_t ping_sent;
+	uint32_t ping_fails;
+	sofia_registration_t *next;
+	sofia_registration_t *next_call_id;
+	sofia_registration_t *ping_next;
+	sofia_registration_t **ping_pprev;
+};
+
+/* registrations are spread over shards by sip_user, each with its own lock, indexes and expiry heap */
+typedef struct {
+	switch_mutex_t *mutex;
+	switch_hash_t *users;
+	switch_hash_t *call_ids;
+	sofia_registration_t **heap;
+	uint32_t heap_used;
+	uint32_t heap_size;
+	uint32_t count;
+	sofia_registration_t *ping_wheel[SOFIA_REG_PING_SLOTS];
+} sofia_reg_shard_t;
+
+/* keepalive pings to registered contacts, contacts are spread over a wheel so each interval sends an even trickle */
+typedef struct {
+	switch_mutex_t *mutex;
+	uint32_t pos;
+	uint64_t sent;
+	uint64_t answered;
+	uint64_t failed;
+	uint64_t lost;
+	switch_time_t rtt_total;
+	switch_time_t rtt_last;
+	uint32_t round_sent;
+	uint32_t last_round_sent;
+} sofia_nat_ping_t;
+
+typedef enum {
+	SOFIA_REG_FIND_REMOVE = (1 << 0),
+	SOFIA_REG_FIND_PRESENCE_HOSTS = (1 << 1),
+	SOFIA_REG_FIND_NAT = (1 << 2)
+} sofia_reg_find_flag_t;
 
 struct sofia_profile {
 	int debug;
@@ -698,10 +760,17 @@ struct sofia_profile {
 	uint32_t sip_force_expires;
 	uint32_t sip_expires_max_deviation;
 	int ireg_seconds;
+	uint32_t nat_ping_seconds;
+	uint32_t nat_ping_max_fails;
+	uint32_t tcp_keepalive;
+	sofia_nat_ping_t nat_ping;
 	sofia_paid_type_t paid_type;
 	uint32_t rtp_digit_delay;
 	switch_queue_t *event_queue;
 	switch_thread_t *thread;		
+	sofia_reg_shard_t reg_shards[SOFIA_REG_SHARDS];
+	switch_hash_t *pres_watched;
+	switch_mutex_t *pres_watched_mutex;
 };
 
 struct private_object {
@@ -1193,6 +1262,20 @@ switch_status_t sip_dig_function(_In_opt_z_ const char *cmd, _In_opt_ switch_cor
 const char *sofia_gateway_status_name(sofia_gateway_status_t status);
 void sofia_reg_fire_custom_gateway_state_event(sofia_gateway_t *gateway, int status, const char *phrase);
 uint32_t sofia_reg_reg_count(sofia_profile_t *profile, const char *user, const char *host);
+void sofia_reg_store_init(sofia_profile_t *profile);
+void sofia_reg_store_destroy(sofia_profile_t *profile);
+void sofia_reg_store_load(sofia_profile_t *profile);
+void sofia_reg_store_add(sofia_profile_t *profile, const sofia_registration_t *reg);
+uint32_t sofia_reg_store_update(sofia_profile_t *profile, const sofia_registration_t *reg);
+uint32_t sofia_reg_store_count(sofia_profile_t *profile, const char *user, const char *host, const char *username, const char *contact, int flags);
+sofia_registration_t *sofia_reg_store_find(sofia_profile_t *profile, const char *call_id, const char *user, const char *host, const char *contact,
+										   int flags);
+sofia_registration_t *sofia_reg_store_find_all(sofia_profile_t *profile, const char *user, const char *host, int flags);
+sofia_registration_t *sofia_reg_store_expire(sofia_profile_t *profile, time_t now);
+void sofia_reg_store_set_expires(sofia_profile_t *profile, const char *call_id, const char *user, const char *host, time_t expires);
+void sofia_reg_store_free(sofia_registration_t **list);
+void sofia_reg_ping_nat(sofia_profile_t *profile, time_t now);
+uint32_t sofia_reg_ping_result(sofia_profile_t *profile, const char *call_id, const char *user, int status);
 void sofia_glue_copy_t38_options(switch_t38_options_t *t38_options, switch_core_session_t *session);
 switch_t38_options_t *sofia_glue_extract_t38_options(switch_core_session_t *session, const char *r_sdp);
 char *sofia_glue_get_multipart(switch_core_session_t *session, const char *prefix, const char *sdp, char **mp_type);
@@ -1214,6 +1297,10 @@ void sofia_process_dispatch_event(sofia_dispatch_event_t **dep);
 void sofia_process_dispatch_event_in_thread(sofia_dispatch_event_t **dep);
 char *sofia_glue_get_host(const char *str, switch_memory_pool_t *pool);
 void sofia_presence_check_subscriptions(sofia_profile_t *profile, time_t now);
+void sofia_presence_watch_init(sofia_profile_t *profile);
+void sofia_presence_watch_destroy(sofia_profile_t *profile);
+void sofia_presence_watch(sofia_profile_t *profile, const char *sub_to_user);
+void sofia_presence_engine_status(switch_stream_handle_t *stream);
 void sofia_msg_thread_start(int idx);
 void crtp_init(switch_loadable_module_interface_t *module_interface);
 int sofia_recover_callback(switch_core_session_t *session);
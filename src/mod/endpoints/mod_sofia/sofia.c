@@ -1430,6 +1430,7 @@ static void our_sofia_event_callback(nua_event_t event,
 				
 				
 				sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+				sofia_presence_watch(profile, to_user);
 
 				sip_to_tag(nh->nh_home, sip->sip_to, to_tag);
 			}
@@ -2039,6 +2040,7 @@ void event_handler(switch_event_t *event)
 		char *dup_mwi_account = NULL;
 		char *mwi_user = NULL;
 		char *mwi_host = NULL;
+		sofia_registration_t reg = { 0 }, *list;
 
 		if ((mwi_account = switch_event_get_header_nil(event, "orig-mwi-account"))) {
 			dup_mwi_account = strdup(mwi_account);
@@ -2066,10 +2068,13 @@ void event_handler(switch_event_t *event)
 			goto end;
 		}
 		if (sofia_test_pflag(profile, PFLAG_MULTIREG)) {
+			list = sofia_reg_store_find(profile, call_id, NULL, NULL, NULL, SOFIA_REG_FIND_REMOVE);
 			sql = switch_mprintf("delete from sip_registrations where call_id='%q'", call_id);
 		} else {
+			list = sofia_reg_store_find(profile, NULL, from_user, from_host, NULL, SOFIA_REG_FIND_REMOVE);
 			sql = switch_mprintf("delete from sip_registrations where sip_user='%q' and sip_host='%q'", from_user, from_host);
 		}
+		sofia_reg_store_free(&list);
 
 		if (mod_sofia_globals.rewrite_multicasted_fs_path && contact_str) {
 			const char *needle = ";fs_path=";
@@ -2110,6 +2115,23 @@ void event_handler(switch_event_t *event)
 		sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 
 		switch_find_local_ip(guess_ip4, sizeof(guess_ip4), NULL, AF_INET);
+
+		reg.call_id = call_id;
+		reg.sip_user = from_user;
+		reg.sip_host = from_host;
+		reg.presence_hosts = presence_hosts;
+		reg.contact = contact_str;
+		reg.status = "Registered";
+		reg.rpid = rpid;
+		reg.expires = (time_t) expires;
+		reg.user_agent = user_agent;
+		reg.server_user = to_user;
+		reg.server_host = guess_ip4;
+		reg.network_ip = network_ip;
+		reg.network_port = network_port;
+		reg.sip_username = username;
+		sofia_reg_store_add(profile, &reg);
+
 		sql = switch_mprintf("insert into sip_registrations "
 							 "(call_id, sip_user, sip_host, presence_hosts, contact, status, rpid, expires,"
 							 "user_agent, server_user, server_host, profile_name, hostname, network_ip, network_port, sip_username, sip_realm," 
@@ -2224,6 +2246,8 @@ void *SWITCH_THREAD_FUNC sofia_profile_worker_thread_run(switch_thread_t *thread
 				sofia_reg_check_expire(profile, now, 0);
 				ireg_loops = 0;
 			}
+
+			sofia_reg_ping_nat(profile, switch_epoch_time_now(NULL));
 			
 			if (++gateway_loops >= GATEWAY_SECONDS) {
 				sofia_reg_check_gateway(profile, switch_epoch_time_now(NULL));
@@ -2430,6 +2454,7 @@ void *SWITCH_THREAD_FUNC sofia_profile_thread_run(switch_thread_t *thread, void
 							  SIPTAG_ACCEPT_STR("application/sdp, multipart/mixed"),
 							  TAG_IF(sofia_test_pflag(profile, PFLAG_NO_CONNECTION_REUSE),
 									TPTAG_REUSE(0)),
+							  TAG_IF(profile->tcp_keepalive, TPTAG_KEEPALIVE(profile->tcp_keepalive)),
 							  TAG_END());	/* Last tag should always finish the sequence */
 	
 	if (!profile->nua) {
@@ -2548,6 +2573,10 @@ void *SWITCH_THREAD_FUNC sofia_profile_thread_run(switch_thread_t *thread, void
 									   profile->inner_post_trans_execute);
 	switch_sql_queue_manager_start(profile->qm);
 
+	sofia_reg_store_init(profile);
+	sofia_reg_store_load(profile);
+	sofia_presence_watch_init(profile);
+
 	if (switch_event_create(&s_event, SWITCH_EVENT_PUBLISH) == SWITCH_STATUS_SUCCESS) {
 		switch_event_add_header(s_event, SWITCH_STACK_BOTTOM, "service", "_sip._udp,_sip._tcp,_sip._sctp%s",
 								(sofia_test_pflag(profile, PFLAG_TLS)) ? ",_sips._tcp" : "");
@@ -2672,6 +2701,8 @@ void *SWITCH_THREAD_FUNC sofia_profile_thread_run(switch_thread_t *thread, void
 	//pool = profile->pool;
 
 	sofia_glue_del_profile(profile);
+	sofia_reg_store_destroy(profile);
+	sofia_presence_watch_destroy(profile);
 	switch_core_hash_destroy(&profile->chat_hash);
 	switch_core_hash_destroy(&profile->mwi_debounce_hash);
 	
@@ -3461,6 +3492,7 @@ switch_status_t config_sofia(sofia_config_t reload, char *profile_name)
 	mod_sofia_globals.auto_restart = SWITCH_TRUE;
 	mod_sofia_globals.reg_deny_binding_fetch_and_no_lookup = SWITCH_FALSE; /* handle backwards compatilibity - by default use new behavior */
 	mod_sofia_globals.rewrite_multicasted_fs_path = SWITCH_FALSE;
+	mod_sofia_globals.presence_coalesce_ms = 20;
 
 	if ((settings = switch_xml_child(cfg, "global_settings"))) {
 		for (param = switch_xml_child(settings, "param"); param; param = param->next) {
@@ -3474,6 +3506,10 @@ switch_status_t config_sofia(sofia_config_t reload, char *profile_name)
 				mod_sofia_globals.debug_presence = atoi(val);
 			} else if (!strcasecmp(var, "debug-sla")) {
 				mod_sofia_globals.debug_sla = atoi(val);
+			} else if (!strcasecmp(var, "presence-coalesce-ms")) {
+				int x = atoi(val);
+
+				mod_sofia_globals.presence_coalesce_ms = x > 0 ? x : 0;
 			} else if (!strcasecmp(var, "max-reg-threads") && val) {
 				int x = atoi(val);
 
@@ -3596,6 +3632,7 @@ switch_status_t config_sofia(sofia_config_t reload, char *profile_name)
 					profile->ndlb |= PFLAG_NDLB_ALLOW_NONDUP_SDP;
 					profile->te = 101;
 					profile->ireg_seconds = IREG_SECONDS;
+					profile->nat_ping_max_fails = 1;
 					profile->paid_type = PAID_DEFAULT;
 
 
@@ -4220,6 +4257,15 @@ switch_status_t config_sofia(sofia_config_t reload, char *profile_name)
 						} else {
 							sofia_clear_pflag(profile, PFLAG_NAT_OPTIONS_PING);
 						}
+					} else if (!strcasecmp(var, "nat-options-ping-interval")) {
+						int v = atoi(val);
+						profile->nat_ping_seconds = v > 0 ? (uint32_t) v : 0;
+					} else if (!strcasecmp(var, "nat-options-ping-max-fails")) {
+						int v = atoi(val);
+						profile->nat_ping_max_fails = v > 0 ? (uint32_t) v : 1;
+					} else if (!strcasecmp(var, "tcp-keepalive")) {
+						int v = atoi(val);
+						profile->tcp_keepalive = v > 0 ? (uint32_t) v : 0;
 					} else if (!strcasecmp(var, "all-reg-options-ping")) { 
 						if (switch_true(val)) {
 							sofia_set_pflag(profile, PFLAG_ALL_REG_OPTIONS_PING);
@@ -4797,18 +4843,22 @@ static void sofia_handle_sip_r_options(switch_core_session_t *session, int statu
 		gateway->ping = switch_epoch_time_now(NULL) + gateway->ping_freq;
 		sofia_reg_release_gateway(gateway);
 		gateway->pinging = 0;
-	} else if (sofia_test_pflag(profile, PFLAG_UNREG_OPTIONS_FAIL) && (status != 200 && status != 486) &&
-			   sip && sip->sip_to && sip->sip_call_id && sip->sip_call_id->i_id && strchr(sip->sip_call_id->i_id, '_')) {
-		char *sql;
-		time_t now = switch_epoch_time_now(NULL);
+	} else if (sip && sip->sip_to && sip->sip_call_id && sip->sip_call_id->i_id && strchr(sip->sip_call_id->i_id, '_')) {
 		const char *call_id = strchr(sip->sip_call_id->i_id, '_') + 1;
+		uint32_t fails = sofia_reg_ping_result(profile, call_id, sip->sip_to->a_url->url_user, status);
 
-		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "Expire registration '%s@%s' due to options failure\n",
-						  sip->sip_to->a_url->url_user, sip->sip_to->a_url->url_host);
+		if (sofia_test_pflag(profile, PFLAG_UNREG_OPTIONS_FAIL) && (status != 200 && status != 486) && fails >= profile->nat_ping_max_fails) {
+			char *sql;
+			time_t now = switch_epoch_time_now(NULL);
 
-		sql = switch_mprintf("update sip_registrations set expires=%ld where sip_user='%s' and sip_host='%s' and call_id='%q'",
-							 (long) now, sip->sip_to->a_url->url_user, sip->sip_to->a_url->url_host, call_id);
-		sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
+			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "Expire registration '%s@%s' due to options failure\n",
+							  sip->sip_to->a_url->url_user, sip->sip_to->a_url->url_host);
+
+			sofia_reg_store_set_expires(profile, call_id, sip->sip_to->a_url->url_user, sip->sip_to->a_url->url_host, now);
+			sql = switch_mprintf("update sip_registrations set expires=%ld where sip_user='%s' and sip_host='%s' and call_id='%q'",
+								 (long) now, sip->sip_to->a_url->url_user, sip->sip_to->a_url->url_host, call_id);
+			sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
+		}
 	}
 }
 
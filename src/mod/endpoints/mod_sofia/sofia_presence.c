@@ -55,6 +55,8 @@ static int broadsoft_sla_notify_callback(void *pArg, int argc, char **argv, char
 static int sync_sla(sofia_profile_t *profile, const char *to_user, const char *to_host, switch_bool_t clear, switch_bool_t unseize, const char *call_id);
 static int sofia_dialog_probe_callback(void *pArg, int argc, char **argv, char **columnNames);
 static int sofia_dialog_probe_notify_callback(void *pArg, int argc, char **argv, char **columnNames);
+static switch_bool_t presence_watched(sofia_profile_t *profile, const char *sub_to_user);
+static void presence_rebuild_watched(sofia_profile_t *profile);
 
 struct pres_sql_cb {
 	sofia_profile_t *profile;
@@ -93,9 +95,32 @@ struct presence_helper {
 	char last_uuid[512];
 	int hup;
 	int calls_up;
+	switch_event_t *pidf_cache;
+};
 
+/* a presence event waiting out the coalesce window, a newer event for the same key replaces it */
+struct pres_pending {
+	char *key;
+	switch_event_t *event;
+	switch_time_t due;
+	struct pres_pending *next;
 };
 
+static struct {
+	switch_hash_t *pending;
+	struct pres_pending *head;
+	struct pres_pending **tail;
+	/* the counters are bumped from the presence thread and the sofia workers and read by the api, so they are atomics */
+	switch_atomic_t pending_count;
+	switch_atomic_t events;
+	switch_atomic_t coalesced;
+	switch_atomic_t notifies;
+	switch_atomic_t skipped;
+	switch_atomic_t window_notifies;
+	switch_time_t window_start;
+	switch_atomic_t notify_rate;
+} pres_engine;
+
 switch_status_t sofia_presence_chat_send(switch_event_t *message_event)
 										 
 {
@@ -425,6 +450,7 @@ void sofia_presence_cancel(void)
 					
 					r = sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_presence_sub_callback, &helper);
 					switch_safe_free(sql);
+					switch_event_destroy(&helper.pidf_cache);
 
 					if (r != SWITCH_TRUE) {
 						sofia_glue_release_profile(profile);
@@ -1191,6 +1217,7 @@ static switch_event_t *actual_sofia_presence_event_handler(switch_event_t *event
 					helper.event = NULL;
 					sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_presence_sub_callback, &helper);
 					switch_safe_free(sql);
+					switch_event_destroy(&helper.pidf_cache);
 					sofia_glue_release_profile(profile);
 				}
 			}
@@ -1315,6 +1342,16 @@ static switch_event_t *actual_sofia_presence_event_handler(switch_event_t *event
 					proto = SOFIA_CHAT_PROTO;
 				}
 
+				if (zstr(call_id) && !presence_watched(profile, euser)) {
+					/* nobody subscribed to this presentity, there is no one to notify */
+					if (mod_sofia_globals.debug_presence > 0) {
+						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%s@%s has no watchers on %s, skipping\n", euser, host, profile->name);
+					}
+					switch_atomic_inc(&pres_engine.skipped);
+					sofia_glue_release_profile(profile);
+					continue;
+				}
+
 				if (zstr(uuid)) {
 				
 					sql = switch_mprintf("select state,status,rpid,presence_id,uuid from sip_dialogs "
@@ -1481,6 +1518,7 @@ static switch_event_t *actual_sofia_presence_event_handler(switch_event_t *event
 
 				sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_presence_sub_callback, &helper);
 				switch_safe_free(sql);
+				switch_event_destroy(&helper.pidf_cache);
 			
 				if (mod_sofia_globals.debug_presence > 0) {
 					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s END_PRESENCE_SQL (%s)\n",
@@ -1545,12 +1583,209 @@ static int EVENT_THREAD_STARTED = 0;
 static void do_flush(void)
 {
 	void *pop = NULL;
+	struct pres_pending *pp;
 
 	while (mod_sofia_globals.presence_queue && switch_queue_trypop(mod_sofia_globals.presence_queue, &pop) == SWITCH_STATUS_SUCCESS && pop) {
 		switch_event_t *event = (switch_event_t *) pop;
 		switch_event_destroy(&event);
 	}
 
+	while ((pp = pres_engine.head)) {
+		pres_engine.head = pp->next;
+		switch_core_hash_delete(pres_engine.pending, pp->key);
+		switch_event_destroy(&pp->event);
+		free(pp->key);
+		free(pp);
+	}
+
+	pres_engine.tail = &pres_engine.head;
+	switch_atomic_set(&pres_engine.pending_count, 0);
+}
+
+static void presence_dispatch(switch_event_t *event)
+{
+	switch(event->event_id) {
+	case SWITCH_EVENT_MESSAGE_WAITING:
+		actual_sofia_presence_mwi_event_handler(event);
+		break;
+	case SWITCH_EVENT_CONFERENCE_DATA:
+		conference_data_event_handler(event);
+		break;
+	default:
+		do {
+			switch_event_t *ievent = event;
+			event = actual_sofia_presence_event_handler(ievent);
+			switch_event_destroy(&ievent);
+		} while (event);
+		break;
+	}
+
+	switch_event_destroy(&event);
+}
+
+/* 
+   Plain state updates for a presentity (no call-info, not aimed at one subscription) are held for
+   presence-coalesce-ms; when the same presentity/call changes again in that window only the latest
+   state is rendered and sent, the earlier one is dropped.
+*/
+static switch_bool_t presence_coalesce(switch_event_t *event)
+{
+	struct pres_pending *pp;
+	const char *from;
+	char *key;
+
+	if (!mod_sofia_globals.presence_coalesce_ms || event->event_id != SWITCH_EVENT_PRESENCE_IN ||
+		zstr((from = switch_event_get_header(event, "from"))) ||
+		switch_event_get_header(event, "presence-call-info") || switch_event_get_header(event, "call-id")) {
+		return SWITCH_FALSE;
+	}
+
+	key = switch_mprintf("%s|%s|%s|%s|%s|%s", switch_event_get_header_nil(event, "proto"), from,
+						 switch_event_get_header_nil(event, "event_type"), switch_event_get_header_nil(event, "alt_event_type"),
+						 switch_event_get_header_nil(event, "presence-source"), switch_event_get_header_nil(event, "unique-id"));
+
+	if ((pp = switch_core_hash_find(pres_engine.pending, key))) {
+		switch_event_destroy(&pp->event);
+		pp->event = event;
+		switch_atomic_inc(&pres_engine.coalesced);
+		free(key);
+		return SWITCH_TRUE;
+	}
+
+	switch_zmalloc(pp, sizeof(*pp));
+	pp->key = key;
+	pp->event = event;
+	pp->due = switch_micro_time_now() + (switch_time_t) mod_sofia_globals.presence_coalesce_ms * 1000;
+	switch_core_hash_insert(pres_engine.pending, key, pp);
+	*pres_engine.tail = pp;
+	pres_engine.tail = &pp->next;
+	switch_atomic_inc(&pres_engine.pending_count);
+
+	return SWITCH_TRUE;
+}
+
+static void presence_run_pending(switch_bool_t all)
+{
+	switch_time_t now = switch_micro_time_now();
+	struct pres_pending *pp;
+
+	while ((pp = pres_engine.head) && (all || pp->due <= now)) {
+		if (!(pres_engine.head = pp->next)) {
+			pres_engine.tail = &pres_engine.head;
+		}
+		switch_atomic_dec(&pres_engine.pending_count);
+		switch_core_hash_delete(pres_engine.pending, pp->key);
+		presence_dispatch(pp->event);
+		free(pp->key);
+		free(pp);
+	}
+}
+
+static void presence_update_rate(void)
+{
+	switch_time_t now = switch_micro_time_now();
+	switch_time_t elapsed = now - pres_engine.window_start;
+
+	if (elapsed >= 10000000) {
+		uint32_t notifies = switch_atomic_read(&pres_engine.window_notifies);
+
+		switch_atomic_set(&pres_engine.window_notifies, 0);
+		switch_atomic_set(&pres_engine.notify_rate, (uint32_t) ((uint64_t) notifies * 1000000 / elapsed));
+		pres_engine.window_start = now;
+	}
+}
+
+void sofia_presence_engine_status(switch_stream_handle_t *stream)
+{
+	stream->write_function(stream, "presence: queue %d, coalescing %u, events %u, coalesced %u, unwatched %u, notifies %u (%u/sec)\n",
+						   mod_sofia_globals.presence_queue ? switch_queue_size(mod_sofia_globals.presence_queue) : 0,
+						   switch_atomic_read(&pres_engine.pending_count), switch_atomic_read(&pres_engine.events), switch_atomic_read(&pres_engine.coalesced),
+						   switch_atomic_read(&pres_engine.skipped), switch_atomic_read(&pres_engine.notifies),
+						   switch_atomic_read(&pres_engine.notify_rate));
+}
+
+void sofia_presence_watch_init(sofia_profile_t *profile)
+{
+	switch_mutex_init(&profile->pres_watched_mutex, SWITCH_MUTEX_NESTED, profile->pool);
+	switch_core_hash_init(&profile->pres_watched, NULL);
+	presence_rebuild_watched(profile);
+}
+
+void sofia_presence_watch_destroy(sofia_profile_t *profile)
+{
+	if (profile->pres_watched_mutex) {
+		switch_mutex_lock(profile->pres_watched_mutex);
+		switch_core_hash_destroy(&profile->pres_watched);
+		switch_mutex_unlock(profile->pres_watched_mutex);
+	}
+}
+
+void sofia_presence_watch(sofia_profile_t *profile, const char *sub_to_user)
+{
+	if (zstr(sub_to_user) || !profile->pres_watched_mutex) {
+		return;
+	}
+
+	switch_mutex_lock(profile->pres_watched_mutex);
+	if (profile->pres_watched) {
+		switch_core_hash_insert(profile->pres_watched, sub_to_user, profile);
+	}
+	switch_mutex_unlock(profile->pres_watched_mutex);
+}
+
+static switch_bool_t presence_watched(sofia_profile_t *profile, const char *sub_to_user)
+{
+	switch_bool_t r = SWITCH_TRUE;
+
+	if (zstr(sub_to_user) || !profile->pres_watched_mutex) {
+		return r;
+	}
+
+	switch_mutex_lock(profile->pres_watched_mutex);
+	if (profile->pres_watched) {
+		r = switch_core_hash_find(profile->pres_watched, sub_to_user) ? SWITCH_TRUE : SWITCH_FALSE;
+	}
+	switch_mutex_unlock(profile->pres_watched_mutex);
+
+	return r;
+}
+
+static int presence_watched_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	switch_hash_t *hash = (switch_hash_t *) pArg;
+
+	if (!zstr(argv[0])) {
+		switch_core_hash_insert(hash, argv[0], hash);
+	}
+
+	return 0;
+}
+
+/* 
+   The watched set only ever grows between rebuilds; dropped subscriptions fall out here,
+   the lock is held across the select so a SUBSCRIBE landing meanwhile can't be lost.
+*/
+static void presence_rebuild_watched(sofia_profile_t *profile)
+{
+	switch_hash_t *hash = NULL, *old;
+	char *sql;
+
+	switch_core_hash_init(&hash, NULL);
+
+	sql = switch_mprintf("select distinct sub_to_user from sip_subscriptions where hostname='%q' and profile_name='%q'",
+						 mod_sofia_globals.hostname, profile->name);
+
+	switch_mutex_lock(profile->pres_watched_mutex);
+	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, presence_watched_callback, hash);
+	old = profile->pres_watched;
+	profile->pres_watched = hash;
+	switch_mutex_unlock(profile->pres_watched_mutex);
+
+	if (old) {
+		switch_core_hash_destroy(&old);
+	}
+
+	switch_safe_free(sql);
 }
 
 void *SWITCH_THREAD_FUNC sofia_presence_event_thread_run(switch_thread_t *thread, void *obj)
@@ -1573,10 +1808,27 @@ void *SWITCH_THREAD_FUNC sofia_presence_event_thread_run(switch_thread_t *thread
 
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "Event Thread Started\n");
 
+	switch_core_hash_init(&pres_engine.pending, NULL);
+	pres_engine.head = NULL;
+	pres_engine.tail = &pres_engine.head;
+	pres_engine.window_start = switch_micro_time_now();
+
 	while (mod_sofia_globals.running == 1) {
-		int count = 0;
+		switch_interval_time_t timeout = 1000000;
+		switch_status_t status;
+
+		if (pres_engine.head) {
+			switch_time_t now = switch_micro_time_now();
+			timeout = pres_engine.head->due > now ? pres_engine.head->due - now : 0;
+		}
 
-		if (switch_queue_pop(mod_sofia_globals.presence_queue, &pop) == SWITCH_STATUS_SUCCESS) {
+		if (timeout) {
+			status = switch_queue_pop_timeout(mod_sofia_globals.presence_queue, &pop, timeout);
+		} else {
+			status = switch_queue_trypop(mod_sofia_globals.presence_queue, &pop);
+		}
+
+		if (status == SWITCH_STATUS_SUCCESS) {
 			switch_event_t *event = (switch_event_t *) pop;
 
 			if (!pop) {
@@ -1592,28 +1844,23 @@ void *SWITCH_THREAD_FUNC sofia_presence_event_thread_run(switch_thread_t *thread
 				switch_mutex_unlock(mod_sofia_globals.mutex);
 			}
 
-			switch(event->event_id) {
-			case SWITCH_EVENT_MESSAGE_WAITING:
-				actual_sofia_presence_mwi_event_handler(event);
-				break;
-			case SWITCH_EVENT_CONFERENCE_DATA:
-				conference_data_event_handler(event);
-				break;
-			default:
-				do {
-					switch_event_t *ievent = event;
-					event = actual_sofia_presence_event_handler(ievent);
-					switch_event_destroy(&ievent);
-				} while (event);
-				break;
-			}
+			switch_atomic_inc(&pres_engine.events);
 
-			switch_event_destroy(&event);
-			count++;
+			if (!presence_coalesce(event)) {
+				if (event->event_id == SWITCH_EVENT_PRESENCE_IN || event->event_id == SWITCH_EVENT_PRESENCE_OUT) {
+					/* keep per presentity ordering, anything waiting goes out before an event we can't merge */
+					presence_run_pending(SWITCH_TRUE);
+				}
+				presence_dispatch(event);
+			}
 		}
+
+		presence_run_pending(SWITCH_FALSE);
+		presence_update_rate();
 	}
 
 	do_flush();
+	switch_core_hash_destroy(&pres_engine.pending);
 
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "Event Thread Ended\n");
 
@@ -2247,6 +2494,8 @@ static void _send_presence_notify(sofia_profile_t *profile,
 	cseq = sip_cseq_create(nh->nh_home, callsequence, SIP_METHOD_NOTIFY);
 	nua_handle_bind(nh, &mod_sofia_globals.destroy_private);
 
+	switch_atomic_inc(&pres_engine.notifies);
+	switch_atomic_inc(&pres_engine.window_notifies);
 
 	nua_notify(nh,
 			   NUTAG_NEWSUB(1),
@@ -2509,6 +2758,43 @@ static char *gen_pidf(char *user_agent, char *id, char *url, char *open, char *r
 	return ret;
 }
 
+/* 
+   A rendered pidf only depends on its inputs, so every watcher of the same presentity state with the
+   same content type (the user agent only picks xpidf or pidf) reuses the body rendered for the first one.
+*/
+static char *cached_gen_pidf(struct presence_helper *helper, char *user_agent, char *id, char *url, char *open, char *rpid, char *prpid, char *status,
+							 const char **ct)
+{
+	int xpidf = !!switch_stristr("polycom", user_agent);
+	char *key, *pl;
+	const char *cached;
+
+	key = switch_mprintf("%d|%s|%s|%s|%s|%s|%s", xpidf, switch_str_nil(id), switch_str_nil(url), switch_str_nil(open), switch_str_nil(rpid),
+						 switch_str_nil(prpid), switch_str_nil(status));
+
+	if (helper->pidf_cache && (cached = switch_event_get_header(helper->pidf_cache, key))) {
+		*ct = xpidf ? "application/xpidf+xml" : "application/pidf+xml";
+		free(key);
+		return strdup(cached);
+	}
+
+	pl = gen_pidf(user_agent, id, url, open, rpid, prpid, status, ct);
+
+	if (pl) {
+		if (!helper->pidf_cache) {
+			switch_event_create(&helper->pidf_cache, SWITCH_EVENT_CLONE);
+		}
+
+		if (helper->pidf_cache) {
+			switch_event_add_header_string(helper->pidf_cache, SWITCH_STACK_BOTTOM, key, pl);
+		}
+	}
+
+	free(key);
+
+	return pl;
+}
+
 static int sofia_presence_sub_callback(void *pArg, int argc, char **argv, char **columnNames)
 {
 	struct presence_helper *helper = (struct presence_helper *) pArg;
@@ -3044,7 +3330,7 @@ static int sofia_presence_sub_callback(void *pArg, int argc, char **argv, char *
 				prpid = rpid = dialog_rpid;
 			}
 						
-			pl = gen_pidf(user_agent, clean_id, profile->url, open, rpid, prpid, status_line, &ct);
+			pl = cached_gen_pidf(helper, user_agent, clean_id, profile->url, open, rpid, prpid, status_line, &ct);
 		}
 
 	} else {
@@ -3069,7 +3355,7 @@ static int sofia_presence_sub_callback(void *pArg, int argc, char **argv, char *
 		}
 
 		
-		pl = gen_pidf(user_agent, clean_id, profile->url, open, rpid, prpid, status, &ct);
+		pl = cached_gen_pidf(helper, user_agent, clean_id, profile->url, open, rpid, prpid, status, &ct);
 	}
 
 
@@ -3729,6 +4015,7 @@ void sofia_presence_handle_sip_i_subscribe(int status,
 
 
 			sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+			sofia_presence_watch(profile, to_user);
 			sstr = switch_mprintf("active;expires=%ld", exp_delta);
 		}
 		
@@ -4661,6 +4948,8 @@ void sofia_presence_check_subscriptions(sofia_profile_t *profile, time_t now)
 
 			sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
 		}
+
+		presence_rebuild_watched(profile);
 	}
 
 
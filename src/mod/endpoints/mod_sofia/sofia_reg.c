@@ -502,6 +502,554 @@ void sofia_reg_check_gateway(sofia_profile_t *profile, time_t now)
 	switch_mutex_unlock(profile->gw_mutex);
 }
 
+/* 
+   REGISTRATION STORE
+
+   Each profile keeps its registrations in memory and that store is what REGISTER handling, expiry, pinging and contact
+   lookups use.  sip_registrations is only a mirror: every change is written through the profile's queued sql, including
+   the inserts and deletes that used to run with sofia_glue_execute_sql_now, so readers of the table (sofia status,
+   presence, other boxes sharing the db) may trail the store by one queue flush.  The table is read back into the
+   store when the profile starts.
+*/
+
+#define REG_STR_FIELDS 13
+
+static uint32_t reg_store_hash(const char *str)
+{
+	uint32_t hash = 5381;
+
+	while (str && *str) {
+		hash = ((hash << 5) + hash) + (unsigned char) *str++;
+	}
+
+	return hash;
+}
+
+static sofia_reg_shard_t *reg_store_shard(sofia_profile_t *profile, const char *user)
+{
+	return &profile->reg_shards[reg_store_hash(user) % SOFIA_REG_SHARDS];
+}
+
+/* the registration and all of its strings live in one allocation so a single free() releases it */
+static sofia_registration_t *reg_store_new(const sofia_registration_t *src)
+{
+	const char *in[REG_STR_FIELDS] = { src->call_id, src->sip_user, src->sip_host, src->presence_hosts, src->contact, src->status, src->rpid,
+		src->user_agent, src->server_user, src->server_host, src->network_ip, src->network_port, src->sip_username
+	};
+	sofia_registration_t *reg;
+	char **out[REG_STR_FIELDS];
+	switch_size_t len = sizeof(*reg), flen;
+	char *p;
+	int i;
+
+	for (i = 0; i < REG_STR_FIELDS; i++) {
+		len += strlen(switch_str_nil(in[i])) + 1;
+	}
+
+	switch_zmalloc(reg, len);
+
+	out[0] = &reg->call_id;
+	out[1] = &reg->sip_user;
+	out[2] = &reg->sip_host;
+	out[3] = &reg->presence_hosts;
+	out[4] = &reg->contact;
+	out[5] = &reg->status;
+	out[6] = &reg->rpid;
+	out[7] = &reg->user_agent;
+	out[8] = &reg->server_user;
+	out[9] = &reg->server_host;
+	out[10] = &reg->network_ip;
+	out[11] = &reg->network_port;
+	out[12] = &reg->sip_username;
+
+	p = (char *) (reg + 1);
+
+	for (i = 0; i < REG_STR_FIELDS; i++) {
+		flen = strlen(switch_str_nil(in[i])) + 1;
+		memcpy(p, switch_str_nil(in[i]), flen);
+		*out[i] = p;
+		p += flen;
+	}
+
+	reg->expires = src->expires;
+	reg->ping_sent = src->ping_sent;
+	reg->ping_fails = src->ping_fails;
+
+	return reg;
+}
+
+static void reg_heap_set(sofia_reg_shard_t *shard, uint32_t i, sofia_registration_t *reg)
+{
+	shard->heap[i] = reg;
+	reg->heap_pos = i + 1;
+}
+
+static void reg_heap_up(sofia_reg_shard_t *shard, uint32_t i)
+{
+	sofia_registration_t *reg = shard->heap[i];
+
+	while (i > 0 && shard->heap[(i - 1) / 2]->expires > reg->expires) {
+		reg_heap_set(shard, i, shard->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	reg_heap_set(shard, i, reg);
+}
+
+static void reg_heap_down(sofia_reg_shard_t *shard, uint32_t i)
+{
+	sofia_registration_t *reg = shard->heap[i];
+	uint32_t child;
+
+	while ((child = i * 2 + 1) < shard->heap_used) {
+		if (child + 1 < shard->heap_used && shard->heap[child + 1]->expires < shard->heap[child]->expires) {
+			child++;
+		}
+
+		if (shard->heap[child]->expires >= reg->expires) {
+			break;
+		}
+
+		reg_heap_set(shard, i, shard->heap[child]);
+		i = child;
+	}
+
+	reg_heap_set(shard, i, reg);
+}
+
+static void reg_heap_push(sofia_reg_shard_t *shard, sofia_registration_t *reg)
+{
+	if (reg->expires <= 0) {
+		return;
+	}
+
+	if (shard->heap_used == shard->heap_size) {
+		uint32_t size = shard->heap_size ? shard->heap_size * 2 : 1024;
+		sofia_registration_t **heap = realloc(shard->heap, size * sizeof(*heap));
+
+		switch_assert(heap);
+		shard->heap = heap;
+		shard->heap_size = size;
+	}
+
+	shard->heap[shard->heap_used] = reg;
+	reg_heap_up(shard, shard->heap_used++);
+}
+
+static void reg_heap_remove(sofia_reg_shard_t *shard, sofia_registration_t *reg)
+{
+	uint32_t i;
+	sofia_registration_t *last;
+
+	if (!reg->heap_pos) {
+		return;
+	}
+
+	i = reg->heap_pos - 1;
+	last = shard->heap[--shard->heap_used];
+	reg->heap_pos = 0;
+
+	if (last != reg) {
+		reg_heap_set(shard, i, last);
+		reg_heap_up(shard, i);
+		reg_heap_down(shard, last->heap_pos - 1);
+	}
+}
+
+static void reg_store_link(sofia_reg_shard_t *shard, sofia_registration_t *reg)
+{
+	uint32_t slot;
+
+	reg->next = switch_core_hash_find(shard->users, reg->sip_user);
+	switch_core_hash_insert(shard->users, reg->sip_user, reg);
+
+	reg->next_call_id = switch_core_hash_find(shard->call_ids, reg->call_id);
+	switch_core_hash_insert(shard->call_ids, reg->call_id, reg);
+
+	reg_heap_push(shard, reg);
+
+	slot = reg_store_hash(reg->call_id) % SOFIA_REG_PING_SLOTS;
+	if ((reg->ping_next = shard->ping_wheel[slot])) {
+		reg->ping_next->ping_pprev = &reg->ping_next;
+	}
+	shard->ping_wheel[slot] = reg;
+	reg->ping_pprev = &shard->ping_wheel[slot];
+
+	shard->count++;
+}
+
+static void reg_store_unlink(sofia_reg_shard_t *shard, sofia_registration_t *reg)
+{
+	sofia_registration_t *head, *np;
+
+	if ((head = switch_core_hash_find(shard->users, reg->sip_user)) == reg) {
+		if (reg->next) {
+			switch_core_hash_insert(shard->users, reg->sip_user, reg->next);
+		} else {
+			switch_core_hash_delete(shard->users, reg->sip_user);
+		}
+	} else {
+		for (np = head; np && np->next; np = np->next) {
+			if (np->next == reg) {
+				np->next = reg->next;
+				break;
+			}
+		}
+	}
+
+	if ((head = switch_core_hash_find(shard->call_ids, reg->call_id)) == reg) {
+		if (reg->next_call_id) {
+			switch_core_hash_insert(shard->call_ids, reg->call_id, reg->next_call_id);
+		} else {
+			switch_core_hash_delete(shard->call_ids, reg->call_id);
+		}
+	} else {
+		for (np = head; np && np->next_call_id; np = np->next_call_id) {
+			if (np->next_call_id == reg) {
+				np->next_call_id = reg->next_call_id;
+				break;
+			}
+		}
+	}
+
+	reg_heap_remove(shard, reg);
+
+	if ((*reg->ping_pprev = reg->ping_next)) {
+		reg->ping_next->ping_pprev = reg->ping_pprev;
+	}
+
+	reg->next = reg->next_call_id = reg->ping_next = NULL;
+	reg->ping_pprev = NULL;
+	shard->count--;
+}
+
+void sofia_reg_store_init(sofia_profile_t *profile)
+{
+	int i;
+
+	for (i = 0; i < SOFIA_REG_SHARDS; i++) {
+		sofia_reg_shard_t *shard = &profile->reg_shards[i];
+
+		memset(shard, 0, sizeof(*shard));
+		switch_mutex_init(&shard->mutex, SWITCH_MUTEX_NESTED, profile->pool);
+		switch_core_hash_init(&shard->users, NULL);
+		switch_core_hash_init(&shard->call_ids, NULL);
+	}
+
+	memset(&profile->nat_ping, 0, sizeof(profile->nat_ping));
+	switch_mutex_init(&profile->nat_ping.mutex, SWITCH_MUTEX_NESTED, profile->pool);
+}
+
+void sofia_reg_store_destroy(sofia_profile_t *profile)
+{
+	int i;
+
+	for (i = 0; i < SOFIA_REG_SHARDS; i++) {
+		sofia_reg_shard_t *shard = &profile->reg_shards[i];
+		switch_hash_index_t *hi;
+		void *val;
+
+		if (!shard->mutex) {
+			continue;
+		}
+
+		switch_mutex_lock(shard->mutex);
+
+		/* registrations that never expire are not in the heap, walk the user index for everything */
+		for (hi = switch_hash_first(NULL, shard->users); hi; hi = switch_hash_next(hi)) {
+			sofia_registration_t *reg, *next;
+
+			switch_hash_this(hi, NULL, NULL, &val);
+			for (reg = (sofia_registration_t *) val; reg; reg = next) {
+				next = reg->next;
+				free(reg);
+			}
+		}
+
+		switch_core_hash_destroy(&shard->users);
+		switch_core_hash_destroy(&shard->call_ids);
+		switch_safe_free(shard->heap);
+		shard->heap_used = shard->heap_size = shard->count = 0;
+		switch_mutex_unlock(shard->mutex);
+	}
+}
+
+static int sofia_reg_store_load_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	sofia_profile_t *profile = (sofia_profile_t *) pArg;
+	sofia_registration_t reg = { 0 };
+
+	reg.call_id = argv[0];
+	reg.sip_user = argv[1];
+	reg.sip_host = argv[2];
+	reg.presence_hosts = argv[3];
+	reg.contact = argv[4];
+	reg.status = argv[5];
+	reg.rpid = argv[6];
+	reg.expires = (time_t) atol(switch_str_nil(argv[7]));
+	reg.user_agent = argv[8];
+	reg.server_user = argv[9];
+	reg.server_host = argv[10];
+	reg.network_ip = argv[11];
+	reg.network_port = argv[12];
+	reg.sip_username = argv[13];
+
+	sofia_reg_store_add(profile, &reg);
+
+	return 0;
+}
+
+/* registrations that survived a restart in the db are pulled back into memory once when the profile starts */
+void sofia_reg_store_load(sofia_profile_t *profile)
+{
+	char *sql;
+
+	sql = switch_mprintf("select call_id,sip_user,sip_host,presence_hosts,contact,status,rpid,expires,user_agent,server_user,server_host,"
+						 "network_ip,network_port,sip_username from sip_registrations where hostname='%q' and profile_name='%q'",
+						 mod_sofia_globals.hostname, profile->name);
+
+	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_store_load_callback, profile);
+	switch_safe_free(sql);
+}
+
+void sofia_reg_store_add(sofia_profile_t *profile, const sofia_registration_t *reg)
+{
+	sofia_reg_shard_t *shard = reg_store_shard(profile, reg->sip_user);
+	sofia_registration_t *new_reg = reg_store_new(reg);
+
+	switch_mutex_lock(shard->mutex);
+	reg_store_link(shard, new_reg);
+	switch_mutex_unlock(shard->mutex);
+}
+
+/* same as update sip_registrations ... where sip_user, sip_username, sip_host and contact match */
+uint32_t sofia_reg_store_update(sofia_profile_t *profile, const sofia_registration_t *reg)
+{
+	sofia_reg_shard_t *shard = reg_store_shard(profile, reg->sip_user);
+	sofia_registration_t *np, *next, *found = NULL;
+	uint32_t updated = 0;
+
+	switch_mutex_lock(shard->mutex);
+
+	for (np = switch_core_hash_find(shard->users, reg->sip_user); np; np = next) {
+		sofia_registration_t tmp;
+
+		next = np->next;
+
+		if (strcmp(np->sip_username, switch_str_nil(reg->sip_username)) || strcmp(np->sip_host, switch_str_nil(reg->sip_host)) ||
+			strcmp(np->contact, switch_str_nil(reg->contact))) {
+			continue;
+		}
+
+		tmp = *np;
+		tmp.call_id = reg->call_id;
+		tmp.network_ip = reg->network_ip;
+		tmp.network_port = reg->network_port;
+		tmp.presence_hosts = reg->presence_hosts;
+		tmp.server_host = reg->server_host;
+		tmp.expires = reg->expires;
+
+		reg_store_unlink(shard, np);
+		np->next = found;
+		found = np;
+
+		np = reg_store_new(&tmp);
+		np->next = NULL;
+		reg_store_link(shard, np);
+		updated++;
+	}
+
+	switch_mutex_unlock(shard->mutex);
+
+	sofia_reg_store_free(&found);
+
+	return updated;
+}
+
+static int reg_store_host_match(sofia_registration_t *reg, const char *host, int flags)
+{
+	if (!strcmp(reg->sip_host, host)) {
+		return 1;
+	}
+
+	return (flags & SOFIA_REG_FIND_PRESENCE_HOSTS) && !zstr(reg->presence_hosts) && strstr(reg->presence_hosts, host);
+}
+
+uint32_t sofia_reg_store_count(sofia_profile_t *profile, const char *user, const char *host, const char *username, const char *contact, int flags)
+{
+	sofia_reg_shard_t *shard = reg_store_shard(profile, user);
+	sofia_registration_t *np;
+	uint32_t count = 0;
+
+	if (zstr(user)) {
+		return 0;
+	}
+
+	switch_mutex_lock(shard->mutex);
+	for (np = switch_core_hash_find(shard->users, user); np; np = np->next) {
+		if ((!host || reg_store_host_match(np, host, flags)) &&
+			(!username || !strcmp(np->sip_username, username)) && (!contact || !strcmp(np->contact, contact))) {
+			count++;
+		}
+	}
+	switch_mutex_unlock(shard->mutex);
+
+	return count;
+}
+
+static int reg_store_is_nat(sofia_registration_t *reg)
+{
+	return strstr(reg->status, "NAT") || strstr(reg->contact, "fs_nat=yes");
+}
+
+static int reg_store_match(sofia_registration_t *reg, const char *user, const char *host, const char *contact, int flags)
+{
+	if ((flags & SOFIA_REG_FIND_NAT) && !reg_store_is_nat(reg)) {
+		return 0;
+	}
+
+	return (!user || !strcmp(reg->sip_user, user)) && (!host || reg_store_host_match(reg, host, flags)) && (!contact || !strcmp(reg->contact, contact));
+}
+
+/* 
+   Registrations matching call_id, or user/host/contact (any of which may be NULL), or everything when all of them are NULL.
+   With SOFIA_REG_FIND_REMOVE they are taken out of the store, otherwise copies are returned; free the list with sofia_reg_store_free.
+*/
+sofia_registration_t *sofia_reg_store_find(sofia_profile_t *profile, const char *call_id, const char *user, const char *host, const char *contact,
+										   int flags)
+{
+	sofia_registration_t *list = NULL, **tail = &list;
+	sofia_registration_t **found = NULL;
+	uint32_t found_used = 0, found_size = 0, x;
+	int all = !call_id && !user && !host && !contact;
+	int i;
+
+	for (i = 0; i < SOFIA_REG_SHARDS; i++) {
+		sofia_reg_shard_t *shard = &profile->reg_shards[i];
+		sofia_registration_t *np;
+
+		if (!call_id && user && shard != reg_store_shard(profile, user)) {
+			continue;
+		}
+
+		switch_mutex_lock(shard->mutex);
+
+		found_used = 0;
+
+#define reg_store_found(_reg) do {												\
+			if (found_used == found_size) {										\
+				found_size = found_size ? found_size * 2 : 64;					\
+				found = realloc(found, found_size * sizeof(*found));			\
+				switch_assert(found);											\
+			}																	\
+			found[found_used++] = _reg;											\
+		} while (0)
+
+		if (call_id) {
+			for (np = switch_core_hash_find(shard->call_ids, call_id); np; np = np->next_call_id) {
+				if (reg_store_match(np, NULL, NULL, NULL, flags)) {
+					reg_store_found(np);
+				}
+			}
+		}
+
+		if (user && shard == reg_store_shard(profile, user)) {
+			for (np = switch_core_hash_find(shard->users, user); np; np = np->next) {
+				if ((!call_id || strcmp(np->call_id, call_id)) && reg_store_match(np, user, host, contact, flags)) {
+					reg_store_found(np);
+				}
+			}
+		} else if (!user && (all || host || contact)) {
+			switch_hash_index_t *hi;
+			void *val;
+
+			for (hi = switch_hash_first(NULL, shard->users); hi; hi = switch_hash_next(hi)) {
+				switch_hash_this(hi, NULL, NULL, &val);
+				for (np = (sofia_registration_t *) val; np; np = np->next) {
+					if ((!call_id || strcmp(np->call_id, call_id)) && reg_store_match(np, NULL, host, contact, flags)) {
+						reg_store_found(np);
+					}
+				}
+			}
+		}
+
+#undef reg_store_found
+
+		for (x = 0; x < found_used; x++) {
+			np = found[x];
+
+			if ((flags & SOFIA_REG_FIND_REMOVE)) {
+				reg_store_unlink(shard, np);
+			} else {
+				np = reg_store_new(np);
+			}
+
+			*tail = np;
+			tail = &np->next;
+		}
+
+		switch_mutex_unlock(shard->mutex);
+	}
+
+	switch_safe_free(found);
+
+	return list;
+}
+
+/* takes every registration with 0 < expires <= now out of the store, or all expiring ones when now is 0 */
+sofia_registration_t *sofia_reg_store_expire(sofia_profile_t *profile, time_t now)
+{
+	sofia_registration_t *list = NULL, **tail = &list;
+	int i;
+
+	for (i = 0; i < SOFIA_REG_SHARDS; i++) {
+		sofia_reg_shard_t *shard = &profile->reg_shards[i];
+
+		switch_mutex_lock(shard->mutex);
+		while (shard->heap_used && (!now || shard->heap[0]->expires <= now)) {
+			sofia_registration_t *reg = shard->heap[0];
+
+			reg_store_unlink(shard, reg);
+			*tail = reg;
+			tail = &reg->next;
+		}
+		switch_mutex_unlock(shard->mutex);
+	}
+
+	return list;
+}
+
+void sofia_reg_store_set_expires(sofia_profile_t *profile, const char *call_id, const char *user, const char *host, time_t expires)
+{
+	sofia_reg_shard_t *shard = reg_store_shard(profile, user);
+	sofia_registration_t *np;
+
+	if (zstr(user) || zstr(host) || zstr(call_id)) {
+		return;
+	}
+
+	switch_mutex_lock(shard->mutex);
+	for (np = switch_core_hash_find(shard->users, user); np; np = np->next) {
+		if (!strcmp(np->sip_host, host) && !strcmp(np->call_id, call_id)) {
+			reg_heap_remove(shard, np);
+			np->expires = expires;
+			reg_heap_push(shard, np);
+		}
+	}
+	switch_mutex_unlock(shard->mutex);
+}
+
+void sofia_reg_store_free(sofia_registration_t **list)
+{
+	sofia_registration_t *np, *next;
+
+	for (np = *list; np; np = next) {
+		next = np->next;
+		free(np);
+	}
+
+	*list = NULL;
+}
 
 int sofia_reg_find_callback(void *pArg, int argc, char **argv, char **columnNames)
 {
@@ -679,12 +1227,41 @@ int sofia_reg_del_callback(void *pArg, int argc, char **argv, char **columnNames
 	return 0;
 }
 
+/* feeds registrations taken out of the store through the same path as rows selected from sip_registrations */
+static void reg_store_fire_del(sofia_profile_t *profile, sofia_registration_t *list, int reboot)
+{
+	sofia_registration_t *np;
+	char expires[32], reboot_str[8];
+	char *argv[13];
+
+	switch_snprintf(reboot_str, sizeof(reboot_str), "%d", reboot);
+
+	for (np = list; np; np = np->next) {
+		switch_snprintf(expires, sizeof(expires), "%ld", (long) np->expires);
+		argv[0] = np->call_id;
+		argv[1] = np->sip_user;
+		argv[2] = np->sip_host;
+		argv[3] = np->contact;
+		argv[4] = np->status;
+		argv[5] = np->rpid;
+		argv[6] = expires;
+		argv[7] = np->user_agent;
+		argv[8] = np->server_user;
+		argv[9] = np->server_host;
+		argv[10] = profile->name;
+		argv[11] = np->network_ip;
+		argv[12] = reboot_str;
+		sofia_reg_del_callback(profile, 13, argv, NULL);
+	}
+}
+
 void sofia_reg_expire_call_id(sofia_profile_t *profile, const char *call_id, int reboot)
 {
 	char *sql = NULL;
 	char *sqlextra = NULL;
 	char *dup = strdup(call_id);
 	char *host = NULL, *user = NULL;
+	sofia_registration_t *list;
 
 	switch_assert(dup);
 
@@ -700,21 +1277,18 @@ void sofia_reg_expire_call_id(sofia_profile_t *profile, const char *call_id, int
 	}
 
 	if (zstr(user)) {
+		user = NULL;
 		sqlextra = switch_mprintf(" or (sip_host='%q')", host);
 	} else {
 		sqlextra = switch_mprintf(" or (sip_user='%q' and sip_host='%q')", user, host);
 	}
 
-	sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,expires"
-						 ",user_agent,server_user,server_host,profile_name,network_ip"
-						 ",%d from sip_registrations where call_id='%q' %s", reboot, call_id, sqlextra);
-
-
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_del_callback, profile);
-	switch_safe_free(sql);
+	list = sofia_reg_store_find(profile, call_id, user, host, NULL, SOFIA_REG_FIND_REMOVE);
+	reg_store_fire_del(profile, list, reboot);
+	sofia_reg_store_free(&list);
 
 	sql = switch_mprintf("delete from sip_registrations where call_id='%q' %s", call_id, sqlextra);
-	sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+	sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 
 	switch_safe_free(sqlextra);
 	switch_safe_free(sql);
@@ -725,27 +1299,20 @@ void sofia_reg_expire_call_id(sofia_profile_t *profile, const char *call_id, int
 void sofia_reg_check_expire(sofia_profile_t *profile, time_t now, int reboot)
 {
 	char *sql;
+	sofia_registration_t *list;
 
-	if (now) {
-		sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,expires"
-						",user_agent,server_user,server_host,profile_name,network_ip"
-						",%d from sip_registrations where expires > 0 and expires <= %ld", reboot, (long) now);
-	} else {
-		sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,expires"
-						",user_agent,server_user,server_host,profile_name,network_ip" ",%d from sip_registrations where expires > 0", reboot);
-	}
-
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_del_callback, profile);
-	free(sql);
+	if ((list = sofia_reg_store_expire(profile, now))) {
+		reg_store_fire_del(profile, list, reboot);
+		sofia_reg_store_free(&list);
 
-	if (now) {
-		sql = switch_mprintf("delete from sip_registrations where expires > 0 and expires <= %ld and hostname='%q'",
-						(long) now, mod_sofia_globals.hostname);
-	} else {
-		sql = switch_mprintf("delete from sip_registrations where expires > 0 and hostname='%q'", mod_sofia_globals.hostname);
+		if (now) {
+			sql = switch_mprintf("delete from sip_registrations where expires > 0 and expires <= %ld and hostname='%q'",
+							(long) now, mod_sofia_globals.hostname);
+		} else {
+			sql = switch_mprintf("delete from sip_registrations where expires > 0 and hostname='%q'", mod_sofia_globals.hostname);
+		}
+		sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 	}
-	sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
-	
 
 
 
@@ -793,28 +1360,156 @@ void sofia_reg_check_expire(sofia_profile_t *profile, time_t now, int reboot)
 
 	sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 
+}
 
-	if (now) {
-		if (sofia_test_pflag(profile, PFLAG_ALL_REG_OPTIONS_PING)) {
-			sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,"
-							"expires,user_agent,server_user,server_host,profile_name"
- " from sip_registrations where hostname='%s' and " 
- "profile_name='%s'", mod_sofia_globals.hostname, profile->name); 
-			
-			sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_nat_callback, profile);
-			switch_safe_free(sql);
-		} else if (sofia_test_pflag(profile, PFLAG_NAT_OPTIONS_PING)) {
-			sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,"
-							"expires,user_agent,server_user,server_host,profile_name"
-							" from sip_registrations where (status like '%%NAT%%' "
- "or contact like '%%fs_nat=yes%%') and hostname='%s' " 
- "and profile_name='%s'", mod_sofia_globals.hostname, profile->name); 
-			
-			sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_nat_callback, profile);
-			switch_safe_free(sql);
+static void reg_ping_slot(sofia_profile_t *profile, uint32_t slot, int all)
+{
+	sofia_registration_t *list = NULL, **tail = &list, *expired = NULL, **etail = &expired, *np;
+	switch_time_t now = switch_micro_time_now();
+	time_t epoch = switch_epoch_time_now(NULL);
+	uint32_t sent = 0, lost = 0;
+	char *argv[4];
+	char *sql;
+	int i;
+
+	for (i = 0; i < SOFIA_REG_SHARDS; i++) {
+		sofia_reg_shard_t *shard = &profile->reg_shards[i];
+
+		switch_mutex_lock(shard->mutex);
+		for (np = shard->ping_wheel[slot]; np; np = np->ping_next) {
+			if (!all && !reg_store_is_nat(np)) {
+				continue;
+			}
+
+			if (np->ping_sent) {
+				/* the last ping never got any answer, not even a local timeout */
+				np->ping_fails++;
+				lost++;
+			}
+
+			if (np->ping_fails >= profile->nat_ping_max_fails && sofia_test_pflag(profile, PFLAG_UNREG_OPTIONS_FAIL) &&
+				np->expires > epoch) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Expire registration '%s@%s' after %u unanswered pings\n",
+								  np->sip_user, np->sip_host, np->ping_fails);
+				reg_heap_remove(shard, np);
+				np->expires = epoch;
+				reg_heap_push(shard, np);
+				np->ping_sent = 0;
+				*etail = reg_store_new(np);
+				etail = &(*etail)->next;
+				continue;
+			}
+
+			np->ping_sent = now;
+			*tail = reg_store_new(np);
+			tail = &(*tail)->next;
+			sent++;
+		}
+		switch_mutex_unlock(shard->mutex);
+	}
+
+	for (np = list; np; np = np->next) {
+		argv[0] = np->call_id;
+		argv[1] = np->sip_user;
+		argv[2] = np->sip_host;
+		argv[3] = np->contact;
+		sofia_reg_nat_callback(profile, 4, argv, NULL);
+	}
+
+	sofia_reg_store_free(&list);
+
+	/* keep the mirror in step the same way an OPTIONS failure answer does in sofia_handle_sip_r_options */
+	for (np = expired; np; np = np->next) {
+		sql = switch_mprintf("update sip_registrations set expires=%ld where sip_user='%q' and sip_host='%q' and call_id='%q'",
+							 (long) np->expires, np->sip_user, np->sip_host, np->call_id);
+		sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
+	}
+
+	sofia_reg_store_free(&expired);
+
+	switch_mutex_lock(profile->nat_ping.mutex);
+	profile->nat_ping.sent += sent;
+	profile->nat_ping.lost += lost;
+	profile->nat_ping.round_sent += sent;
+	if (slot == SOFIA_REG_PING_SLOTS - 1) {
+		profile->nat_ping.last_round_sent = profile->nat_ping.round_sent;
+		profile->nat_ping.round_sent = 0;
+	}
+	switch_mutex_unlock(profile->nat_ping.mutex);
+}
+
+/* 
+   Called once a second from the profile worker, it advances the ping wheel to where it should be in the
+   current interval so every contact gets one OPTIONS per interval without bursting them all at once.
+*/
+void sofia_reg_ping_nat(sofia_profile_t *profile, time_t now)
+{
+	uint32_t interval = profile->nat_ping_seconds ? profile->nat_ping_seconds : (uint32_t) profile->ireg_seconds;
+	uint32_t pos;
+	int all = sofia_test_pflag(profile, PFLAG_ALL_REG_OPTIONS_PING);
+
+	if (!all && !sofia_test_pflag(profile, PFLAG_NAT_OPTIONS_PING)) {
+		return;
+	}
+
+	if (!interval) {
+		interval = IREG_SECONDS;
+	}
+
+	pos = (uint32_t) (((uint64_t) (now % interval) * SOFIA_REG_PING_SLOTS) / interval);
+
+	while (profile->nat_ping.pos != pos) {
+		profile->nat_ping.pos = (profile->nat_ping.pos + 1) % SOFIA_REG_PING_SLOTS;
+		reg_ping_slot(profile, profile->nat_ping.pos, all);
+	}
+}
+
+/* accounts an OPTIONS answer (or local timeout) to the registration it was sent for, returns its consecutive failures */
+uint32_t sofia_reg_ping_result(sofia_profile_t *profile, const char *call_id, const char *user, int status)
+{
+	sofia_reg_shard_t *shard;
+	sofia_registration_t *np;
+	switch_time_t now = switch_micro_time_now(), rtt = 0;
+	uint32_t fails = 0;
+	int ok = (status == 200 || status == 486), matched = 0;
+
+	if (zstr(call_id) || zstr(user)) {
+		return 0;
+	}
+
+	shard = reg_store_shard(profile, user);
+
+	switch_mutex_lock(shard->mutex);
+	for (np = switch_core_hash_find(shard->call_ids, call_id); np; np = np->next_call_id) {
+		if (!np->ping_sent) {
+			continue;
 		}
+
+		rtt = now - np->ping_sent;
+		np->ping_sent = 0;
+		np->ping_fails = ok ? 0 : np->ping_fails + 1;
+
+		if (np->ping_fails > fails) {
+			fails = np->ping_fails;
+		}
+
+		matched++;
+	}
+	switch_mutex_unlock(shard->mutex);
+
+	if (matched) {
+		switch_mutex_lock(profile->nat_ping.mutex);
+		if (ok) {
+			profile->nat_ping.answered++;
+			profile->nat_ping.rtt_total += rtt;
+			profile->nat_ping.rtt_last = rtt;
+		} else {
+			profile->nat_ping.failed++;
+		}
+		switch_mutex_unlock(profile->nat_ping.mutex);
 	}
 
+	return fails;
 }
 
 
@@ -829,10 +1524,9 @@ int sofia_reg_check_callback(void *pArg, int argc, char **argv, char **columnNam
 
 void sofia_reg_check_call_id(sofia_profile_t *profile, const char *call_id)
 {
-	char *sql = NULL;
-	char *sqlextra = NULL;
 	char *dup = strdup(call_id);
 	char *host = NULL, *user = NULL;
+	sofia_registration_t *list, *np;
 
 	switch_assert(dup);
 
@@ -848,21 +1542,16 @@ void sofia_reg_check_call_id(sofia_profile_t *profile, const char *call_id)
 	}
 
 	if (zstr(user)) {
-		sqlextra = switch_mprintf(" or (sip_host='%q')", host);
-	} else {
-		sqlextra = switch_mprintf(" or (sip_user='%q' and sip_host='%q')", user, host);
+		user = NULL;
 	}
 
-	sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,expires"
-						 ",user_agent,server_user,server_host,profile_name,network_ip"
-						 " from sip_registrations where call_id='%q' %s", call_id, sqlextra);
-
-
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_check_callback, profile);
+	list = sofia_reg_store_find(profile, call_id, user, host, NULL, 0);
 
+	for (np = list; np; np = np->next) {
+		sofia_reg_send_reboot(profile, np->call_id, np->sip_user, np->sip_host, np->contact, np->user_agent, np->network_ip);
+	}
 
-	switch_safe_free(sql);
-	switch_safe_free(sqlextra);
+	sofia_reg_store_free(&list);
 	switch_safe_free(dup);
 
 }
@@ -870,14 +1559,11 @@ void sofia_reg_check_call_id(sofia_profile_t *profile, const char *call_id)
 void sofia_reg_check_sync(sofia_profile_t *profile)
 {
 	char *sql;
+	sofia_registration_t *list;
 
-	sql = switch_mprintf("select call_id,sip_user,sip_host,contact,status,rpid,expires"
-					",user_agent,server_user,server_host,profile_name,network_ip" 
-					" from sip_registrations where expires > 0");
-
-
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_del_callback, profile);
-	switch_safe_free(sql);
+	list = sofia_reg_store_expire(profile, 0);
+	reg_store_fire_del(profile, list, 0);
+	sofia_reg_store_free(&list);
 
 	sql = switch_mprintf("delete from sip_registrations where expires > 0 and hostname='%q'", mod_sofia_globals.hostname);
 	sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
@@ -898,62 +1584,42 @@ void sofia_reg_check_sync(sofia_profile_t *profile)
 
 char *sofia_reg_find_reg_url(sofia_profile_t *profile, const char *user, const char *host, char *val, switch_size_t len)
 {
-	struct callback_t cbt = { 0 };
-	char *sql;
+	sofia_registration_t *list;
 
 	if (!user) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Called with null user!\n");
 		return NULL;
 	}
 
-	cbt.val = val;
-	cbt.len = len;
-
-	if (host) {
-		sql = switch_mprintf("select contact from sip_registrations where sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-						user, host, host);
-	} else {
-		sql = switch_mprintf("select contact from sip_registrations where sip_user='%q'", user);
-	}
-
-
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_find_callback, &cbt);
-
-	switch_safe_free(sql);
-
-	if (cbt.list) {
-		switch_console_free_matches(&cbt.list);
-	}
-
-	if (cbt.matches) {
+	if ((list = sofia_reg_store_find(profile, NULL, user, host, NULL, SOFIA_REG_FIND_PRESENCE_HOSTS))) {
+		switch_copy_string(val, list->contact, len);
+		sofia_reg_store_free(&list);
 		return val;
-	} else {
-		return NULL;
 	}
+
+	return NULL;
 }
 
 
 switch_console_callback_match_t *sofia_reg_find_reg_url_multi(sofia_profile_t *profile, const char *user, const char *host)
 {
 	struct callback_t cbt = { 0 };
-	char *sql;
+	sofia_registration_t *list, *np;
+	char *argv[1];
 
 	if (!user) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Called with null user!\n");
 		return NULL;
 	}
 
-	if (host) {
-		sql = switch_mprintf("select contact from sip_registrations where sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-						user, host, host);
-	} else {
-		sql = switch_mprintf("select contact from sip_registrations where sip_user='%q'", user);
-	}
+	list = sofia_reg_store_find(profile, NULL, user, host, NULL, SOFIA_REG_FIND_PRESENCE_HOSTS);
 
+	for (np = list; np; np = np->next) {
+		argv[0] = np->contact;
+		sofia_reg_find_callback(&cbt, 1, argv, NULL);
+	}
 
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_find_callback, &cbt);
-	
-	switch_safe_free(sql);
+	sofia_reg_store_free(&list);
 
 	return cbt.list;
 }
@@ -962,26 +1628,29 @@ switch_console_callback_match_t *sofia_reg_find_reg_url_multi(sofia_profile_t *p
 switch_console_callback_match_t *sofia_reg_find_reg_url_with_positive_expires_multi(sofia_profile_t *profile, const char *user, const char *host, time_t reg_time, const char *contact_str, long exptime)
 {
 	struct callback_t cbt = { 0 };
-	char *sql;
+	sofia_registration_t *list, *np;
+	char expires[32];
+	char *argv[2];
 
 	if (!user) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Called with null user!\n");
 		return NULL;
 	}
 
-	if (host) {
-		sql = switch_mprintf("select contact,expires from sip_registrations where sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')",
-						user, host, host);
-	} else {
-		sql = switch_mprintf("select contact,expires from sip_registrations where sip_user='%q'", user);
-	}
-
 	cbt.time = reg_time;
 	cbt.contact_str = contact_str;
 	cbt.exptime = exptime;
 
-	sofia_glue_execute_sql_callback(profile, profile->dbh_mutex, sql, sofia_reg_find_reg_with_positive_expires_callback, &cbt);
-	free(sql);
+	list = sofia_reg_store_find(profile, NULL, user, host, NULL, SOFIA_REG_FIND_PRESENCE_HOSTS);
+
+	for (np = list; np; np = np->next) {
+		switch_snprintf(expires, sizeof(expires), "%ld", (long) np->expires);
+		argv[0] = np->contact;
+		argv[1] = expires;
+		sofia_reg_find_reg_with_positive_expires_callback(&cbt, 2, argv, NULL);
+	}
+
+	sofia_reg_store_free(&list);
 
 	return cbt.list;
 }
@@ -1025,15 +1694,7 @@ void sofia_reg_auth_challenge(sofia_profile_t *profile, nua_handle_t *nh, sofia_
 
 uint32_t sofia_reg_reg_count(sofia_profile_t *profile, const char *user, const char *host)
 {
-	char buf[32] = "";
-	char *sql;
-	
-	sql = switch_mprintf("select count(*) from sip_registrations where profile_name='%q' and "
-						 "sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')", profile->name, user, host, host);
-	
-	sofia_glue_execute_sql2str(profile, profile->dbh_mutex, sql, buf, sizeof(buf));
-	switch_safe_free(sql);
-	return atoi(buf);													
+	return sofia_reg_store_count(profile, user, host, NULL, NULL, SOFIA_REG_FIND_PRESENCE_HOSTS);
 }
 
 static int debounce_check(sofia_profile_t *profile, const char *user, const char *host)
@@ -1579,38 +2240,34 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 		char *url = NULL;
 		char *contact = NULL;
 		switch_bool_t update_registration = SWITCH_FALSE;
+		sofia_registration_t reg = { 0 };
 
 		if (auth_params) {
 			username = switch_event_get_header(auth_params, "sip_auth_username");
 			realm = switch_event_get_header(auth_params, "sip_auth_realm");
 		}
+
 		if (auth_res != AUTH_RENEWED || !multi_reg) {
+			sofia_registration_t *list;
+
 			if (multi_reg) {
 				if (multi_reg_contact) {
+					list = sofia_reg_store_find(profile, NULL, to_user, reg_host, contact_str, SOFIA_REG_FIND_REMOVE);
 					sql =
 						switch_mprintf("delete from sip_registrations where sip_user='%q' and sip_host='%q' and contact='%q'", to_user, reg_host, contact_str);
 				} else {
+					list = sofia_reg_store_find(profile, call_id, NULL, NULL, NULL, SOFIA_REG_FIND_REMOVE);
 					sql = switch_mprintf("delete from sip_registrations where call_id='%q'", call_id);
 				}
 			} else {
+				list = sofia_reg_store_find(profile, NULL, to_user, reg_host, NULL, SOFIA_REG_FIND_REMOVE);
 				sql = switch_mprintf("delete from sip_registrations where sip_user='%q' and sip_host='%q'", to_user, reg_host);
 			}
-			
-			sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
-		} else {
-			char buf[32] = "";
-
-			
-			sql = switch_mprintf("select count(*) from sip_registrations where sip_user='%q' and sip_username='%q' and sip_host='%q' and contact='%q'", 
-								 to_user, username, reg_host, contact_str);
-
-
 
-			sofia_glue_execute_sql2str(profile, profile->dbh_mutex, sql, buf, sizeof(buf));
-			switch_safe_free(sql);
-			if (atoi(buf) > 0) {
-				update_registration = SWITCH_TRUE;
-			}
+			sofia_reg_store_free(&list);
+			sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
+		} else if (sofia_reg_store_count(profile, to_user, reg_host, username, contact_str, 0) > 0) {
+			update_registration = SWITCH_TRUE;
 		}
 
 		switch_find_local_ip(guess_ip4, sizeof(guess_ip4), NULL, AF_INET);
@@ -1624,7 +2281,24 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 		switch_safe_free(url);
 		switch_safe_free(contact);
 
+		reg.call_id = (char *) call_id;
+		reg.sip_user = (char *) to_user;
+		reg.sip_host = (char *) reg_host;
+		reg.presence_hosts = profile->presence_hosts;
+		reg.contact = (char *) contact_str;
+		reg.status = (char *) reg_desc;
+		reg.rpid = (char *) rpid;
+		reg.expires = (time_t) ((long) reg_time + (long) exptime + 60);
+		reg.user_agent = (char *) agent;
+		reg.server_user = (char *) from_user;
+		reg.server_host = guess_ip4;
+		reg.network_ip = network_ip;
+		reg.network_port = network_port_c;
+		reg.sip_username = (char *) username;
+
+		/* the in-memory store is authoritative, the table is only a mirror so the write can be queued */
 		if (!update_registration) {
+			sofia_reg_store_add(profile, &reg);
 			sql = switch_mprintf("insert into sip_registrations "
 					"(call_id,sip_user,sip_host,presence_hosts,contact,status,rpid,expires,"
 					"user_agent,server_user,server_host,profile_name,hostname,network_ip,network_port,sip_username,sip_realm,"
@@ -1635,6 +2309,7 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 					agent, from_user, guess_ip4, profile->name, mod_sofia_globals.hostname, network_ip, network_port_c, username, realm, 
 								 mwi_user, mwi_host, guess_ip4, mod_sofia_globals.hostname, sub_host);
 		} else {
+			sofia_reg_store_update(profile, &reg);
 			sql = switch_mprintf("update sip_registrations set call_id='%q',"
 								 "sub_host='%q', network_ip='%q',network_port='%q',"
 								 "presence_hosts='%q', server_host='%q', orig_server_host='%q',"
@@ -1648,7 +2323,7 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 		}				 
 
 		if (sql) {
-			sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+			sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 		}
 
 		if (!update_registration && sofia_reg_reg_count(profile, to_user, reg_host) == 1) {
@@ -1692,6 +2367,7 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 
 	} else {
 		int send = 1;
+		sofia_registration_t *list;
 
 		if (multi_reg) {
 			if (sofia_reg_reg_count(profile, to_user, sub_host) > 0) {
@@ -1724,19 +2400,24 @@ uint8_t sofia_reg_handle_register(nua_t *nua, sofia_profile_t *profile, nua_hand
 			}
 
 			if (multi_reg_contact) {
+				list = sofia_reg_store_find(profile, NULL, to_user, reg_host, contact_str, SOFIA_REG_FIND_REMOVE);
 				sql =
 					switch_mprintf("delete from sip_registrations where sip_user='%q' and sip_host='%q' and contact='%q'", to_user, reg_host, contact_str);
 			} else {
+				list = sofia_reg_store_find(profile, call_id, NULL, NULL, NULL, SOFIA_REG_FIND_REMOVE);
 				sql = switch_mprintf("delete from sip_registrations where call_id='%q'", call_id);
 			}
 
-			sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+			sofia_reg_store_free(&list);
+			sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 
 			switch_safe_free(icontact);
 		} else {
+			list = sofia_reg_store_find(profile, NULL, to_user, reg_host, NULL, SOFIA_REG_FIND_REMOVE);
+			sofia_reg_store_free(&list);
 
 			if ((sql = switch_mprintf("delete from sip_registrations where sip_user='%q' and sip_host='%q'", to_user, reg_host))) {
-				sofia_glue_execute_sql_now(profile, &sql, SWITCH_TRUE);
+				sofia_glue_execute_sql(profile, &sql, SWITCH_TRUE);
 			}
 		}
 	}
@@ -2291,13 +2972,58 @@ static int sofia_reg_nonce_callback(void *pArg, int argc, char **argv, char **co
 	return 0;
 }
 
-static int sofia_reg_regcount_callback(void *pArg, int argc, char **argv, char **columnNames)
+/* 
+   Copies of the user/host matches in every profile's store, for the lookups that always ran over the whole
+   sip_registrations table rather than one profile's rows.  profile is one the caller already holds, or NULL.
+   Registrations held by other boxes on a shared db are not seen.
+*/
+sofia_registration_t *sofia_reg_store_find_all(sofia_profile_t *profile, const char *user, const char *host, int flags)
 {
-	int *ret = (int *) pArg;
-	if (argc == 1) {
-		*ret = atoi(argv[0]);
+	switch_hash_index_t *hi;
+	const void *var;
+	void *val;
+	sofia_profile_t *pptr;
+	sofia_registration_t *list = NULL, **tail = &list;
+
+	switch_mutex_lock(mod_sofia_globals.hash_mutex);
+	for (hi = switch_hash_first(NULL, mod_sofia_globals.profile_hash); hi; hi = switch_hash_next(hi)) {
+		switch_hash_this(hi, &var, NULL, &val);
+
+		/* aliases and domains point at the same profile, only visit it under its own name */
+		if (!(pptr = (sofia_profile_t *) val) || strcmp((const char *) var, pptr->name)) {
+			continue;
+		}
+
+		if (pptr != profile && sofia_glue_profile_rdlock(pptr) != SWITCH_STATUS_SUCCESS) {
+			continue;
+		}
+
+		for (*tail = sofia_reg_store_find(pptr, NULL, user, host, NULL, flags & ~SOFIA_REG_FIND_REMOVE); *tail; tail = &(*tail)->next);
+
+		if (pptr != profile) {
+			sofia_glue_release_profile(pptr);
+		}
 	}
-	return 0;
+	switch_mutex_unlock(mod_sofia_globals.hash_mutex);
+
+	return list;
+}
+
+/* max-registrations-per-extension has always counted the user's registrations in every profile, not only the one being registered to */
+static uint32_t reg_store_count_other_calls(sofia_profile_t *profile, const char *user, const char *call_id)
+{
+	sofia_registration_t *list, *np;
+	uint32_t count = 0;
+
+	list = sofia_reg_store_find_all(profile, user, NULL, 0);
+	for (np = list; np; np = np->next) {
+		if (strcmp(np->call_id, call_id)) {
+			count++;
+		}
+	}
+	sofia_reg_store_free(&list);
+
+	return count;
 }
 
 auth_res_t sofia_reg_parse_auth(sofia_profile_t *profile,
@@ -2670,10 +3396,7 @@ auth_res_t sofia_reg_parse_auth(sofia_profile_t *profile,
 		call_id = sip->sip_call_id->i_id;
 		switch_assert(call_id);
 
-		sql = switch_mprintf("select count(sip_user) from sip_registrations where sip_user='%q' AND call_id <> '%q'", username, call_id);
-		switch_assert(sql != NULL);
-		sofia_glue_execute_sql_callback(profile, NULL, sql, sofia_reg_regcount_callback, &count);
-		free(sql);
+		count = reg_store_count_other_calls(profile, username, call_id);
 
 		if (count + 1 > max_registrations_perext) {
 			ret = AUTH_FORBIDDEN;
@@ -0,0 +1,363 @@
+/*
+ * Times the registration lookups and writes sofia_reg_handle_register() makes per REGISTER, on the in-memory
+ * registration store and on the sip_registrations queries it replaced, and reports requests per second.
+ * sofia_reg.c is included; the few core and sofia_glue calls the store makes are faked below, see README.
+ */
+#include "../sofia_reg.c"
+#include <sqlite3.h>
+#include <sys/time.h>
+
+static int fail_count;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+struct mod_sofia_globals mod_sofia_globals;
+
+/* the store's hashes are made without a pool, the allocations just leak */
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory, const char *file, const char *func, int line)
+{
+	return calloc(1, memory);
+}
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	*lock = (switch_mutex_t *) mutex;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	pthread_mutex_lock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* the profile starts with an empty table, there is nothing to load into the store */
+switch_bool_t sofia_glue_execute_sql_callback(sofia_profile_t *profile, switch_mutex_t *dbh_mutex, char *sql,
+											  switch_core_db_callback_func_t callback, void *pdata)
+{
+	return SWITCH_TRUE;
+}
+
+switch_status_t sofia_glue_profile_rdlock__(const char *file, const char *func, int line, sofia_profile_t *profile)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void sofia_glue_release_profile__(const char *file, const char *func, int line, sofia_profile_t *profile)
+{
+}
+
+static switch_time_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (switch_time_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+typedef struct {
+	char call_id[64];
+	char user[32];
+	char contact[128];
+	char port[8];
+} bench_reg_t;
+
+static bench_reg_t *regs;
+static const char *host = "example.com";
+static const char *presence_hosts = "example.com,example.org";
+
+static void regs_init(int users)
+{
+	int x;
+
+	regs = calloc(users, sizeof(*regs));
+
+	for (x = 0; x < users; x++) {
+		snprintf(regs[x].call_id, sizeof(regs[x].call_id), "%08x-reg-bench@10.0.%d.%d", x * 2654435761u, (x >> 8) & 255, x & 255);
+		snprintf(regs[x].user, sizeof(regs[x].user), "%d", 10000 + x);
+		snprintf(regs[x].port, sizeof(regs[x].port), "%d", 5060 + (x % 1000));
+		snprintf(regs[x].contact, sizeof(regs[x].contact), "\"%s\" <sip:%s@10.0.%d.%d:%s;transport=udp>",
+						regs[x].user, regs[x].user, (x >> 8) & 255, x & 255, regs[x].port);
+	}
+}
+
+/* what sofia_reg_handle_register() asks the store for one REGISTER: is it a refresh, write it, and the first-register count */
+static void store_register(sofia_profile_t *profile, bench_reg_t *br, time_t expires)
+{
+	sofia_registration_t reg = { 0 };
+	int update;
+
+	update = sofia_reg_store_count(profile, br->user, host, br->user, br->contact, 0) > 0;
+
+	reg.call_id = br->call_id;
+	reg.sip_user = br->user;
+	reg.sip_host = (char *) host;
+	reg.presence_hosts = (char *) presence_hosts;
+	reg.contact = br->contact;
+	reg.status = "Registered(UDP)";
+	reg.rpid = "unknown";
+	reg.expires = expires;
+	reg.user_agent = "reg_bench";
+	reg.server_user = br->user;
+	reg.server_host = "10.0.0.1";
+	reg.network_ip = "10.0.0.2";
+	reg.network_port = br->port;
+	reg.sip_username = br->user;
+
+	if (!update) {
+		sofia_reg_store_add(profile, &reg);
+	} else {
+		sofia_reg_store_update(profile, &reg);
+	}
+
+	if (!update) {
+		sofia_reg_reg_count(profile, br->user, host);
+	}
+}
+
+static int count_callback(void *pArg, int argc, char **argv, char **columnNames)
+{
+	*(int *) pArg = atoi(argv[0]);
+	return 0;
+}
+
+static int sql_count(sqlite3 *db, char *sql)
+{
+	int count = 0;
+
+	sqlite3_exec(db, sql, count_callback, &count, NULL);
+	sqlite3_free(sql);
+
+	return count;
+}
+
+/* the same REGISTER before the store: the two counts and the write all went to sip_registrations on the handler thread */
+static void sql_register(sqlite3 *db, sofia_profile_t *profile, bench_reg_t *br, time_t expires)
+{
+	char *sql;
+	int update;
+
+	update = sql_count(db, sqlite3_mprintf("select count(*) from sip_registrations where sip_user='%q' and sip_username='%q' and sip_host='%q' and contact='%q'",
+										   br->user, br->user, host, br->contact)) > 0;
+
+	if (!update) {
+		sql = sqlite3_mprintf("insert into sip_registrations "
+							  "(call_id,sip_user,sip_host,presence_hosts,contact,status,rpid,expires,"
+							  "user_agent,server_user,server_host,profile_name,hostname,network_ip,network_port,sip_username,sip_realm,"
+							  "mwi_user,mwi_host, orig_server_host, orig_hostname, sub_host) "
+							  "values ('%q','%q', '%q','%q','%q','%q', '%q', %ld, '%q', '%q', '%q', '%q', '%q', '%q', '%q','%q','%q','%q','%q','%q','%q','%q')",
+							  br->call_id, br->user, host, presence_hosts, br->contact, "Registered(UDP)", "unknown", (long) expires,
+							  "reg_bench", br->user, "10.0.0.1", profile->name, "bench", "10.0.0.2", br->port, br->user, host,
+							  br->user, host, "10.0.0.1", "bench", host);
+	} else {
+		sql = sqlite3_mprintf("update sip_registrations set call_id='%q',"
+							  "sub_host='%q', network_ip='%q',network_port='%q',"
+							  "presence_hosts='%q', server_host='%q', orig_server_host='%q',"
+							  "hostname='%q', orig_hostname='%q',"
+							  "expires = %ld where sip_user='%q' and sip_username='%q' and sip_host='%q' and contact='%q'",
+							  br->call_id, host, "10.0.0.2", br->port, presence_hosts, "10.0.0.1", "10.0.0.1", "bench", "bench",
+							  (long) expires, br->user, br->user, host, br->contact);
+	}
+
+	sqlite3_exec(db, sql, NULL, NULL, NULL);
+	sqlite3_free(sql);
+
+	if (!update) {
+		sql_count(db, sqlite3_mprintf("select count(*) from sip_registrations where profile_name='%q' and "
+									  "sip_user='%q' and (sip_host='%q' or presence_hosts like '%%%q%%')", profile->name, br->user, host, host));
+	}
+}
+
+static sqlite3 *sql_open(void)
+{
+	static const char *schema[] = {
+		"CREATE TABLE sip_registrations (call_id VARCHAR(255), sip_user VARCHAR(255), sip_host VARCHAR(255), presence_hosts VARCHAR(255), "
+		"contact VARCHAR(1024), status VARCHAR(255), rpid VARCHAR(255), expires INTEGER, user_agent VARCHAR(255), server_user VARCHAR(255), "
+		"server_host VARCHAR(255), profile_name VARCHAR(255), hostname VARCHAR(255), network_ip VARCHAR(255), network_port VARCHAR(6), "
+		"sip_username VARCHAR(255), sip_realm VARCHAR(255), mwi_user VARCHAR(255), mwi_host VARCHAR(255), orig_server_host VARCHAR(255), "
+		"orig_hostname VARCHAR(255), sub_host VARCHAR(255))",
+		/* the indexes sofia_glue_init_sql() creates */
+		"create index sr_call_id on sip_registrations (call_id)",
+		"create index sr_sip_user on sip_registrations (sip_user)",
+		"create index sr_sip_host on sip_registrations (sip_host)",
+		"create index sr_sub_host on sip_registrations (sub_host)",
+		"create index sr_mwi_user on sip_registrations (mwi_user)",
+		"create index sr_mwi_host on sip_registrations (mwi_host)",
+		"create index sr_profile_name on sip_registrations (profile_name)",
+		"create index sr_presence_hosts on sip_registrations (presence_hosts)",
+		"create index sr_contact on sip_registrations (contact)",
+		"create index sr_expires on sip_registrations (expires)",
+		"create index sr_hostname on sip_registrations (hostname)",
+		"create index sr_status on sip_registrations (status)",
+		"create index sr_network_ip on sip_registrations (network_ip)",
+		"create index sr_network_port on sip_registrations (network_port)",
+		"create index sr_sip_username on sip_registrations (sip_username)",
+		"create index sr_sip_realm on sip_registrations (sip_realm)",
+		"create index sr_orig_server_host on sip_registrations (orig_server_host)",
+		"create index sr_orig_hostname on sip_registrations (orig_hostname)",
+		NULL
+	};
+	sqlite3 *db;
+	int x;
+
+	if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+		return NULL;
+	}
+
+	for (x = 0; schema[x]; x++) {
+		sqlite3_exec(db, schema[x], NULL, NULL, NULL);
+	}
+
+	return db;
+}
+
+static sofia_profile_t *profile_new(void)
+{
+	sofia_profile_t *profile = calloc(1, sizeof(*profile));
+
+	profile->name = "internal";
+	sofia_reg_store_init(profile);
+
+	return profile;
+}
+
+/* every user registers once, then refreshes rounds times; a refresh is the common case on a busy profile */
+static void bench_store(int users, int rounds)
+{
+	sofia_profile_t *profile = profile_new();
+	time_t expires = time(NULL) + 3600;
+	switch_time_t start, first, refresh;
+	int x, y;
+
+	start = now_us();
+	for (x = 0; x < users; x++) {
+		store_register(profile, &regs[x], expires);
+	}
+	first = now_us() - start;
+
+	start = now_us();
+	for (y = 0; y < rounds; y++) {
+		for (x = 0; x < users; x++) {
+			store_register(profile, &regs[x], expires + y + 1);
+		}
+	}
+	refresh = now_us() - start;
+
+	for (x = 0; x < users; x += users / 10 + 1) {
+		CHECK(sofia_reg_store_count(profile, regs[x].user, host, NULL, NULL, 0) == 1, "user %s has %u registrations",
+			  regs[x].user, sofia_reg_store_count(profile, regs[x].user, host, NULL, NULL, 0));
+	}
+
+	printf("store: %8.0f first registers/sec  %8.0f refreshes/sec\n", users * 1000000.0 / (first ? first : 1),
+		   (double) users * rounds * 1000000.0 / (refresh ? refresh : 1));
+
+	sofia_reg_store_destroy(profile);
+}
+
+static void bench_sql(int users, int rounds)
+{
+	sofia_profile_t *profile = profile_new();
+	time_t expires = time(NULL) + 3600;
+	switch_time_t start, first, refresh;
+	sqlite3 *db;
+	int x, y;
+
+	if (!(db = sql_open())) {
+		CHECK(0, "cannot open sqlite");
+		return;
+	}
+
+	start = now_us();
+	for (x = 0; x < users; x++) {
+		sql_register(db, profile, &regs[x], expires);
+	}
+	first = now_us() - start;
+
+	start = now_us();
+	for (y = 0; y < rounds; y++) {
+		for (x = 0; x < users; x++) {
+			sql_register(db, profile, &regs[x], expires + y + 1);
+		}
+	}
+	refresh = now_us() - start;
+
+	CHECK(sql_count(db, sqlite3_mprintf("select count(*) from sip_registrations")) == users, "sip_registrations does not hold one row per user");
+
+	printf("sql:   %8.0f first registers/sec  %8.0f refreshes/sec\n", users * 1000000.0 / (first ? first : 1),
+		   (double) users * rounds * 1000000.0 / (refresh ? refresh : 1));
+
+	sqlite3_close(db);
+	sofia_reg_store_destroy(profile);
+}
+
+/* sofia_count_reg and sofia_username_of span every profile, once each however many aliases point at it */
+static void test_find_all(void)
+{
+	sofia_profile_t *internal = profile_new(), *external = profile_new();
+	sofia_registration_t *list, *np;
+	int count = 0, fails = fail_count;
+
+	external->name = "external";
+	switch_core_hash_insert(mod_sofia_globals.profile_hash, internal->name, internal);
+	switch_core_hash_insert(mod_sofia_globals.profile_hash, external->name, external);
+	switch_core_hash_insert(mod_sofia_globals.profile_hash, host, internal);
+
+	store_register(internal, &regs[0], time(NULL) + 60);
+	store_register(external, &regs[0], time(NULL) + 60);
+	store_register(external, &regs[1], time(NULL) + 60);
+
+	list = sofia_reg_store_find_all(internal, regs[0].user, "example.org", SOFIA_REG_FIND_PRESENCE_HOSTS);
+	for (np = list; np; np = np->next) {
+		count++;
+	}
+	CHECK(count == 2, "%d registrations of %s over both profiles, expected 2", count, regs[0].user);
+	CHECK(list && !strcmp(list->sip_username, regs[0].user), "wrong sip_username");
+	sofia_reg_store_free(&list);
+
+	list = sofia_reg_store_find_all(NULL, NULL, host, 0);
+	for (count = 0, np = list; np; np = np->next) {
+		count++;
+	}
+	CHECK(count == 3, "%d registrations on %s, expected 3", count, host);
+	sofia_reg_store_free(&list);
+
+	switch_core_hash_delete(mod_sofia_globals.profile_hash, internal->name);
+	switch_core_hash_delete(mod_sofia_globals.profile_hash, external->name);
+	switch_core_hash_delete(mod_sofia_globals.profile_hash, host);
+	sofia_reg_store_destroy(internal);
+	sofia_reg_store_destroy(external);
+
+	printf("test_find_all() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+int main(int argc, char **argv)
+{
+	int users = argc > 1 ? atoi(argv[1]) : 10000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+	switch_mutex_init(&mod_sofia_globals.hash_mutex, SWITCH_MUTEX_NESTED, NULL);
+	switch_core_hash_init(&mod_sofia_globals.profile_hash, NULL);
+	regs_init(users);
+
+	test_find_all();
+
+	printf("%d users, %d refresh rounds\n", users, rounds);
+	bench_store(users, rounds);
+	bench_sql(users, rounds);
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+	return fail_count ? 1 : 0;
+}
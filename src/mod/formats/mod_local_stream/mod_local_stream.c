@@ -33,6 +33,9 @@
 #include <switch.h>
 /* for apr_pstrcat */
 #define DEFAULT_PREBUFFER_SIZE 1024 * 64
+/* number of intervals of decoded (and encoded) audio kept in the shared ring of each stream */
+#define RING_CHUNKS 64
+#define ENCODER_NOT_STARTED 0xFFFFFFFF
 
 SWITCH_MODULE_LOAD_FUNCTION(mod_local_stream_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_local_stream_shutdown);
@@ -49,10 +52,28 @@ static struct {
 static int RUNNING = 1;
 static int THREADS = 0;
 
+/* one encoded copy of a stream, shared by every listener using the same codec and ptime */
+struct local_stream_encoder {
+	const switch_codec_implementation_t *impl;
+	switch_codec_t codec;
+	uint8_t *ring;
+	uint32_t *ring_len;
+	uint8_t *silence;
+	uint32_t silence_len;
+	uint32_t start_seq;
+	int users;
+	int failed;
+	struct local_stream_encoder *next;
+};
+
+typedef struct local_stream_encoder local_stream_encoder_t;
+
 struct local_stream_context {
 	struct local_stream_source *source;
-	switch_mutex_t *audio_mutex;
-	switch_buffer_t *audio_buffer;
+	local_stream_encoder_t *encoder;
+	uint32_t cursor;
+	uint32_t offset;
+	int lagged;
 	int err;
 	const char *file;
 	const char *func;
@@ -90,6 +111,13 @@ struct local_stream_source {
 	int32_t chime_counter;
 	int32_t chime_max_counter;
 	switch_file_handle_t chime_fh;
+	int encode_cache;
+	switch_size_t chunk_bytes;
+	uint8_t *ring;
+	uint32_t *ring_len;
+	uint32_t ring_seq;
+	switch_thread_rwlock_t *ring_rwlock;
+	local_stream_encoder_t *encoders;
 };
 
 typedef struct local_stream_source local_stream_source_t;
@@ -103,11 +131,112 @@ static int do_rand(void)
 	return index;
 }
 
+/* Called with source->mutex held, after the decoded chunk for seq was stored in the ring */
+static void encode_chunk(local_stream_source_t *source, uint32_t seq, uint8_t *data)
+{
+	local_stream_encoder_t *encoder;
+	uint32_t slot = seq % RING_CHUNKS;
+
+	for (encoder = source->encoders; encoder; encoder = encoder->next) {
+		const switch_codec_implementation_t *impl = encoder->impl;
+		uint8_t *out = encoder->ring + (slot * source->chunk_bytes);
+		uint32_t pos, olen = 0;
+
+		if (!encoder->users || encoder->failed) {
+			encoder->start_seq = ENCODER_NOT_STARTED;
+			continue;
+		}
+
+		for (pos = 0; pos < source->chunk_bytes; pos += impl->decoded_bytes_per_packet) {
+			uint32_t elen = (uint32_t) source->chunk_bytes - olen, rate = impl->actual_samples_per_second;
+			unsigned int flag = 0;
+
+			if (switch_core_codec_encode(&encoder->codec, NULL, data + pos, impl->decoded_bytes_per_packet, impl->actual_samples_per_second,
+										 out + olen, &elen, &rate, &flag) != SWITCH_STATUS_SUCCESS || elen != impl->encoded_bytes_per_packet) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Stream %s cannot cache %s@%dms frames, falling back to decoded audio\n",
+								  source->name, impl->iananame, impl->microseconds_per_packet / 1000);
+				encoder->failed = 1;
+				break;
+			}
+			olen += elen;
+		}
+
+		encoder->ring_len[slot] = olen;
+
+		if (encoder->start_seq == ENCODER_NOT_STARTED) {
+			encoder->start_seq = seq;
+		}
+	}
+}
+
+/* Find or create the shared encoder for impl, called with source->mutex held */
+static local_stream_encoder_t *get_encoder(local_stream_source_t *source, const switch_codec_implementation_t *impl)
+{
+	local_stream_encoder_t *encoder;
+	uint8_t *zero;
+	uint32_t pos, elen, rate;
+	unsigned int flag;
+
+	if (!impl || source->channels != 1 || impl->number_of_channels != 1 || (int) impl->actual_samples_per_second != source->rate ||
+		!impl->decoded_bytes_per_packet || !impl->encoded_bytes_per_packet || source->chunk_bytes % impl->decoded_bytes_per_packet ||
+		!strcasecmp(impl->iananame, "L16")) {
+		return NULL;
+	}
+
+	for (encoder = source->encoders; encoder; encoder = encoder->next) {
+		if (encoder->impl->samples_per_second == impl->samples_per_second && encoder->impl->microseconds_per_packet == impl->microseconds_per_packet &&
+			!strcasecmp(encoder->impl->iananame, impl->iananame)) {
+			break;
+		}
+	}
+
+	if (!encoder) {
+		encoder = switch_core_alloc(source->pool, sizeof(*encoder));
+
+		if (switch_core_codec_init(&encoder->codec, impl->iananame, impl->fmtp, impl->samples_per_second, impl->microseconds_per_packet / 1000, 1,
+								   SWITCH_CODEC_FLAG_ENCODE, NULL, source->pool) != SWITCH_STATUS_SUCCESS) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Stream %s cannot load %s encoder\n", source->name, impl->iananame);
+			encoder->failed = 1;
+		} else {
+			encoder->ring = switch_core_alloc(source->pool, source->chunk_bytes * RING_CHUNKS);
+			encoder->ring_len = switch_core_alloc(source->pool, sizeof(uint32_t) * RING_CHUNKS);
+			encoder->silence = switch_core_alloc(source->pool, source->chunk_bytes);
+			zero = switch_core_alloc(source->pool, source->chunk_bytes);
+
+			for (pos = 0; pos < source->chunk_bytes; pos += impl->decoded_bytes_per_packet) {
+				elen = (uint32_t) source->chunk_bytes - encoder->silence_len;
+				rate = impl->actual_samples_per_second;
+				flag = 0;
+				if (switch_core_codec_encode(&encoder->codec, NULL, zero + pos, impl->decoded_bytes_per_packet, impl->actual_samples_per_second,
+											 encoder->silence + encoder->silence_len, &elen, &rate, &flag) != SWITCH_STATUS_SUCCESS ||
+					elen != impl->encoded_bytes_per_packet) {
+					encoder->failed = 1;
+					break;
+				}
+				encoder->silence_len += elen;
+			}
+		}
+
+		encoder->impl = impl;
+		encoder->start_seq = ENCODER_NOT_STARTED;
+		encoder->next = source->encoders;
+		source->encoders = encoder;
+	}
+
+	if (encoder->failed) {
+		return NULL;
+	}
+
+	encoder->users++;
+
+	return encoder;
+}
+
 static void *SWITCH_THREAD_FUNC read_stream_thread(switch_thread_t *thread, void *obj)
 {
 	local_stream_source_t *source = obj;
 	switch_file_handle_t fh = { 0 };
-	local_stream_context_t *cp;
+	local_stream_encoder_t *encoder;
 	char file_buf[128] = "", path_buf[512] = "";
 	switch_timer_t timer = { 0 };
 	int fd = -1;
@@ -128,6 +257,11 @@ static void *SWITCH_THREAD_FUNC read_stream_thread(switch_thread_t *thread, void
 	switch_buffer_create_dynamic(&audio_buffer, 1024, source->prebuf + 10, 0);
 	dist_buf = switch_core_alloc(source->pool, source->prebuf + 10);
 
+	source->chunk_bytes = source->samples * 2;
+	source->ring = switch_core_alloc(source->pool, source->chunk_bytes * RING_CHUNKS);
+	source->ring_len = switch_core_alloc(source->pool, sizeof(uint32_t) * RING_CHUNKS);
+	switch_thread_rwlock_create(&source->ring_rwlock, source->pool);
+
 	if (source->shuffle) {
 		skip = do_rand();
 	}
@@ -286,23 +420,24 @@ static void *SWITCH_THREAD_FUNC read_stream_thread(switch_thread_t *thread, void
 				if (!is_open || used >= source->prebuf || (source->total && used > source->samples * 2)) {
 					used = switch_buffer_read(audio_buffer, dist_buf, source->samples * 2);
 					if (source->total) {
+						uint32_t seq = source->ring_seq, slot = seq % RING_CHUNKS;
+
+						/* the slot for seq is never readable until ring_seq moves past it, listeners only keep a cursor into the ring */
+						memcpy(source->ring + (slot * source->chunk_bytes), dist_buf, used);
+						source->ring_len[slot] = (uint32_t) used;
 
 						switch_mutex_lock(source->mutex);
-						for (cp = source->context_list; cp && RUNNING; cp = cp->next) {
-							if (switch_test_flag(cp->handle, SWITCH_FILE_CALLBACK)) {
-								continue;
-							}
-							switch_mutex_lock(cp->audio_mutex);
-							if (switch_buffer_inuse(cp->audio_buffer) > source->samples * 768) {
-								switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Leaking stream handle! [%s() %s:%d]\n", cp->func, cp->file,
-												  cp->line);
-								switch_buffer_zero(cp->audio_buffer);
-							} else {
-								switch_buffer_write(cp->audio_buffer, dist_buf, used);
+						if (source->encoders) {
+							if (used < source->chunk_bytes) {
+								memset(dist_buf + used, 0, source->chunk_bytes - used);
 							}
-							switch_mutex_unlock(cp->audio_mutex);
+							encode_chunk(source, seq, dist_buf);
 						}
 						switch_mutex_unlock(source->mutex);
+
+						switch_thread_rwlock_wrlock(source->ring_rwlock);
+						source->ring_seq++;
+						switch_thread_rwlock_unlock(source->ring_rwlock);
 					}
 				}
 			}
@@ -337,6 +472,12 @@ static void *SWITCH_THREAD_FUNC read_stream_thread(switch_thread_t *thread, void
 
 	switch_buffer_destroy(&audio_buffer);
 
+	for (encoder = source->encoders; encoder; encoder = encoder->next) {
+		if (switch_core_codec_ready(&encoder->codec)) {
+			switch_core_codec_destroy(&encoder->codec);
+		}
+	}
+
 	if (fd > -1) {
 		close(fd);
 	}
@@ -416,19 +557,18 @@ static switch_status_t local_stream_file_open(switch_file_handle_t *handle, cons
 	handle->interval = source->interval;
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Opening Stream [%s] %dhz\n", path, handle->samplerate);
 
-	switch_mutex_init(&context->audio_mutex, SWITCH_MUTEX_NESTED, handle->memory_pool);
-	if (switch_buffer_create_dynamic(&context->audio_buffer, 512, 1024, 0) != SWITCH_STATUS_SUCCESS) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Memory Error!\n");
-		status = SWITCH_STATUS_MEMERR;
-		goto end;
-	}
-
 	context->source = source;
 	context->file = handle->file;
 	context->func = handle->func;
 	context->line = handle->line;
 	context->handle = handle;
 	switch_mutex_lock(source->mutex);
+	if (source->encode_cache && (context->encoder = get_encoder(source, handle->native_impl))) {
+		switch_set_flag(handle, SWITCH_FILE_NATIVE);
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Stream [%s] sending cached %s@%dms frames\n", path,
+						  context->encoder->impl->iananame, context->encoder->impl->microseconds_per_packet / 1000);
+	}
+	context->cursor = source->ring_seq;
 	context->next = source->context_list;
 	source->context_list = context;
 	source->total++;
@@ -456,26 +596,108 @@ static switch_status_t local_stream_file_close(switch_file_handle_t *handle)
 		last = cp;
 	}
 	context->source->total--;
+	if (context->encoder) {
+		context->encoder->users--;
+	}
 	switch_mutex_unlock(context->source->mutex);
-	switch_buffer_destroy(&context->audio_buffer);
 	switch_thread_rwlock_unlock(context->source->rwlock);
 
 	return SWITCH_STATUS_SUCCESS;
 }
 
+/* Called with source->ring_rwlock read locked, moves the cursor back into the readable part of the ring */
+static void check_cursor(local_stream_context_t *context, uint32_t oldest)
+{
+	if ((int32_t) (context->cursor - oldest) < 0) {
+		if (!context->lagged) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Stream handle fell behind, skipping audio! [%s() %s:%d]\n",
+							  context->func, context->file, context->line);
+			context->lagged = 1;
+		}
+		context->cursor = oldest;
+		context->offset = 0;
+	}
+}
+
 static switch_status_t local_stream_file_read(switch_file_handle_t *handle, void *data, size_t *len)
 {
 	local_stream_context_t *context = handle->private_info;
+	local_stream_source_t *source = context->source;
+	local_stream_encoder_t *encoder = context->encoder;
 	switch_size_t bytes = 0;
 	size_t need = *len * 2;
+	uint32_t head, oldest, slot;
+	uint8_t *out = data;
 
-	if (!context->source->ready) {
+	if (!source->ready) {
 		*len = 0;
 		return SWITCH_STATUS_FALSE;
 	}
 
-	switch_mutex_lock(context->audio_mutex);
-	if ((bytes = switch_buffer_read(context->audio_buffer, data, need))) {
+	if (encoder && encoder->failed) {
+		/* the codec turned out not to be cacheable, switch this listener back to decoded audio */
+		switch_mutex_lock(source->mutex);
+		encoder->users--;
+		switch_mutex_unlock(source->mutex);
+		context->encoder = encoder = NULL;
+		context->offset = 0;
+		switch_clear_flag(handle, SWITCH_FILE_NATIVE);
+		need = *len;
+	}
+
+	switch_thread_rwlock_rdlock(source->ring_rwlock);
+	head = source->ring_seq;
+	oldest = head - (RING_CHUNKS - 1);
+
+	if (encoder) {
+		/* native reads are measured in bytes and only whole cached intervals are handed out */
+		need = *len;
+
+		if (encoder->start_seq != ENCODER_NOT_STARTED && (int32_t) (oldest - encoder->start_seq) < 0) {
+			oldest = encoder->start_seq;
+		}
+
+		check_cursor(context, oldest);
+
+		while (context->cursor != head && encoder->start_seq != ENCODER_NOT_STARTED) {
+			slot = context->cursor % RING_CHUNKS;
+			if (bytes + encoder->ring_len[slot] > need) {
+				break;
+			}
+			memcpy(out + bytes, encoder->ring + (slot * source->chunk_bytes), encoder->ring_len[slot]);
+			bytes += encoder->ring_len[slot];
+			context->cursor++;
+		}
+	} else {
+		check_cursor(context, oldest);
+
+		while (context->cursor != head && bytes < need) {
+			switch_size_t chunk;
+
+			slot = context->cursor % RING_CHUNKS;
+			chunk = source->ring_len[slot] - context->offset;
+			if (chunk > need - bytes) {
+				chunk = need - bytes;
+			}
+			memcpy(out + bytes, source->ring + (slot * source->chunk_bytes) + context->offset, chunk);
+			bytes += chunk;
+			context->offset += (uint32_t) chunk;
+
+			if (context->offset >= source->ring_len[slot]) {
+				context->offset = 0;
+				context->cursor++;
+			}
+		}
+	}
+	switch_thread_rwlock_unlock(source->ring_rwlock);
+
+	if (encoder) {
+		if (!bytes && encoder->silence_len <= need) {
+			memcpy(data, encoder->silence, encoder->silence_len);
+			bytes = encoder->silence_len;
+		}
+		*len = bytes;
+	} else if (bytes) {
 		*len = bytes / 2;
 	} else {
 		if (need > 2560) {
@@ -484,7 +706,7 @@ static switch_status_t local_stream_file_read(switch_file_handle_t *handle, void
 		memset(data, 255, need);
 		*len = need / 2;
 	}
-	switch_mutex_unlock(context->audio_mutex);
+
 	handle->sample_count += *len;
 	return SWITCH_STATUS_SUCCESS;
 }
@@ -580,6 +802,8 @@ static void launch_threads(void)
 				}
 			} else if (!strcasecmp(var, "timer-name")) {
 				source->timer_name = switch_core_strdup(source->pool, val);
+			} else if (!strcasecmp(var, "encode-cache")) {
+				source->encode_cache = switch_true(val);
 			}
 		}
 
@@ -662,6 +886,7 @@ SWITCH_STANDARD_API(stop_local_stream_function)
 SWITCH_STANDARD_API(show_local_stream_function)
 {
 	local_stream_source_t *source = NULL;
+	local_stream_encoder_t *encoder;
 	char *mycmd = NULL, *argv[2] = { 0 };
 	char *local_stream_name = NULL;
 	int argc = 0;
@@ -710,6 +935,13 @@ SWITCH_STANDARD_API(show_local_stream_function)
 				stream->write_function(stream, "  <shuffle>%s</shuffle>\n", (source->shuffle) ? "true" : "false");
 				stream->write_function(stream, "  <ready>%s</ready>\n", (source->ready) ? "true" : "false");
 				stream->write_function(stream, "  <stopped>%s</stopped>\n", (source->stopped) ? "true" : "false");
+				stream->write_function(stream, "  <encode-cache>%s</encode-cache>\n", (source->encode_cache) ? "true" : "false");
+				switch_mutex_lock(source->mutex);
+				for (encoder = source->encoders; encoder; encoder = encoder->next) {
+					stream->write_function(stream, "  <encoder codec=\"%s\" ptime=\"%d\" users=\"%d\" failed=\"%s\"/>\n", encoder->impl->iananame,
+										   encoder->impl->microseconds_per_packet / 1000, encoder->users, encoder->failed ? "true" : "false");
+				}
+				switch_mutex_unlock(source->mutex);
 				stream->write_function(stream, "</local_stream>\n");
 			} else {
 				stream->write_function(stream, "%s\n", source->name);
@@ -724,6 +956,13 @@ SWITCH_STANDARD_API(show_local_stream_function)
 				stream->write_function(stream, "  shuffle:  %s\n", (source->shuffle) ? "true" : "false");
 				stream->write_function(stream, "  ready:    %s\n", (source->ready) ? "true" : "false");
 				stream->write_function(stream, "  stopped:  %s\n", (source->stopped) ? "true" : "false");
+				stream->write_function(stream, "  encode-cache: %s\n", (source->encode_cache) ? "true" : "false");
+				switch_mutex_lock(source->mutex);
+				for (encoder = source->encoders; encoder; encoder = encoder->next) {
+					stream->write_function(stream, "  encoder:  %s@%dms users: %d%s\n", encoder->impl->iananame,
+										   encoder->impl->microseconds_per_packet / 1000, encoder->users, encoder->failed ? " (failed)" : "");
+				}
+				switch_mutex_unlock(source->mutex);
 			}
 		} else {
 			stream->write_function(stream, "-ERR Cannot locate local_stream %s!\n", local_stream_name);
@@ -754,7 +993,7 @@ SWITCH_STANDARD_API(start_local_stream_function)
 	char *mycmd = NULL, *argv[8] = { 0 };
 	char *local_stream_name = NULL, *path = NULL, *timer_name = NULL, *chime_list = NULL, *list_dup = NULL;
 	uint32_t prebuf = 1;
-	int rate = 8000, shuffle = 1, interval = 20, chime_freq = 30;
+	int rate = 8000, shuffle = 1, interval = 20, chime_freq = 30, encode_cache = 0;
 	uint8_t channels = 1;
 	uint32_t chime_max = 0;
 	int argc = 0;
@@ -864,6 +1103,8 @@ SWITCH_STANDARD_API(start_local_stream_function)
 						}
 					} else if (!strcasecmp(var, "chime-list")) {
 		                                chime_list = val;
+					} else if (!strcasecmp(var, "encode-cache")) {
+						encode_cache = switch_true(val);
 					}
 				}
 				break;
@@ -919,6 +1160,7 @@ SWITCH_STANDARD_API(start_local_stream_function)
 	source->prebuf = prebuf;
 	source->stopped = 0;
 	source->shuffle = shuffle;
+	source->encode_cache = encode_cache;
 	source->samples = switch_samples_per_packet(source->rate, source->interval);
 
 	switch_mutex_init(&source->mutex, SWITCH_MUTEX_NESTED, source->pool);
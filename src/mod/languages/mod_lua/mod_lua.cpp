@@ -41,9 +41,51 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lua_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_lua_shutdown);
 
 SWITCH_MODULE_DEFINITION_EX(mod_lua, mod_lua_load, mod_lua_shutdown, NULL, SMODF_GLOBAL_SYMBOLS);
+typedef enum {
+	LUA_VM_APP,
+	LUA_VM_API,
+	LUA_VM_DIALPLAN,
+	LUA_VM_XML,
+	LUA_VM_CLASSES
+} lua_vm_class_t;
+
+static const char *lua_vm_class_names[LUA_VM_CLASSES] = { "app", "api", "dialplan", "xml" };
+
+#define LUA_VM_POOL_MAX 64
+#define LUA_PRISTINE_KEY "mod_lua_pristine"
+#define LUA_USES_KEY "mod_lua_uses"
+
+/* idle, already initialized VMs for one kind of caller */
+struct lua_vm_pool {
+	switch_mutex_t *mutex;
+	lua_State *idle[LUA_VM_POOL_MAX];
+	int count;
+	uint64_t created;
+	uint64_t reused;
+	uint64_t discarded;
+};
+
+/* compiled script, keyed by path and only valid while the file keeps its mtime and size */
+struct lua_chunk {
+	char *data;
+	switch_size_t len;
+	switch_size_t alloc;
+	time_t mtime;
+	off_t size;
+};
+
 static struct {
 	switch_memory_pool_t *pool;
 	char *xml_handler;
+	int vm_pool_size;
+	uint32_t vm_max_uses;
+	struct lua_vm_pool vm_pools[LUA_VM_CLASSES];
+	switch_bool_t script_cache;
+	switch_hash_t *chunk_hash;
+	switch_thread_rwlock_t *chunk_rwlock;
+	/* bumped under the read lock by any number of threads at once */
+	switch_atomic_t chunk_hits;
+	switch_atomic_t chunk_misses;
 } globals;
 
 int luaopen_freeswitch(lua_State * L);
@@ -127,6 +169,389 @@ static lua_State *lua_init(void)
 	return L;
 }
 
+static int lua_vm_guarded(lua_State * L, int idx)
+{
+	int type = lua_type(L, idx);
+
+	return type == LUA_TTABLE || type == LUA_TFUNCTION || type == LUA_TUSERDATA;
+}
+
+/*
+ * Remember what a fresh VM starts with so lua_vm_reset() can put it back: every table reachable from
+ * the registry, the globals and the string metatable (package.loaded, the libraries, the SWIG class
+ * metatables, the io environment ...) with its fields and metatable, and the environment of every function.
+ */
+static void lua_vm_snapshot(lua_State * L)
+{
+	int i, n = 0;
+
+	lua_settop(L, 0);
+	lua_pushinteger(L, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUA_USES_KEY);
+
+	lua_newtable(L);			/* 1: the snapshot */
+	lua_newtable(L);			/* 2: table -> copy of its fields */
+	lua_newtable(L);			/* 3: table -> its metatable */
+	lua_newtable(L);			/* 4: function -> its environment */
+	lua_newtable(L);			/* 5: values already visited */
+	lua_newtable(L);			/* 6: values still to visit */
+
+	lua_pushvalue(L, 2);
+	lua_setfield(L, 1, "tables");
+	lua_pushvalue(L, 3);
+	lua_setfield(L, 1, "metatables");
+	lua_pushvalue(L, 4);
+	lua_setfield(L, 1, "fenvs");
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+	lua_setfield(L, 1, "globals");
+	lua_pushliteral(L, "");
+	if (lua_getmetatable(L, -1)) {
+		lua_setfield(L, 1, "string_mt");
+	}
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, LUA_PRISTINE_KEY);
+
+	/* the snapshot does not guard itself */
+	for (i = 1; i <= 4; i++) {
+		lua_pushvalue(L, i);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, 5);
+	}
+
+	lua_pushvalue(L, LUA_REGISTRYINDEX);
+	lua_rawseti(L, 6, ++n);
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+	lua_rawseti(L, 6, ++n);
+	lua_getfield(L, 1, "string_mt");
+	lua_rawseti(L, 6, ++n);
+
+	while (n) {
+		lua_rawgeti(L, 6, n);	/* 7: the value */
+		lua_pushnil(L);
+		lua_rawseti(L, 6, n--);
+
+		lua_pushvalue(L, 7);
+		lua_rawget(L, 5);
+		if (!lua_vm_guarded(L, 7) || !lua_isnil(L, -1)) {
+			lua_settop(L, 6);
+			continue;
+		}
+		lua_pop(L, 1);
+		lua_pushvalue(L, 7);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, 5);
+
+		if (lua_istable(L, 7)) {
+			lua_newtable(L);	/* 8: the copy */
+			lua_pushnil(L);
+			while (lua_next(L, 7) != 0) {
+				lua_pushvalue(L, -2);
+				lua_pushvalue(L, -2);
+				lua_rawset(L, 8);
+				if (lua_vm_guarded(L, -1)) {
+					lua_rawseti(L, 6, ++n);
+				} else {
+					lua_pop(L, 1);
+				}
+				if (lua_vm_guarded(L, -1)) {
+					lua_pushvalue(L, -1);
+					lua_rawseti(L, 6, ++n);
+				}
+			}
+			lua_pushvalue(L, 7);
+			lua_insert(L, 8);
+			lua_rawset(L, 2);
+
+			if (lua_getmetatable(L, 7)) {
+				lua_pushvalue(L, -1);
+				lua_rawseti(L, 6, ++n);
+				lua_pushvalue(L, 7);
+				lua_insert(L, -2);
+				lua_rawset(L, 3);
+			}
+		} else if (lua_isfunction(L, 7)) {
+			lua_getfenv(L, 7);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, 6, ++n);
+			lua_pushvalue(L, 7);
+			lua_insert(L, -2);
+			lua_rawset(L, 4);
+		} else if (lua_getmetatable(L, 7)) {
+			/* userdata like io.stdout: its metatable is guarded, not which one it has */
+			lua_rawseti(L, 6, ++n);
+		}
+
+		lua_settop(L, 6);
+	}
+
+	lua_settop(L, 0);
+}
+
+/*
+ * Undo what a script did to the VM.  Globals, package.loaded entries and library fields it added are
+ * removed and the ones it replaced are put back, so modules it required are loaded again by the next
+ * borrower and session/event/stream objects it held become garbage.  State only reachable through the
+ * debug library (upvalues, the registry entry of the snapshot itself) is not covered.
+ */
+static void lua_vm_reset(lua_State * L)
+{
+	int i;
+
+	lua_settop(L, 0);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUA_PRISTINE_KEY);	/* 1 */
+
+	/* setfenv(0, t) replaces the table LUA_GLOBALSINDEX refers to */
+	lua_pushthread(L);
+	lua_getfield(L, 1, "globals");
+	lua_setfenv(L, -2);
+	lua_settop(L, 1);
+
+	lua_getfield(L, 1, "tables");	/* 2 */
+	lua_getfield(L, 1, "metatables");	/* 3 */
+	lua_pushnil(L);
+	while (lua_next(L, 2) != 0) {	/* 4: table 5: its copy */
+		/* drop the fields the script added; clearing existing fields is allowed during lua_next */
+		lua_pushnil(L);
+		while (lua_next(L, 4) != 0) {
+			lua_pop(L, 1);
+			lua_pushvalue(L, -1);
+			lua_rawget(L, 5);
+			if (lua_isnil(L, -1)) {
+				lua_pushvalue(L, -2);
+				lua_pushnil(L);
+				lua_rawset(L, 4);
+			}
+			lua_pop(L, 1);
+		}
+
+		/* and restore the ones it replaced or removed */
+		lua_pushnil(L);
+		while (lua_next(L, 5) != 0) {
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, 4);
+		}
+
+		lua_pushvalue(L, 4);
+		lua_rawget(L, 3);
+		lua_setmetatable(L, 4);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 1);
+
+	lua_getfield(L, 1, "fenvs");	/* 2 */
+	lua_pushnil(L);
+	while (lua_next(L, 2) != 0) {
+		lua_setfenv(L, -2);
+	}
+	lua_settop(L, 1);
+
+	/* the type-wide metatables; only strings have one in a fresh VM */
+	for (i = 0; i < 7; i++) {
+		switch (i) {
+		case 0:
+			lua_pushliteral(L, "");
+			break;
+		case 1:
+			lua_pushnil(L);
+			break;
+		case 2:
+			lua_pushboolean(L, 0);
+			break;
+		case 3:
+			lua_pushnumber(L, 0);
+			break;
+		case 4:
+			lua_pushcfunction(L, traceback);
+			break;
+		case 5:
+			lua_pushlightuserdata(L, NULL);
+			break;
+		default:
+			lua_pushthread(L);
+			break;
+		}
+		if (i == 0) {
+			lua_getfield(L, 1, "string_mt");
+		} else {
+			lua_pushnil(L);
+		}
+		lua_setmetatable(L, -2);
+		lua_pop(L, 1);
+	}
+	lua_settop(L, 0);
+
+	/* run the finalizers of session/event/stream objects the script held before the VM is reused */
+	lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+static lua_State *lua_vm_acquire(lua_vm_class_t vm_class)
+{
+	struct lua_vm_pool *vm_pool = &globals.vm_pools[vm_class];
+	lua_State *L = NULL;
+
+	switch_mutex_lock(vm_pool->mutex);
+	if (vm_pool->count) {
+		L = vm_pool->idle[--vm_pool->count];
+		vm_pool->reused++;
+	} else {
+		vm_pool->created++;
+	}
+	switch_mutex_unlock(vm_pool->mutex);
+
+	if (!L) {
+		L = lua_init();
+		lua_vm_snapshot(L);
+	}
+
+	return L;
+}
+
+/* Hand a VM back to its pool.  VMs that hit an error or have been used vm-max-uses times are closed instead. */
+static void lua_vm_release(lua_vm_class_t vm_class, lua_State * L, int error)
+{
+	struct lua_vm_pool *vm_pool = &globals.vm_pools[vm_class];
+	lua_Integer uses;
+
+	lua_settop(L, 0);
+	lua_getfield(L, LUA_REGISTRYINDEX, LUA_USES_KEY);
+	uses = lua_tointeger(L, -1) + 1;
+	lua_pop(L, 1);
+
+	if (!error && globals.vm_pool_size && (!globals.vm_max_uses || uses < (lua_Integer) globals.vm_max_uses)) {
+		lua_vm_reset(L);
+		lua_pushinteger(L, uses);
+		lua_setfield(L, LUA_REGISTRYINDEX, LUA_USES_KEY);
+
+		switch_mutex_lock(vm_pool->mutex);
+		if (vm_pool->count < globals.vm_pool_size) {
+			vm_pool->idle[vm_pool->count++] = L;
+			L = NULL;
+		}
+		switch_mutex_unlock(vm_pool->mutex);
+	}
+
+	if (L) {
+		switch_mutex_lock(vm_pool->mutex);
+		vm_pool->discarded++;
+		switch_mutex_unlock(vm_pool->mutex);
+		lua_uninit(L);
+	}
+}
+
+static void lua_vm_pool_flush(void)
+{
+	int i;
+
+	for (i = 0; i < LUA_VM_CLASSES; i++) {
+		struct lua_vm_pool *vm_pool = &globals.vm_pools[i];
+
+		switch_mutex_lock(vm_pool->mutex);
+		while (vm_pool->count) {
+			lua_uninit(vm_pool->idle[--vm_pool->count]);
+		}
+		switch_mutex_unlock(vm_pool->mutex);
+	}
+}
+
+static int lua_chunk_writer(lua_State * L, const void *p, size_t sz, void *ud)
+{
+	struct lua_chunk *chunk = (struct lua_chunk *) ud;
+
+	if (chunk->len + sz > chunk->alloc) {
+		switch_size_t alloc = chunk->alloc ? chunk->alloc : 4096;
+		char *data;
+
+		while (alloc < chunk->len + sz) {
+			alloc *= 2;
+		}
+		if (!(data = (char *) realloc(chunk->data, alloc))) {
+			return 1;
+		}
+		chunk->data = data;
+		chunk->alloc = alloc;
+	}
+
+	memcpy(chunk->data + chunk->len, p, sz);
+	chunk->len += sz;
+
+	return 0;
+}
+
+static void lua_chunk_free(struct lua_chunk *chunk)
+{
+	if (chunk) {
+		switch_safe_free(chunk->data);
+		free(chunk);
+	}
+}
+
+/* luaL_loadfile() with the compiled result cached by path, mtime and size */
+static int lua_load_script(lua_State * L, const char *file)
+{
+	struct lua_chunk *chunk, *old;
+	struct stat st;
+	char *chunkname;
+	int error;
+
+	if (!globals.script_cache || stat(file, &st) != 0) {
+		return luaL_loadfile(L, file);
+	}
+
+	chunkname = switch_mprintf("@%s", file);
+	switch_assert(chunkname);
+
+	switch_thread_rwlock_rdlock(globals.chunk_rwlock);
+	if ((chunk = (struct lua_chunk *) switch_core_hash_find(globals.chunk_hash, file)) && chunk->mtime == st.st_mtime && chunk->size == st.st_size) {
+		error = luaL_loadbuffer(L, chunk->data, chunk->len, chunkname);
+		switch_thread_rwlock_unlock(globals.chunk_rwlock);
+		switch_atomic_inc(&globals.chunk_hits);
+		free(chunkname);
+		return error;
+	}
+	switch_thread_rwlock_unlock(globals.chunk_rwlock);
+	switch_atomic_inc(&globals.chunk_misses);
+	free(chunkname);
+
+	if ((error = luaL_loadfile(L, file))) {
+		return error;
+	}
+
+	switch_zmalloc(chunk, sizeof(*chunk));
+	chunk->mtime = st.st_mtime;
+	chunk->size = st.st_size;
+
+	if (lua_dump(L, lua_chunk_writer, chunk)) {
+		lua_chunk_free(chunk);
+		return 0;
+	}
+
+	switch_thread_rwlock_wrlock(globals.chunk_rwlock);
+	old = (struct lua_chunk *) switch_core_hash_find(globals.chunk_hash, file);
+	switch_core_hash_insert(globals.chunk_hash, file, chunk);
+	switch_thread_rwlock_unlock(globals.chunk_rwlock);
+	lua_chunk_free(old);
+
+	return 0;
+}
+
+static void lua_chunk_flush(void)
+{
+	switch_hash_index_t *hi;
+	void *val;
+
+	switch_thread_rwlock_wrlock(globals.chunk_rwlock);
+	while ((hi = switch_hash_first(NULL, globals.chunk_hash))) {
+		const void *key;
+		switch_hash_this(hi, &key, NULL, &val);
+		switch_core_hash_delete(globals.chunk_hash, (const char *) key);
+		lua_chunk_free((struct lua_chunk *) val);
+	}
+	switch_thread_rwlock_unlock(globals.chunk_rwlock);
+}
+
 
 static int lua_parse_and_execute(lua_State * L, char *input_code)
 {
@@ -187,7 +612,7 @@ static int lua_parse_and_execute(lua_State * L, char *input_code)
 				switch_assert(fdup);
 				file = fdup;
 			}
-			error = luaL_loadfile(L, file) || docall(L, 0, 0, 0);
+			error = lua_load_script(L, file) || docall(L, 0, 0, 0);
 			switch_safe_free(fdup);
 		}
 	}
@@ -233,7 +658,7 @@ static switch_xml_t lua_fetch(const char *section,
 	switch_xml_t xml = NULL;
 
 	if (!zstr(globals.xml_handler)) {
-		lua_State *L = lua_init();
+		lua_State *L = lua_vm_acquire(LUA_VM_XML);
 		char *mycmd = strdup(globals.xml_handler);
 		const char *str;
 		int error;
@@ -262,6 +687,8 @@ static switch_xml_t lua_fetch(const char *section,
 
 		if((error = lua_parse_and_execute(L, mycmd))){
 		    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "LUA script parse/execute error!\n");
+		    lua_vm_release(LUA_VM_XML, L, error);
+		    free(mycmd);
 		    return NULL;
 		}
 
@@ -279,7 +706,7 @@ static switch_xml_t lua_fetch(const char *section,
 			}
 		}
 
-		lua_uninit(L);
+		lua_vm_release(LUA_VM_XML, L, 0);
 		free(mycmd);
 	}
 
@@ -306,7 +733,19 @@ static switch_status_t do_config(void)
 			char *var = (char *) switch_xml_attr_soft(param, "name");
 			char *val = (char *) switch_xml_attr_soft(param, "value");
 
-			if (!strcmp(var, "xml-handler-script")) {
+			if (!strcmp(var, "vm-pool-size")) {
+				int tmp = atoi(val);
+				if (tmp >= 0) {
+					globals.vm_pool_size = tmp > LUA_VM_POOL_MAX ? LUA_VM_POOL_MAX : tmp;
+				}
+			} else if (!strcmp(var, "vm-max-uses")) {
+				int tmp = atoi(val);
+				if (tmp >= 0) {
+					globals.vm_max_uses = (uint32_t) tmp;
+				}
+			} else if (!strcmp(var, "script-cache")) {
+				globals.script_cache = switch_true(val) ? SWITCH_TRUE : SWITCH_FALSE;
+			} else if (!strcmp(var, "xml-handler-script")) {
 				globals.xml_handler = switch_core_strdup(globals.pool, val);
 			} else if (!strcmp(var, "xml-handler-bindings")) {
 				if (!zstr(globals.xml_handler)) {
@@ -407,21 +846,23 @@ int lua_thread(const char *text)
 
 SWITCH_STANDARD_APP(lua_function)
 {
-	lua_State *L = lua_init();
+	lua_State *L;
 	char *mycmd;
+	int error;
 
 	if (zstr(data)) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "no args specified!\n");
 		return;
 	}
 
+	L = lua_vm_acquire(LUA_VM_APP);
 	mod_lua_conjure_session(L, session, "session", 1);
 
 	mycmd = strdup((char *) data);
 	switch_assert(mycmd);
 
-	lua_parse_and_execute(L, mycmd);
-	lua_uninit(L);
+	error = lua_parse_and_execute(L, mycmd);
+	lua_vm_release(LUA_VM_APP, L, error);
 	free(mycmd);
 
 }
@@ -441,16 +882,17 @@ SWITCH_STANDARD_API(luarun_api_function)
 
 SWITCH_STANDARD_CHAT_APP(lua_chat_function)
 {
-	lua_State *L = lua_init();
+	lua_State *L = lua_vm_acquire(LUA_VM_API);
 	char *dup = NULL;
+	int error;
 
 	if (data) {
 		dup = strdup(data);
 	}
 
 	mod_lua_conjure_event(L, message, "message", 1);
-	lua_parse_and_execute(L, (char *)dup);
-	lua_uninit(L);
+	error = lua_parse_and_execute(L, (char *)dup);
+	lua_vm_release(LUA_VM_API, L, error);
 
 	switch_safe_free(dup);
 
@@ -461,13 +903,14 @@ SWITCH_STANDARD_CHAT_APP(lua_chat_function)
 SWITCH_STANDARD_API(lua_api_function)
 {
 
-	lua_State *L = lua_init();
+	lua_State *L;
 	char *mycmd;
 	int error;
 
 	if (zstr(cmd)) {
 		stream->write_function(stream, "");
 	} else {
+		L = lua_vm_acquire(LUA_VM_API);
 
 		mycmd = strdup(cmd);
 		switch_assert(mycmd);
@@ -493,18 +936,51 @@ SWITCH_STANDARD_API(lua_api_function)
 				stream->write_function(stream, "-ERR Cannot execute script\n");
 			}
 		}
-		lua_uninit(L);
+		lua_vm_release(LUA_VM_API, L, error);
 		free(mycmd);
 	}
 	return SWITCH_STATUS_SUCCESS;
 }
 
+#define LUA_POOL_SYNTAX "[status|flush]"
+SWITCH_STANDARD_API(lua_pool_api_function)
+{
+	int i;
+
+	if (!zstr(cmd) && !strcasecmp(cmd, "flush")) {
+		lua_vm_pool_flush();
+		lua_chunk_flush();
+		stream->write_function(stream, "+OK\n");
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	if (!zstr(cmd) && strcasecmp(cmd, "status")) {
+		stream->write_function(stream, "-USAGE: %s\n", LUA_POOL_SYNTAX);
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	stream->write_function(stream, "vm-pool-size: %d vm-max-uses: %u\n", globals.vm_pool_size, globals.vm_max_uses);
+	for (i = 0; i < LUA_VM_CLASSES; i++) {
+		struct lua_vm_pool *vm_pool = &globals.vm_pools[i];
+
+		switch_mutex_lock(vm_pool->mutex);
+		stream->write_function(stream, "%-9s idle: %d created: %" SWITCH_UINT64_T_FMT " reused: %" SWITCH_UINT64_T_FMT " discarded: %" SWITCH_UINT64_T_FMT "\n",
+							   lua_vm_class_names[i], vm_pool->count, vm_pool->created, vm_pool->reused, vm_pool->discarded);
+		switch_mutex_unlock(vm_pool->mutex);
+	}
+	stream->write_function(stream, "script-cache: %s hits: %u misses: %u\n",
+						   globals.script_cache ? "on" : "off", switch_atomic_read(&globals.chunk_hits), switch_atomic_read(&globals.chunk_misses));
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_STANDARD_DIALPLAN(lua_dialplan_hunt)
 {
-	lua_State *L = lua_init();
+	lua_State *L = lua_vm_acquire(LUA_VM_DIALPLAN);
 	switch_caller_extension_t *extension = NULL;
 	switch_channel_t *channel = switch_core_session_get_channel(session);
 	char *cmd = NULL;
+	int error = 0;
 
 	if (!caller_profile) {
 		if (!(caller_profile = switch_channel_get_caller_profile(channel))) {
@@ -529,7 +1005,9 @@ SWITCH_STANDARD_DIALPLAN(lua_dialplan_hunt)
 	switch_assert(cmd);
 
 	mod_lua_conjure_session(L, session, "session", 1);
-	lua_parse_and_execute(L, cmd);
+	if ((error = lua_parse_and_execute(L, cmd))) {
+		goto done;
+	}
 
 	/* expecting ACTIONS = { {"app1", "app_data1"}, { "app2" }, "app3" } -- each of three is valid */
 	lua_getfield(L, LUA_GLOBALSINDEX, "ACTIONS");
@@ -613,7 +1091,7 @@ SWITCH_STANDARD_DIALPLAN(lua_dialplan_hunt)
 
  done:
 	switch_safe_free(cmd);
-	lua_uninit(L);
+	lua_vm_release(LUA_VM_DIALPLAN, L, error);
 	return extension;
 }
 
@@ -623,12 +1101,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lua_load)
 	switch_application_interface_t *app_interface;
 	switch_dialplan_interface_t *dp_interface;
 	switch_chat_application_interface_t *chat_app_interface;
+	int i;
 
 	/* connect my internal structure to the blank pointer passed to me */
 	*module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
 	SWITCH_ADD_API(api_interface, "luarun", "run a script", luarun_api_function, "<script>");
 	SWITCH_ADD_API(api_interface, "lua", "run a script as an api function", lua_api_function, "<script>");
+	SWITCH_ADD_API(api_interface, "lua_pool", "show or flush the lua VM pool and script cache", lua_pool_api_function, LUA_POOL_SYNTAX);
 	SWITCH_ADD_APP(app_interface, "lua", "Launch LUA ivr", "Run a lua ivr on a channel", lua_function, "<script>", 
 				   SAF_SUPPORT_NOMEDIA | SAF_ROUTING_EXEC | SAF_ZOMBIE_EXEC);
 	SWITCH_ADD_DIALPLAN(dp_interface, "LUA", lua_dialplan_hunt);
@@ -637,6 +1117,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lua_load)
 
 
 	globals.pool = pool;
+	globals.vm_pool_size = 8;
+	globals.vm_max_uses = 1000;
+	globals.script_cache = SWITCH_TRUE;
+	for (i = 0; i < LUA_VM_CLASSES; i++) {
+		switch_mutex_init(&globals.vm_pools[i].mutex, SWITCH_MUTEX_NESTED, globals.pool);
+	}
+	switch_core_hash_init(&globals.chunk_hash, globals.pool);
+	switch_thread_rwlock_create(&globals.chunk_rwlock, globals.pool);
 	do_config();
 
 	/* indicate that the module should continue to be loaded */
@@ -645,6 +1133,10 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_lua_load)
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_lua_shutdown)
 {
+	lua_vm_pool_flush();
+	lua_chunk_flush();
+	switch_core_hash_destroy(&globals.chunk_hash);
+
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -40,11 +40,14 @@
 #define ENCODING_BASE64 2
 #define ENCODING_TEXTXML 3
 
+#define CDR_SPOOL_MAGIC 0x58434452
+
 static struct {
 	char *cred;
 	char *urls[MAX_URLS + 1];
 	int url_count;
 	int url_index;
+	switch_mutex_t *url_mutex;
 	switch_thread_rwlock_t *log_path_lock;
 	char *base_log_dir;
 	char *base_err_log_dir;
@@ -70,6 +73,11 @@ static struct {
 	int timeout;
 	switch_memory_pool_t *pool;
 	switch_event_node_t *node;
+	int async;
+	char *spool_dir;
+	uint32_t batch_size;
+	uint32_t worker_count;
+	switch_spool_t *spool;
 } globals;
 
 SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load);
@@ -179,20 +187,299 @@ static switch_status_t set_xml_cdr_log_dirs()
 	return status;
 }
 
+static void write_err_file(const char *name, const char *xml_text)
+{
+	char *path = NULL;
+	int fd = -1;
+
+	switch_thread_rwlock_rdlock(globals.log_path_lock);
+	path = switch_mprintf("%s%s%s.cdr.xml", globals.err_log_dir, SWITCH_PATH_SEPARATOR, name);
+	switch_thread_rwlock_unlock(globals.log_path_lock);
+	if (path) {
+#ifdef _MSC_VER
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) > -1) {
+#else
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) > -1) {
+#endif
+			int wrote;
+			wrote = write(fd, xml_text, (unsigned) strlen(xml_text));
+			wrote++;
+			close(fd);
+			fd = -1;
+		} else {
+			char ebuf[512] = { 0 };
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error![%s]\n",
+					switch_strerror_r(errno, ebuf, sizeof(ebuf)));
+		}
+		switch_safe_free(path);
+	}
+}
+
+static int current_url(void)
+{
+	int index;
+
+	switch_mutex_lock(globals.url_mutex);
+	index = globals.url_index;
+	switch_mutex_unlock(globals.url_mutex);
+
+	return index;
+}
+
+/* fail over from the url that just failed, unless another thread already did */
+static int next_url(int failed)
+{
+	int index;
+
+	switch_mutex_lock(globals.url_mutex);
+	if (globals.url_index == failed && ++globals.url_index >= globals.url_count) {
+		globals.url_index = 0;
+	}
+	index = globals.url_index;
+	switch_mutex_unlock(globals.url_mutex);
+
+	return index;
+}
+
+/* POST xml_text to the configured urls with the configured encoding, retries and failover.
+   The curl handle is owned by the caller so the async workers can keep their connection alive. */
+static switch_status_t post_cdr(switch_CURL *curl_handle, const char *xml_text, const char *query)
+{
+	char *destUrl = NULL;
+	char *curl_xml_text = NULL;
+	char *xml_text_escaped = NULL;
+	switch_curl_slist_t *headers = NULL;
+	switch_curl_slist_t *slist = NULL;
+	uint32_t cur_try;
+	int url_index;
+	long httpRes = 0;
+	switch_status_t status = SWITCH_STATUS_FALSE;
+
+	if (globals.encode == ENCODING_TEXTXML) {
+		headers = switch_curl_slist_append(headers, "Content-Type: text/xml");
+	} else if (globals.encode) {
+		switch_size_t need_bytes = strlen(xml_text) * 3 + 1;
+
+		xml_text_escaped = malloc(need_bytes);
+		switch_assert(xml_text_escaped);
+		memset(xml_text_escaped, 0, need_bytes);
+		if (globals.encode == ENCODING_DEFAULT) {
+			headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
+			switch_url_encode(xml_text, xml_text_escaped, need_bytes);
+		} else {
+			headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-base64-encoded");
+			switch_b64_encode((unsigned char *) xml_text, need_bytes / 3, (unsigned char *) xml_text_escaped, need_bytes);
+		}
+		xml_text = xml_text_escaped;
+	} else {
+		headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-plaintext");
+	}
+
+	if (globals.encode == ENCODING_TEXTXML) {
+		curl_xml_text = (char *) xml_text;
+	} else if (!(curl_xml_text = switch_mprintf("cdr=%s", xml_text))) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Memory Error!\n");
+		goto end;
+	}
+
+	if (!zstr(globals.cred)) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, globals.auth_scheme);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_USERPWD, globals.cred);
+	}
+
+	switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_POST, 1);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, curl_xml_text);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "freeswitch-xml/1.0");
+	switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, httpCallBack);
+
+	if (globals.disable100continue) {
+		slist = switch_curl_slist_append(slist, "Expect:");
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, slist);
+	}
+
+	if (globals.ssl_cert_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLCERT, globals.ssl_cert_file);
+	}
+
+	if (globals.ssl_key_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEY, globals.ssl_key_file);
+	}
+
+	if (globals.ssl_key_password) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEYPASSWD, globals.ssl_key_password);
+	}
+
+	if (globals.ssl_version) {
+		if (!strcasecmp(globals.ssl_version, "SSLv3")) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_SSLv3);
+		} else if (!strcasecmp(globals.ssl_version, "TLSv1")) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1);
+		}
+	}
+
+	if (globals.ssl_cacert_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_CAINFO, globals.ssl_cacert_file);
+	}
+	
+	switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, globals.timeout);
+
+	/* these were used for testing, optionally they may be enabled if someone desires
+	   switch_curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1); // 302 recursion level
+	 */
+
+	for (cur_try = 0; cur_try < globals.retries; cur_try++) {
+		if (cur_try > 0) {
+			/* anything still undelivered at shutdown stays in the spool */
+			if (globals.async && globals.shutdown) {
+				break;
+			}
+			switch_yield(globals.delay * 1000000);
+		}
+
+		url_index = current_url();
+		destUrl = switch_mprintf("%s?%s", globals.urls[url_index], query);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_URL, destUrl);
+
+		if (!strncasecmp(destUrl, "https", 5)) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0);
+		}
+
+		if (globals.enable_cacert_check) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, TRUE);
+		}
+
+		if (globals.enable_ssl_verifyhost) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
+		}
+
+		switch_curl_easy_perform(curl_handle);
+		switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &httpRes);
+		switch_safe_free(destUrl);
+		if (httpRes >= 200 && httpRes <= 299) {
+			status = SWITCH_STATUS_SUCCESS;
+			break;
+		} else {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Got error [%ld] posting to web server [%s]\n",
+							  httpRes, globals.urls[url_index]);
+			url_index = next_url(url_index);
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Retry will be with url [%s]\n", globals.urls[url_index]);
+		}
+	}
+
+  end:
+	switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, NULL);
+	if (headers) {
+		switch_curl_slist_free_all(headers);
+	}
+	if (slist) {
+		switch_curl_slist_free_all(slist);
+	}
+	if (curl_xml_text != xml_text) {
+		switch_safe_free(curl_xml_text);
+	}
+	switch_safe_free(xml_text_escaped);
+
+	return status;
+}
+
+/* skip the <?xml ... ?> declaration so several CDRs can share one document */
+static const char *skip_xml_decl(const char *xml_text)
+{
+	const char *p;
+
+	if (!strncmp(xml_text, "<?xml", 5) && (p = strstr(xml_text, "?>"))) {
+		for (p += 2; *p == '\r' || *p == '\n'; p++);
+		return p;
+	}
+
+	return xml_text;
+}
+
+static char *spool_render(switch_spool_record_t *records, uint32_t count, void *user_data)
+{
+	switch_stream_handle_t stream = { 0 };
+	uint32_t i;
+
+	SWITCH_STANDARD_STREAM(stream);
+	stream.write_function(&stream, "<?xml version=\"1.0\"?>\n<cdrs count=\"%u\">\n", count);
+	for (i = 0; i < count; i++) {
+		stream.write_function(&stream, "%s", skip_xml_decl(records[i].data));
+	}
+	stream.write_function(&stream, "</cdrs>\n");
+
+	return (char *) stream.data;
+}
+
+static switch_status_t spool_post(void *worker_data, const char *body, switch_spool_record_t *records, uint32_t count, void *user_data)
+{
+	char *query;
+	switch_status_t status;
+
+	if (count == 1) {
+		query = switch_mprintf("uuid=%s", records[0].name);
+	} else {
+		query = switch_mprintf("batch=%u", count);
+	}
+
+	status = post_cdr((switch_CURL *) worker_data, body, query);
+	switch_safe_free(query);
+
+	if (status != SWITCH_STATUS_SUCCESS) {
+		if (globals.shutdown) {
+			return SWITCH_STATUS_BREAK;
+		}
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to post to web server, writing %u CDR(s) to file\n", count);
+	}
+
+	return status;
+}
+
+static void spool_failed(switch_spool_record_t *record, void *user_data)
+{
+	write_err_file(record->name, record->data);
+}
+
+static void *spool_worker_init(void *user_data)
+{
+	return switch_curl_easy_init();
+}
+
+static void spool_worker_destroy(void *worker_data, void *user_data)
+{
+	switch_curl_easy_cleanup((switch_CURL *) worker_data);
+}
+
+static void spool_start(void)
+{
+	switch_spool_settings_t settings = { 0 };
+
+	settings.dir = globals.spool_dir;
+	settings.magic = CDR_SPOOL_MAGIC;
+	settings.workers = globals.worker_count;
+	settings.batch_size = globals.batch_size;
+	settings.render = spool_render;
+	settings.post = spool_post;
+	settings.failed = spool_failed;
+	settings.worker_init = spool_worker_init;
+	settings.worker_destroy = spool_worker_destroy;
+
+	if (switch_spool_create(&globals.spool, &settings, globals.pool) != SWITCH_STATUS_SUCCESS) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot start the spool, posting synchronously\n");
+		globals.async = 0;
+	}
+}
+
 static switch_status_t my_on_reporting(switch_core_session_t *session)
 {
-	switch_xml_t cdr = NULL;
 	char *xml_text = NULL;
 	char *path = NULL;
-	char *curl_xml_text = NULL;
+	char *name = NULL;
 	const char *logdir = NULL;
-	char *xml_text_escaped = NULL;
 	int fd = -1;
-	uint32_t cur_try;
-	long httpRes;
 	switch_CURL *curl_handle = NULL;
-	switch_curl_slist_t *headers = NULL;
-	switch_curl_slist_t *slist = NULL;
 	switch_channel_t *channel = switch_core_session_get_channel(session);
 	switch_status_t status = SWITCH_STATUS_FALSE;
 	int is_b;
@@ -212,18 +499,12 @@ static switch_status_t my_on_reporting(switch_core_session_t *session)
 	if (!is_b && globals.prefix_a)
 		a_prefix = "a_";
 
-	if (switch_ivr_generate_xml_cdr(session, &cdr) != SWITCH_STATUS_SUCCESS) {
+	/* build the XML, written straight to text instead of going through an xml tree */
+	if (switch_ivr_generate_xml_cdr_text(session, &xml_text, SWITCH_TRUE) != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error Generating Data!\n");
 		return SWITCH_STATUS_FALSE;
 	}
 
-	/* build the XML */
-	xml_text = switch_xml_toxml(cdr, SWITCH_TRUE);
-	if (!xml_text) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Memory Error!\n");
-		goto error;
-	}
-
 	switch_thread_rwlock_rdlock(globals.log_path_lock);
 
 	if (!(logdir = switch_channel_get_variable(channel, "xml_cdr_base"))) {
@@ -257,176 +538,50 @@ static switch_status_t my_on_reporting(switch_core_session_t *session)
 
 	/* try to post it to the web server */
 	if (globals.url_count) {
-		char *destUrl = NULL;
-		curl_handle = switch_curl_easy_init();
-
-		if (globals.encode == ENCODING_TEXTXML) {
-			headers = switch_curl_slist_append(headers, "Content-Type: text/xml");
-		} else if (globals.encode) {
-			switch_size_t need_bytes = strlen(xml_text) * 3 + 1;
-
-			xml_text_escaped = malloc(need_bytes);
-			switch_assert(xml_text_escaped);
-			memset(xml_text_escaped, 0, need_bytes);
-			if (globals.encode == ENCODING_DEFAULT) {
-				headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
-				switch_url_encode(xml_text, xml_text_escaped, need_bytes);
-			} else {
-				headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-base64-encoded");
-				switch_b64_encode((unsigned char *) xml_text, need_bytes / 3, (unsigned char *) xml_text_escaped, need_bytes);
-			}
-			switch_safe_free(xml_text);
-			xml_text = xml_text_escaped;
-		} else {
-			headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-plaintext");
-		}
-
-		if (globals.encode == ENCODING_TEXTXML) {
-			curl_xml_text = xml_text;
-		} else if (!(curl_xml_text = switch_mprintf("cdr=%s", xml_text))) {
-			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Memory Error!\n");
-			goto error;
-		}
+		name = switch_mprintf("%s%s", a_prefix, switch_core_session_get_uuid(session));
 
-		if (!zstr(globals.cred)) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, globals.auth_scheme);
-			switch_curl_easy_setopt(curl_handle, CURLOPT_USERPWD, globals.cred);
+		/* hand it to the spool workers and let the session go */
+		if (globals.async && switch_spool_write(globals.spool, name, xml_text) == SWITCH_STATUS_SUCCESS) {
+			goto success;
 		}
 
-		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_POST, 1);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, curl_xml_text);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "freeswitch-xml/1.0");
-		switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, httpCallBack);
-
-		if (globals.disable100continue) {
-			slist = switch_curl_slist_append(slist, "Expect:");
-			switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, slist);
-		}
-
-		if (globals.ssl_cert_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLCERT, globals.ssl_cert_file);
-		}
-
-		if (globals.ssl_key_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEY, globals.ssl_key_file);
-		}
-
-		if (globals.ssl_key_password) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEYPASSWD, globals.ssl_key_password);
-		}
-
-		if (globals.ssl_version) {
-			if (!strcasecmp(globals.ssl_version, "SSLv3")) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_SSLv3);
-			} else if (!strcasecmp(globals.ssl_version, "TLSv1")) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1);
-			}
-		}
+		curl_handle = switch_curl_easy_init();
+		path = switch_mprintf("uuid=%s", name);
 
-		if (globals.ssl_cacert_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_CAINFO, globals.ssl_cacert_file);
+		if (post_cdr(curl_handle, xml_text, path) == SWITCH_STATUS_SUCCESS) {
+			goto success;
 		}
-		
-		switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, globals.timeout);
-
-		/* these were used for testing, optionally they may be enabled if someone desires
-		   switch_curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1); // 302 recursion level
-		 */
-
-		for (cur_try = 0; cur_try < globals.retries; cur_try++) {
-			if (cur_try > 0) {
-				switch_yield(globals.delay * 1000000);
-			}
-
-			destUrl = switch_mprintf("%s?uuid=%s%s", globals.urls[globals.url_index], a_prefix, switch_core_session_get_uuid(session));
-			switch_curl_easy_setopt(curl_handle, CURLOPT_URL, destUrl);
-
-			if (!strncasecmp(destUrl, "https", 5)) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0);
-			}
-
-			if (globals.enable_cacert_check) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, TRUE);
-			}
-
-			if (globals.enable_ssl_verifyhost) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
-			}
-
-			switch_curl_easy_perform(curl_handle);
-			switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &httpRes);
-			switch_safe_free(destUrl);
-			if (httpRes >= 200 && httpRes <= 299) {
-				goto success;
-			} else {
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Got error [%ld] posting to web server [%s]\n",
-								  httpRes, globals.urls[globals.url_index]);
-				globals.url_index++;
-				switch_assert(globals.url_count <= MAX_URLS);
-				if (globals.url_index >= globals.url_count) {
-					globals.url_index = 0;
-				}
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Retry will be with url [%s]\n", globals.urls[globals.url_index]);
-			}
-		}
-		switch_curl_easy_cleanup(curl_handle);
-		switch_curl_slist_free_all(headers);
-		switch_curl_slist_free_all(slist);
-		slist = NULL;
-		headers = NULL;
-		curl_handle = NULL;
 
 		/* if we are here the web post failed for some reason */
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to post to web server, writing to file\n");
-
-		switch_thread_rwlock_rdlock(globals.log_path_lock);
-		path = switch_mprintf("%s%s%s%s.cdr.xml", globals.err_log_dir, SWITCH_PATH_SEPARATOR, a_prefix, switch_core_session_get_uuid(session));
-		switch_thread_rwlock_unlock(globals.log_path_lock);
-		if (path) {
-#ifdef _MSC_VER
-			if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) > -1) {
-#else
-			if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) > -1) {
-#endif
-				int wrote;
-				wrote = write(fd, xml_text, (unsigned) strlen(xml_text));
-				wrote++;
-				close(fd);
-				fd = -1;
-			} else {
-				char ebuf[512] = { 0 };
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error![%s]\n",
-						switch_strerror_r(errno, ebuf, sizeof(ebuf)));
-			}
-		}
+		write_err_file(name, xml_text);
 	}
 
   success:
 	status = SWITCH_STATUS_SUCCESS;
 
-  error:
 	if (curl_handle) {
 		switch_curl_easy_cleanup(curl_handle);
 	}
-	if (headers) {
-		switch_curl_slist_free_all(headers);
-	}
-	if (slist) {
-		switch_curl_slist_free_all(slist);
-	}
-	if (curl_xml_text != xml_text) {
-		switch_safe_free(curl_xml_text);
-	}
 	switch_safe_free(xml_text);
 	switch_safe_free(path);
-	switch_xml_free(cdr);
+	switch_safe_free(name);
 
 	return status;
 }
 
+SWITCH_STANDARD_API(xml_cdr_status_function)
+{
+	if (!globals.async) {
+		stream->write_function(stream, "async-delivery: off\n");
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_spool_status(globals.spool, stream);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
 static void event_handler(switch_event_t *event)
 {
 	const char *sig = switch_event_get_header(event, "Trapped-Signal");
@@ -457,6 +612,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load)
 	char *cf = "xml_cdr.conf";
 	switch_xml_t cfg, xml, settings, param;
 	switch_status_t status = SWITCH_STATUS_SUCCESS;
+	switch_api_interface_t *api_interface;
 
 	/* test global state handlers */
 	switch_core_add_state_handler(&state_handlers);
@@ -465,6 +621,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load)
 
 	memset(&globals, 0, sizeof(globals));
 
+	SWITCH_ADD_API(api_interface, "xml_cdr_status", "Show the xml_cdr delivery backlog", xml_cdr_status_function, "");
+
 	if (switch_event_bind_removable(modname, SWITCH_EVENT_TRAP, SWITCH_EVENT_SUBCLASS_ANY, event_handler, NULL, &globals.node) != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't bind!\n");
 		return SWITCH_STATUS_GENERR;
@@ -475,8 +633,11 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load)
 	globals.disable100continue = 0;
 	globals.pool = pool;
 	globals.auth_scheme = CURLAUTH_BASIC;
+	globals.batch_size = 1;
+	globals.worker_count = 2;
 
 	switch_thread_rwlock_create(&globals.log_path_lock, pool);
+	switch_mutex_init(&globals.url_mutex, SWITCH_MUTEX_NESTED, pool);
 
 	/* parse the config */
 	if (!(xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
@@ -525,6 +686,24 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load)
 				}
 			} else if (!strcasecmp(var, "retries") && !zstr(val)) {
 				globals.retries = switch_atoui(val);
+			} else if (!strcasecmp(var, "async-delivery")) {
+				globals.async = switch_true(val);
+			} else if (!strcasecmp(var, "spool-dir") && !zstr(val)) {
+				if (switch_is_file_path(val)) {
+					globals.spool_dir = switch_core_strdup(globals.pool, val);
+				} else {
+					globals.spool_dir = switch_core_sprintf(globals.pool, "%s%s%s", SWITCH_GLOBAL_dirs.storage_dir, SWITCH_PATH_SEPARATOR, val);
+				}
+			} else if (!strcasecmp(var, "batch-size") && !zstr(val)) {
+				int tmp = atoi(val);
+				if (tmp > 0) {
+					globals.batch_size = tmp > SWITCH_SPOOL_MAX_BATCH ? SWITCH_SPOOL_MAX_BATCH : tmp;
+				}
+			} else if (!strcasecmp(var, "delivery-workers") && !zstr(val)) {
+				int tmp = atoi(val);
+				if (tmp > 0) {
+					globals.worker_count = tmp > SWITCH_SPOOL_MAX_WORKERS ? SWITCH_SPOOL_MAX_WORKERS : tmp;
+				}
 			} else if (!strcasecmp(var, "rotate") && !zstr(val)) {
 				globals.rotate = switch_true(val);
 			} else if (!strcasecmp(var, "log-dir")) {
@@ -600,6 +779,15 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_cdr_load)
 
 	set_xml_cdr_log_dirs();
 
+	if (globals.async && globals.url_count) {
+		if (zstr(globals.spool_dir)) {
+			globals.spool_dir = switch_core_sprintf(globals.pool, "%s%sxml_cdr_spool", SWITCH_GLOBAL_dirs.storage_dir, SWITCH_PATH_SEPARATOR);
+		}
+		spool_start();
+	} else {
+		globals.async = 0;
+	}
+
 	switch_xml_free(xml);
 
 	return status;
@@ -610,11 +798,17 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_xml_cdr_shutdown)
 
 	globals.shutdown = 1;
 
+	/* no new CDRs once the spool is going away */
+	switch_core_remove_state_handler(&state_handlers);
+
+	if (globals.async) {
+		switch_spool_destroy(&globals.spool);
+	}
+
 	switch_safe_free(globals.log_dir);
 	switch_safe_free(globals.err_log_dir);
 
 	switch_event_unbind(&globals.node);
-	switch_core_remove_state_handler(&state_handlers);
 
 	switch_thread_rwlock_destroy(globals.log_path_lock);
 
@@ -39,7 +39,14 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_xml_curl_shutdown);
 SWITCH_MODULE_DEFINITION(mod_xml_curl, mod_xml_curl_load, mod_xml_curl_shutdown, NULL);
 
 
+#define XML_CURL_MAX_POOL 64
+#define XML_CURL_MAX_CACHE_PARAMS 32
+#define XML_CURL_LATENCY_BUCKETS 9
+
+static const int latency_bounds[XML_CURL_LATENCY_BUCKETS - 1] = { 10, 25, 50, 100, 250, 500, 1000, 2500 };
+
 struct xml_binding {
+	char *name;
 	char *method;
 	char *url;
 	char *bindings;
@@ -59,8 +66,59 @@ struct xml_binding {
 	int use_dynamic_url;
 	int auth_scheme;
 	int timeout;
+	/* idle easy handles, each keeps its connections open so the next fetch skips the tcp/tls setup */
+	switch_mutex_t *mutex;
+	switch_CURL *idle[XML_CURL_MAX_POOL];
+	int idle_count;
+	int pool_size;
+	/* stop calling a webserver that keeps failing and let the next binding answer */
+	int breaker_failures;
+	int breaker_cooldown;
+	uint32_t consecutive_failures;
+	switch_time_t breaker_open_until;
+	uint64_t requests;
+	uint64_t failures;
+	uint64_t reused;
+	uint64_t short_circuits;
+	uint64_t latency_total;
+	uint64_t latency[XML_CURL_LATENCY_BUCKETS];
+	/* parsed responses keyed on section, tag, key, value and the cache-key-params */
+	switch_hash_t *cache;
+	/* fetches on the wire, identical ones wait on these instead of asking again */
+	switch_hash_t *flights;
+	struct xml_curl_flight *free_flights;
+	uint32_t cache_generation;
+	int cache_ttl;
+	uint32_t cache_max;
+	uint32_t cache_count;
+	char *cache_params_data;
+	char *cache_params[XML_CURL_MAX_CACHE_PARAMS];
+	int cache_params_count;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cache_coalesced;
+	struct xml_binding *next;
 };
 
+typedef struct xml_curl_cache_entry {
+	char *key;
+	switch_xml_t xml;
+	switch_time_t expires;
+	struct xml_curl_cache_entry *next;
+} xml_curl_cache_entry_t;
+
+typedef struct xml_curl_flight {
+	char *key;
+	switch_thread_cond_t *cond;
+	uint8_t done;
+	uint32_t waiters;
+	switch_xml_t xml;
+	struct xml_curl_flight *next;
+} xml_curl_flight_t;
+
+/* how long a fetch waits for an identical one already on the wire before going itself */
+#define XML_CURL_COALESCE_WAIT 5000000
+
 static int keep_files_around = 0;
 
 typedef struct xml_binding xml_binding_t;
@@ -69,9 +127,11 @@ typedef struct xml_binding xml_binding_t;
 
 struct config_data {
 	char *name;
-	int fd;
+	char *buf;
+	switch_size_t buflen;
 	switch_size_t bytes;
 	switch_size_t max_bytes;
+	int max_age;
 	int err;
 };
 
@@ -84,9 +144,140 @@ static struct {
 	switch_memory_pool_t *pool;
 	hash_node_t *hash_root;
 	hash_node_t *hash_tail;
+	xml_binding_t *bindings;
 } globals;
 
-#define XML_CURL_SYNTAX "[debug_on|debug_off]"
+static void binding_status(xml_binding_t *binding, switch_stream_handle_t *stream)
+{
+	int i;
+	uint64_t requests;
+
+	switch_mutex_lock(binding->mutex);
+	requests = binding->requests;
+	stream->write_function(stream, "%s [%s]\n", binding->name, binding->url);
+	stream->write_function(stream, "  requests: %" SWITCH_UINT64_T_FMT " failures: %" SWITCH_UINT64_T_FMT " reused: %" SWITCH_UINT64_T_FMT
+						   " short-circuited: %" SWITCH_UINT64_T_FMT "\n", requests, binding->failures, binding->reused, binding->short_circuits);
+	stream->write_function(stream, "  idle connections: %d/%d breaker: %s\n", binding->idle_count, binding->pool_size,
+						   binding->breaker_open_until > switch_micro_time_now() ? "OPEN" : "closed");
+	stream->write_function(stream, "  avg latency: %" SWITCH_UINT64_T_FMT "ms\n  latency:", requests ? binding->latency_total / requests : 0);
+	for (i = 0; i < XML_CURL_LATENCY_BUCKETS; i++) {
+		if (i < XML_CURL_LATENCY_BUCKETS - 1) {
+			stream->write_function(stream, " <%dms:%" SWITCH_UINT64_T_FMT, latency_bounds[i], binding->latency[i]);
+		} else {
+			stream->write_function(stream, " >=%dms:%" SWITCH_UINT64_T_FMT, latency_bounds[i - 1], binding->latency[i]);
+		}
+	}
+	stream->write_function(stream, "\n");
+	if (binding->cache) {
+		stream->write_function(stream, "  cache: %u/%u entries hits: %" SWITCH_UINT64_T_FMT " misses: %" SWITCH_UINT64_T_FMT
+							   " coalesced: %" SWITCH_UINT64_T_FMT "\n", binding->cache_count, binding->cache_max,
+							   binding->cache_hits, binding->cache_misses, binding->cache_coalesced);
+	}
+	switch_mutex_unlock(binding->mutex);
+}
+
+static void cache_entry_free(xml_curl_cache_entry_t *entry)
+{
+	if (entry->xml) {
+		switch_xml_free(entry->xml);
+	}
+	switch_safe_free(entry->key);
+	free(entry);
+}
+
+/* binding->mutex must be held */
+static uint32_t binding_cache_flush(xml_binding_t *binding, switch_bool_t expired_only)
+{
+	switch_hash_index_t *hi;
+	void *val;
+	uint32_t r = 0;
+	switch_time_t now = switch_micro_time_now();
+	xml_curl_cache_entry_t *entry, *victims = NULL;
+
+	if (!expired_only) {
+		/* fetches out on the wire right now must not put what they get back in */
+		binding->cache_generation++;
+	}
+
+	/* one pass to pick them, deleting while iterating would invalidate the index */
+	for (hi = switch_core_hash_first(binding->cache); hi; hi = switch_core_hash_next(hi)) {
+		switch_core_hash_this(hi, NULL, NULL, &val);
+		entry = (xml_curl_cache_entry_t *) val;
+
+		if (expired_only && entry->expires > now) {
+			continue;
+		}
+
+		entry->next = victims;
+		victims = entry;
+	}
+
+	while ((entry = victims)) {
+		victims = entry->next;
+		switch_core_hash_delete(binding->cache, entry->key);
+		cache_entry_free(entry);
+		binding->cache_count--;
+		r++;
+	}
+
+	return r;
+}
+
+/* binding->mutex must be held, flights are recycled so their conds come from the module pool only once */
+static xml_curl_flight_t *binding_flight_new(xml_binding_t *binding, const char *key)
+{
+	xml_curl_flight_t *flight;
+
+	if ((flight = binding->free_flights)) {
+		binding->free_flights = flight->next;
+	} else {
+		switch_zmalloc(flight, sizeof(*flight));
+		switch_thread_cond_create(&flight->cond, globals.pool);
+	}
+
+	flight->key = strdup(key);
+	flight->done = 0;
+	flight->waiters = 0;
+	flight->xml = NULL;
+	flight->next = NULL;
+
+	switch_core_hash_insert(binding->flights, flight->key, flight);
+
+	return flight;
+}
+
+/* binding->mutex must be held, the flight must be landed or abandoned by everyone */
+static void binding_flight_release(xml_binding_t *binding, xml_curl_flight_t *flight)
+{
+	if (flight->xml) {
+		switch_xml_free(flight->xml);
+		flight->xml = NULL;
+	}
+
+	switch_safe_free(flight->key);
+	flight->next = binding->free_flights;
+	binding->free_flights = flight;
+}
+
+/* binding->mutex must be held, hands the document to whoever waited and frees the flight once nobody holds it */
+static void binding_flight_land(xml_binding_t *binding, xml_curl_flight_t *flight, switch_xml_t xml)
+{
+	switch_core_hash_delete(binding->flights, flight->key);
+	flight->done = 1;
+
+	if (!flight->waiters) {
+		binding_flight_release(binding, flight);
+		return;
+	}
+
+	if (xml) {
+		flight->xml = switch_xml_dup(xml);
+	}
+
+	switch_thread_cond_broadcast(flight->cond);
+}
+
+#define XML_CURL_SYNTAX "[debug_on|debug_off|status|cache flush]"
 SWITCH_STANDARD_API(xml_curl_function)
 {
 	if (session) {
@@ -101,6 +292,27 @@ SWITCH_STANDARD_API(xml_curl_function)
 		keep_files_around = 1;
 	} else if (!strcasecmp(cmd, "debug_off")) {
 		keep_files_around = 0;
+	} else if (!strcasecmp(cmd, "status")) {
+		xml_binding_t *binding;
+
+		for (binding = globals.bindings; binding; binding = binding->next) {
+			binding_status(binding, stream);
+		}
+		return SWITCH_STATUS_SUCCESS;
+	} else if (!strcasecmp(cmd, "cache flush")) {
+		xml_binding_t *binding;
+		uint32_t r = 0;
+
+		for (binding = globals.bindings; binding; binding = binding->next) {
+			if (binding->cache) {
+				switch_mutex_lock(binding->mutex);
+				r += binding_cache_flush(binding, SWITCH_FALSE);
+				switch_mutex_unlock(binding->mutex);
+			}
+		}
+
+		stream->write_function(stream, "+OK flushed %u entr%s\n", r, r == 1 ? "y" : "ies");
+		return SWITCH_STATUS_SUCCESS;
 	} else {
 		goto usage;
 	}
@@ -117,28 +329,131 @@ static size_t file_callback(void *ptr, size_t size, size_t nmemb, void *data)
 {
 	register unsigned int realsize = (unsigned int) (size * nmemb);
 	struct config_data *config_data = data;
-	int x;
-
-	config_data->bytes += realsize;
 
-	if (config_data->bytes > config_data->max_bytes) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Oversized file detected [%d bytes]\n", (int) config_data->bytes);
+	if (config_data->bytes + realsize > config_data->max_bytes) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Oversized file detected [%d bytes]\n", (int) (config_data->bytes + realsize));
 		config_data->err = 1;
 		return 0;
 	}
 
-	x = write(config_data->fd, ptr, realsize);
-	if (x != (int) realsize) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Short write! %d out of %d\n", x, realsize);
+	/* collect the response in memory, it only goes to the temp file once the fetch is known to be good */
+	if (config_data->bytes + realsize + 1 > config_data->buflen) {
+		switch_size_t need = config_data->buflen ? config_data->buflen : 4096;
+		char *tmp;
+
+		while (need < config_data->bytes + realsize + 1) {
+			need *= 2;
+		}
+
+		if (!(tmp = realloc(config_data->buf, need))) {
+			config_data->err = 1;
+			return 0;
+		}
+
+		config_data->buf = tmp;
+		config_data->buflen = need;
 	}
-	return x;
+
+	memcpy(config_data->buf + config_data->bytes, ptr, realsize);
+	config_data->bytes += realsize;
+	config_data->buf[config_data->bytes] = '\0';
+
+	return realsize;
 }
 
+static size_t header_callback(void *ptr, size_t size, size_t nmemb, void *data)
+{
+	size_t realsize = size * nmemb;
+	struct config_data *config_data = data;
+	char line[256];
+	const char *p;
 
+	if (realsize < 14 || strncasecmp((char *) ptr, "Cache-Control:", 14)) {
+		return realsize;
+	}
 
+	switch_copy_string(line, (char *) ptr, realsize + 1 < sizeof(line) ? realsize + 1 : sizeof(line));
 
-static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, const char *key_name, const char *key_value, switch_event_t *params,
-								  void *user_data)
+	if (switch_stristr("no-store", line) || switch_stristr("no-cache", line) || switch_stristr("private", line)) {
+		config_data->max_age = 0;
+	} else if ((p = switch_stristr("max-age=", line))) {
+		int tmp = atoi(p + 8);
+		config_data->max_age = tmp > 0 ? tmp : 0;
+	}
+
+	return realsize;
+}
+
+static switch_CURL *binding_get_handle(xml_binding_t *binding)
+{
+	switch_CURL *curl_handle = NULL;
+
+	switch_mutex_lock(binding->mutex);
+	if (binding->idle_count) {
+		curl_handle = binding->idle[--binding->idle_count];
+		binding->reused++;
+	}
+	switch_mutex_unlock(binding->mutex);
+
+	if (!curl_handle) {
+		curl_handle = switch_curl_easy_init();
+	}
+
+	return curl_handle;
+}
+
+static void binding_put_handle(xml_binding_t *binding, switch_CURL *curl_handle)
+{
+	/* drops the options but keeps the connection cache */
+	curl_easy_reset(curl_handle);
+
+	switch_mutex_lock(binding->mutex);
+	if (binding->idle_count < binding->pool_size) {
+		binding->idle[binding->idle_count++] = curl_handle;
+		curl_handle = NULL;
+	}
+	switch_mutex_unlock(binding->mutex);
+
+	if (curl_handle) {
+		switch_curl_easy_cleanup(curl_handle);
+	}
+}
+
+static void binding_record(xml_binding_t *binding, switch_time_t started, switch_bool_t failed)
+{
+	uint64_t ms = (uint64_t) ((switch_micro_time_now() - started) / 1000);
+	int i;
+
+	for (i = 0; i < XML_CURL_LATENCY_BUCKETS - 1 && ms >= (uint64_t) latency_bounds[i]; i++);
+
+	switch_mutex_lock(binding->mutex);
+	binding->requests++;
+	binding->latency_total += ms;
+	binding->latency[i]++;
+
+	if (failed) {
+		binding->failures++;
+		binding->consecutive_failures++;
+
+		if (binding->breaker_failures && binding->consecutive_failures >= (uint32_t) binding->breaker_failures) {
+			if (binding->breaker_open_until <= switch_micro_time_now()) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Binding [%s] failed %u times in a row, not calling it for %d seconds\n",
+								  binding->name, binding->consecutive_failures, binding->breaker_cooldown);
+			}
+			binding->breaker_open_until = switch_micro_time_now() + (switch_time_t) binding->breaker_cooldown * 1000000;
+		}
+	} else {
+		binding->consecutive_failures = 0;
+		binding->breaker_open_until = 0;
+	}
+	switch_mutex_unlock(binding->mutex);
+}
+
+
+
+
+static switch_xml_t xml_url_fetch_http(const char *section, const char *tag_name, const char *key_name, const char *key_value, switch_event_t *params,
+									   xml_binding_t *binding, int *max_age)
 {
 	char filename[512] = "";
 	switch_CURL *curl_handle = NULL;
@@ -147,7 +462,6 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 	char *data = NULL;
 	switch_uuid_t uuid;
 	char uuid_str[SWITCH_UUID_FORMATTED_LENGTH + 1];
-	xml_binding_t *binding = (xml_binding_t *) user_data;
 	char *file_url;
 	switch_curl_slist_t *slist = NULL;
 	long httpRes = 0;
@@ -156,6 +470,8 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 	char basic_data[512];
 	char *uri = NULL;
 	char *dynamic_url = NULL;
+	switch_CURLcode cc = 0;
+	switch_time_t started;
 
     strncpy(hostname, switch_core_get_switchname(), sizeof(hostname));
 
@@ -173,6 +489,21 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 		return xml;
 	}
 
+	if (binding->breaker_failures) {
+		switch_bool_t open;
+
+		switch_mutex_lock(binding->mutex);
+		if ((open = binding->breaker_open_until > switch_micro_time_now())) {
+			binding->short_circuits++;
+		}
+		switch_mutex_unlock(binding->mutex);
+
+		if (open) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Binding [%s] is cooling down, skipping fetch\n", binding->name);
+			return NULL;
+		}
+	}
+
 	switch_snprintf(basic_data, sizeof(basic_data), "hostname=%s&section=%s&tag_name=%s&key_name=%s&key_value=%s",
 					hostname, section, switch_str_nil(tag_name), switch_str_nil(key_name), switch_str_nil(key_value));
 
@@ -206,7 +537,7 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 	switch_uuid_format(uuid_str, &uuid);
 
 	switch_snprintf(filename, sizeof(filename), "%s%s%s.tmp.xml", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR, uuid_str);
-	curl_handle = switch_curl_easy_init();
+	curl_handle = binding_get_handle(binding);
 	headers = switch_curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
 
 	if (!strncasecmp(binding->url, "https", 5)) {
@@ -218,93 +549,118 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 
 	config_data.name = filename;
 	config_data.max_bytes = XML_CURL_MAX_BYTES;
+	config_data.max_age = -1;
 
-	if ((config_data.fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR)) > -1) {
-		if (!zstr(binding->cred)) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, binding->auth_scheme);
-			switch_curl_easy_setopt(curl_handle, CURLOPT_USERPWD, binding->cred);
-		}
-		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
-		if (binding->method != NULL)
-			switch_curl_easy_setopt(curl_handle, CURLOPT_CUSTOMREQUEST, binding->method);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_POST, !binding->use_get_style);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_MAXREDIRS, 10);
-		if (!binding->use_get_style)
-			switch_curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, data);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_URL, binding->use_get_style ? uri : dynamic_url);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, file_callback);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) &config_data);
-		switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "freeswitch-xml/1.0");
-
-		if (binding->timeout) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, binding->timeout);
-			switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
-		}
+	if (!zstr(binding->cred)) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, binding->auth_scheme);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_USERPWD, binding->cred);
+	}
+	switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+	if (binding->method != NULL)
+		switch_curl_easy_setopt(curl_handle, CURLOPT_CUSTOMREQUEST, binding->method);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_POST, !binding->use_get_style);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_MAXREDIRS, 10);
+	if (!binding->use_get_style)
+		switch_curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, data);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_URL, binding->use_get_style ? uri : dynamic_url);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, file_callback);
+	switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) &config_data);
+	if (binding->cache) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, header_callback);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) &config_data);
+	}
+	switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "freeswitch-xml/1.0");
 
-		if (binding->disable100continue) {
-			slist = switch_curl_slist_append(slist, "Expect:");
-			switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, slist);
-		}
+	if (binding->timeout) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, binding->timeout);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
+	}
 
-		if (binding->enable_cacert_check) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, TRUE);
-		}
+	if (binding->disable100continue) {
+		slist = switch_curl_slist_append(slist, "Expect:");
+		switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, slist);
+	}
 
-		if (binding->ssl_cert_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLCERT, binding->ssl_cert_file);
-		}
+	if (binding->enable_cacert_check) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, TRUE);
+	}
 
-		if (binding->ssl_key_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEY, binding->ssl_key_file);
-		}
+	if (binding->ssl_cert_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLCERT, binding->ssl_cert_file);
+	}
 
-		if (binding->ssl_key_password) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEYPASSWD, binding->ssl_key_password);
-		}
+	if (binding->ssl_key_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEY, binding->ssl_key_file);
+	}
 
-		if (binding->ssl_version) {
-			if (!strcasecmp(binding->ssl_version, "SSLv3")) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_SSLv3);
-			} else if (!strcasecmp(binding->ssl_version, "TLSv1")) {
-				switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1);
-			}
-		}
+	if (binding->ssl_key_password) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSLKEYPASSWD, binding->ssl_key_password);
+	}
 
-		if (binding->ssl_cacert_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_CAINFO, binding->ssl_cacert_file);
+	if (binding->ssl_version) {
+		if (!strcasecmp(binding->ssl_version, "SSLv3")) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_SSLv3);
+		} else if (!strcasecmp(binding->ssl_version, "TLSv1")) {
+			switch_curl_easy_setopt(curl_handle, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1);
 		}
+	}
 
-		if (binding->enable_ssl_verifyhost) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
-		}
+	if (binding->ssl_cacert_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_CAINFO, binding->ssl_cacert_file);
+	}
 
-		if (binding->cookie_file) {
-			switch_curl_easy_setopt(curl_handle, CURLOPT_COOKIEJAR, binding->cookie_file);
-			switch_curl_easy_setopt(curl_handle, CURLOPT_COOKIEFILE, binding->cookie_file);
-		}
+	if (binding->enable_ssl_verifyhost) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
+	}
 
-		if (binding->bind_local) {
-			curl_easy_setopt(curl_handle, CURLOPT_INTERFACE, binding->bind_local);
-		}
+	if (binding->cookie_file) {
+		switch_curl_easy_setopt(curl_handle, CURLOPT_COOKIEJAR, binding->cookie_file);
+		switch_curl_easy_setopt(curl_handle, CURLOPT_COOKIEFILE, binding->cookie_file);
+	}
 
-		switch_curl_easy_perform(curl_handle);
-		switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &httpRes);
-		switch_curl_easy_cleanup(curl_handle);
-		switch_curl_slist_free_all(headers);
-		switch_curl_slist_free_all(slist);
-		close(config_data.fd);
-	} else {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error Opening temp file!\n");
+	if (binding->bind_local) {
+		curl_easy_setopt(curl_handle, CURLOPT_INTERFACE, binding->bind_local);
 	}
 
+	started = switch_micro_time_now();
+	cc = switch_curl_easy_perform(curl_handle);
+	switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &httpRes);
+	binding_put_handle(binding, curl_handle);
+	switch_curl_slist_free_all(headers);
+	switch_curl_slist_free_all(slist);
+
+	/* a 4xx is the webserver answering, only transport errors and 5xx count against it */
+	binding_record(binding, started, (cc && !config_data.err) || httpRes == 0 || httpRes >= 500);
+
 	if (config_data.err) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error encountered! [%s]\ndata: [%s]\n", binding->url, data);
 		xml = NULL;
 	} else {
-		if (httpRes == 200) {
-			if (!(xml = switch_xml_parse_file(filename))) {
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error Parsing Result! [%s]\ndata: [%s]\n", binding->url, data);
+		if (httpRes == 200 && config_data.buf) {
+			int fd;
+
+			/* switch_xml_parse_file runs the pre-processor ($${vars}, X-PRE-PROCESS) the way it always did for these responses */
+			if ((fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR)) > -1) {
+				if (write(fd, config_data.buf, config_data.bytes) != (int) config_data.bytes) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Short write to %s\n", filename);
+				}
+				close(fd);
+
+				if (!(xml = switch_xml_parse_file(filename))) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error Parsing Result! [%s]\ndata: [%s]\n", binding->url, data);
+				}
+
+				/* Debug by leaving the file behind for review */
+				if (keep_files_around) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "XML response is in %s\n", filename);
+				} else {
+					if (unlink(filename) != 0) {
+						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "XML response file [%s] delete failed\n", filename);
+					}
+				}
+			} else {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error Opening temp file!\n");
 			}
 		} else {
 			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Received HTTP error %ld trying to fetch %s\ndata: [%s]\n", httpRes, binding->url,
@@ -313,20 +669,137 @@ static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, con
 		}
 	}
 
-	/* Debug by leaving the file behind for review */
-	if (keep_files_around) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "XML response is in %s\n", filename);
-	} else {
-		if (unlink(filename) != 0) {
-			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "XML response file [%s] delete failed\n", filename);
-		}
-	}
-
+	switch_safe_free(config_data.buf);
 	switch_safe_free(data);
 	if (binding->use_get_style == 1)
 		switch_safe_free(uri);
 	if (binding->use_dynamic_url && dynamic_url != binding->url)
 		switch_safe_free(dynamic_url);
+
+	*max_age = config_data.max_age;
+
+	return xml;
+}
+
+static void binding_cache_key(xml_binding_t *binding, char *buf, switch_size_t len, const char *section, const char *tag_name,
+							  const char *key_name, const char *key_value, switch_event_t *params)
+{
+	switch_size_t used;
+	int i;
+
+	switch_snprintf(buf, len, "%s|%s|%s|%s", switch_str_nil(section), switch_str_nil(tag_name), switch_str_nil(key_name), switch_str_nil(key_value));
+	used = strlen(buf);
+
+	for (i = 0; i < binding->cache_params_count && used < len - 1; i++) {
+		const char *val = params ? switch_event_get_header(params, binding->cache_params[i]) : NULL;
+
+		switch_snprintf(buf + used, len - used, "|%s=%s", binding->cache_params[i], switch_str_nil(val));
+		used += strlen(buf + used);
+	}
+}
+
+static switch_xml_t xml_url_fetch(const char *section, const char *tag_name, const char *key_name, const char *key_value, switch_event_t *params,
+								  void *user_data)
+{
+	xml_binding_t *binding = (xml_binding_t *) user_data;
+	xml_curl_cache_entry_t *entry;
+	xml_curl_flight_t *flight = NULL;
+	char key[2048];
+	switch_xml_t xml = NULL;
+	switch_time_t now, deadline;
+	uint32_t generation;
+	int max_age = -1;
+
+	if (!binding) {
+		return NULL;
+	}
+
+	if (!binding->cache) {
+		return xml_url_fetch_http(section, tag_name, key_name, key_value, params, binding, &max_age);
+	}
+
+	binding_cache_key(binding, key, sizeof(key), section, tag_name, key_name, key_value, params);
+
+	switch_mutex_lock(binding->mutex);
+
+	now = switch_micro_time_now();
+
+	if ((entry = switch_core_hash_find(binding->cache, key))) {
+		if (entry->expires > now) {
+			binding->cache_hits++;
+			xml = switch_xml_dup(entry->xml);
+			switch_mutex_unlock(binding->mutex);
+			return xml;
+		}
+
+		switch_core_hash_delete(binding->cache, key);
+		cache_entry_free(entry);
+		binding->cache_count--;
+	}
+
+	if ((flight = switch_core_hash_find(binding->flights, key))) {
+		/* same document is already on its way, wait for that one only and take what it brings back */
+		binding->cache_coalesced++;
+		flight->waiters++;
+		deadline = now + XML_CURL_COALESCE_WAIT;
+
+		while (!flight->done && (now = switch_micro_time_now()) < deadline) {
+			switch_thread_cond_timedwait(flight->cond, binding->mutex, deadline - now);
+		}
+
+		flight->waiters--;
+
+		if (flight->done) {
+			xml = flight->xml ? switch_xml_dup(flight->xml) : NULL;
+
+			if (!flight->waiters) {
+				binding_flight_release(binding, flight);
+			}
+
+			switch_mutex_unlock(binding->mutex);
+			return xml;
+		}
+
+		/* it is taking too long, go ourselves without holding anyone else up on it */
+		flight = NULL;
+	} else {
+		flight = binding_flight_new(binding, key);
+	}
+
+	binding->cache_misses++;
+	generation = binding->cache_generation;
+
+	switch_mutex_unlock(binding->mutex);
+
+	xml = xml_url_fetch_http(section, tag_name, key_name, key_value, params, binding, &max_age);
+
+	switch_mutex_lock(binding->mutex);
+
+	if (xml && generation == binding->cache_generation) {
+		int ttl = max_age > -1 ? max_age * 1000 : binding->cache_ttl;
+
+		if (ttl > 0 && !switch_core_hash_find(binding->cache, key)) {
+			if (binding->cache_max && binding->cache_count >= binding->cache_max) {
+				binding_cache_flush(binding, SWITCH_TRUE);
+			}
+
+			if (!binding->cache_max || binding->cache_count < binding->cache_max) {
+				switch_zmalloc(entry, sizeof(*entry));
+				entry->key = strdup(key);
+				entry->xml = switch_xml_dup(xml);
+				entry->expires = switch_micro_time_now() + (switch_time_t) ttl * 1000;
+				switch_core_hash_insert(binding->cache, entry->key, entry);
+				binding->cache_count++;
+			}
+		}
+	}
+
+	if (flight) {
+		binding_flight_land(binding, flight, xml);
+	}
+
+	switch_mutex_unlock(binding->mutex);
+
 	return xml;
 }
 
@@ -369,6 +842,9 @@ static switch_status_t do_config(void)
 		char *cookie_file = NULL;
 		hash_node_t *hash_node;
 		int auth_scheme = CURLAUTH_BASIC;
+		int pool_size = 4, breaker_failures = 0, breaker_cooldown = 30;
+		int cache_ttl = 0, cache_max = 1000;
+		char *cache_params = NULL;
 		need_vars_map = 0;
 		vars_map = NULL;
 
@@ -447,6 +923,31 @@ static switch_status_t do_config(void)
 				}
 			} else if (!strcasecmp(var, "bind-local")) {
 				bind_local = val;
+			} else if (!strcasecmp(var, "connection-pool-size")) {
+				int tmp = atoi(val);
+				if (tmp >= 0 && tmp <= XML_CURL_MAX_POOL) {
+					pool_size = tmp;
+				} else {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "connection-pool-size must be between 0 and %d\n", XML_CURL_MAX_POOL);
+				}
+			} else if (!strcasecmp(var, "circuit-breaker-failures")) {
+				int tmp = atoi(val);
+				if (tmp >= 0) {
+					breaker_failures = tmp;
+				}
+			} else if (!strcasecmp(var, "cache-ttl")) {
+				int tmp = atoi(val);
+				cache_ttl = tmp > 0 ? tmp : 0;
+			} else if (!strcasecmp(var, "cache-max-entries")) {
+				int tmp = atoi(val);
+				cache_max = tmp > 0 ? tmp : 0;
+			} else if (!strcasecmp(var, "cache-key-params")) {
+				cache_params = val;
+			} else if (!strcasecmp(var, "circuit-breaker-cooldown")) {
+				int tmp = atoi(val);
+				if (tmp > 0) {
+					breaker_cooldown = tmp;
+				}
 			}
 		}
 
@@ -464,8 +965,27 @@ static switch_status_t do_config(void)
 		}
 		memset(binding, 0, sizeof(*binding));
 
+		binding->name = strdup(zstr(bname) ? "N/A" : bname);
 		binding->auth_scheme = auth_scheme;
 		binding->timeout = timeout;
+		binding->pool_size = pool_size;
+		binding->breaker_failures = breaker_failures;
+		binding->breaker_cooldown = breaker_cooldown;
+		switch_mutex_init(&binding->mutex, SWITCH_MUTEX_NESTED, globals.pool);
+
+		if (cache_ttl && zstr(cache_params)) {
+			/* without them two lookups that only differ in the posted params would get each other's document */
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+							  "Binding [%s] has cache-ttl but no cache-key-params, list the params the webserver answers on to enable caching\n",
+							  binding->name);
+		} else if (cache_ttl) {
+			binding->cache_ttl = cache_ttl;
+			binding->cache_max = cache_max;
+			switch_core_hash_init(&binding->cache, globals.pool);
+			switch_core_hash_init(&binding->flights, globals.pool);
+			binding->cache_params_data = strdup(cache_params);
+			binding->cache_params_count = switch_separate_string(binding->cache_params_data, ',', binding->cache_params, XML_CURL_MAX_CACHE_PARAMS);
+		}
 		binding->url = strdup(url);
 		switch_assert(binding->url);
 
@@ -538,6 +1058,8 @@ static switch_status_t do_config(void)
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Binding [%s] XML Fetch Function [%s] [%s]\n",
 						  zstr(bname) ? "N/A" : bname, binding->url, binding->bindings ? binding->bindings : "all");
 		switch_xml_bind_search_function(xml_url_fetch, switch_xml_parse_section_string(binding->bindings), binding);
+		binding->next = globals.bindings;
+		globals.bindings = binding;
 		x++;
 		binding = NULL;
 	}
@@ -567,6 +1089,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_curl_load)
 	SWITCH_ADD_API(xml_curl_api_interface, "xml_curl", "XML Curl", xml_curl_function, XML_CURL_SYNTAX);
 	switch_console_set_complete("add xml_curl debug_on");
 	switch_console_set_complete("add xml_curl debug_off");
+	switch_console_set_complete("add xml_curl status");
+	switch_console_set_complete("add xml_curl cache flush");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
@@ -575,6 +1099,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_xml_curl_load)
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_xml_curl_shutdown)
 {
 	hash_node_t *ptr = NULL;
+	xml_binding_t *binding;
 
 	while (globals.hash_root) {
 		ptr = globals.hash_root;
@@ -585,6 +1110,22 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_xml_curl_shutdown)
 
 	switch_xml_unbind_search_function_ptr(xml_url_fetch);
 
+	for (binding = globals.bindings; binding; binding = binding->next) {
+		switch_mutex_lock(binding->mutex);
+		while (binding->idle_count) {
+			switch_curl_easy_cleanup(binding->idle[--binding->idle_count]);
+		}
+		if (binding->cache) {
+			binding_cache_flush(binding, SWITCH_FALSE);
+		}
+		while (binding->free_flights) {
+			xml_curl_flight_t *flight = binding->free_flights;
+			binding->free_flights = flight->next;
+			free(flight);
+		}
+		switch_mutex_unlock(binding->mutex);
+	}
+
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -159,6 +159,13 @@ struct switch_channel {
 	switch_event_t *api_list;
 	switch_event_t *var_list;
 	switch_hold_record_t *hold_record;
+	switch_channel_waiter_t *waiter;
+};
+
+struct switch_channel_waiter {
+	switch_mutex_t *mutex;
+	switch_thread_cond_t *cond;
+	uint32_t seq;
 };
 
 SWITCH_DECLARE(switch_hold_record_t *) switch_channel_get_hold_record(switch_channel_t *channel)
@@ -365,6 +372,81 @@ SWITCH_DECLARE(switch_status_t) switch_channel_alloc(switch_channel_t **channel,
 	return SWITCH_STATUS_SUCCESS;
 }
 
+SWITCH_DECLARE(switch_status_t) switch_channel_waiter_create(switch_channel_waiter_t **waiter, switch_memory_pool_t *pool)
+{
+	switch_channel_waiter_t *w;
+
+	switch_assert(pool != NULL);
+
+	if (!(w = switch_core_alloc(pool, sizeof(*w)))) {
+		return SWITCH_STATUS_MEMERR;
+	}
+
+	switch_mutex_init(&w->mutex, SWITCH_MUTEX_NESTED, pool);
+	switch_thread_cond_create(&w->cond, pool);
+	*waiter = w;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_DECLARE(void) switch_channel_waiter_wake(switch_channel_waiter_t *waiter)
+{
+	switch_mutex_lock(waiter->mutex);
+	waiter->seq++;
+	switch_thread_cond_signal(waiter->cond);
+	switch_mutex_unlock(waiter->mutex);
+}
+
+SWITCH_DECLARE(uint32_t) switch_channel_waiter_seq(switch_channel_waiter_t *waiter)
+{
+	uint32_t seq;
+
+	switch_mutex_lock(waiter->mutex);
+	seq = waiter->seq;
+	switch_mutex_unlock(waiter->mutex);
+
+	return seq;
+}
+
+SWITCH_DECLARE(switch_status_t) switch_channel_waiter_wait(switch_channel_waiter_t *waiter, uint32_t seq, switch_interval_time_t timeout)
+{
+	switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+	switch_mutex_lock(waiter->mutex);
+	if (waiter->seq == seq) {
+		switch_thread_cond_timedwait(waiter->cond, waiter->mutex, timeout);
+		if (waiter->seq == seq) {
+			status = SWITCH_STATUS_TIMEOUT;
+		}
+	}
+	switch_mutex_unlock(waiter->mutex);
+
+	return status;
+}
+
+SWITCH_DECLARE(void) switch_channel_set_waiter(switch_channel_t *channel, switch_channel_waiter_t *waiter)
+{
+	switch_assert(channel != NULL);
+
+	switch_mutex_lock(channel->flag_mutex);
+	channel->waiter = waiter;
+	switch_mutex_unlock(channel->flag_mutex);
+}
+
+/* poke whoever is blocked on this channel, detaching takes flag_mutex so the waiter cannot vanish under us */
+static inline void channel_wake_waiter(switch_channel_t *channel)
+{
+	if (!channel->waiter) {
+		return;
+	}
+
+	switch_mutex_lock(channel->flag_mutex);
+	if (channel->waiter) {
+		switch_channel_waiter_wake(channel->waiter);
+	}
+	switch_mutex_unlock(channel->flag_mutex);
+}
+
 SWITCH_DECLARE(switch_status_t) switch_channel_dtmf_lock(switch_channel_t *channel) 
 {
 	return switch_mutex_lock(channel->dtmf_mutex);
@@ -1642,6 +1724,8 @@ SWITCH_DECLARE(void) switch_channel_set_flag_value(switch_channel_t *channel, sw
 	channel->flags[flag] = value;
 	switch_mutex_unlock(channel->flag_mutex);
 
+	channel_wake_waiter(channel);
+
 	if (HELD) {
 		switch_hold_record_t *hr;
 		const char *brto = switch_channel_get_partner_uuid(channel);
@@ -1683,6 +1767,8 @@ SWITCH_DECLARE(void) switch_channel_set_flag_recursive(switch_channel_t *channel
 	channel->flags[flag]++;
 	switch_mutex_unlock(channel->flag_mutex);
 
+	channel_wake_waiter(channel);
+
 	if (flag == CF_OUTBOUND) {
 		switch_channel_set_variable(channel, "is_outbound", "true");
 	}
@@ -1804,6 +1890,8 @@ SWITCH_DECLARE(void) switch_channel_clear_flag(switch_channel_t *channel, switch
 	channel->flags[flag] = 0;
 	switch_mutex_unlock(channel->flag_mutex);
 
+	channel_wake_waiter(channel);
+
 	if (ACTIVE) {
 		switch_channel_set_callstate(channel, CCS_ACTIVE);
 		switch_mutex_lock(channel->profile_mutex);
@@ -2071,6 +2159,8 @@ SWITCH_DECLARE(switch_channel_state_t) switch_channel_perform_set_running_state(
 
 	switch_mutex_unlock(channel->state_mutex);
 
+	channel_wake_waiter(channel);
+
 	return (switch_channel_state_t) SWITCH_STATUS_SUCCESS;
 }
 
@@ -2292,6 +2382,11 @@ SWITCH_DECLARE(switch_channel_state_t) switch_channel_perform_set_state(switch_c
   done:
 
 	switch_mutex_unlock(channel->state_mutex);
+
+	if (ok) {
+		channel_wake_waiter(channel);
+	}
+
 	return channel->state;
 }
 
@@ -3014,14 +3109,17 @@ SWITCH_DECLARE(switch_channel_state_t) switch_channel_perform_hangup(switch_chan
 		}
 		switch_mutex_unlock(channel->profile_mutex);
 
+		/* the cause goes in with the state so a waiter woken by CS_HANGUP never reads a stale one */
 		switch_mutex_lock(channel->state_mutex);
 		last_state = channel->state;
+		channel->hangup_cause = hangup_cause;
 		channel->state = CS_HANGUP;
 		switch_mutex_unlock(channel->state_mutex);
 
+		channel_wake_waiter(channel);
+
 
 		switch_channel_set_callstate(channel, CCS_HANGUP);
-		channel->hangup_cause = hangup_cause;
 		switch_log_printf(SWITCH_CHANNEL_ID_LOG, file, func, line, switch_channel_get_uuid(channel), SWITCH_LOG_NOTICE, "Hangup %s [%s] [%s]\n",
 						  channel->name, state_names[last_state], switch_channel_cause2str(channel->hangup_cause));
 
@@ -1532,6 +1532,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_init(switch_core_flag_t flags, switc
 
 	runtime.max_db_handles = 50;
 	runtime.db_handle_timeout = 5000000;
+	runtime.user_cache_max = 10000;
 	
 	runtime.runlevel++;
 	runtime.dummy_cng_frame.data = runtime.dummy_data;
@@ -1825,6 +1826,18 @@ static void switch_load_core_config(const char *file)
 						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "db-handle-timeout must be between 1 and 5000\n");
 					}
 					
+				} else if (!strcasecmp(var, "user-cache-ttl")) {
+					int tmp = atoi(val);
+					runtime.user_cache_ttl = tmp > 0 ? (uint32_t) tmp : 0;
+				} else if (!strcasecmp(var, "user-cache-negative-ttl")) {
+					int tmp = atoi(val);
+					runtime.user_cache_negative_ttl = tmp > 0 ? (uint32_t) tmp : 0;
+				} else if (!strcasecmp(var, "user-cache-stale-ttl")) {
+					int tmp = atoi(val);
+					runtime.user_cache_stale_ttl = tmp > 0 ? (uint32_t) tmp : 0;
+				} else if (!strcasecmp(var, "user-cache-max-entries")) {
+					int tmp = atoi(val);
+					runtime.user_cache_max = tmp > 0 ? (uint32_t) tmp : 0;
 				} else if (!strcasecmp(var, "multiple-registrations")) {
 					runtime.multiple_registrations = switch_true(val);
 				} else if (!strcasecmp(var, "auto-create-schemas")) {
@@ -34,14 +34,335 @@
 
 #include <switch.h>
 #include "private/switch_core_pvt.h"
-#include <sqlite3.h>
-#include "../../../libs/sqlite/src/hash.h"
+
+/*
+  Open addressing hash table with robin hood probing.
+
+  The bucket array only holds the full 32 bit hash and a pointer to the entry so a probe
+  compares hashes without touching the entries and stops as soon as it passes a bucket
+  closer to its home slot than the key would be.  Deletes use backward shifting so there
+  are no tombstones.
+
+  Entries are carved out of chunks that never move and are threaded on a list in insertion
+  order, so iteration is stable across inserts and table growth and an entry removed while
+  iterating still points at the one after it.  Short keys are stored inside the entry so the
+  common case (uuids, names) needs no allocation beyond the chunk.
+
+  The iterator type remains struct HashElem for the sake of existing bindings.
+*/
+
+#define SWITCH_HASH_INITIAL_BUCKETS 16
+#define SWITCH_HASH_FIRST_CHUNK 8
+#define SWITCH_HASH_MAX_CHUNK 256
+#define SWITCH_HASH_INLINE_KEY 40
+
+typedef struct HashElem switch_hash_entry_t;
+
+struct HashElem {
+	switch_hash_entry_t *next;
+	switch_hash_entry_t *prev;
+	char *key;
+	void *val;
+	uint32_t hash;
+	uint32_t klen;
+	char ikey[SWITCH_HASH_INLINE_KEY];
+};
+
+typedef struct switch_hash_bucket {
+	switch_hash_entry_t *entry;
+	uint32_t hash;
+} switch_hash_bucket_t;
+
+typedef struct switch_hash_chunk {
+	struct switch_hash_chunk *next;
+	uint32_t size;
+	uint32_t used;
+	switch_hash_entry_t entries[1];
+} switch_hash_chunk_t;
 
 struct switch_hash {
-	Hash table;
+	switch_hash_bucket_t *buckets;
+	uint32_t mask;
+	uint32_t count;
+	switch_hash_entry_t *head;
+	switch_hash_entry_t *tail;
+	switch_hash_entry_t *free_list;
+	switch_hash_chunk_t *chunks;
+	switch_bool_t case_sensitive;
 	switch_memory_pool_t *pool;
 };
 
+static inline unsigned char hash_fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (unsigned char) (c + ('a' - 'A')) : c;
+}
+
+/* FNV-1a over the key, measuring it on the way so callers never need a separate strlen */
+static inline uint32_t hash_key(switch_hash_t *hash, const char *key, uint32_t *klen)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	uint32_t h = 2166136261U;
+
+	if (hash->case_sensitive) {
+		for (; *p; p++) {
+			h = (h ^ *p) * 16777619U;
+		}
+	} else {
+		for (; *p; p++) {
+			h = (h ^ hash_fold(*p)) * 16777619U;
+		}
+	}
+
+	*klen = (uint32_t) (p - (const unsigned char *) key);
+
+	return h;
+}
+
+static inline int hash_key_eq(switch_hash_t *hash, switch_hash_entry_t *entry, const char *key, uint32_t klen)
+{
+	const unsigned char *a, *b;
+
+	if (entry->klen != klen) {
+		return 0;
+	}
+
+	if (hash->case_sensitive) {
+		return !memcmp(entry->key, key, klen);
+	}
+
+	for (a = (const unsigned char *) entry->key, b = (const unsigned char *) key; *b; a++, b++) {
+		if (hash_fold(*a) != hash_fold(*b)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static inline uint32_t hash_probe_dist(switch_hash_t *hash, uint32_t h, uint32_t idx)
+{
+	return (idx - (h & hash->mask)) & hash->mask;
+}
+
+static int32_t hash_lookup(switch_hash_t *hash, const char *key, uint32_t h, uint32_t klen)
+{
+	uint32_t idx, dist = 0;
+
+	if (!hash->buckets) {
+		return -1;
+	}
+
+	for (idx = h & hash->mask;; idx = (idx + 1) & hash->mask, dist++) {
+		switch_hash_bucket_t *b = &hash->buckets[idx];
+
+		if (!b->entry || hash_probe_dist(hash, b->hash, idx) < dist) {
+			return -1;
+		}
+
+		if (b->hash == h && hash_key_eq(hash, b->entry, key, klen)) {
+			return (int32_t) idx;
+		}
+	}
+}
+
+/* place an entry known not to be in the table, displacing richer buckets on the way */
+static void hash_place(switch_hash_t *hash, switch_hash_entry_t *entry, uint32_t h)
+{
+	switch_hash_bucket_t cur, tmp;
+	uint32_t idx, dist = 0, d;
+
+	cur.entry = entry;
+	cur.hash = h;
+
+	for (idx = h & hash->mask;; idx = (idx + 1) & hash->mask, dist++) {
+		switch_hash_bucket_t *b = &hash->buckets[idx];
+
+		if (!b->entry) {
+			*b = cur;
+			return;
+		}
+
+		if ((d = hash_probe_dist(hash, b->hash, idx)) < dist) {
+			tmp = *b;
+			*b = cur;
+			cur = tmp;
+			dist = d;
+		}
+	}
+}
+
+static void hash_resize(switch_hash_t *hash, uint32_t size)
+{
+	switch_hash_entry_t *entry;
+
+	switch_safe_free(hash->buckets);
+	switch_zmalloc(hash->buckets, size * sizeof(switch_hash_bucket_t));
+	hash->mask = size - 1;
+
+	for (entry = hash->head; entry; entry = entry->next) {
+		hash_place(hash, entry, entry->hash);
+	}
+}
+
+static switch_hash_entry_t *hash_entry_alloc(switch_hash_t *hash)
+{
+	switch_hash_entry_t *entry;
+	switch_hash_chunk_t *chunk = hash->chunks;
+
+	if ((entry = hash->free_list)) {
+		hash->free_list = entry->prev;
+		return entry;
+	}
+
+	if (!chunk || chunk->used == chunk->size) {
+		uint32_t size = chunk ? chunk->size * 2 : SWITCH_HASH_FIRST_CHUNK;
+
+		if (size > SWITCH_HASH_MAX_CHUNK) {
+			size = SWITCH_HASH_MAX_CHUNK;
+		}
+
+		switch_zmalloc(chunk, sizeof(*chunk) + (size - 1) * sizeof(switch_hash_entry_t));
+		chunk->size = size;
+		chunk->next = hash->chunks;
+		hash->chunks = chunk;
+	}
+
+	return &chunk->entries[chunk->used++];
+}
+
+static void hash_entry_free(switch_hash_t *hash, switch_hash_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		hash->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		hash->tail = entry->prev;
+	}
+
+	if (entry->key != entry->ikey) {
+		free(entry->key);
+	}
+
+	/* next is left alone so an iterator parked on this entry can still move on */
+	entry->ikey[0] = '\0';
+	entry->key = entry->ikey;
+	entry->klen = 0;
+	entry->val = NULL;
+	entry->prev = hash->free_list;
+	hash->free_list = entry;
+}
+
+static void hash_remove(switch_hash_t *hash, const char *key)
+{
+	uint32_t klen, h = hash_key(hash, key, &klen), next;
+	switch_hash_entry_t *entry;
+	int32_t pos;
+	uint32_t idx;
+
+	if ((pos = hash_lookup(hash, key, h, klen)) < 0) {
+		return;
+	}
+
+	idx = (uint32_t) pos;
+	entry = hash->buckets[idx].entry;
+
+	/* shift the rest of the cluster back one slot */
+	for (;;) {
+		switch_hash_bucket_t *nb;
+
+		next = (idx + 1) & hash->mask;
+		nb = &hash->buckets[next];
+
+		if (!nb->entry || hash_probe_dist(hash, nb->hash, next) == 0) {
+			hash->buckets[idx].entry = NULL;
+			hash->buckets[idx].hash = 0;
+			break;
+		}
+
+		hash->buckets[idx] = *nb;
+		idx = next;
+	}
+
+	hash->count--;
+	hash_entry_free(hash, entry);
+}
+
+static void hash_set(switch_hash_t *hash, const char *key, const void *data)
+{
+	uint32_t klen, h;
+	int32_t pos;
+	switch_hash_entry_t *entry;
+
+	/* storing NULL has always meant removing the key */
+	if (!data) {
+		hash_remove(hash, key);
+		return;
+	}
+
+	h = hash_key(hash, key, &klen);
+
+	if ((pos = hash_lookup(hash, key, h, klen)) >= 0) {
+		hash->buckets[pos].entry->val = (void *) data;
+		return;
+	}
+
+	if (!hash->buckets) {
+		hash_resize(hash, SWITCH_HASH_INITIAL_BUCKETS);
+	} else if ((hash->count + 1) * 8 > (hash->mask + 1) * 7) {
+		hash_resize(hash, (hash->mask + 1) * 2);
+	}
+
+	entry = hash_entry_alloc(hash);
+
+	if (klen < SWITCH_HASH_INLINE_KEY) {
+		entry->key = entry->ikey;
+	} else {
+		switch_malloc(entry->key, klen + 1);
+	}
+
+	memcpy(entry->key, key, klen + 1);
+	entry->klen = klen;
+	entry->hash = h;
+	entry->val = (void *) data;
+
+	entry->next = NULL;
+	entry->prev = hash->tail;
+
+	if (hash->tail) {
+		hash->tail->next = entry;
+	} else {
+		hash->head = entry;
+	}
+
+	hash->tail = entry;
+	hash->count++;
+
+	hash_place(hash, entry, h);
+}
+
+static void *hash_get(switch_hash_t *hash, const char *key)
+{
+	uint32_t klen, h;
+	int32_t pos;
+
+	if (!hash->count) {
+		return NULL;
+	}
+
+	h = hash_key(hash, key, &klen);
+
+	if ((pos = hash_lookup(hash, key, h, klen)) < 0) {
+		return NULL;
+	}
+
+	return hash->buckets[pos].entry->val;
+}
+
 SWITCH_DECLARE(switch_status_t) switch_core_hash_init_case(switch_hash_t **hash, switch_memory_pool_t *pool, switch_bool_t case_sensitive)
 {
 	switch_hash_t *newhash;
@@ -55,7 +376,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_init_case(switch_hash_t **hash,
 
 	switch_assert(newhash);
 
-	sqlite3HashInit(&newhash->table, case_sensitive ? SQLITE_HASH_BINARY : SQLITE_HASH_STRING, 1);
+	newhash->case_sensitive = case_sensitive;
 	*hash = newhash;
 
 	return SWITCH_STATUS_SUCCESS;
@@ -63,11 +384,28 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_init_case(switch_hash_t **hash,
 
 SWITCH_DECLARE(switch_status_t) switch_core_hash_destroy(switch_hash_t **hash)
 {
+	switch_hash_entry_t *entry;
+	switch_hash_chunk_t *chunk, *next;
+
 	switch_assert(hash != NULL && *hash != NULL);
-	sqlite3HashClear(&(*hash)->table);
+
+	for (entry = (*hash)->head; entry; entry = entry->next) {
+		if (entry->key != entry->ikey) {
+			free(entry->key);
+		}
+	}
+
+	for (chunk = (*hash)->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	switch_safe_free((*hash)->buckets);
 
 	if (!(*hash)->pool) {
 		free(*hash);
+	} else {
+		memset(*hash, 0, sizeof(**hash));
 	}
 
 	*hash = NULL;
@@ -77,7 +415,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_destroy(switch_hash_t **hash)
 
 SWITCH_DECLARE(switch_status_t) switch_core_hash_insert(switch_hash_t *hash, const char *key, const void *data)
 {
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, (void *) data);
+	hash_set(hash, key, data);
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -87,7 +425,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_insert_locked(switch_hash_t *ha
 		switch_mutex_lock(mutex);
 	}
 
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, (void *) data);
+	hash_set(hash, key, data);
 
 	if (mutex) {
 		switch_mutex_unlock(mutex);
@@ -102,7 +440,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_insert_wrlock(switch_hash_t *ha
 		switch_thread_rwlock_wrlock(rwlock);
 	}
 
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, (void *) data);
+	hash_set(hash, key, data);
 
 	if (rwlock) {
 		switch_thread_rwlock_unlock(rwlock);
@@ -113,7 +451,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_insert_wrlock(switch_hash_t *ha
 
 SWITCH_DECLARE(switch_status_t) switch_core_hash_delete(switch_hash_t *hash, const char *key)
 {
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, NULL);
+	hash_remove(hash, key);
 	return SWITCH_STATUS_SUCCESS;
 }
 
@@ -123,7 +461,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_delete_locked(switch_hash_t *ha
 		switch_mutex_lock(mutex);
 	}
 
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, NULL);
+	hash_remove(hash, key);
 
 	if (mutex) {
 		switch_mutex_unlock(mutex);
@@ -138,7 +476,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_delete_wrlock(switch_hash_t *ha
 		switch_thread_rwlock_wrlock(rwlock);
 	}
 
-	sqlite3HashInsert(&hash->table, key, (int) strlen(key) + 1, NULL);
+	hash_remove(hash, key);
 
 	if (rwlock) {
 		switch_thread_rwlock_unlock(rwlock);
@@ -185,7 +523,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_hash_delete_multi(switch_hash_t *has
 
 SWITCH_DECLARE(void *) switch_core_hash_find(switch_hash_t *hash, const char *key)
 {
-	return sqlite3HashFind(&hash->table, key, (int) strlen(key) + 1);
+	return hash_get(hash, key);
 }
 
 SWITCH_DECLARE(void *) switch_core_hash_find_locked(switch_hash_t *hash, const char *key, switch_mutex_t *mutex)
@@ -196,7 +534,7 @@ SWITCH_DECLARE(void *) switch_core_hash_find_locked(switch_hash_t *hash, const c
 		switch_mutex_lock(mutex);
 	}
 
-	val = sqlite3HashFind(&hash->table, key, (int) strlen(key) + 1);
+	val = hash_get(hash, key);
 
 	if (mutex) {
 		switch_mutex_unlock(mutex);
@@ -213,7 +551,7 @@ SWITCH_DECLARE(void *) switch_core_hash_find_rdlock(switch_hash_t *hash, const c
 		switch_thread_rwlock_rdlock(rwlock);
 	}
 
-	val = sqlite3HashFind(&hash->table, key, (int) strlen(key) + 1);
+	val = hash_get(hash, key);
 
 	if (rwlock) {
 		switch_thread_rwlock_unlock(rwlock);
@@ -224,24 +562,24 @@ SWITCH_DECLARE(void *) switch_core_hash_find_rdlock(switch_hash_t *hash, const c
 
 SWITCH_DECLARE(switch_hash_index_t *) switch_core_hash_first(switch_hash_t *hash)
 {
-	return (switch_hash_index_t *) sqliteHashFirst(&hash->table);
+	return hash->head;
 }
 
 SWITCH_DECLARE(switch_hash_index_t *) switch_core_hash_next(switch_hash_index_t *hi)
 {
-	return (switch_hash_index_t *) sqliteHashNext((HashElem *) hi);
+	return hi->next;
 }
 
 SWITCH_DECLARE(void) switch_core_hash_this(switch_hash_index_t *hi, const void **key, switch_ssize_t *klen, void **val)
 {
 	if (key) {
-		*key = sqliteHashKey((HashElem *) hi);
+		*key = hi->key;
 		if (klen) {
-			*klen = strlen((char *) *key) + 1;
+			*klen = hi->klen + 1;
 		}
 	}
 	if (val) {
-		*val = sqliteHashData((HashElem *) hi);
+		*val = hi->val;
 	}
 }
 
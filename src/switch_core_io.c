@@ -674,43 +674,54 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_read_frame(switch_core_sessi
 			switch_media_bug_t *bp;
 			switch_bool_t ok = SWITCH_TRUE;
 			int prune = 0;
+			uint64_t mark;
+
 			switch_thread_rwlock_rdlock(session->bug_rwlock);
 
+			/* listen-only bugs share one copy of the frame in the tap hub, the rest get their own below */
+			mark = switch_core_media_bug_tap_feed(session, SMBF_READ_STREAM, read_frame->data, read_frame->datalen);
+
 			for (bp = session->bugs; bp; bp = bp->next) {
 				if (switch_channel_test_flag(session->channel, CF_PAUSE_BUGS) && !switch_core_media_bug_test_flag(bp, SMBF_NO_PAUSE)) {
+					switch_core_media_bug_tap_skip(bp, SMBF_READ_STREAM, mark);
 					continue;
 				}
 
 				if (!switch_channel_test_flag(session->channel, CF_ANSWERED) && switch_core_media_bug_test_flag(bp, SMBF_ANSWER_REQ)) {
+					switch_core_media_bug_tap_skip(bp, SMBF_READ_STREAM, mark);
 					continue;
 				}
 
 				if (!switch_channel_test_flag(session->channel, CF_BRIDGED) && switch_core_media_bug_test_flag(bp, SMBF_BRIDGE_REQ)) {
+					switch_core_media_bug_tap_skip(bp, SMBF_READ_STREAM, mark);
 					continue;
 				}
 
 				if (switch_test_flag(bp, SMBF_PRUNE)) {
+					switch_core_media_bug_tap_skip(bp, SMBF_READ_STREAM, mark);
 					prune++;
 					continue;
 				}
 
-				if (ok && bp->ready && switch_test_flag(bp, SMBF_READ_STREAM)) {
-					switch_mutex_lock(bp->read_mutex);
-					if (bp->read_demux_frame) {
+				if (!(ok && bp->ready)) {
+					switch_core_media_bug_tap_skip(bp, SMBF_READ_STREAM, mark);
+				} else if (switch_test_flag(bp, SMBF_READ_STREAM)) {
+					if (!bp->raw_read_buffer) {
+						/* already fed through the tap hub */
+					} else if (bp->read_demux_frame) {
 						uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
 						int bytes = read_frame->datalen / 2;
 
 						memcpy(data, read_frame->data, read_frame->datalen);
 						switch_unmerge_sln((int16_t *)data, bytes, bp->read_demux_frame->data, bytes);
-						switch_buffer_write(bp->raw_read_buffer, data, read_frame->datalen);
+						switch_core_media_bug_ring_write(bp->raw_read_buffer, data, read_frame->datalen);
 					} else {
-						switch_buffer_write(bp->raw_read_buffer, read_frame->data, read_frame->datalen);
+						switch_core_media_bug_ring_write(bp->raw_read_buffer, read_frame->data, read_frame->datalen);
 					}
 
-					if (bp->callback) {
+					if (bp->callback && switch_core_media_bug_batch_ready(bp, SWITCH_ABC_TYPE_READ)) {
 						ok = bp->callback(bp, bp->user_data, SWITCH_ABC_TYPE_READ);
 					}
-					switch_mutex_unlock(bp->read_mutex);
 				}
 
 				if ((bp->stop_time && bp->stop_time <= switch_epoch_time_now(NULL)) || ok == SWITCH_FALSE) {
@@ -861,8 +872,8 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_read_frame(switch_core_sessi
 				}
 
 				if (bp->ready && switch_test_flag(bp, SMBF_READ_PING)) {
-					switch_mutex_lock(bp->read_mutex);
 					bp->ping_frame = *frame;
+					/* never batched, the callback only sees ping_frame while it is this frame */
 					if (bp->callback) {
 						if (bp->callback(bp, bp->user_data, SWITCH_ABC_TYPE_READ_PING) == SWITCH_FALSE
 							|| (bp->stop_time && bp->stop_time <= switch_epoch_time_now(NULL))) {
@@ -870,7 +881,6 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_read_frame(switch_core_sessi
 						}
 					}
 					bp->ping_frame = NULL;;
-					switch_mutex_unlock(bp->read_mutex);
 				}
 
 				if (ok == SWITCH_FALSE) {
@@ -1210,33 +1220,45 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_write_frame(switch_core_sess
 	if (session->bugs) {
 		switch_media_bug_t *bp;
 		int prune = 0;
+		uint64_t mark;
 
 		switch_thread_rwlock_rdlock(session->bug_rwlock);
+
+		/* 
+		   the tap hub takes the frame as it arrives, before any write-replace bug below rewrites it; its subscribers
+		   are always ahead of every write-replace bug in the list (see tap_write_to_private) so that is what they would hear
+		*/
+		mark = switch_core_media_bug_tap_feed(session, SMBF_WRITE_STREAM, write_frame->data, write_frame->datalen);
+
 		for (bp = session->bugs; bp; bp = bp->next) {
 			switch_bool_t ok = SWITCH_TRUE;
 			if (!bp->ready) {
+				switch_core_media_bug_tap_skip(bp, SMBF_WRITE_STREAM, mark);
 				continue;
 			}
 
 			if (switch_channel_test_flag(session->channel, CF_PAUSE_BUGS) && !switch_core_media_bug_test_flag(bp, SMBF_NO_PAUSE)) {
+				switch_core_media_bug_tap_skip(bp, SMBF_WRITE_STREAM, mark);
 				continue;
 			}
 
 			if (!switch_channel_test_flag(session->channel, CF_ANSWERED) && switch_core_media_bug_test_flag(bp, SMBF_ANSWER_REQ)) {
+				switch_core_media_bug_tap_skip(bp, SMBF_WRITE_STREAM, mark);
 				continue;
 			}
 
 			if (switch_test_flag(bp, SMBF_PRUNE)) {
+				switch_core_media_bug_tap_skip(bp, SMBF_WRITE_STREAM, mark);
 				prune++;
 				continue;
 			}
 
 			if (switch_test_flag(bp, SMBF_WRITE_STREAM)) {
-				switch_mutex_lock(bp->write_mutex);
-				switch_buffer_write(bp->raw_write_buffer, write_frame->data, write_frame->datalen);
-				switch_mutex_unlock(bp->write_mutex);
+				if (bp->raw_write_buffer) {
+					switch_core_media_bug_ring_write(bp->raw_write_buffer, write_frame->data, write_frame->datalen);
+				}
 				
-				if (bp->callback) {
+				if (bp->callback && switch_core_media_bug_batch_ready(bp, SWITCH_ABC_TYPE_WRITE)) {
 					ok = bp->callback(bp, bp->user_data, SWITCH_ABC_TYPE_WRITE);
 				}
 			}
@@ -35,18 +35,555 @@
 #include "switch.h"
 #include "private/switch_core_pvt.h"
 
-static void switch_core_media_bug_destroy(switch_media_bug_t *bug)
+#define MAX_BUG_BUFFER 1024 * 512
+
+#if defined(_MSC_VER)
+#define bug_ring_barrier() MemoryBarrier()
+#define bug_reader_enter(_bug) (InterlockedCompareExchange((volatile LONG *) &(_bug)->reader, 1, 0) == 0)
+#elif defined(__GNUC__)
+#define bug_ring_barrier() __sync_synchronize()
+#define bug_reader_enter(_bug) __sync_bool_compare_and_swap(&(_bug)->reader, 0, 1)
+#else
+#define bug_ring_barrier()
+#define bug_reader_enter(_bug) (!(_bug)->reader && ((_bug)->reader = 1))
+#endif
+#define bug_reader_leave(_bug) do { bug_ring_barrier(); (_bug)->reader = 0; } while(0)
+
+/* rings live on the heap, not the session pool, so a call that keeps adding and removing bugs gives the memory back */
+static switch_media_bug_ring_t *bug_ring_create(switch_size_t bytes)
 {
-	switch_event_t *event = NULL;
+	switch_media_bug_ring_t *ring;
+	uint32_t size = 1024;
+
+	switch_zmalloc(ring, sizeof(*ring));
+
+	if (!bytes) {
+		bytes = SWITCH_RECOMMENDED_BUFFER_SIZE;
+	}
+
+	/* room for the same backlog the old dynamic buffers were allowed to grow to before dropping audio */
+	while (size < bytes * SWITCH_BUFFER_START_FRAMES * 4 && size < MAX_BUG_BUFFER) {
+		size <<= 1;
+	}
+
+	ring->size = size;
+	switch_zmalloc(ring->data, size);
+
+	return ring;
+}
+
+static void bug_ring_destroy(switch_media_bug_ring_t **ring)
+{
+	if (*ring) {
+		free((*ring)->data);
+		free(*ring);
+		*ring = NULL;
+	}
+}
+
+/* producer side, a frame that does not fit is dropped whole just like a full switch_buffer */
+uint32_t switch_core_media_bug_ring_write(switch_media_bug_ring_t *ring, const void *data, uint32_t datalen)
+{
+	uint32_t head = ring->head, tail, off, chunk;
 
-	if (bug->raw_read_buffer) {
-		switch_buffer_destroy(&bug->raw_read_buffer);
+	tail = ring->tail;
+	bug_ring_barrier();
+
+	if (ring->size - (head - tail) < datalen) {
+		return 0;
 	}
 
-	if (bug->raw_write_buffer) {
-		switch_buffer_destroy(&bug->raw_write_buffer);
+	off = head & (ring->size - 1);
+	chunk = ring->size - off;
+
+	if (chunk > datalen) {
+		chunk = datalen;
 	}
 
+	memcpy(ring->data + off, data, chunk);
+	if (datalen > chunk) {
+		memcpy(ring->data, (const uint8_t *) data + chunk, datalen - chunk);
+	}
+
+	bug_ring_barrier();
+	ring->head = head + datalen;
+
+	return datalen;
+}
+
+static uint32_t bug_ring_inuse(switch_media_bug_ring_t *ring)
+{
+	uint32_t head = ring->head;
+
+	bug_ring_barrier();
+
+	return head - ring->tail;
+}
+
+/* 
+   consumer side, apply a flush requested by bug_ring_zero.  Only the consumer ever moves tail, so a flush
+   from the media thread or anywhere else can not tear the index under a read in progress.
+*/
+static void bug_ring_apply_flush(switch_media_bug_ring_t *ring)
+{
+	uint32_t req = ring->flush_req, to;
+
+	if (req == ring->flush_seen) {
+		return;
+	}
+
+	bug_ring_barrier();
+	to = ring->flush_to;
+	ring->flush_seen = req;
+
+	/* never rewind, a mark older than what was already read is simply stale */
+	if (to - ring->tail <= ring->head - ring->tail) {
+		ring->tail = to;
+	}
+}
+
+static uint32_t bug_ring_read(switch_media_bug_ring_t *ring, uint8_t *data, switch_size_t len)
+{
+	uint32_t tail, inuse, off, chunk;
+
+	bug_ring_apply_flush(ring);
+
+	tail = ring->tail;
+	inuse = bug_ring_inuse(ring);
+
+	if (len > inuse) {
+		len = inuse;
+	}
+
+	off = tail & (ring->size - 1);
+	chunk = ring->size - off;
+
+	if (chunk > len) {
+		chunk = (uint32_t) len;
+	}
+
+	memcpy(data, ring->data + off, chunk);
+	if (len > chunk) {
+		memcpy(data + chunk, ring->data, len - chunk);
+	}
+
+	bug_ring_barrier();
+	ring->tail = tail + (uint32_t) len;
+
+	return (uint32_t) len;
+}
+
+/* any thread, everything queued so far is discarded the next time the consumer looks at the ring */
+static void bug_ring_zero(switch_media_bug_ring_t *ring)
+{
+	ring->flush_to = ring->head;
+	bug_ring_barrier();
+	ring->flush_req++;
+}
+
+static void tap_stream_write(switch_media_tap_stream_t *ts, const uint8_t *data, uint64_t len)
+{
+	uint64_t off = ts->head % ts->size, chunk = ts->size - off;
+
+	if (len > ts->size) {
+		data += len - ts->size;
+		ts->head += len - ts->size;
+		len = ts->size;
+		off = ts->head % ts->size;
+		chunk = ts->size - off;
+	}
+
+	if (chunk > len) {
+		chunk = len;
+	}
+
+	memcpy(ts->data + off, data, (size_t) chunk);
+	if (len > chunk) {
+		memcpy(ts->data, data + chunk, (size_t) (len - chunk));
+	}
+
+	ts->head += len;
+}
+
+/* room for the same backlog a private buffer gets for frames of this size */
+static uint64_t tap_stream_size(uint64_t frame_bytes)
+{
+	if (!frame_bytes) {
+		frame_bytes = SWITCH_RECOMMENDED_BUFFER_SIZE;
+	}
+
+	return frame_bytes * SWITCH_BUFFER_START_FRAMES * 4;
+}
+
+/* re-lay the stream in a bigger buffer, positions are absolute so every cursor stays valid */
+static void tap_stream_grow(switch_media_tap_stream_t *ts, uint64_t size)
+{
+	uint8_t *data;
+	uint64_t pos;
+
+	if (!ts->data) {
+		/* first subscriber since the stream was released, nothing older than head is held */
+		switch_zmalloc(ts->data, (switch_size_t) size);
+		ts->size = size;
+		ts->floor = ts->head;
+		return;
+	}
+
+	if (size <= ts->size) {
+		return;
+	}
+
+	/* grow at least twofold so a codec change costs a handful of reallocations at most */
+	if (size < ts->size * 2) {
+		size = ts->size * 2;
+	}
+
+	switch_zmalloc(data, (switch_size_t) size);
+
+	for (pos = ts->head > ts->size ? ts->head - ts->size : 0; pos < ts->head; pos++) {
+		data[pos % size] = ts->data[pos % ts->size];
+	}
+
+	/* what the old buffer had already overwritten stays lost, cursors behind it must not read the zeroes */
+	if (ts->head > ts->size && ts->head - ts->size > ts->floor) {
+		ts->floor = ts->head - ts->size;
+	}
+
+	free(ts->data);
+	ts->data = data;
+	ts->size = size;
+}
+
+/* the last subscriber left, give the buffer back until somebody subscribes again */
+static void tap_stream_release(switch_media_tap_stream_t *ts)
+{
+	switch_safe_free(ts->data);
+	ts->size = 0;
+}
+
+/* a cursor never rests inside a gap, it jumps to the end of any gap it reaches and forgets the ones behind it */
+static void tap_gaps_skip(switch_media_tap_gaps_t *gaps, uint64_t *pos)
+{
+	uint32_t x;
+
+	while (gaps->count && gaps->start[0] <= *pos) {
+		if (gaps->end[0] > *pos) {
+			*pos = gaps->end[0];
+		}
+
+		for (x = 1; x < gaps->count; x++) {
+			gaps->start[x - 1] = gaps->start[x];
+			gaps->end[x - 1] = gaps->end[x];
+		}
+
+		gaps->count--;
+	}
+}
+
+static switch_size_t tap_stream_inuse(switch_media_tap_stream_t *ts, uint64_t *pos, switch_media_tap_gaps_t *gaps)
+{
+	uint64_t inuse;
+	uint32_t x;
+
+	if (ts->head - *pos > ts->size) {
+		/* the subscriber fell a whole ring behind, the oldest audio is gone */
+		*pos = ts->head - ts->size;
+	}
+
+	if (*pos < ts->floor) {
+		*pos = ts->floor;
+	}
+
+	tap_gaps_skip(gaps, pos);
+
+	inuse = ts->head - *pos;
+
+	for (x = 0; x < gaps->count; x++) {
+		inuse -= gaps->end[x] - gaps->start[x];
+	}
+
+	return (switch_size_t) inuse;
+}
+
+static switch_size_t tap_stream_read(switch_media_tap_stream_t *ts, uint64_t *pos, switch_media_tap_gaps_t *gaps, uint8_t *data, switch_size_t len)
+{
+	switch_size_t inuse = tap_stream_inuse(ts, pos, gaps), done = 0;
+
+	if (len > inuse) {
+		len = inuse;
+	}
+
+	while (done < len) {
+		uint64_t stop = gaps->count ? gaps->start[0] : ts->head;
+		uint64_t want = len - done, off, chunk;
+
+		if (want > stop - *pos) {
+			want = stop - *pos;
+		}
+
+		off = *pos % ts->size;
+		chunk = ts->size - off;
+
+		if (chunk > want) {
+			chunk = want;
+		}
+
+		memcpy(data + done, ts->data + off, (size_t) chunk);
+		if (want > chunk) {
+			memcpy(data + done + chunk, ts->data, (size_t) (want - chunk));
+		}
+
+		*pos += want;
+		done += (switch_size_t) want;
+
+		tap_gaps_skip(gaps, pos);
+	}
+
+	return len;
+}
+
+static switch_media_tap_stream_t *tap_stream(switch_media_bug_t *bug, switch_media_bug_flag_t stream, uint64_t **pos, switch_media_tap_gaps_t **gaps)
+{
+	if (stream == SMBF_READ_STREAM) {
+		*pos = &bug->tap_read_pos;
+		*gaps = &bug->tap_read_gaps;
+		return bug->tap_read ? &bug->session->tap->read : NULL;
+	}
+
+	*pos = &bug->tap_write_pos;
+	*gaps = &bug->tap_write_gaps;
+	return bug->tap_write ? &bug->session->tap->write : NULL;
+}
+
+/* only the consumer may apply a posted flush to the ring, anyone else gets what is buffered before it */
+static switch_size_t bug_stream_inuse(switch_media_bug_t *bug, switch_media_bug_flag_t stream, switch_bool_t consumer)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+	switch_size_t inuse;
+
+	if ((ts = tap_stream(bug, stream, &pos, &gaps))) {
+		switch_mutex_lock(bug->session->tap->mutex);
+		inuse = tap_stream_inuse(ts, pos, gaps);
+		switch_mutex_unlock(bug->session->tap->mutex);
+	} else if (stream == SMBF_READ_STREAM) {
+		if (bug->raw_read_buffer) {
+			if (consumer) {
+				bug_ring_apply_flush(bug->raw_read_buffer);
+			}
+			inuse = bug_ring_inuse(bug->raw_read_buffer);
+		} else {
+			inuse = 0;
+		}
+	} else if (bug->raw_write_buffer) {
+		if (consumer) {
+			bug_ring_apply_flush(bug->raw_write_buffer);
+		}
+		inuse = bug_ring_inuse(bug->raw_write_buffer);
+	} else {
+		inuse = 0;
+	}
+
+	return inuse;
+}
+
+static switch_size_t bug_stream_read(switch_media_bug_t *bug, switch_media_bug_flag_t stream, void *data, switch_size_t len)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+	switch_size_t bytes;
+
+	if ((ts = tap_stream(bug, stream, &pos, &gaps))) {
+		switch_mutex_lock(bug->session->tap->mutex);
+		bytes = tap_stream_read(ts, pos, gaps, data, len);
+		switch_mutex_unlock(bug->session->tap->mutex);
+	} else if (stream == SMBF_READ_STREAM) {
+		bytes = bug_ring_read(bug->raw_read_buffer, data, len);
+	} else {
+		bytes = bug_ring_read(bug->raw_write_buffer, data, len);
+	}
+
+	return bytes;
+}
+
+static void bug_stream_zero(switch_media_bug_t *bug, switch_media_bug_flag_t stream)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+
+	if ((ts = tap_stream(bug, stream, &pos, &gaps))) {
+		switch_mutex_lock(bug->session->tap->mutex);
+		*pos = ts->head;
+		gaps->count = 0;
+		switch_mutex_unlock(bug->session->tap->mutex);
+	} else if (stream == SMBF_READ_STREAM) {
+		if (bug->raw_read_buffer) {
+			bug_ring_zero(bug->raw_read_buffer);
+		}
+	} else if (bug->raw_write_buffer) {
+		bug_ring_zero(bug->raw_write_buffer);
+	}
+}
+
+/* Append one frame of a session stream to the tap hub, returns the stream position before the frame */
+uint64_t switch_core_media_bug_tap_feed(switch_core_session_t *session, switch_media_bug_flag_t stream, const void *data, uint32_t datalen)
+{
+	switch_media_tap_t *tap = session->tap;
+	switch_media_tap_stream_t *ts;
+	uint64_t mark;
+
+	if (!tap) {
+		return 0;
+	}
+
+	ts = stream == SMBF_READ_STREAM ? &tap->read : &tap->write;
+
+	switch_mutex_lock(tap->mutex);
+	mark = ts->head;
+	if (ts->subscribers) {
+		/* the codec changed to bigger frames than the hub was sized for */
+		tap_stream_grow(ts, tap_stream_size(datalen));
+		tap_stream_write(ts, data, datalen);
+	}
+	switch_mutex_unlock(tap->mutex);
+
+	return mark;
+}
+
+/* 
+   A subscriber that was not eligible for the frame fed at mark (paused, not yet answered or bridged...) must not hear it.
+   When it has no older audio queued it just jumps over the frame, otherwise the frame is remembered as a gap to skip later.
+*/
+void switch_core_media_bug_tap_skip(switch_media_bug_t *bug, switch_media_bug_flag_t stream, uint64_t mark)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+
+	if ((ts = tap_stream(bug, stream, &pos, &gaps))) {
+		switch_mutex_lock(bug->session->tap->mutex);
+		if (*pos >= mark) {
+			*pos = ts->head;
+			gaps->count = 0;
+		} else if (mark < ts->head) {
+			if (gaps->count && gaps->end[gaps->count - 1] == mark) {
+				gaps->end[gaps->count - 1] = ts->head;
+			} else if (gaps->count < SWITCH_MEDIA_TAP_MAX_GAPS) {
+				gaps->start[gaps->count] = mark;
+				gaps->end[gaps->count] = ts->head;
+				gaps->count++;
+			} else {
+				/* too many separate gaps to track, drop the backlog rather than play audio the bug should not hear */
+				*pos = ts->head;
+				gaps->count = 0;
+			}
+		}
+		switch_mutex_unlock(bug->session->tap->mutex);
+	}
+}
+
+static void tap_subscribe(switch_media_bug_t *bug, switch_media_bug_flag_t stream)
+{
+	switch_core_session_t *session = bug->session;
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+	uint64_t size = bug->read_impl.decoded_bytes_per_packet;
+
+	if (size < bug->write_impl.decoded_bytes_per_packet) {
+		size = bug->write_impl.decoded_bytes_per_packet;
+	}
+
+	size = tap_stream_size(size);
+
+	if (!session->tap) {
+		switch_media_tap_t *tap = switch_core_session_alloc(session, sizeof(*tap));
+
+		switch_mutex_init(&tap->mutex, SWITCH_MUTEX_NESTED, session->pool);
+		session->tap = tap;
+	}
+
+	switch_mutex_lock(session->tap->mutex);
+	if (stream == SMBF_READ_STREAM) {
+		bug->tap_read = 1;
+	} else {
+		bug->tap_write = 1;
+	}
+	ts = tap_stream(bug, stream, &pos, &gaps);
+	/* later bugs may run at a different rate or ptime than the one that created the hub */
+	tap_stream_grow(ts, size);
+	*pos = ts->head;
+	gaps->count = 0;
+	ts->subscribers++;
+	switch_mutex_unlock(session->tap->mutex);
+}
+
+static void tap_unsubscribe(switch_media_bug_t *bug, switch_media_bug_flag_t stream)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	uint64_t *pos;
+
+	if ((ts = tap_stream(bug, stream, &pos, &gaps))) {
+		switch_mutex_lock(bug->session->tap->mutex);
+		if (!--ts->subscribers) {
+			tap_stream_release(ts);
+		}
+		if (stream == SMBF_READ_STREAM) {
+			bug->tap_read = 0;
+		} else {
+			bug->tap_write = 0;
+		}
+		switch_mutex_unlock(bug->session->tap->mutex);
+	}
+}
+
+/* 
+   The write tap is fed before any write-replace bug runs, so it only carries the right audio for subscribers ahead of
+   every write-replace bug in the list.  New bugs go to the head of the list, so when a write-replace bug arrives the
+   subscribers already there end up behind it and must hear what it writes: move them to a private ring, backlog included.
+   Called with the bug list write locked, so the media thread is not feeding anything meanwhile.
+*/
+static void tap_write_to_private(switch_media_bug_t *bug)
+{
+	switch_media_tap_stream_t *ts;
+	switch_media_tap_gaps_t *gaps;
+	switch_media_bug_ring_t *ring;
+	uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	uint64_t *pos;
+	switch_size_t bytes;
+
+	if (!(ts = tap_stream(bug, SMBF_WRITE_STREAM, &pos, &gaps))) {
+		return;
+	}
+
+	ring = bug_ring_create(bug->write_impl.decoded_bytes_per_packet);
+
+	switch_mutex_lock(bug->session->tap->mutex);
+	while ((bytes = tap_stream_read(ts, pos, gaps, data, sizeof(data)))) {
+		switch_core_media_bug_ring_write(ring, data, (uint32_t) bytes);
+	}
+	bug->raw_write_buffer = ring;
+	bug_ring_barrier();
+	bug->tap_write = 0;
+	if (!--ts->subscribers) {
+		tap_stream_release(ts);
+	}
+	switch_mutex_unlock(bug->session->tap->mutex);
+}
+
+static void switch_core_media_bug_destroy(switch_media_bug_t *bug)
+{
+	switch_event_t *event = NULL;
+
+	tap_unsubscribe(bug, SMBF_READ_STREAM);
+	tap_unsubscribe(bug, SMBF_WRITE_STREAM);
+	bug_ring_destroy(&bug->raw_read_buffer);
+	bug_ring_destroy(&bug->raw_write_buffer);
+
 	if (switch_event_create(&event, SWITCH_EVENT_MEDIA_BUG_STOP) == SWITCH_STATUS_SUCCESS) {
 		switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Media-Bug-Function", "%s", bug->function);
 		switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Media-Bug-Target", "%s", bug->target);
@@ -133,17 +670,8 @@ SWITCH_DECLARE(void) switch_core_media_bug_flush(switch_media_bug_t *bug)
 
 	bug->record_pre_buffer_count = 0;
 
-	if (bug->raw_read_buffer) {
-		switch_mutex_lock(bug->read_mutex);
-		switch_buffer_zero(bug->raw_read_buffer);
-		switch_mutex_unlock(bug->read_mutex);
-	}
-
-	if (bug->raw_write_buffer) {
-		switch_mutex_lock(bug->write_mutex);
-		switch_buffer_zero(bug->raw_write_buffer);
-		switch_mutex_unlock(bug->write_mutex);
-	}
+	bug_stream_zero(bug, SMBF_READ_STREAM);
+	bug_stream_zero(bug, SMBF_WRITE_STREAM);
 
 	bug->record_frame_size = 0;
 	bug->record_pre_buffer_count = 0;
@@ -151,21 +679,24 @@ SWITCH_DECLARE(void) switch_core_media_bug_flush(switch_media_bug_t *bug)
 
 SWITCH_DECLARE(void) switch_core_media_bug_inuse(switch_media_bug_t *bug, switch_size_t *readp, switch_size_t *writep)
 {
+	/* a reader busy in switch_core_media_bug_read owns the rings, just look at them */
+	switch_bool_t consumer = bug_reader_enter(bug) ? SWITCH_TRUE : SWITCH_FALSE;
+
 	if (switch_test_flag(bug, SMBF_READ_STREAM)) {
-		switch_mutex_lock(bug->read_mutex);
-		*readp = bug->raw_read_buffer ? switch_buffer_inuse(bug->raw_read_buffer) : 0;
-		switch_mutex_unlock(bug->read_mutex);
+		*readp = bug_stream_inuse(bug, SMBF_READ_STREAM, consumer);
 	} else {
 		*readp = 0;
 	}
 
 	if (switch_test_flag(bug, SMBF_WRITE_STREAM)) {
-		switch_mutex_lock(bug->write_mutex);
-		*writep = bug->raw_write_buffer ? switch_buffer_inuse(bug->raw_write_buffer) : 0;
-		switch_mutex_unlock(bug->write_mutex);
+		*writep = bug_stream_inuse(bug, SMBF_WRITE_STREAM, consumer);
 	} else {
 		*writep = 0;
 	}
+
+	if (consumer) {
+		bug_reader_leave(bug);
+	}
 }
 
 SWITCH_DECLARE(switch_status_t) switch_core_media_bug_set_pre_buffer_framecount(switch_media_bug_t *bug, uint32_t framecount)
@@ -175,7 +706,49 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_set_pre_buffer_framecount(
 	return SWITCH_STATUS_SUCCESS;
 }
 
-SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *bug, switch_frame_t *frame, switch_bool_t fill)
+SWITCH_DECLARE(switch_status_t) switch_core_media_bug_set_batch_framecount(switch_media_bug_t *bug, uint32_t framecount)
+{
+	/* keep a full batch well inside the smallest ring so nothing is dropped while waiting for it */
+	if (framecount > SWITCH_BUFFER_START_FRAMES) {
+		framecount = SWITCH_BUFFER_START_FRAMES;
+	}
+
+	bug->batch_frames = framecount > 1 ? framecount : 0;
+	bug->batch_read = bug->batch_write = 0;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* called by the media threads for every frame, true once a whole batch is queued for the callback */
+switch_bool_t switch_core_media_bug_batch_ready(switch_media_bug_t *bug, switch_abc_type_t type)
+{
+	uint32_t *count;
+
+	if (!bug->batch_frames) {
+		return SWITCH_TRUE;
+	}
+
+	switch (type) {
+	case SWITCH_ABC_TYPE_READ:
+		count = &bug->batch_read;
+		break;
+	case SWITCH_ABC_TYPE_WRITE:
+		count = &bug->batch_write;
+		break;
+	default:
+		return SWITCH_TRUE;
+	}
+
+	if (++(*count) < bug->batch_frames) {
+		return SWITCH_FALSE;
+	}
+
+	*count = 0;
+
+	return SWITCH_TRUE;
+}
+
+static switch_status_t bug_read_frame(switch_media_bug_t *bug, switch_frame_t *frame)
 {
 	switch_size_t bytes = 0, datalen = 0;
 	int16_t *dp, *fp;
@@ -183,15 +756,17 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 	size_t rlen = 0;
 	size_t wlen = 0;
 	uint32_t blen;
-	switch_codec_implementation_t read_impl = { 0 };
+	uint32_t rate;
 	int16_t *tp;
 	switch_size_t do_read = 0, do_write = 0;
-	int fill_read = 0, fill_write = 0;
-
+	int fill_read = 0, fill_write = 0, tap_mix = 0;
+	uint64_t mix_read_pos = 0, mix_write_pos = 0;
+	switch_status_t status = SWITCH_STATUS_SUCCESS;
 
-	switch_core_session_get_read_impl(bug->session, &read_impl);
 
-	bytes = read_impl.decoded_bytes_per_packet;
+	/* only two fields are needed, read them off the session instead of copying the whole implementation per frame */
+	bytes = bug->session->read_impl.codec_id ? bug->session->read_impl.decoded_bytes_per_packet : 0;
+	rate = bug->session->read_impl.actual_samples_per_second;
 
 	if (frame->buflen < bytes) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_ERROR, "%s frame buffer too small!\n",
@@ -199,7 +774,7 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 		return SWITCH_STATUS_FALSE;
 	}
 
-	if ((!bug->raw_read_buffer && (!bug->raw_write_buffer || !switch_test_flag(bug, SMBF_WRITE_STREAM)))) {
+	if ((!bug->raw_read_buffer && !bug->tap_read && ((!bug->raw_write_buffer && !bug->tap_write) || !switch_test_flag(bug, SMBF_WRITE_STREAM)))) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_ERROR, 
 				"%s Buffer Error (raw_read_buffer=%p, raw_write_buffer=%p, read=%s, write=%s)\n",
 			        switch_channel_get_name(bug->session->channel),
@@ -213,15 +788,11 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 	frame->datalen = 0;
 
 	if (switch_test_flag(bug, SMBF_READ_STREAM)) {
-		switch_mutex_lock(bug->read_mutex);
-		do_read = switch_buffer_inuse(bug->raw_read_buffer);
-		switch_mutex_unlock(bug->read_mutex);
+		do_read = bug_stream_inuse(bug, SMBF_READ_STREAM, SWITCH_TRUE);
 	}
 
 	if (switch_test_flag(bug, SMBF_WRITE_STREAM)) {
-		switch_mutex_lock(bug->write_mutex);
-		do_write = switch_buffer_inuse(bug->raw_write_buffer);
-		switch_mutex_unlock(bug->write_mutex);
+		do_write = bug_stream_inuse(bug, SMBF_WRITE_STREAM, SWITCH_TRUE);
 	}
 
 	if (bug->record_frame_size && bug->record_pre_buffer_max && (do_read || do_write) && bug->record_pre_buffer_count < bug->record_pre_buffer_max) {
@@ -231,12 +802,10 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 
 	if (!bug->record_frame_size) {
 		switch_size_t frame_size;
-		switch_codec_implementation_t read_impl = { 0 };
 		//switch_codec_implementation_t other_read_impl = { 0 };
 		//switch_core_session_t *other_session;
 			
-		switch_core_session_get_read_impl(bug->session, &read_impl);
-		frame_size = read_impl.decoded_bytes_per_packet;
+		frame_size = bytes;
 		bug->record_frame_size = frame_size;
 #if 0
 		if (do_read && do_write) {			
@@ -289,33 +858,65 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 	if (do_write && do_write > SWITCH_RECOMMENDED_BUFFER_SIZE) {
 		do_write = 1280;
 	}
+
+	/* bugs reading only from the tap hub at the same positions get the same mix, so hand out the cached one */
+	if ((tap_mix = (bug->tap_read || !do_read) && (bug->tap_write || !do_write) && (bug->tap_read || bug->tap_write))) {
+		switch_media_tap_t *tap = bug->session->tap;
+		uint32_t mix_flags = bug->flags & (SMBF_STEREO | SMBF_STEREO_SWAP);
+
+		switch_mutex_lock(tap->mutex);
+		if (bug->tap_read_gaps.count || bug->tap_write_gaps.count) {
+			/* this bug skips audio other subscribers may hear, it can neither use nor seed the shared mix */
+			tap_mix = 0;
+		} else if (tap->mix_valid && tap->mix_read_pos == bug->tap_read_pos && tap->mix_write_pos == bug->tap_write_pos &&
+			tap->mix_read_len == do_read && tap->mix_write_len == do_write && tap->mix_flags == mix_flags && tap->mix_bytes == bytes) {
+			if (do_read) {
+				bug->tap_read_pos += do_read;
+			}
+			if (do_write) {
+				bug->tap_write_pos += do_write;
+			}
+			memcpy(frame->data, tap->mix_data, tap->mix_len);
+			status = tap->mix_status;
+			switch_mutex_unlock(tap->mutex);
+
+			frame->datalen = bytes;
+			frame->samples = bytes / sizeof(int16_t);
+			frame->rate = rate;
+			frame->codec = NULL;
+
+			if (status == SWITCH_STATUS_SUCCESS) {
+				memcpy(bug->session->recur_buffer, frame->data, frame->datalen);
+				bug->session->recur_buffer_len = frame->datalen;
+			}
+
+			return status;
+		}
+		mix_read_pos = bug->tap_read_pos;
+		mix_write_pos = bug->tap_write_pos;
+		switch_mutex_unlock(tap->mutex);
+	}
 	
 	if (do_read) {
-		switch_mutex_lock(bug->read_mutex);
-		frame->datalen = (uint32_t) switch_buffer_read(bug->raw_read_buffer, frame->data, do_read);
+		frame->datalen = (uint32_t) bug_stream_read(bug, SMBF_READ_STREAM, frame->data, do_read);
 		if (frame->datalen != do_read) {
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_ERROR, "Framing Error Reading!\n");
 			switch_core_media_bug_flush(bug);
-			switch_mutex_unlock(bug->read_mutex);
 			return SWITCH_STATUS_FALSE;
 		}
-		switch_mutex_unlock(bug->read_mutex);
 	} else if (fill_read) {
 		frame->datalen = bytes;
 		memset(frame->data, 255, frame->datalen);
 	}
 
 	if (do_write) {
-		switch_assert(bug->raw_write_buffer);
-		switch_mutex_lock(bug->write_mutex);
-		datalen = (uint32_t) switch_buffer_read(bug->raw_write_buffer, bug->data, do_write);
+		switch_assert(bug->raw_write_buffer || bug->tap_write);
+		datalen = (uint32_t) bug_stream_read(bug, SMBF_WRITE_STREAM, bug->data, do_write);
 		if (datalen != do_write) {
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_ERROR, "Framing Error Writing!\n");
 			switch_core_media_bug_flush(bug);
-			switch_mutex_unlock(bug->write_mutex);
 			return SWITCH_STATUS_FALSE;
 		}
-		switch_mutex_unlock(bug->write_mutex);
 	} else if (fill_write) {
 		datalen = bytes;
 		memset(bug->data, 255, datalen);
@@ -382,15 +983,35 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 
 	frame->datalen = bytes;
 	frame->samples = bytes / sizeof(int16_t);
-	frame->rate = read_impl.actual_samples_per_second;
+	frame->rate = rate;
 	frame->codec = NULL;
 
-	if (fill_read && fill_write) {
-		return SWITCH_STATUS_BREAK;
+	if (fill_read || fill_write) {
+		status = SWITCH_STATUS_BREAK;
 	}
 
-	if (fill_read || fill_write) {
-		return SWITCH_STATUS_BREAK;
+	if (tap_mix) {
+		switch_media_tap_t *tap = bug->session->tap;
+
+		switch_mutex_lock(tap->mutex);
+		/* only a mix of exactly the span at the cached positions is reusable, not one that jumped a gap on the way */
+		if (bug->tap_read_pos - mix_read_pos == do_read && bug->tap_write_pos - mix_write_pos == do_write) {
+			tap->mix_read_pos = mix_read_pos;
+			tap->mix_write_pos = mix_write_pos;
+			tap->mix_read_len = do_read;
+			tap->mix_write_len = do_write;
+			tap->mix_flags = bug->flags & (SMBF_STEREO | SMBF_STEREO_SWAP);
+			tap->mix_bytes = bytes;
+			tap->mix_len = switch_test_flag(bug, SMBF_STEREO) ? bytes * 2 : bytes;
+			tap->mix_status = status;
+			memcpy(tap->mix_data, frame->data, tap->mix_len);
+			tap->mix_valid = 1;
+		}
+		switch_mutex_unlock(tap->mutex);
+	}
+
+	if (status != SWITCH_STATUS_SUCCESS) {
+		return status;
 	}
 
 	memcpy(bug->session->recur_buffer, frame->data, frame->datalen);
@@ -399,7 +1020,25 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *b
 	return SWITCH_STATUS_SUCCESS;
 }
 
-#define MAX_BUG_BUFFER 1024 * 512
+SWITCH_DECLARE(switch_status_t) switch_core_media_bug_read(switch_media_bug_t *bug, switch_frame_t *frame, switch_bool_t fill)
+{
+	switch_status_t status;
+
+	/* the rings have one consumer and never lock, a second reader at the same time would tear the tail under the first */
+	if (!bug_reader_enter(bug)) {
+		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_CRIT,
+						  "%s media bug %s read from two threads at once\n", switch_channel_get_name(bug->session->channel), bug->function);
+		switch_assert(0);
+		return SWITCH_STATUS_FALSE;
+	}
+
+	status = bug_read_frame(bug, frame);
+
+	bug_reader_leave(bug);
+
+	return status;
+}
+
 SWITCH_DECLARE(switch_status_t) switch_core_media_bug_add(switch_core_session_t *session,
 														  const char *function,
 														  const char *target,
@@ -502,16 +1141,26 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_add(switch_core_session_t
 		bug->flags = (SMBF_READ_STREAM | SMBF_WRITE_STREAM);
 	}
 
+	/* 
+	   Bugs that only listen share the session tap hub, bugs that replace a stream may unmerge their own
+	   audio from it (see switch_core_media_bug_set_read_demux_frame) so they keep private buffers.
+	*/
 	if (switch_test_flag(bug, SMBF_READ_STREAM) || switch_test_flag(bug, SMBF_READ_PING)) {
-		switch_buffer_create_dynamic(&bug->raw_read_buffer, bytes * SWITCH_BUFFER_BLOCK_FRAMES, bytes * SWITCH_BUFFER_START_FRAMES, MAX_BUG_BUFFER);
-		switch_mutex_init(&bug->read_mutex, SWITCH_MUTEX_NESTED, session->pool);
+		if (switch_test_flag(bug, SMBF_READ_STREAM) && !switch_test_flag(bug, SMBF_READ_REPLACE)) {
+			tap_subscribe(bug, SMBF_READ_STREAM);
+		} else {
+			bug->raw_read_buffer = bug_ring_create(bytes);
+		}
 	}
 
 	bytes = bug->write_impl.decoded_bytes_per_packet;
 
 	if (switch_test_flag(bug, SMBF_WRITE_STREAM)) {
-		switch_buffer_create_dynamic(&bug->raw_write_buffer, bytes * SWITCH_BUFFER_BLOCK_FRAMES, bytes * SWITCH_BUFFER_START_FRAMES, MAX_BUG_BUFFER);
-		switch_mutex_init(&bug->write_mutex, SWITCH_MUTEX_NESTED, session->pool);
+		if (!switch_test_flag(bug, SMBF_WRITE_REPLACE)) {
+			tap_subscribe(bug, SMBF_WRITE_STREAM);
+		} else {
+			bug->raw_write_buffer = bug_ring_create(bytes);
+		}
 	}
 
 	if ((bug->flags & SMBF_THREAD_LOCK)) {
@@ -535,6 +1184,9 @@ SWITCH_DECLARE(switch_status_t) switch_core_media_bug_add(switch_core_session_t
 	session->bugs = bug;
 
 	for(bp = session->bugs; bp; bp = bp->next) {
+		if (bp != bug && switch_test_flag(bug, SMBF_WRITE_REPLACE)) {
+			tap_write_to_private(bp);
+		}
 		if (bp->ready && !switch_test_flag(bp, SMBF_TAP_NATIVE_READ) && !switch_test_flag(bp, SMBF_TAP_NATIVE_WRITE)) {
 			tap_only = 0;
 		}	
@@ -115,13 +115,34 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_set_codec_slin(switch_core_s
 }
 
 
+static inline struct switch_session_stripe *session_stripe(const char *uuid_str)
+{
+	switch_ssize_t klen = APR_HASH_KEY_STRING;
+
+	return &session_manager.stripes[switch_hashfunc_default(uuid_str, &klen) % SWITCH_SESSION_TABLE_STRIPES];
+}
+
+static switch_bool_t session_table_exists(const char *uuid_str)
+{
+	struct switch_session_stripe *stripe = session_stripe(uuid_str);
+	switch_bool_t r;
+
+	switch_thread_rwlock_rdlock(stripe->rwlock);
+	r = switch_core_hash_find(stripe->table, uuid_str) ? SWITCH_TRUE : SWITCH_FALSE;
+	switch_thread_rwlock_unlock(stripe->rwlock);
+
+	return r;
+}
+
 SWITCH_DECLARE(switch_core_session_t *) switch_core_session_perform_locate(const char *uuid_str, const char *file, const char *func, int line)
 {
 	switch_core_session_t *session = NULL;
 
 	if (uuid_str) {
-		switch_mutex_lock(runtime.session_hash_mutex);
-		if ((session = switch_core_hash_find(session_manager.session_table, uuid_str))) {
+		struct switch_session_stripe *stripe = session_stripe(uuid_str);
+
+		switch_thread_rwlock_rdlock(stripe->rwlock);
+		if ((session = switch_core_hash_find(stripe->table, uuid_str))) {
 			/* Acquire a read lock on the session */
 #ifdef SWITCH_DEBUG_RWLOCKS
 			if (switch_core_session_perform_read_lock(session, file, func, line) != SWITCH_STATUS_SUCCESS) {
@@ -135,7 +156,7 @@ SWITCH_DECLARE(switch_core_session_t *) switch_core_session_perform_locate(const
 				session = NULL;
 			}
 		}
-		switch_mutex_unlock(runtime.session_hash_mutex);
+		switch_thread_rwlock_unlock(stripe->rwlock);
 	}
 
 	/* if its not NULL, now it's up to you to rwunlock this */
@@ -152,8 +173,10 @@ SWITCH_DECLARE(switch_core_session_t *) switch_core_session_perform_force_locate
 	switch_status_t status;
 
 	if (uuid_str) {
-		switch_mutex_lock(runtime.session_hash_mutex);
-		if ((session = switch_core_hash_find(session_manager.session_table, uuid_str))) {
+		struct switch_session_stripe *stripe = session_stripe(uuid_str);
+
+		switch_thread_rwlock_rdlock(stripe->rwlock);
+		if ((session = switch_core_hash_find(stripe->table, uuid_str))) {
 			/* Acquire a read lock on the session */
 
 			if (switch_test_flag(session, SSF_DESTROYED)) {
@@ -175,7 +198,7 @@ SWITCH_DECLARE(switch_core_session_t *) switch_core_session_perform_force_locate
 				session = NULL;
 			}
 		}
-		switch_mutex_unlock(runtime.session_hash_mutex);
+		switch_thread_rwlock_unlock(stripe->rwlock);
 	}
 
 	/* if its not NULL, now it's up to you to rwunlock this */
@@ -204,11 +227,61 @@ struct str_node {
 	struct str_node *next;
 };
 
-SWITCH_DECLARE(uint32_t) switch_core_session_hupall_matching_var_ans(const char *var_name, const char *var_val, switch_call_cause_t cause, 
-																	 switch_hup_type_t type)
+typedef switch_bool_t (*session_snapshot_filter_t) (switch_core_session_t *session, void *user_data);
+
+/*
+  Collect the uuids of every live session accepted by filter into a list allocated from pool.
+  Each stripe is only read locked while it is walked so callers act on the copy without blocking creation or lookups.
+*/
+static struct str_node *session_table_snapshot(switch_memory_pool_t *pool, session_snapshot_filter_t filter, void *user_data)
 {
 	switch_hash_index_t *hi;
 	void *val;
+	switch_core_session_t *session;
+	struct str_node *head = NULL, *np;
+	int i;
+
+	for (i = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+		struct switch_session_stripe *stripe = &session_manager.stripes[i];
+
+		switch_thread_rwlock_rdlock(stripe->rwlock);
+		for (hi = switch_core_hash_first(stripe->table); hi; hi = switch_core_hash_next(hi)) {
+			switch_core_hash_this(hi, NULL, NULL, &val);
+			if (val) {
+				session = (switch_core_session_t *) val;
+				if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
+					if (!filter || filter(session, user_data)) {
+						np = switch_core_alloc(pool, sizeof(*np));
+						np->str = switch_core_strdup(pool, session->uuid_str);
+						np->next = head;
+						head = np;
+					}
+					switch_core_session_rwunlock(session);
+				}
+			}
+		}
+		switch_thread_rwlock_unlock(stripe->rwlock);
+	}
+
+	return head;
+}
+
+static switch_bool_t snapshot_answered_filter(switch_core_session_t *session, void *user_data)
+{
+	switch_hup_type_t type = *(switch_hup_type_t *) user_data;
+	int ans = switch_channel_test_flag(switch_core_session_get_channel(session), CF_ANSWERED);
+
+	return ((ans && (type & SHT_ANSWERED)) || (!ans && (type & SHT_UNANSWERED))) ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+static switch_bool_t snapshot_endpoint_filter(switch_core_session_t *session, void *user_data)
+{
+	return session->endpoint_interface == (const switch_endpoint_interface_t *) user_data ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+SWITCH_DECLARE(uint32_t) switch_core_session_hupall_matching_var_ans(const char *var_name, const char *var_val, switch_call_cause_t cause, 
+																	 switch_hup_type_t type)
+{
 	switch_core_session_t *session;
 	switch_memory_pool_t *pool;
 	struct str_node *head = NULL, *np;
@@ -219,24 +292,7 @@ SWITCH_DECLARE(uint32_t) switch_core_session_hupall_matching_var_ans(const char
 	if (!var_val)
 		return r;
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	for (hi = switch_hash_first(NULL, session_manager.session_table); hi; hi = switch_hash_next(hi)) {
-		switch_hash_this(hi, NULL, NULL, &val);
-		if (val) {
-			session = (switch_core_session_t *) val;
-			if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-				int ans = switch_channel_test_flag(switch_core_session_get_channel(session), CF_ANSWERED);
-				if ((ans && (type & SHT_ANSWERED)) || (!ans && (type & SHT_UNANSWERED))) {
-					np = switch_core_alloc(pool, sizeof(*np));
-					np->str = switch_core_strdup(pool, session->uuid_str);
-					np->next = head;
-					head = np;
-				}
-				switch_core_session_rwunlock(session);
-			}
-		}
-	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
+	head = session_table_snapshot(pool, snapshot_answered_filter, &type);
 
 	for(np = head; np; np = np->next) {
 		if ((session = switch_core_session_locate(np->str))) {
@@ -258,8 +314,6 @@ SWITCH_DECLARE(uint32_t) switch_core_session_hupall_matching_var_ans(const char
 
 SWITCH_DECLARE(switch_console_callback_match_t *) switch_core_session_findall_matching_var(const char *var_name, const char *var_val)
 {
-	switch_hash_index_t *hi;
-	void *val;
 	switch_core_session_t *session;
 	switch_memory_pool_t *pool;
 	struct str_node *head = NULL, *np;
@@ -270,21 +324,7 @@ SWITCH_DECLARE(switch_console_callback_match_t *) switch_core_session_findall_ma
 	if (!var_val)
 		return NULL;
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	for (hi = switch_hash_first(NULL, session_manager.session_table); hi; hi = switch_hash_next(hi)) {
-		switch_hash_this(hi, NULL, NULL, &val);
-		if (val) {
-			session = (switch_core_session_t *) val;
-			if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-				np = switch_core_alloc(pool, sizeof(*np));
-				np->str = switch_core_strdup(pool, session->uuid_str);
-				np->next = head;
-				head = np;
-				switch_core_session_rwunlock(session);
-			}
-		}
-	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
+	head = session_table_snapshot(pool, NULL, NULL);
 
 	for(np = head; np; np = np->next) {
 		if ((session = switch_core_session_locate(np->str))) {
@@ -305,31 +345,13 @@ SWITCH_DECLARE(switch_console_callback_match_t *) switch_core_session_findall_ma
 
 SWITCH_DECLARE(void) switch_core_session_hupall_endpoint(const switch_endpoint_interface_t *endpoint_interface, switch_call_cause_t cause)
 {
-	switch_hash_index_t *hi;
-	void *val;
 	switch_core_session_t *session;
 	switch_memory_pool_t *pool;
     struct str_node *head = NULL, *np;
 	
 	switch_core_new_memory_pool(&pool);
 	
-	switch_mutex_lock(runtime.session_hash_mutex);
-	for (hi = switch_hash_first(NULL, session_manager.session_table); hi; hi = switch_hash_next(hi)) {
-		switch_hash_this(hi, NULL, NULL, &val);
-		if (val) {
-			session = (switch_core_session_t *) val;
-			if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-				if (session->endpoint_interface == endpoint_interface) {
-					np = switch_core_alloc(pool, sizeof(*np));
-                    np->str = switch_core_strdup(pool, session->uuid_str);
-                    np->next = head;
-					head = np;
-				}
-				switch_core_session_rwunlock(session);
-			}
-		}
-	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
+	head = session_table_snapshot(pool, snapshot_endpoint_filter, (void *) endpoint_interface);
 
 	for(np = head; np; np = np->next) {
 		if ((session = switch_core_session_locate(np->str))) {
@@ -344,8 +366,6 @@ SWITCH_DECLARE(void) switch_core_session_hupall_endpoint(const switch_endpoint_i
 
 SWITCH_DECLARE(void) switch_core_session_hupall(switch_call_cause_t cause)
 {
-	switch_hash_index_t *hi;
-	void *val;
 	switch_core_session_t *session;
 	switch_memory_pool_t *pool;
 	struct str_node *head = NULL, *np;
@@ -353,21 +373,7 @@ SWITCH_DECLARE(void) switch_core_session_hupall(switch_call_cause_t cause)
 	switch_core_new_memory_pool(&pool);
 
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	for (hi = switch_hash_first(NULL, session_manager.session_table); hi; hi = switch_hash_next(hi)) {
-		switch_hash_this(hi, NULL, NULL, &val);
-		if (val) {
-			session = (switch_core_session_t *) val;
-			if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-				np = switch_core_alloc(pool, sizeof(*np));
-				np->str = switch_core_strdup(pool, session->uuid_str);
-				np->next = head;
-				head = np;
-				switch_core_session_rwunlock(session);
-			}
-		}
-	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
+	head = session_table_snapshot(pool, NULL, NULL);
 
 	for(np = head; np; np = np->next) { 
 		if ((session = switch_core_session_locate(np->str))) {
@@ -388,18 +394,24 @@ SWITCH_DECLARE(switch_console_callback_match_t *) switch_core_session_findall(vo
 	switch_core_session_t *session;
 	switch_console_callback_match_t *my_matches = NULL;
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	for (hi = switch_hash_first(NULL, session_manager.session_table); hi; hi = switch_hash_next(hi)) {
-		switch_hash_this(hi, NULL, NULL, &val);
-		if (val) {
-			session = (switch_core_session_t *) val;
-			if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-				switch_console_push_match(&my_matches, session->uuid_str);
-				switch_core_session_rwunlock(session);
+	int i;
+
+	for (i = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+		struct switch_session_stripe *stripe = &session_manager.stripes[i];
+
+		switch_thread_rwlock_rdlock(stripe->rwlock);
+		for (hi = switch_core_hash_first(stripe->table); hi; hi = switch_core_hash_next(hi)) {
+			switch_core_hash_this(hi, NULL, NULL, &val);
+			if (val) {
+				session = (switch_core_session_t *) val;
+				if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
+					switch_console_push_match(&my_matches, session->uuid_str);
+					switch_core_session_rwunlock(session);
+				}
 			}
 		}
+		switch_thread_rwlock_unlock(stripe->rwlock);
 	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
 
 	return my_matches;
 }
@@ -409,17 +421,12 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_message_send(const char *uui
 	switch_core_session_t *session = NULL;
 	switch_status_t status = SWITCH_STATUS_FALSE;
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	if ((session = switch_core_hash_find(session_manager.session_table, uuid_str)) != 0) {
-		/* Acquire a read lock on the session or forget it the channel is dead */
-		if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-			if (switch_channel_up_nosig(session->channel)) {
-				status = switch_core_session_receive_message(session, message);
-			}
-			switch_core_session_rwunlock(session);
+	if ((session = switch_core_session_locate(uuid_str))) {
+		if (switch_channel_up_nosig(session->channel)) {
+			status = switch_core_session_receive_message(session, message);
 		}
+		switch_core_session_rwunlock(session);
 	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
 
 	return status;
 }
@@ -429,17 +436,12 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_event_send(const char *uuid_
 	switch_core_session_t *session = NULL;
 	switch_status_t status = SWITCH_STATUS_FALSE;
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	if ((session = switch_core_hash_find(session_manager.session_table, uuid_str)) != 0) {
-		/* Acquire a read lock on the session or forget it the channel is dead */
-		if (switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
-			if (switch_channel_up_nosig(session->channel)) {
-				status = switch_core_session_queue_event(session, event);
-			}
-			switch_core_session_rwunlock(session);
+	if ((session = switch_core_session_locate(uuid_str))) {
+		if (switch_channel_up_nosig(session->channel)) {
+			status = switch_core_session_queue_event(session, event);
 		}
+		switch_core_session_rwunlock(session);
 	}
-	switch_mutex_unlock(runtime.session_hash_mutex);
 
 	return status;
 }
@@ -1368,6 +1370,7 @@ SWITCH_DECLARE(void) switch_core_session_perform_destroy(switch_core_session_t *
 	switch_memory_pool_t *pool;
 	switch_event_t *event;
 	switch_endpoint_interface_t *endpoint_interface = (*session)->endpoint_interface;
+	struct switch_session_stripe *stripe;
 	int i;
 
 
@@ -1389,8 +1392,10 @@ SWITCH_DECLARE(void) switch_core_session_perform_destroy(switch_core_session_t *
 
 	switch_scheduler_del_task_group((*session)->uuid_str);
 
+	stripe = session_stripe((*session)->uuid_str);
+	switch_core_hash_delete_wrlock(stripe->table, (*session)->uuid_str, stripe->rwlock);
+
 	switch_mutex_lock(runtime.session_hash_mutex);
-	switch_core_hash_delete(session_manager.session_table, (*session)->uuid_str);
 	if (session_manager.session_count) {
 		session_manager.session_count--;
 		if (session_manager.session_count == 0) {
@@ -1852,6 +1857,9 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_set_uuid(switch_core_session
 	switch_event_t *event;
 	switch_core_session_message_t msg = { 0 };
 	switch_caller_profile_t *profile;
+	struct switch_session_stripe *old_stripe, *new_stripe;
+	char old_uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+	int duplicate = 0;
 
 	switch_assert(use_uuid);
 
@@ -1859,17 +1867,44 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_set_uuid(switch_core_session
 		return SWITCH_STATUS_SUCCESS;
 	}
 
+	switch_copy_string(old_uuid, session->uuid_str, sizeof(old_uuid));
 
-	switch_mutex_lock(runtime.session_hash_mutex);
-	if (switch_core_hash_find(session_manager.session_table, use_uuid)) {
+	/* lock both stripes in index order so concurrent renames cannot deadlock */
+	old_stripe = session_stripe(session->uuid_str);
+	new_stripe = session_stripe(use_uuid);
+
+	if (old_stripe > new_stripe) {
+		switch_thread_rwlock_wrlock(new_stripe->rwlock);
+		switch_thread_rwlock_wrlock(old_stripe->rwlock);
+	} else {
+		switch_thread_rwlock_wrlock(old_stripe->rwlock);
+		if (new_stripe != old_stripe) {
+			switch_thread_rwlock_wrlock(new_stripe->rwlock);
+		}
+	}
+
+	if (switch_core_hash_find(new_stripe->table, use_uuid)) {
+		duplicate = 1;
+	} else {
+		switch_core_hash_delete(old_stripe->table, session->uuid_str);
+		switch_set_string(session->uuid_str, use_uuid);
+		switch_core_hash_insert(new_stripe->table, session->uuid_str, session);
+	}
+
+	if (new_stripe != old_stripe) {
+		switch_thread_rwlock_unlock(new_stripe->rwlock);
+	}
+	switch_thread_rwlock_unlock(old_stripe->rwlock);
+
+	if (duplicate) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_CRIT, "Duplicate UUID!\n");
-		switch_mutex_unlock(runtime.session_hash_mutex);
 		return SWITCH_STATUS_FALSE;
 	}
 
+	/* the rename is committed, only now tell the endpoint, the variables and the event consumers about it */
 	msg.message_id = SWITCH_MESSAGE_INDICATE_UUID_CHANGE;
 	msg.from = switch_channel_get_name(session->channel);
-	msg.string_array_arg[0] = session->uuid_str;
+	msg.string_array_arg[0] = old_uuid;
 	msg.string_array_arg[1] = use_uuid;
 	switch_core_session_receive_message(session, &msg);
 
@@ -1880,15 +1915,11 @@ SWITCH_DECLARE(switch_status_t) switch_core_session_set_uuid(switch_core_session
 	switch_channel_set_variable(session->channel, "uuid", use_uuid);
 	switch_channel_set_variable(session->channel, "call_uuid", use_uuid);
 
-	switch_event_create(&event, SWITCH_EVENT_CHANNEL_UUID);
-	switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Old-Unique-ID", session->uuid_str);
-	switch_core_hash_delete(session_manager.session_table, session->uuid_str);
-	switch_set_string(session->uuid_str, use_uuid);
-	switch_core_hash_insert(session_manager.session_table, session->uuid_str, session);
-	switch_mutex_unlock(runtime.session_hash_mutex);
-	switch_channel_event_set_data(session->channel, event);
-	switch_event_fire(&event);
-
+	if (switch_event_create(&event, SWITCH_EVENT_CHANNEL_UUID) == SWITCH_STATUS_SUCCESS) {
+		switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Old-Unique-ID", old_uuid);
+		switch_channel_event_set_data(session->channel, event);
+		switch_event_fire(&event);
+	}
 
 	return SWITCH_STATUS_SUCCESS;
 }
@@ -2175,12 +2206,13 @@ SWITCH_DECLARE(switch_core_session_t *) switch_core_session_request_uuid(switch_
 {
 	switch_memory_pool_t *usepool;
 	switch_core_session_t *session;
+	struct switch_session_stripe *stripe;
 	switch_uuid_t uuid;
 	uint32_t count = 0;
 	int32_t sps = 0;
 
 
-	if (use_uuid && switch_core_hash_find(session_manager.session_table, use_uuid)) {
+	if (use_uuid && session_table_exists(use_uuid)) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Duplicate UUID!\n");
 		return NULL;
 	}
@@ -2288,8 +2320,10 @@ SWITCH_DECLARE(switch_core_session_t *) switch_core_session_request_uuid(switch_
 	switch_queue_create(&session->private_event_queue, SWITCH_EVENT_QUEUE_LEN, session->pool);
 	switch_queue_create(&session->private_event_queue_pri, SWITCH_EVENT_QUEUE_LEN, session->pool);
 
+	stripe = session_stripe(session->uuid_str);
+	switch_core_hash_insert_wrlock(stripe->table, session->uuid_str, session, stripe->rwlock);
+
 	switch_mutex_lock(runtime.session_hash_mutex);
-	switch_core_hash_insert(session_manager.session_table, session->uuid_str, session);
 	session->id = session_manager.session_id++;
 	session_manager.session_count++;
 	switch_mutex_unlock(runtime.session_hash_mutex);
@@ -2402,11 +2436,17 @@ SWITCH_DECLARE(uint32_t) switch_core_sessions_per_second(uint32_t new_limit)
 
 void switch_core_session_init(switch_memory_pool_t *pool)
 {
+	int i;
+
 	memset(&session_manager, 0, sizeof(session_manager));
 	session_manager.session_limit = 1000;
 	session_manager.session_id = 1;
 	session_manager.memory_pool = pool;
-	switch_core_hash_init(&session_manager.session_table, session_manager.memory_pool);
+
+	for (i = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+		switch_thread_rwlock_create(&session_manager.stripes[i].rwlock, session_manager.memory_pool);
+		switch_core_hash_init(&session_manager.stripes[i].table, session_manager.memory_pool);
+	}
 	
 	if (switch_test_flag((&runtime), SCF_SESSION_THREAD_POOL)) {
 		switch_threadattr_t *thd_attr;
@@ -2425,8 +2465,11 @@ void switch_core_session_uninit(void)
 {
 	int sanity = 100;
 	switch_status_t st = SWITCH_STATUS_FALSE;
+	int i;
 
-	switch_core_hash_destroy(&session_manager.session_table);
+	for (i = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+		switch_core_hash_destroy(&session_manager.stripes[i].table);
+	}
 	session_manager.ready = 0;
 
 	switch_thread_join(&st, session_manager.manager_thread);
@@ -2863,6 +2863,602 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_generate_json_cdr(switch_core_session
 }
 
 
+/* Streaming CDR generation.  These walk the channel once and write the document text directly,
+   producing byte for byte what switch_xml_toxml() / cJSON_PrintUnformatted() would produce from
+   switch_ivr_generate_xml_cdr() / switch_ivr_generate_json_cdr() without building the tree first.
+   Change both sides together; src/test/cdr_test.c compares them. */
+
+static const char *switch_ivr_cdr_url_encode(char **buf, switch_size_t *buflen, const char *val, switch_size_t dlen)
+{
+	if (dlen > *buflen) {
+		switch_safe_free(*buf);
+		if (!(*buf = malloc(dlen))) {
+			abort();
+		}
+		*buflen = dlen;
+	}
+
+	switch_url_encode(val, *buf, dlen);
+
+	return *buf;
+}
+
+static void switch_ivr_write_xml_profile_data(switch_xml_writer_t *writer, switch_caller_profile_t *caller_profile)
+{
+	profile_node_t *pn;
+
+	switch_xml_writer_leaf(writer, "username", caller_profile->username);
+	switch_xml_writer_leaf(writer, "dialplan", caller_profile->dialplan);
+	switch_xml_writer_leaf(writer, "caller_id_name", caller_profile->caller_id_name);
+	switch_xml_writer_leaf(writer, "caller_id_number", caller_profile->caller_id_number);
+	switch_xml_writer_leaf(writer, "callee_id_name", caller_profile->callee_id_name);
+	switch_xml_writer_leaf(writer, "callee_id_number", caller_profile->callee_id_number);
+	switch_xml_writer_leaf(writer, "ani", caller_profile->ani);
+	switch_xml_writer_leaf(writer, "aniii", caller_profile->aniii);
+	switch_xml_writer_leaf(writer, "network_addr", caller_profile->network_addr);
+	switch_xml_writer_leaf(writer, "rdnis", caller_profile->rdnis);
+	switch_xml_writer_leaf(writer, "destination_number", caller_profile->destination_number);
+	switch_xml_writer_leaf(writer, "uuid", caller_profile->uuid);
+	switch_xml_writer_leaf(writer, "source", caller_profile->source);
+
+	if (caller_profile->transfer_source) {
+		switch_xml_writer_leaf(writer, "transfer_source", caller_profile->transfer_source);
+	}
+
+	switch_xml_writer_leaf(writer, "context", caller_profile->context);
+	switch_xml_writer_leaf(writer, "chan_name", caller_profile->chan_name);
+
+	for (pn = caller_profile->soft; pn; pn = pn->next) {
+		switch_xml_writer_leaf(writer, pn->var, pn->val);
+	}
+}
+
+static void switch_ivr_write_xml_profile_list(switch_xml_writer_t *writer, const char *name, const char *item_name, switch_caller_profile_t *cp)
+{
+	switch_xml_writer_open(writer, name);
+	for (; cp; cp = cp->next) {
+		switch_xml_writer_open(writer, item_name);
+		switch_ivr_write_xml_profile_data(writer, cp);
+		switch_xml_writer_close(writer, item_name);
+	}
+	switch_xml_writer_close(writer, name);
+}
+
+static void switch_ivr_write_xml_extension_app(switch_xml_writer_t *writer, switch_caller_extension_t *extension, switch_caller_application_t *ap)
+{
+	switch_xml_writer_open(writer, "application");
+	if (ap == extension->current_application) {
+		switch_xml_writer_attr(writer, "last_executed", "true");
+	}
+	switch_xml_writer_attr(writer, "app_name", ap->application_name);
+	switch_xml_writer_attr(writer, "app_data", ap->application_data);
+	switch_xml_writer_close(writer, "application");
+}
+
+/* switch_ivr_generate_xml_cdr() adds each sub extension to the extension written before it.  s_off is
+   the offset this one was given in its parent, the next one lands at s_off + 1 among this extension's
+   applications, whose offsets start at app_off.  Reproduce that nesting and ordering exactly. */
+static void switch_ivr_write_xml_sub_extension(switch_xml_writer_t *writer, switch_caller_profile_t *cp, int s_off, int app_off)
+{
+	switch_caller_profile_t *next;
+	switch_caller_application_t *ap;
+	int count = 0, off;
+
+	for (; cp && !cp->caller_extension; cp = cp->next);
+
+	if (!cp) {
+		return;
+	}
+
+	for (next = cp->next; next && !next->caller_extension; next = next->next);
+	for (ap = cp->caller_extension->applications; ap; ap = ap->next) {
+		count++;
+	}
+
+	switch_xml_writer_open(writer, "sub_extensions");
+	switch_xml_writer_open(writer, "extension");
+	switch_xml_writer_attr(writer, "name", cp->caller_extension->extension_name);
+	switch_xml_writer_attr(writer, "number", cp->caller_extension->extension_number);
+	switch_xml_writer_attr(writer, "dialplan", cp->dialplan);
+	if (cp->caller_extension->current_application) {
+		switch_xml_writer_attr(writer, "current_app", cp->caller_extension->current_application->application_name);
+	}
+
+	for (ap = cp->caller_extension->applications, off = app_off; ap && off <= s_off + 1; ap = ap->next, off++) {
+		switch_ivr_write_xml_extension_app(writer, cp->caller_extension, ap);
+	}
+
+	if (next) {
+		switch_ivr_write_xml_sub_extension(writer, next, s_off + 1, app_off + count);
+	}
+
+	for (; ap; ap = ap->next) {
+		switch_ivr_write_xml_extension_app(writer, cp->caller_extension, ap);
+	}
+
+	switch_xml_writer_close(writer, "extension");
+	switch_xml_writer_close(writer, "sub_extensions");
+}
+
+SWITCH_DECLARE(switch_status_t) switch_ivr_generate_xml_cdr_text(switch_core_session_t *session, char **xml_text, switch_bool_t prn_header)
+{
+	switch_channel_t *channel = switch_core_session_get_channel(session);
+	switch_caller_profile_t *caller_profile;
+	switch_xml_writer_t writer;
+	switch_event_header_t *hi;
+	switch_app_log_t *app_log;
+	switch_hold_record_t *hold_record = switch_channel_get_hold_record(channel), *hr;
+	char tmp[512], *f, *enc = NULL;
+	switch_size_t enc_len = 0;
+
+	switch_xml_writer_init(&writer, prn_header);
+
+	switch_xml_writer_open(&writer, "cdr");
+	switch_xml_writer_attr(&writer, "core-uuid", switch_core_get_uuid());
+
+	switch_xml_writer_open(&writer, "channel_data");
+	switch_xml_writer_leaf(&writer, "state", switch_channel_state_name(switch_channel_get_state(channel)));
+	switch_xml_writer_leaf(&writer, "direction", switch_channel_direction(channel) == SWITCH_CALL_DIRECTION_OUTBOUND ? "outbound" : "inbound");
+	switch_snprintf(tmp, sizeof(tmp), "%d", switch_channel_get_state(channel));
+	switch_xml_writer_leaf(&writer, "state_number", tmp);
+
+	if ((f = switch_channel_get_flag_string(channel))) {
+		switch_xml_writer_leaf(&writer, "flags", f);
+		free(f);
+	}
+
+	if ((f = switch_channel_get_cap_string(channel))) {
+		switch_xml_writer_leaf(&writer, "caps", f);
+		free(f);
+	}
+	switch_xml_writer_close(&writer, "channel_data");
+
+	switch_xml_writer_open(&writer, "variables");
+	if ((hi = switch_channel_variable_first(channel))) {
+		for (; hi; hi = hi->next) {
+			int i, n = hi->idx ? hi->idx : 1;
+
+			for (i = 0; i < n; i++) {
+				const char *val = hi->idx ? hi->array[i] : hi->value;
+
+				if (!zstr(hi->name) && !zstr(val)) {
+					switch_xml_writer_leaf(&writer, hi->name, switch_ivr_cdr_url_encode(&enc, &enc_len, val, strlen(val) * 3 + 1));
+				}
+			}
+		}
+		switch_channel_variable_last(channel);
+	}
+	switch_xml_writer_close(&writer, "variables");
+
+	if ((app_log = switch_core_session_get_app_log(session))) {
+		switch_app_log_t *ap;
+
+		switch_xml_writer_open(&writer, "app_log");
+		for (ap = app_log; ap; ap = ap->next) {
+			switch_xml_writer_open(&writer, "application");
+			switch_xml_writer_attr(&writer, "app_name", ap->app);
+			switch_xml_writer_attr(&writer, "app_data", ap->arg);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, ap->stamp);
+			switch_xml_writer_attr(&writer, "app_stamp", tmp);
+			switch_xml_writer_close(&writer, "application");
+		}
+		switch_xml_writer_close(&writer, "app_log");
+	}
+
+	if (hold_record) {
+		switch_xml_writer_open(&writer, "hold-record");
+		for (hr = hold_record; hr; hr = hr->next) {
+			switch_xml_writer_open(&writer, "hold");
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, hr->on);
+			switch_xml_writer_attr(&writer, "on", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, hr->off);
+			switch_xml_writer_attr(&writer, "off", tmp);
+			if (hr->uuid) {
+				switch_xml_writer_attr(&writer, "bridged-to", hr->uuid);
+			}
+			switch_xml_writer_close(&writer, "hold");
+		}
+		switch_xml_writer_close(&writer, "hold-record");
+	}
+
+	for (caller_profile = switch_channel_get_caller_profile(channel); caller_profile; caller_profile = caller_profile->next) {
+		switch_xml_writer_open(&writer, "callflow");
+
+		if (!zstr(caller_profile->dialplan)) {
+			switch_xml_writer_attr(&writer, "dialplan", caller_profile->dialplan);
+		}
+
+		if (!zstr(caller_profile->uuid_str)) {
+			switch_xml_writer_attr(&writer, "unique-id", caller_profile->uuid_str);
+		}
+
+		if (!zstr(caller_profile->clone_of)) {
+			switch_xml_writer_attr(&writer, "clone-of", caller_profile->clone_of);
+		}
+
+		if (!zstr(caller_profile->profile_index)) {
+			switch_xml_writer_attr(&writer, "profile_index", caller_profile->profile_index);
+		}
+
+		if (caller_profile->caller_extension) {
+			switch_caller_extension_t *extension = caller_profile->caller_extension;
+			switch_caller_application_t *ap;
+			int app_off = 0;
+
+			switch_xml_writer_open(&writer, "extension");
+			switch_xml_writer_attr(&writer, "name", extension->extension_name);
+			switch_xml_writer_attr(&writer, "number", extension->extension_number);
+			if (extension->current_application) {
+				switch_xml_writer_attr(&writer, "current_app", extension->current_application->application_name);
+			}
+
+			for (ap = extension->applications; ap; ap = ap->next) {
+				switch_ivr_write_xml_extension_app(&writer, extension, ap);
+				app_off++;
+			}
+
+			switch_ivr_write_xml_sub_extension(&writer, extension->children, app_off, 0);
+
+			switch_xml_writer_close(&writer, "extension");
+		}
+
+		switch_xml_writer_open(&writer, "caller_profile");
+		switch_ivr_write_xml_profile_data(&writer, caller_profile);
+
+		if (caller_profile->origination_caller_profile) {
+			switch_ivr_write_xml_profile_list(&writer, "origination", "origination_caller_profile", caller_profile->origination_caller_profile);
+		}
+
+		if (caller_profile->originator_caller_profile) {
+			switch_ivr_write_xml_profile_list(&writer, "originator", "originator_caller_profile", caller_profile->originator_caller_profile);
+		}
+
+		if (caller_profile->originatee_caller_profile) {
+			switch_ivr_write_xml_profile_list(&writer, "originatee", "originatee_caller_profile", caller_profile->originatee_caller_profile);
+		}
+		switch_xml_writer_close(&writer, "caller_profile");
+
+		if (caller_profile->times) {
+			switch_xml_writer_open(&writer, "times");
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->created);
+			switch_xml_writer_leaf(&writer, "created_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->profile_created);
+			switch_xml_writer_leaf(&writer, "profile_created_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->progress);
+			switch_xml_writer_leaf(&writer, "progress_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->progress_media);
+			switch_xml_writer_leaf(&writer, "progress_media_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->answered);
+			switch_xml_writer_leaf(&writer, "answered_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->bridged);
+			switch_xml_writer_leaf(&writer, "bridged_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->last_hold);
+			switch_xml_writer_leaf(&writer, "last_hold_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->hold_accum);
+			switch_xml_writer_leaf(&writer, "hold_accum_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->hungup);
+			switch_xml_writer_leaf(&writer, "hangup_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->resurrected);
+			switch_xml_writer_leaf(&writer, "resurrect_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->transferred);
+			switch_xml_writer_leaf(&writer, "transfer_time", tmp);
+			switch_xml_writer_close(&writer, "times");
+		}
+
+		switch_xml_writer_close(&writer, "callflow");
+	}
+
+	switch_xml_writer_close(&writer, "cdr");
+
+	switch_safe_free(enc);
+	*xml_text = switch_xml_writer_finish(&writer);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+typedef struct {
+	char *data;
+	switch_size_t len;
+	switch_size_t max;
+} json_cdr_writer_t;
+
+static void json_cdr_reserve(json_cdr_writer_t *writer, switch_size_t need)
+{
+	char *tmp;
+
+	if (writer->len + need + 1 <= writer->max) {
+		return;
+	}
+
+	while (writer->len + need + 1 > writer->max) {
+		writer->max *= 2;
+	}
+
+	if (!(tmp = realloc(writer->data, writer->max))) {
+		abort();
+	}
+	writer->data = tmp;
+}
+
+static void json_cdr_put(json_cdr_writer_t *writer, const char *s, switch_size_t slen)
+{
+	json_cdr_reserve(writer, slen);
+	memcpy(writer->data + writer->len, s, slen);
+	writer->len += slen;
+	writer->data[writer->len] = '\0';
+}
+
+/* quote and escape s exactly as cJSON's print_string_ptr() does */
+static void json_cdr_put_string(json_cdr_writer_t *writer, const char *s)
+{
+	const unsigned char *p;
+
+	json_cdr_reserve(writer, 2 + (s ? strlen(s) * 6 : 0));
+
+	writer->data[writer->len++] = '"';
+	for (p = (const unsigned char *) s; p && *p; p++) {
+		if (*p > 31 && *p != '"' && *p != '\\') {
+			writer->data[writer->len++] = *p;
+			continue;
+		}
+
+		writer->data[writer->len++] = '\\';
+		switch (*p) {
+		case '\\':
+			writer->data[writer->len++] = '\\';
+			break;
+		case '"':
+			writer->data[writer->len++] = '"';
+			break;
+		case '\b':
+			writer->data[writer->len++] = 'b';
+			break;
+		case '\f':
+			writer->data[writer->len++] = 'f';
+			break;
+		case '\n':
+			writer->data[writer->len++] = 'n';
+			break;
+		case '\r':
+			writer->data[writer->len++] = 'r';
+			break;
+		case '\t':
+			writer->data[writer->len++] = 't';
+			break;
+		default:
+			writer->len += sprintf(writer->data + writer->len, "u%04x", *p);
+			break;
+		}
+	}
+	writer->data[writer->len++] = '"';
+	writer->data[writer->len] = '\0';
+}
+
+/* start a member or element, adding the separator unless it is the first one in its container */
+static void json_cdr_key(json_cdr_writer_t *writer, const char *name)
+{
+	char last = writer->len ? writer->data[writer->len - 1] : '{';
+
+	if (last != '{' && last != '[' && last != ':') {
+		json_cdr_put(writer, ",", 1);
+	}
+
+	if (name) {
+		json_cdr_put_string(writer, name);
+		json_cdr_put(writer, ":", 1);
+	}
+}
+
+static void json_cdr_open(json_cdr_writer_t *writer, const char *name, const char *brace)
+{
+	json_cdr_key(writer, name);
+	json_cdr_put(writer, brace, 1);
+}
+
+static void json_cdr_pair(json_cdr_writer_t *writer, const char *name, const char *val)
+{
+	json_cdr_key(writer, name);
+	json_cdr_put_string(writer, val);
+}
+
+static void switch_ivr_write_json_profile_data(json_cdr_writer_t *writer, switch_caller_profile_t *caller_profile)
+{
+	json_cdr_pair(writer, "username", caller_profile->username);
+	json_cdr_pair(writer, "dialplan", caller_profile->dialplan);
+	json_cdr_pair(writer, "caller_id_name", caller_profile->caller_id_name);
+	json_cdr_pair(writer, "ani", caller_profile->ani);
+	json_cdr_pair(writer, "aniii", caller_profile->aniii);
+	json_cdr_pair(writer, "caller_id_number", caller_profile->caller_id_number);
+	json_cdr_pair(writer, "network_addr", caller_profile->network_addr);
+	json_cdr_pair(writer, "rdnis", caller_profile->rdnis);
+	json_cdr_pair(writer, "destination_number", caller_profile->destination_number);
+	json_cdr_pair(writer, "uuid", caller_profile->uuid);
+	json_cdr_pair(writer, "source", caller_profile->source);
+	json_cdr_pair(writer, "context", caller_profile->context);
+	json_cdr_pair(writer, "chan_name", caller_profile->chan_name);
+}
+
+static void switch_ivr_write_json_profile_list(json_cdr_writer_t *writer, const char *name, const char *list_name, switch_caller_profile_t *cp)
+{
+	json_cdr_open(writer, name, "{");
+	json_cdr_open(writer, list_name, "[");
+	for (; cp; cp = cp->next) {
+		json_cdr_open(writer, NULL, "{");
+		switch_ivr_write_json_profile_data(writer, cp);
+		json_cdr_put(writer, "}", 1);
+	}
+	json_cdr_put(writer, "]}", 2);
+}
+
+static void switch_ivr_write_json_extension_apps(json_cdr_writer_t *writer, switch_caller_extension_t *extension)
+{
+	switch_caller_application_t *ap;
+
+	json_cdr_open(writer, "applications", "[");
+	for (ap = extension->applications; ap; ap = ap->next) {
+		json_cdr_open(writer, NULL, "{");
+		if (ap == extension->current_application) {
+			json_cdr_pair(writer, "last_executed", "true");
+		}
+		json_cdr_pair(writer, "app_name", ap->application_name);
+		json_cdr_pair(writer, "app_data", switch_str_nil(ap->application_data));
+		json_cdr_put(writer, "}", 1);
+	}
+	json_cdr_put(writer, "]", 1);
+}
+
+SWITCH_DECLARE(switch_status_t) switch_ivr_generate_json_cdr_text(switch_core_session_t *session, char **json_text, switch_bool_t urlencode)
+{
+	switch_channel_t *channel = switch_core_session_get_channel(session);
+	switch_caller_profile_t *caller_profile;
+	json_cdr_writer_t writer = { 0 };
+	switch_event_header_t *hi;
+	switch_app_log_t *app_log;
+	char tmp[512], *f, *enc = NULL;
+	switch_size_t enc_len = 0;
+
+	writer.max = SWITCH_XML_BUFSIZE * 4;
+	writer.data = malloc(writer.max);
+	switch_assert(writer.data);
+
+	json_cdr_put(&writer, "{", 1);
+	json_cdr_pair(&writer, "core-uuid", switch_core_get_uuid());
+
+	json_cdr_open(&writer, "channel_data", "{");
+	json_cdr_pair(&writer, "state", switch_channel_state_name(switch_channel_get_state(channel)));
+	json_cdr_pair(&writer, "direction", switch_channel_direction(channel) == SWITCH_CALL_DIRECTION_OUTBOUND ? "outbound" : "inbound");
+	switch_snprintf(tmp, sizeof(tmp), "%d", switch_channel_get_state(channel));
+	json_cdr_pair(&writer, "state_number", tmp);
+
+	if ((f = switch_channel_get_flag_string(channel))) {
+		json_cdr_pair(&writer, "flags", f);
+		free(f);
+	}
+
+	if ((f = switch_channel_get_cap_string(channel))) {
+		json_cdr_pair(&writer, "caps", f);
+		free(f);
+	}
+	json_cdr_put(&writer, "}", 1);
+
+	json_cdr_open(&writer, "variables", "{");
+	if ((hi = switch_channel_variable_first(channel))) {
+		for (; hi; hi = hi->next) {
+			if (!zstr(hi->name) && !zstr(hi->value)) {
+				json_cdr_pair(&writer, hi->name,
+							  urlencode ? switch_ivr_cdr_url_encode(&enc, &enc_len, hi->value, strlen(hi->value) * 3) : hi->value);
+			}
+		}
+		switch_channel_variable_last(channel);
+	}
+	json_cdr_put(&writer, "}", 1);
+
+	if ((app_log = switch_core_session_get_app_log(session))) {
+		switch_app_log_t *ap;
+
+		json_cdr_open(&writer, "app_log", "{");
+		json_cdr_open(&writer, "applications", "[");
+		for (ap = app_log; ap; ap = ap->next) {
+			json_cdr_open(&writer, NULL, "{");
+			json_cdr_pair(&writer, "app_name", ap->app);
+			json_cdr_pair(&writer, "app_data", ap->arg);
+			json_cdr_put(&writer, "}", 1);
+		}
+		json_cdr_put(&writer, "]}", 2);
+	}
+
+	for (caller_profile = switch_channel_get_caller_profile(channel); caller_profile; caller_profile = caller_profile->next) {
+		json_cdr_open(&writer, "callflow", "{");
+
+		if (!zstr(caller_profile->dialplan)) {
+			json_cdr_pair(&writer, "dialplan", caller_profile->dialplan);
+		}
+
+		if (!zstr(caller_profile->profile_index)) {
+			json_cdr_pair(&writer, "profile_index", caller_profile->profile_index);
+		}
+
+		if (caller_profile->caller_extension) {
+			switch_caller_extension_t *extension = caller_profile->caller_extension;
+
+			json_cdr_open(&writer, "extension", "{");
+			json_cdr_pair(&writer, "name", extension->extension_name);
+			json_cdr_pair(&writer, "number", extension->extension_number);
+			switch_ivr_write_json_extension_apps(&writer, extension);
+
+			if (extension->current_application) {
+				json_cdr_pair(&writer, "current_app", extension->current_application->application_name);
+			}
+
+			if (extension->children) {
+				switch_caller_profile_t *cp;
+
+				json_cdr_open(&writer, "sub_extensions", "[");
+				for (cp = extension->children; cp; cp = cp->next) {
+					if (!cp->caller_extension) {
+						continue;
+					}
+
+					json_cdr_open(&writer, NULL, "{");
+					json_cdr_pair(&writer, "name", cp->caller_extension->extension_name);
+					json_cdr_pair(&writer, "number", cp->caller_extension->extension_number);
+					json_cdr_pair(&writer, "dialplan", cp->dialplan);
+					if (cp->caller_extension->current_application) {
+						json_cdr_pair(&writer, "current_app", cp->caller_extension->current_application->application_name);
+					}
+					switch_ivr_write_json_extension_apps(&writer, cp->caller_extension);
+					json_cdr_put(&writer, "}", 1);
+				}
+				json_cdr_put(&writer, "]", 1);
+			}
+
+			json_cdr_put(&writer, "}", 1);
+		}
+
+		json_cdr_open(&writer, "caller_profile", "{");
+		switch_ivr_write_json_profile_data(&writer, caller_profile);
+
+		if (caller_profile->originator_caller_profile) {
+			switch_ivr_write_json_profile_list(&writer, "originator", "originator_caller_profiles", caller_profile->originator_caller_profile);
+		}
+
+		if (caller_profile->originatee_caller_profile) {
+			switch_ivr_write_json_profile_list(&writer, "originatee", "originatee_caller_profiles", caller_profile->originatee_caller_profile);
+		}
+		json_cdr_put(&writer, "}", 1);
+
+		if (caller_profile->times) {
+			json_cdr_open(&writer, "times", "{");
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->created);
+			json_cdr_pair(&writer, "created_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->profile_created);
+			json_cdr_pair(&writer, "profile_created_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->progress);
+			json_cdr_pair(&writer, "progress_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->progress_media);
+			json_cdr_pair(&writer, "progress_media_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->answered);
+			json_cdr_pair(&writer, "answered_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->hungup);
+			json_cdr_pair(&writer, "hangup_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->resurrected);
+			json_cdr_pair(&writer, "resurrect_time", tmp);
+			switch_snprintf(tmp, sizeof(tmp), "%" SWITCH_TIME_T_FMT, caller_profile->times->transferred);
+			json_cdr_pair(&writer, "transfer_time", tmp);
+			json_cdr_put(&writer, "}", 1);
+		}
+
+		json_cdr_put(&writer, "}", 1);
+	}
+
+	json_cdr_put(&writer, "}", 1);
+
+	switch_safe_free(enc);
+	*json_text = writer.data;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_DECLARE(void) switch_ivr_park_session(switch_core_session_t *session)
 {
 	switch_channel_t *channel = switch_core_session_get_channel(session);
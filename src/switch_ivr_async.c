@@ -1095,8 +1095,127 @@ struct record_helper {
 	uint32_t packet_len;
 	int min_sec;
 	switch_bool_t hangup_on_error;
+	int use_rtpdump;
+	switch_file_t *rtpdump;
+	switch_mutex_t *rtpdump_mutex;
+	switch_time_t rtpdump_start;
+	uint32_t rtp_ssrc;
+	uint16_t rtp_seq[2];
+	uint32_t rtp_ts[2];
+	switch_time_t rtp_last[2];
 };
 
+/*
+   Native recordings with a .rtpdump extension keep the negotiated codec payloads of both legs in one
+   rtpdump (rtptools) file so nothing is decoded or mixed on the media path; fs_encode mixes them offline.
+   The read leg uses an even SSRC and the write leg the odd one next to it, timestamps count decoded samples.
+*/
+#define RTPDUMP_IN 0
+#define RTPDUMP_OUT 1
+
+static switch_status_t record_rtpdump_open(struct record_helper *rh, switch_core_session_t *session, const char *file)
+{
+	char line[256];
+	uint32_t hdr[4];
+	switch_size_t len;
+	switch_time_t now = switch_micro_time_now();
+
+	if (switch_file_open(&rh->rtpdump, file, SWITCH_FOPEN_WRITE | SWITCH_FOPEN_CREATE | SWITCH_FOPEN_TRUNCATE | SWITCH_FOPEN_BINARY | SWITCH_FOPEN_BUFFERED,
+						 SWITCH_FPROT_OS_DEFAULT, switch_core_session_get_pool(session)) != SWITCH_STATUS_SUCCESS) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	switch_mutex_init(&rh->rtpdump_mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
+	rh->use_rtpdump = 1;
+	rh->rtpdump_start = now;
+	rh->rtp_ssrc = (uint32_t) ((intptr_t) rh ^ now) & ~1U;
+
+	switch_snprintf(line, sizeof(line), "#!rtpplay1.0 0.0.0.0/0\n");
+	len = strlen(line);
+	switch_file_write(rh->rtpdump, line, &len);
+
+	/* RD_hdr_t: start time, source address, port and padding in network order */
+	hdr[0] = htonl((uint32_t) (now / 1000000));
+	hdr[1] = htonl((uint32_t) (now % 1000000));
+	hdr[2] = 0;
+	hdr[3] = 0;
+	len = sizeof(hdr);
+	switch_file_write(rh->rtpdump, hdr, &len);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* label packets with the payload type actually negotiated for the call, not the codec's default one */
+static uint8_t record_rtpdump_pt(switch_frame_t *frame, int dir)
+{
+	if (dir == RTPDUMP_IN && frame->payload) {
+		return (uint8_t) frame->payload;
+	}
+
+	if (frame->codec->agreed_pt) {
+		return (uint8_t) frame->codec->agreed_pt;
+	}
+
+	return (uint8_t) frame->codec->implementation->ianacode;
+}
+
+static void record_rtpdump_frame(struct record_helper *rh, switch_frame_t *frame, int dir)
+{
+	const switch_codec_implementation_t *impl;
+	uint8_t packet[8 + 12 + SWITCH_RECOMMENDED_BUFFER_SIZE];
+	switch_time_t now = switch_micro_time_now();
+	uint32_t samples, expected;
+	uint16_t plen;
+	switch_size_t len;
+
+	if (!frame || !frame->datalen || frame->datalen > SWITCH_RECOMMENDED_BUFFER_SIZE || switch_test_flag(frame, SFF_CNG) ||
+		!frame->codec || !(impl = frame->codec->implementation)) {
+		return;
+	}
+
+	samples = impl->decoded_bytes_per_packet / 2;
+
+	switch_mutex_lock(rh->rtpdump_mutex);
+
+	/* the file may have been closed while this frame was on its way */
+	if (!rh->rtpdump) {
+		switch_mutex_unlock(rh->rtpdump_mutex);
+		return;
+	}
+
+	/* jump the timestamp over any silence we were not given so the offline mix stays aligned */
+	if (rh->rtp_last[dir]) {
+		expected = (uint32_t) ((now - rh->rtp_last[dir]) * impl->actual_samples_per_second / 1000000);
+		if (expected > samples * 2) {
+			rh->rtp_ts[dir] += expected - (expected % samples);
+		} else {
+			rh->rtp_ts[dir] += samples;
+		}
+	}
+	rh->rtp_last[dir] = now;
+
+	plen = (uint16_t) (12 + frame->datalen);
+
+	/* RD_packet_t header */
+	*(uint16_t *) (packet) = htons((uint16_t) (plen + 8));
+	*(uint16_t *) (packet + 2) = htons(plen);
+	*(uint32_t *) (packet + 4) = htonl((uint32_t) ((now - rh->rtpdump_start) / 1000));
+
+	/* RTP header */
+	packet[8] = 0x80;
+	packet[9] = (uint8_t) (record_rtpdump_pt(frame, dir) & 0x7f);
+	*(uint16_t *) (packet + 10) = htons(rh->rtp_seq[dir]++);
+	*(uint32_t *) (packet + 12) = htonl(rh->rtp_ts[dir]);
+	*(uint32_t *) (packet + 16) = htonl(rh->rtp_ssrc | dir);
+
+	memcpy(packet + 20, frame->data, frame->datalen);
+
+	len = plen + 8;
+	switch_file_write(rh->rtpdump, packet, &len);
+
+	switch_mutex_unlock(rh->rtpdump_mutex);
+}
+
 static switch_bool_t record_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
 {
 	switch_core_session_t *session = switch_core_media_bug_get_session(bug);
@@ -1121,8 +1240,12 @@ static switch_bool_t record_callback(switch_media_bug_t *bug, void *user_data, s
 
 			if (rh->rready && rh->wready) {
 				nframe = switch_core_media_bug_get_native_read_frame(bug);
-				len = nframe->datalen;
-				switch_core_file_write(&rh->in_fh, nframe->data, &len);
+				if (rh->use_rtpdump) {
+					record_rtpdump_frame(rh, nframe, RTPDUMP_IN);
+				} else {
+					len = nframe->datalen;
+					switch_core_file_write(&rh->in_fh, nframe->data, &len);
+				}
 			}
 		}
 		break;
@@ -1132,8 +1255,12 @@ static switch_bool_t record_callback(switch_media_bug_t *bug, void *user_data, s
 
 			if (rh->rready && rh->wready) {			
 				nframe = switch_core_media_bug_get_native_write_frame(bug);
-				len = nframe->datalen;
-				switch_core_file_write(&rh->out_fh, nframe->data, &len);
+				if (rh->use_rtpdump) {
+					record_rtpdump_frame(rh, nframe, RTPDUMP_OUT);
+				} else {
+					len = nframe->datalen;
+					switch_core_file_write(&rh->out_fh, nframe->data, &len);
+				}
 			}
 		}
 		break;
@@ -1147,7 +1274,14 @@ static switch_bool_t record_callback(switch_media_bug_t *bug, void *user_data, s
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "Stop recording file %s\n", rh->file);
 			switch_channel_set_private(channel, rh->file, NULL);
 
-			if (rh->native) {
+			if (rh->use_rtpdump) {
+				switch_mutex_lock(rh->rtpdump_mutex);
+				if (rh->rtpdump) {
+					switch_file_close(rh->rtpdump);
+					rh->rtpdump = NULL;
+				}
+				switch_mutex_unlock(rh->rtpdump_mutex);
+			} else if (rh->native) {
 				switch_core_file_close(&rh->in_fh);
 				switch_core_file_close(&rh->out_fh);
 			} else if (rh->fh) {
@@ -1949,7 +2083,35 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_record_session(switch_core_session_t
 	
 	rh = switch_core_session_alloc(session, sizeof(*rh));
 
-	if ((ext = strrchr(file, '.'))) {
+	if ((ext = strrchr(file, '.')) && !strcasecmp(ext, ".rtpdump")) {
+		int tflags = 0;
+
+		if (record_rtpdump_open(rh, session, file) != SWITCH_STATUS_SUCCESS) {
+			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error opening %s\n", file);
+			if (hangup_on_error) {
+				switch_channel_hangup(channel, SWITCH_CAUSE_DESTINATION_OUT_OF_ORDER);
+				switch_core_session_reset(session, SWITCH_TRUE, SWITCH_TRUE);
+			}
+			return SWITCH_STATUS_GENERR;
+		}
+
+		rh->native = 1;
+		fh = NULL;
+
+		if ((flags & SMBF_WRITE_STREAM)) {
+			tflags |= SMBF_TAP_NATIVE_WRITE;
+		}
+
+		if ((flags & SMBF_READ_STREAM)) {
+			tflags |= SMBF_TAP_NATIVE_READ;
+		}
+
+		/* only one leg is tapped, don't wait for the other before writing */
+		rh->rready = !(tflags & SMBF_TAP_NATIVE_READ);
+		rh->wready = !(tflags & SMBF_TAP_NATIVE_WRITE);
+
+		flags = tflags;
+	} else if (ext) {
 		ext++;
 		if (switch_core_file_open(fh, file, channels, read_impl.actual_samples_per_second, file_flags, NULL) != SWITCH_STATUS_SUCCESS) {
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error opening %s\n", file);
@@ -2063,7 +2225,11 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_record_session(switch_core_session_t
 	if ((status = switch_core_media_bug_add(session, "session_record", file,
 											record_callback, rh, to, flags, &bug)) != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error adding media bug for file %s\n", file);
-		switch_core_file_close(fh);
+		if (rh->rtpdump) {
+			switch_file_close(rh->rtpdump);
+		} else {
+			switch_core_file_close(fh);
+		}
 		return status;
 	}
 
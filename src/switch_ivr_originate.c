@@ -125,8 +125,23 @@ typedef struct {
 	switch_caller_profile_t *caller_profile_override;
 	switch_bool_t check_vars;
 	switch_memory_pool_t *pool;
+	switch_channel_waiter_t *waiter;
 } originate_global_t;
 
+/* longest nap between checks while no leg changes, bounds how late we notice caller hangup, cancel_cause and timeouts */
+#define ORIGINATE_WAIT_SLICE 100000
+
+static void originate_set_waiter(originate_status_t *originate_status, int max, switch_channel_waiter_t *waiter)
+{
+	int i;
+
+	for (i = 0; i < max; i++) {
+		if (originate_status[i].peer_channel) {
+			switch_channel_set_waiter(originate_status[i].peer_channel, waiter);
+		}
+	}
+}
+
 
 
 typedef enum {
@@ -461,8 +476,12 @@ static uint8_t check_channel_status(originate_global_t *oglobals, originate_stat
 				
 				
 				old_session = originate_status[i].peer_session;
+				switch_channel_set_waiter(originate_status[i].peer_channel, NULL);
 				originate_status[i].peer_session = swap_session;
 				originate_status[i].peer_channel = switch_core_session_get_channel(originate_status[i].peer_session);
+				if (oglobals->waiter) {
+					switch_channel_set_waiter(originate_status[i].peer_channel, oglobals->waiter);
+				}
 				originate_status[i].caller_profile = switch_channel_get_caller_profile(originate_status[i].peer_channel);
 				switch_channel_set_flag(originate_status[i].peer_channel, CF_ORIGINATING);
 
@@ -1843,6 +1862,7 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 	switch_channel_t *peer_channel = NULL;
 	ringback_t ringback = { 0 };
 	time_t start;
+	uint32_t wake_seq = 0;
 	switch_frame_t *read_frame = NULL;
 	int r = 0, i, and_argc = 0, or_argc = 0;
 	int32_t sleep_ms = 1000, try = 0, retries = 1;
@@ -1888,6 +1908,7 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 	oglobals.file = NULL;
 	oglobals.error_file = NULL;
 	switch_core_new_memory_pool(&oglobals.pool);
+	switch_channel_waiter_create(&oglobals.waiter, oglobals.pool);
 
 	if (caller_profile_override) {
 		oglobals.caller_profile_override = switch_caller_profile_dup(oglobals.pool, caller_profile_override);
@@ -2822,6 +2843,10 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 
 			switch_epoch_time_now(&start);
 
+			/* the legs wake us on every state or flag change so we don't have to spin while they ring */
+			originate_set_waiter(originate_status, and_argc, oglobals.waiter);
+			wake_seq = switch_channel_waiter_seq(oglobals.waiter);
+
 			for (;;) {
 				uint32_t valid_channels = 0;
 				for (i = 0; i < and_argc; i++) {
@@ -2865,8 +2890,6 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 						}
 						goto notready;
 					}
-
-					switch_cond_next();
 				}
 
 				check_per_channel_timeouts(&oglobals, originate_status, and_argc, start, &force_reason);
@@ -2877,6 +2900,8 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 					goto done;
 				}
 
+				switch_channel_waiter_wait(oglobals.waiter, wake_seq, ORIGINATE_WAIT_SLICE);
+				wake_seq = switch_channel_waiter_seq(oglobals.waiter);
 			}
 
 		  endfor1:
@@ -3150,12 +3175,16 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 			do_continue:
 
 				if (!read_packet) {
-					switch_yield(20000);
+					switch_channel_waiter_wait(oglobals.waiter, wake_seq, ORIGINATE_WAIT_SLICE);
 				}
+
+				wake_seq = switch_channel_waiter_seq(oglobals.waiter);
 			}
 
 		  notready:
 
+			originate_set_waiter(originate_status, and_argc, NULL);
+
 			if (caller_channel) {
 				holding = switch_channel_get_variable(caller_channel, SWITCH_HOLDING_UUID_VARIABLE);
 				switch_channel_set_variable(caller_channel, SWITCH_HOLDING_UUID_VARIABLE, NULL);
@@ -3445,6 +3474,8 @@ SWITCH_DECLARE(switch_status_t) switch_ivr_originate(switch_core_session_t *sess
 
 		  done:
 
+			originate_set_waiter(originate_status, and_argc, NULL);
+
 			*cause = SWITCH_CAUSE_NONE;
 
 			if (caller_channel && !switch_channel_ready(caller_channel)) {
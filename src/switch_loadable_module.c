@@ -75,8 +75,72 @@ struct switch_loadable_module_container {
 	switch_hash_t *limit_hash;
 	switch_mutex_t *mutex;
 	switch_memory_pool_t *pool;
+	switch_mutex_t *load_mutex;
+	switch_thread_cond_t *load_cond;
+	uint32_t loads_running;
+	uint32_t max_parallel_loads;
+	switch_time_t init_started;
+	switch_time_t init_finished;
+	struct module_load_record *timeline;
+	struct module_load_record *timeline_tail;
+	switch_mutex_t *lazy_mutex;
+	switch_thread_cond_t *lazy_cond;
+	struct lazy_module *lazy;
+	volatile int lazy_pending;
+	int lazy_loading;
+	int runtime_started;
 };
 
+typedef enum {
+	MODULE_LOAD_SYNC,
+	MODULE_LOAD_PARALLEL,
+	MODULE_LOAD_LAZY
+} module_load_mode_t;
+
+static const char *module_load_mode_names[] = { "sync", "parallel", "lazy" };
+
+/* one entry per module load attempted through modules.conf or a lazy lookup */
+struct module_load_record {
+	char *name;
+	module_load_mode_t mode;
+	switch_time_t started;
+	switch_time_t finished;
+	switch_status_t status;
+	struct module_load_record *next;
+};
+
+/* a <load parallel="true"/> entry; deps are earlier parallel entries it has to wait for */
+struct parallel_load_job {
+	char *path;
+	char *name;
+	switch_bool_t global;
+	switch_bool_t critical;
+	int done;
+	struct parallel_load_job **deps;
+	int ndeps;
+};
+
+typedef enum {
+	LAZY_PENDING,
+	LAZY_LOADING,
+	LAZY_LOADED
+} lazy_state_t;
+
+/* a <load lazy="true" interfaces="..."/> entry, loaded on the first lookup miss for one of its interfaces */
+struct lazy_module {
+	char *path;
+	char *name;
+	switch_bool_t global;
+	char *interfaces[64];
+	int ninterfaces;
+	lazy_state_t state;
+	switch_thread_id_t loader;
+	struct lazy_module *loading_next;
+	struct lazy_module *next;
+};
+
+#define MAX_PARALLEL_LOADS 8
+
 static struct switch_loadable_module_container loadable_modules;
 static switch_status_t do_shutdown(switch_loadable_module_t *module, switch_bool_t shutdown, switch_bool_t unload, switch_bool_t fail_if_busy,
 								   const char **err);
@@ -1419,6 +1483,277 @@ static switch_status_t switch_loadable_module_load_module_ex(char *dir, char *fn
 
 }
 
+static switch_status_t switch_loadable_module_load_timed(char *dir, char *fname, switch_bool_t runtime, switch_bool_t global,
+														  module_load_mode_t mode, const char **err)
+{
+	struct module_load_record *rec;
+	switch_time_t started = switch_time_now();
+	switch_status_t status;
+
+	status = switch_loadable_module_load_module_ex(dir, fname, runtime, global, err);
+
+	rec = switch_core_alloc(loadable_modules.pool, sizeof(*rec));
+	rec->name = switch_core_strdup(loadable_modules.pool, fname);
+	rec->mode = mode;
+	rec->started = started;
+	rec->finished = switch_time_now();
+	rec->status = status;
+
+	switch_mutex_lock(loadable_modules.load_mutex);
+	if (loadable_modules.timeline_tail) {
+		loadable_modules.timeline_tail->next = rec;
+	} else {
+		loadable_modules.timeline = rec;
+	}
+	loadable_modules.timeline_tail = rec;
+	switch_mutex_unlock(loadable_modules.load_mutex);
+
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Module %s took %" SWITCH_TIME_T_FMT "ms to load (%s)\n",
+					  fname, (rec->finished - rec->started) / 1000, module_load_mode_names[mode]);
+
+	return status;
+}
+
+static void *SWITCH_THREAD_FUNC parallel_load_thread(switch_thread_t *thread, void *obj)
+{
+	struct parallel_load_job *job = (struct parallel_load_job *) obj;
+	const char *err;
+	int i;
+
+	switch_mutex_lock(loadable_modules.load_mutex);
+	for (i = 0; i < job->ndeps; i++) {
+		while (!job->deps[i]->done) {
+			switch_thread_cond_wait(loadable_modules.load_cond, loadable_modules.load_mutex);
+		}
+	}
+	switch_mutex_unlock(loadable_modules.load_mutex);
+
+	if (switch_loadable_module_load_timed(job->path, job->name, SWITCH_FALSE, job->global, MODULE_LOAD_PARALLEL, &err) == SWITCH_STATUS_GENERR) {
+		if (job->critical) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Failed to load critical module '%s', abort()\n", job->name);
+			abort();
+		}
+	}
+
+	switch_mutex_lock(loadable_modules.load_mutex);
+	job->done = 1;
+	loadable_modules.loads_running--;
+	switch_thread_cond_broadcast(loadable_modules.load_cond);
+	switch_mutex_unlock(loadable_modules.load_mutex);
+
+	return NULL;
+}
+
+/* strip any extension so depends="mod_foo" matches module="mod_foo.so" */
+static char *parallel_load_key(const char *name)
+{
+	char *key = switch_core_strdup(loadable_modules.pool, switch_cut_path(name));
+	char *dot;
+
+	if ((dot = strchr(key, '.'))) {
+		*dot = '\0';
+	}
+
+	return key;
+}
+
+static void parallel_load_launch(switch_hash_t *jobs, char *path, const char *name, switch_bool_t global, switch_bool_t critical, const char *depends)
+{
+	struct parallel_load_job *job;
+	switch_threadattr_t *thd_attr = NULL;
+	switch_thread_t *thread;
+
+	job = switch_core_alloc(loadable_modules.pool, sizeof(*job));
+	job->path = path;
+	job->name = switch_core_strdup(loadable_modules.pool, name);
+	job->global = global;
+	job->critical = critical;
+
+	if (!zstr(depends)) {
+		char *dup = switch_core_strdup(loadable_modules.pool, depends);
+		char *argv[64] = { 0 };
+		int argc = switch_separate_string(dup, ',', argv, (sizeof(argv) / sizeof(argv[0])));
+		int i;
+
+		job->deps = switch_core_alloc(loadable_modules.pool, sizeof(*job->deps) * argc);
+		for (i = 0; i < argc; i++) {
+			struct parallel_load_job *dep;
+
+			if (zstr(argv[i])) {
+				continue;
+			}
+
+			/* Only earlier parallel entries can be waited on; anything listed before us without
+			   parallel="true" has already finished loading when we get here. */
+			if ((dep = switch_core_hash_find(jobs, parallel_load_key(argv[i])))) {
+				job->deps[job->ndeps++] = dep;
+			} else if (switch_loadable_module_exists(parallel_load_key(argv[i])) != SWITCH_STATUS_SUCCESS) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Module %s depends on %s which is not loaded before it, ignoring.\n",
+								  name, argv[i]);
+			}
+		}
+	}
+
+	switch_core_hash_insert(jobs, parallel_load_key(name), job);
+
+	switch_mutex_lock(loadable_modules.load_mutex);
+	while (loadable_modules.loads_running >= loadable_modules.max_parallel_loads) {
+		switch_thread_cond_wait(loadable_modules.load_cond, loadable_modules.load_mutex);
+	}
+	loadable_modules.loads_running++;
+	switch_mutex_unlock(loadable_modules.load_mutex);
+
+	switch_threadattr_create(&thd_attr, loadable_modules.pool);
+	switch_threadattr_detach_set(thd_attr, 1);
+	switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+	if (switch_thread_create(&thread, thd_attr, parallel_load_thread, job, loadable_modules.pool) != SWITCH_STATUS_SUCCESS) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Cannot start load thread for %s, loading it inline.\n", name);
+		parallel_load_thread(NULL, job);
+	}
+}
+
+/* barrier: every non-parallel entry waits for the parallel loads queued before it */
+static void parallel_load_wait(void)
+{
+	switch_mutex_lock(loadable_modules.load_mutex);
+	while (loadable_modules.loads_running) {
+		switch_thread_cond_wait(loadable_modules.load_cond, loadable_modules.load_mutex);
+	}
+	switch_mutex_unlock(loadable_modules.load_mutex);
+}
+
+static void lazy_module_add(char *path, const char *name, switch_bool_t global, const char *interfaces)
+{
+	struct lazy_module *lm;
+
+	lm = switch_core_alloc(loadable_modules.pool, sizeof(*lm));
+	lm->path = path;
+	lm->name = switch_core_strdup(loadable_modules.pool, name);
+	lm->global = global;
+	lm->ninterfaces = switch_separate_string(switch_core_strdup(loadable_modules.pool, interfaces), ',', lm->interfaces,
+											 (sizeof(lm->interfaces) / sizeof(lm->interfaces[0])));
+
+	switch_mutex_lock(loadable_modules.lazy_mutex);
+	lm->next = loadable_modules.lazy;
+	loadable_modules.lazy = lm;
+	loadable_modules.lazy_pending++;
+	switch_mutex_unlock(loadable_modules.lazy_mutex);
+
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "Deferring load of [%s] until first use\n", name);
+}
+
+/* Called after an interface lookup misses.  Loads every pending lazy module that claims the name in its
+   interfaces="" list and returns true if one was loaded (or finished loading in another thread meanwhile)
+   so the caller can retry its lookup.  The load itself runs without lazy_mutex held, so other lookups and
+   the module's own lookups while it loads are not serialized behind it. */
+static switch_bool_t switch_loadable_module_lazy_load(const char *name)
+{
+	struct lazy_module *lm, *todo = NULL;
+	switch_bool_t loaded = SWITCH_FALSE, waited;
+	switch_thread_id_t self = switch_thread_self();
+	const char *err;
+	int i;
+
+	if ((!loadable_modules.lazy_pending && !loadable_modules.lazy_loading) || zstr(name)) {
+		return SWITCH_FALSE;
+	}
+
+	switch_mutex_lock(loadable_modules.lazy_mutex);
+
+	do {
+		waited = SWITCH_FALSE;
+
+		for (lm = loadable_modules.lazy; lm; lm = lm->next) {
+			int match = 0;
+
+			if (lm->state == LAZY_LOADED) {
+				continue;
+			}
+
+			for (i = 0; !match && i < lm->ninterfaces; i++) {
+				match = !strcasecmp(lm->interfaces[i], name);
+			}
+
+			if (!match) {
+				continue;
+			}
+
+			if (lm->state == LAZY_LOADING) {
+				/* somebody else is loading it, wait for them unless it is our own load looking itself up */
+				if (!switch_thread_equal(lm->loader, self)) {
+					switch_thread_cond_wait(loadable_modules.lazy_cond, loadable_modules.lazy_mutex);
+					waited = loaded = SWITCH_TRUE;
+					break;
+				}
+				continue;
+			}
+
+			lm->state = LAZY_LOADING;
+			lm->loader = self;
+			lm->loading_next = todo;
+			todo = lm;
+			loadable_modules.lazy_pending--;
+			loadable_modules.lazy_loading++;
+		}
+	} while (waited);
+
+	switch_mutex_unlock(loadable_modules.lazy_mutex);
+
+	for (lm = todo; lm; lm = lm->loading_next) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Loading deferred module %s on first use of '%s'\n", lm->name, name);
+		if (switch_loadable_module_load_timed(lm->path, lm->name, loadable_modules.runtime_started ? SWITCH_TRUE : SWITCH_FALSE,
+											  lm->global, MODULE_LOAD_LAZY, &err) == SWITCH_STATUS_SUCCESS) {
+			loaded = SWITCH_TRUE;
+		}
+	}
+
+	if (todo) {
+		switch_mutex_lock(loadable_modules.lazy_mutex);
+		for (lm = todo; lm; lm = lm->loading_next) {
+			lm->state = LAZY_LOADED;
+			loadable_modules.lazy_loading--;
+		}
+		switch_thread_cond_broadcast(loadable_modules.lazy_cond);
+		switch_mutex_unlock(loadable_modules.lazy_mutex);
+	}
+
+	return loaded;
+}
+
+SWITCH_DECLARE(void) switch_loadable_module_timeline(switch_stream_handle_t *stream)
+{
+	struct module_load_record *rec;
+	struct lazy_module *lm;
+	switch_time_t base, total = 0;
+
+	switch_mutex_lock(loadable_modules.load_mutex);
+	base = loadable_modules.init_started;
+
+	stream->write_function(stream, "%-32s %-9s %10s %10s  %s\n", "module", "mode", "start(ms)", "took(ms)", "status");
+	for (rec = loadable_modules.timeline; rec; rec = rec->next) {
+		stream->write_function(stream, "%-32s %-9s %10" SWITCH_TIME_T_FMT " %10" SWITCH_TIME_T_FMT "  %s\n",
+							   rec->name, module_load_mode_names[rec->mode],
+							   (rec->started - base) / 1000, (rec->finished - rec->started) / 1000,
+							   rec->status == SWITCH_STATUS_SUCCESS ? "ok" : "failed");
+		total += rec->finished - rec->started;
+	}
+
+	if (loadable_modules.init_finished) {
+		stream->write_function(stream, "\nStartup took %" SWITCH_TIME_T_FMT "ms wall clock, %" SWITCH_TIME_T_FMT "ms in module load routines\n",
+							   (loadable_modules.init_finished - base) / 1000, total / 1000);
+	}
+	switch_mutex_unlock(loadable_modules.load_mutex);
+
+	switch_mutex_lock(loadable_modules.lazy_mutex);
+	for (lm = loadable_modules.lazy; lm; lm = lm->next) {
+		if (lm->state == LAZY_PENDING) {
+			stream->write_function(stream, "Deferred: %s\n", lm->name);
+		}
+	}
+	switch_mutex_unlock(loadable_modules.lazy_mutex);
+}
+
 SWITCH_DECLARE(switch_status_t) switch_loadable_module_exists(const char *mod)
 {
 	switch_status_t status;
@@ -1680,6 +2015,12 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 	switch_core_hash_init_nocase(&loadable_modules.limit_hash, loadable_modules.pool);
 	switch_core_hash_init_nocase(&loadable_modules.dialplan_hash, loadable_modules.pool);
 	switch_mutex_init(&loadable_modules.mutex, SWITCH_MUTEX_NESTED, loadable_modules.pool);
+	switch_mutex_init(&loadable_modules.load_mutex, SWITCH_MUTEX_NESTED, loadable_modules.pool);
+	switch_thread_cond_create(&loadable_modules.load_cond, loadable_modules.pool);
+	switch_mutex_init(&loadable_modules.lazy_mutex, SWITCH_MUTEX_NESTED, loadable_modules.pool);
+	switch_thread_cond_create(&loadable_modules.lazy_cond, loadable_modules.pool);
+	loadable_modules.max_parallel_loads = MAX_PARALLEL_LOADS;
+	loadable_modules.init_started = switch_time_now();
 
 	switch_loadable_module_load_module("", "CORE_SOFTTIMER_MODULE", SWITCH_FALSE, &err);
 	switch_loadable_module_load_module("", "CORE_PCM_MODULE", SWITCH_FALSE, &err);
@@ -1687,7 +2028,25 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 	if (!autoload) return SWITCH_STATUS_SUCCESS;
 
 	if ((xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
-		switch_xml_t mods, ld;
+		switch_xml_t mods, ld, settings, param;
+		switch_hash_t *jobs = NULL;
+
+		if ((settings = switch_xml_child(cfg, "settings"))) {
+			for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+				const char *var = switch_xml_attr_soft(param, "name");
+				const char *val = switch_xml_attr_soft(param, "value");
+
+				if (!strcasecmp(var, "max-parallel-loads")) {
+					int tmp = atoi(val);
+					if (tmp > 0) {
+						loadable_modules.max_parallel_loads = tmp;
+					}
+				}
+			}
+		}
+
+		switch_core_hash_init(&jobs, loadable_modules.pool);
+
 		if ((mods = switch_xml_child(cfg, "modules"))) {
 			for (ld = switch_xml_child(mods, "load"); ld; ld = ld->next) {
 				switch_bool_t global = SWITCH_FALSE;
@@ -1695,6 +2054,9 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 				const char *path = switch_xml_attr_soft(ld, "path");
 				const char *critical = switch_xml_attr_soft(ld, "critical");
 				const char *sglobal = switch_xml_attr_soft(ld, "global");
+				const char *parallel = switch_xml_attr_soft(ld, "parallel");
+				const char *lazy = switch_xml_attr_soft(ld, "lazy");
+				const char *interfaces = switch_xml_attr(ld, "interfaces");
 				if (zstr(val) || (strchr(val, '.') && !strstr(val, ext) && !strstr(val, EXT))) {
 					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "Invalid extension for %s\n", val);
 					continue;
@@ -1704,15 +2066,29 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 				if (path && zstr(path)) {
 					path = SWITCH_GLOBAL_dirs.mod_dir;
 				}
-				if (switch_loadable_module_load_module_ex((char *) path, (char *) val, SWITCH_FALSE, global, &err) == SWITCH_STATUS_GENERR) {
-					if (critical && switch_true(critical)) {
-						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Failed to load critical module '%s', abort()\n", val);
-						abort();
+
+				if (switch_true(lazy) && zstr(interfaces)) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Module %s is lazy but lists no interfaces, loading it now\n", val);
+				}
+
+				if (switch_true(lazy) && !zstr(interfaces) && !switch_true(critical)) {
+					lazy_module_add((char *) path, val, global, interfaces);
+				} else if (switch_true(parallel)) {
+					parallel_load_launch(jobs, (char *) path, val, global, switch_true(critical), switch_xml_attr(ld, "depends"));
+				} else {
+					parallel_load_wait();
+					if (switch_loadable_module_load_timed((char *) path, (char *) val, SWITCH_FALSE, global, MODULE_LOAD_SYNC, &err) == SWITCH_STATUS_GENERR) {
+						if (critical && switch_true(critical)) {
+							switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Failed to load critical module '%s', abort()\n", val);
+							abort();
+						}
 					}
 				}
 				count++;
 			}
 		}
+		parallel_load_wait();
+		switch_core_hash_destroy(&jobs);
 		switch_xml_free(xml);
 
 	} else {
@@ -1737,7 +2113,7 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 				if (path && zstr(path)) {
 					path = SWITCH_GLOBAL_dirs.mod_dir;
 				}
-				switch_loadable_module_load_module_ex((char *) path, (char *) val, SWITCH_FALSE, global, &err);
+				switch_loadable_module_load_timed((char *) path, (char *) val, SWITCH_FALSE, global, MODULE_LOAD_SYNC, &err);
 				count++;
 			}
 		}
@@ -1782,7 +2158,18 @@ SWITCH_DECLARE(switch_status_t) switch_loadable_module_init(switch_bool_t autolo
 		apr_dir_close(module_dir_handle);
 	}
 
+	/* lazy loads from here on have to start their own runtime thread, the ones already under way finish first */
+	switch_mutex_lock(loadable_modules.lazy_mutex);
+	while (loadable_modules.lazy_loading) {
+		switch_thread_cond_wait(loadable_modules.lazy_cond, loadable_modules.lazy_mutex);
+	}
 	switch_loadable_module_runtime();
+	loadable_modules.runtime_started = 1;
+	switch_mutex_unlock(loadable_modules.lazy_mutex);
+
+	loadable_modules.init_finished = switch_time_now();
+	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CONSOLE, "Modules loaded in %" SWITCH_TIME_T_FMT "ms, %d deferred\n",
+					  (loadable_modules.init_finished - loadable_modules.init_started) / 1000, loadable_modules.lazy_pending);
 
 	memset(&chat_globals, 0, sizeof(chat_globals));
 	chat_globals.running = 1;
@@ -1917,6 +2304,9 @@ SWITCH_DECLARE(switch_endpoint_interface_t *) switch_loadable_module_get_endpoin
 	}
 	switch_mutex_unlock(loadable_modules.mutex);
 
+	if (!ptr && switch_loadable_module_lazy_load(name)) {
+		return switch_loadable_module_get_endpoint_interface(name);
+	}
 
 	return ptr;
 }
@@ -1943,6 +2333,8 @@ SWITCH_DECLARE(switch_codec_interface_t *) switch_loadable_module_get_codec_inte
 
 	if (codec) {
 		PROTECT_INTERFACE(codec);
+	} else if (switch_loadable_module_lazy_load(name)) {
+		return switch_loadable_module_get_codec_interface(name);
 	}
 
 	return codec;
@@ -1953,6 +2345,8 @@ SWITCH_DECLARE(switch_codec_interface_t *) switch_loadable_module_get_codec_inte
 		switch_##_kind_##_interface_t *i;								\
 		if ((i = switch_core_hash_find_locked(loadable_modules._kind_##_hash, name, loadable_modules.mutex))) {	\
 			PROTECT_INTERFACE(i);										\
+		} else if (switch_loadable_module_lazy_load(name)) {			\
+			return switch_loadable_module_get_##_kind_##_interface(name); \
 		}																\
 		return i;														\
 	}
@@ -1972,7 +2366,13 @@ HASH_FUNC(limit)
 
 SWITCH_DECLARE(switch_say_interface_t *) switch_loadable_module_get_say_interface(const char *name)
 {
-	return switch_core_hash_find_locked(loadable_modules.say_hash, name, loadable_modules.mutex);
+	switch_say_interface_t *i;
+
+	if (!(i = switch_core_hash_find_locked(loadable_modules.say_hash, name, loadable_modules.mutex)) && switch_loadable_module_lazy_load(name)) {
+		return switch_loadable_module_get_say_interface(name);
+	}
+
+	return i;
 }
 
 SWITCH_DECLARE(switch_management_interface_t *) switch_loadable_module_get_management_interface(const char *relative_oid)
@@ -0,0 +1,587 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2012, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ *
+ * The Initial Developer of the Original Code is
+ * Anthony Minessale II <anthm@freeswitch.org>
+ * Portions created by the Initial Developer are Copyright (C)
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ *
+ * switch_spool.c -- Disk spool with batching delivery workers (mod_xml_cdr, mod_json_cdr)
+ *
+ */
+#include <switch.h>
+#include <sys/stat.h>
+
+#define SPOOL_SEGMENT_SIZE (16 * 1024 * 1024)
+
+/* Every record is written as this header followed by len bytes of payload.
+   done is rewritten in place once the record has been delivered or handed to the failed callback. */
+typedef struct {
+	uint32_t magic;
+	uint32_t len;
+	uint32_t done;
+	char name[64];
+} spool_hdr_t;
+
+typedef struct spool_segment {
+	uint32_t seq;
+	int fd;
+	char *path;
+	switch_size_t size;
+	uint32_t pending;
+	struct spool_segment *next;
+} spool_segment_t;
+
+typedef struct spool_entry {
+	spool_segment_t *segment;
+	switch_size_t offset;
+	uint32_t len;
+	char name[64];
+	switch_time_t queued;
+	struct spool_entry *next;
+} spool_entry_t;
+
+struct switch_spool {
+	switch_spool_settings_t settings;
+	char *dir;
+	switch_memory_pool_t *pool;
+	switch_thread_t *workers[SWITCH_SPOOL_MAX_WORKERS];
+	switch_mutex_t *mutex;
+	switch_thread_cond_t *cond;
+#ifdef WIN32
+	/* no pread()/pwrite(), so the seek and the transfer have to stay together */
+	switch_mutex_t *io_mutex;
+#endif
+	spool_segment_t *segments;
+	spool_segment_t *current;
+	uint32_t next_seq;
+	spool_entry_t *queue_head;
+	spool_entry_t *queue_tail;
+	uint32_t queued;
+	uint64_t spooled;
+	uint64_t delivered;
+	uint64_t failed;
+	uint64_t batches;
+	int shutdown;
+};
+
+static int spool_pread(switch_spool_t *spool, spool_segment_t *segment, void *buf, uint32_t len, switch_size_t offset)
+{
+#ifdef WIN32
+	int r = -1;
+
+	switch_mutex_lock(spool->io_mutex);
+	if (lseek(segment->fd, (off_t) offset, SEEK_SET) >= 0) {
+		r = read(segment->fd, buf, len);
+	}
+	switch_mutex_unlock(spool->io_mutex);
+
+	return r;
+#else
+	return (int) pread(segment->fd, buf, len, (off_t) offset);
+#endif
+}
+
+static int spool_pwrite(switch_spool_t *spool, spool_segment_t *segment, const void *buf, uint32_t len, switch_size_t offset)
+{
+#ifdef WIN32
+	int r = -1;
+
+	switch_mutex_lock(spool->io_mutex);
+	if (lseek(segment->fd, (off_t) offset, SEEK_SET) >= 0) {
+		r = write(segment->fd, buf, len);
+	}
+	switch_mutex_unlock(spool->io_mutex);
+
+	return r;
+#else
+	return (int) pwrite(segment->fd, buf, len, (off_t) offset);
+#endif
+}
+
+static spool_segment_t *spool_segment_open(switch_spool_t *spool, uint32_t seq)
+{
+	spool_segment_t *segment;
+
+	switch_zmalloc(segment, sizeof(*segment));
+	segment->seq = seq;
+	segment->path = switch_mprintf("%s%s%u.spool", spool->dir, SWITCH_PATH_SEPARATOR, seq);
+
+#ifdef _MSC_VER
+	segment->fd = open(segment->path, O_RDWR | O_CREAT | O_BINARY, S_IRUSR | S_IWUSR);
+#else
+	segment->fd = open(segment->path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+#endif
+
+	if (segment->fd < 0) {
+		char ebuf[512] = { 0 };
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot open spool segment [%s][%s]\n",
+						  segment->path, switch_strerror_r(errno, ebuf, sizeof(ebuf)));
+		switch_safe_free(segment->path);
+		free(segment);
+		return NULL;
+	}
+
+	if (seq >= spool->next_seq) {
+		spool->next_seq = seq + 1;
+	}
+
+	return segment;
+}
+
+/* must be called with the spool mutex held */
+static void spool_segment_release(switch_spool_t *spool, spool_segment_t *segment)
+{
+	spool_segment_t *sp, *last = NULL;
+
+	if (segment->pending || segment == spool->current) {
+		return;
+	}
+
+	for (sp = spool->segments; sp; sp = sp->next) {
+		if (sp == segment) {
+			if (last) {
+				last->next = sp->next;
+			} else {
+				spool->segments = sp->next;
+			}
+			break;
+		}
+		last = sp;
+	}
+
+	close(segment->fd);
+	unlink(segment->path);
+	switch_safe_free(segment->path);
+	free(segment);
+}
+
+/* must be called with the spool mutex held */
+static void spool_enqueue(switch_spool_t *spool, spool_segment_t *segment, switch_size_t offset, spool_hdr_t *hdr)
+{
+	spool_entry_t *entry;
+
+	switch_zmalloc(entry, sizeof(*entry));
+	entry->segment = segment;
+	entry->offset = offset;
+	entry->len = hdr->len;
+	switch_copy_string(entry->name, hdr->name, sizeof(entry->name));
+	entry->queued = switch_micro_time_now();
+
+	if (spool->queue_tail) {
+		spool->queue_tail->next = entry;
+	} else {
+		spool->queue_head = entry;
+	}
+	spool->queue_tail = entry;
+	spool->queued++;
+	segment->pending++;
+
+	switch_thread_cond_signal(spool->cond);
+}
+
+SWITCH_DECLARE(switch_status_t) switch_spool_write(switch_spool_t *spool, const char *name, const char *data)
+{
+	spool_hdr_t hdr = { 0 };
+	switch_status_t status = SWITCH_STATUS_FALSE;
+
+	if (!spool) {
+		return SWITCH_STATUS_FALSE;
+	}
+
+	hdr.magic = spool->settings.magic;
+	hdr.len = (uint32_t) strlen(data);
+	switch_copy_string(hdr.name, name, sizeof(hdr.name));
+
+	switch_mutex_lock(spool->mutex);
+
+	if (spool->shutdown) {
+		goto end;
+	}
+
+	if (!spool->current || spool->current->size >= SPOOL_SEGMENT_SIZE) {
+		spool_segment_t *segment, *sp;
+
+		if ((segment = spool_segment_open(spool, spool->next_seq))) {
+			spool_segment_t *old = spool->current;
+
+			for (sp = spool->segments; sp && sp->next; sp = sp->next);
+			if (sp) {
+				sp->next = segment;
+			} else {
+				spool->segments = segment;
+			}
+			spool->current = segment;
+
+			if (old) {
+				spool_segment_release(spool, old);
+			}
+		}
+	}
+
+	if (spool->current) {
+		spool_segment_t *segment = spool->current;
+
+		if (spool_pwrite(spool, segment, &hdr, sizeof(hdr), segment->size) == (int) sizeof(hdr) &&
+			spool_pwrite(spool, segment, data, hdr.len, segment->size + sizeof(hdr)) == (int) hdr.len) {
+			spool_enqueue(spool, segment, segment->size, &hdr);
+			segment->size += sizeof(hdr) + hdr.len;
+			spool->spooled++;
+			status = SWITCH_STATUS_SUCCESS;
+		} else {
+			/* don't leave a half written record behind anything we append later */
+			spool->current = NULL;
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error writing to spool segment %s\n", segment->path);
+			spool_segment_release(spool, segment);
+		}
+	}
+
+  end:
+	switch_mutex_unlock(spool->mutex);
+
+	return status;
+}
+
+/* the entry holds a pending count on its segment, so the fd stays open without the spool mutex */
+static char *spool_read(switch_spool_t *spool, spool_entry_t *entry)
+{
+	char *data;
+
+	switch_zmalloc(data, entry->len + 1);
+
+	if (spool_pread(spool, entry->segment, data, entry->len, entry->offset + sizeof(spool_hdr_t)) != (int) entry->len) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error reading %s from spool segment %s\n", entry->name, entry->segment->path);
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+static void spool_done(switch_spool_t *spool, spool_entry_t *entry)
+{
+	uint32_t done = 1;
+	spool_segment_t *segment = entry->segment;
+
+	if (spool_pwrite(spool, segment, &done, sizeof(done), entry->offset + offsetof(spool_hdr_t, done)) != (int) sizeof(done)) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Cannot mark %s delivered in %s\n", entry->name, segment->path);
+	}
+
+	switch_mutex_lock(spool->mutex);
+	segment->pending--;
+	spool_segment_release(spool, segment);
+	switch_mutex_unlock(spool->mutex);
+
+	free(entry);
+}
+
+/* Queue every undelivered record left in the spool by a previous run. */
+static void spool_replay(switch_spool_t *spool)
+{
+	switch_dir_t *dir;
+	char buf[256] = "";
+	const char *fname;
+	uint32_t replayed = 0;
+	spool_segment_t *segment, *sp, *last;
+
+	if (switch_dir_open(&dir, spool->dir, spool->pool) != SWITCH_STATUS_SUCCESS) {
+		return;
+	}
+
+	while ((fname = switch_dir_next_file(dir, buf, sizeof(buf)))) {
+		const char *ext = strstr(fname, ".spool");
+		const char *p;
+		uint32_t seq;
+
+		if (!ext || strcmp(ext, ".spool") || ext == fname) {
+			continue;
+		}
+
+		for (p = fname; p < ext && isdigit((unsigned char) *p); p++);
+		if (p != ext) {
+			continue;
+		}
+
+		seq = (uint32_t) atol(fname);
+		if (!(segment = spool_segment_open(spool, seq))) {
+			continue;
+		}
+
+		/* keep the list sorted oldest first */
+		for (last = NULL, sp = spool->segments; sp && sp->seq < seq; last = sp, sp = sp->next);
+		segment->next = sp;
+		if (last) {
+			last->next = segment;
+		} else {
+			spool->segments = segment;
+		}
+	}
+	switch_dir_close(dir);
+
+	switch_mutex_lock(spool->mutex);
+	for (segment = spool->segments; segment; segment = segment->next) {
+		spool_hdr_t hdr;
+		switch_size_t end = (switch_size_t) lseek(segment->fd, 0, SEEK_END);
+
+		while (spool_pread(spool, segment, &hdr, sizeof(hdr), segment->size) == (int) sizeof(hdr)) {
+			if (hdr.magic != spool->settings.magic || segment->size + sizeof(hdr) + hdr.len > end) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Corrupt record in spool segment %s, ignoring the rest\n", segment->path);
+				break;
+			}
+			hdr.name[sizeof(hdr.name) - 1] = '\0';
+			if (!hdr.done) {
+				spool_enqueue(spool, segment, segment->size, &hdr);
+				replayed++;
+			}
+			segment->size += sizeof(hdr) + hdr.len;
+		}
+	}
+
+	/* appends always go to a fresh segment; fully delivered old ones can go now */
+	for (segment = spool->segments; segment; segment = sp) {
+		sp = segment->next;
+		spool_segment_release(spool, segment);
+	}
+	switch_mutex_unlock(spool->mutex);
+
+	if (replayed) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Replaying %u record(s) from %s\n", replayed, spool->dir);
+	}
+}
+
+static void spool_deliver(switch_spool_t *spool, void *worker_data, spool_entry_t **batch, uint32_t count)
+{
+	switch_spool_record_t records[SWITCH_SPOOL_MAX_BATCH];
+	spool_entry_t *ready[SWITCH_SPOOL_MAX_BATCH];
+	char *body = NULL;
+	uint32_t i, n = 0;
+	switch_status_t status = SWITCH_STATUS_FALSE;
+
+	for (i = 0; i < count; i++) {
+		char *data;
+
+		if ((data = spool_read(spool, batch[i]))) {
+			records[n].name = batch[i]->name;
+			records[n].data = data;
+			records[n].len = batch[i]->len;
+			ready[n++] = batch[i];
+		} else {
+			/* unreadable, nothing to retry it with */
+			spool_done(spool, batch[i]);
+		}
+	}
+
+	if (n == 1) {
+		status = spool->settings.post(worker_data, records[0].data, records, n, spool->settings.user_data);
+	} else if (n && (body = spool->settings.render(records, n, spool->settings.user_data))) {
+		status = spool->settings.post(worker_data, body, records, n, spool->settings.user_data);
+	}
+
+	if (status == SWITCH_STATUS_BREAK) {
+		/* left marked pending in the spool for the next start */
+		for (i = 0; i < n; i++) {
+			free(ready[i]);
+		}
+		goto end;
+	}
+
+	if (status == SWITCH_STATUS_SUCCESS) {
+		switch_mutex_lock(spool->mutex);
+		spool->delivered += n;
+		spool->batches++;
+		switch_mutex_unlock(spool->mutex);
+	} else if (n) {
+		for (i = 0; i < n; i++) {
+			spool->settings.failed(&records[i], spool->settings.user_data);
+		}
+		switch_mutex_lock(spool->mutex);
+		spool->failed += n;
+		switch_mutex_unlock(spool->mutex);
+	}
+
+	for (i = 0; i < n; i++) {
+		spool_done(spool, ready[i]);
+	}
+
+  end:
+	for (i = 0; i < n; i++) {
+		free(records[i].data);
+	}
+	switch_safe_free(body);
+}
+
+static void *SWITCH_THREAD_FUNC spool_worker(switch_thread_t *thread, void *obj)
+{
+	switch_spool_t *spool = (switch_spool_t *) obj;
+	spool_entry_t *batch[SWITCH_SPOOL_MAX_BATCH];
+	void *worker_data = NULL;
+	uint32_t count;
+
+	if (spool->settings.worker_init) {
+		worker_data = spool->settings.worker_init(spool->settings.user_data);
+	}
+
+	while (!spool->shutdown) {
+		count = 0;
+
+		switch_mutex_lock(spool->mutex);
+		while (!spool->shutdown && !spool->queue_head) {
+			switch_thread_cond_wait(spool->cond, spool->mutex);
+		}
+		while (!spool->shutdown && spool->queue_head && count < spool->settings.batch_size) {
+			batch[count++] = spool->queue_head;
+			if (!(spool->queue_head = spool->queue_head->next)) {
+				spool->queue_tail = NULL;
+			}
+			spool->queued--;
+		}
+		switch_mutex_unlock(spool->mutex);
+
+		if (count) {
+			spool_deliver(spool, worker_data, batch, count);
+		}
+	}
+
+	if (spool->settings.worker_destroy) {
+		spool->settings.worker_destroy(worker_data, spool->settings.user_data);
+	}
+
+	return NULL;
+}
+
+SWITCH_DECLARE(switch_status_t) switch_spool_create(switch_spool_t **spoolp, const switch_spool_settings_t *settings, switch_memory_pool_t *pool)
+{
+	switch_spool_t *spool;
+	switch_threadattr_t *thd_attr = NULL;
+	uint32_t i;
+
+	switch_assert(settings->post && settings->render && settings->failed);
+
+	if (switch_dir_make_recursive(settings->dir, SWITCH_DEFAULT_DIR_PERMS, pool) != SWITCH_STATUS_SUCCESS) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create spool dir %s\n", settings->dir);
+		return SWITCH_STATUS_FALSE;
+	}
+
+	spool = switch_core_alloc(pool, sizeof(*spool));
+	spool->settings = *settings;
+	spool->dir = switch_core_strdup(pool, settings->dir);
+	spool->pool = pool;
+
+	if (!spool->settings.workers) {
+		spool->settings.workers = 1;
+	} else if (spool->settings.workers > SWITCH_SPOOL_MAX_WORKERS) {
+		spool->settings.workers = SWITCH_SPOOL_MAX_WORKERS;
+	}
+
+	if (!spool->settings.batch_size) {
+		spool->settings.batch_size = 1;
+	} else if (spool->settings.batch_size > SWITCH_SPOOL_MAX_BATCH) {
+		spool->settings.batch_size = SWITCH_SPOOL_MAX_BATCH;
+	}
+
+	switch_mutex_init(&spool->mutex, SWITCH_MUTEX_NESTED, pool);
+	switch_thread_cond_create(&spool->cond, pool);
+#ifdef WIN32
+	switch_mutex_init(&spool->io_mutex, SWITCH_MUTEX_NESTED, pool);
+#endif
+
+	spool_replay(spool);
+
+	switch_threadattr_create(&thd_attr, pool);
+	switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+	for (i = 0; i < spool->settings.workers; i++) {
+		switch_thread_create(&spool->workers[i], thd_attr, spool_worker, spool, pool);
+	}
+
+	*spoolp = spool;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_DECLARE(void) switch_spool_status(switch_spool_t *spool, switch_stream_handle_t *stream)
+{
+	switch_time_t oldest = 0;
+
+	switch_mutex_lock(spool->mutex);
+	if (spool->queue_head) {
+		oldest = (switch_micro_time_now() - spool->queue_head->queued) / 1000000;
+	}
+	stream->write_function(stream, "spool: %s\nworkers: %u batch-size: %u\n", spool->dir, spool->settings.workers, spool->settings.batch_size);
+	stream->write_function(stream, "backlog: %u oldest: %" SWITCH_TIME_T_FMT "s\n", spool->queued, oldest);
+	stream->write_function(stream, "spooled: %" SWITCH_UINT64_T_FMT " delivered: %" SWITCH_UINT64_T_FMT " failed: %" SWITCH_UINT64_T_FMT
+						   " posts: %" SWITCH_UINT64_T_FMT "\n", spool->spooled, spool->delivered, spool->failed, spool->batches);
+	switch_mutex_unlock(spool->mutex);
+}
+
+SWITCH_DECLARE(void) switch_spool_destroy(switch_spool_t **spoolp)
+{
+	switch_spool_t *spool = *spoolp;
+	spool_entry_t *entry;
+	spool_segment_t *segment;
+	switch_status_t st;
+	uint32_t i;
+
+	if (!spool) {
+		return;
+	}
+
+	*spoolp = NULL;
+
+	switch_mutex_lock(spool->mutex);
+	spool->shutdown = 1;
+	switch_thread_cond_broadcast(spool->cond);
+	switch_mutex_unlock(spool->mutex);
+
+	for (i = 0; i < spool->settings.workers; i++) {
+		if (spool->workers[i]) {
+			switch_thread_join(&st, spool->workers[i]);
+		}
+	}
+
+	/* undelivered records are still marked pending in the spool and get replayed on the next start */
+	switch_mutex_lock(spool->mutex);
+	while ((entry = spool->queue_head)) {
+		spool->queue_head = entry->next;
+		free(entry);
+	}
+	spool->queue_tail = NULL;
+	spool->queued = 0;
+
+	while ((segment = spool->segments)) {
+		spool->segments = segment->next;
+		close(segment->fd);
+		switch_safe_free(segment->path);
+		free(segment);
+	}
+	spool->current = NULL;
+	switch_mutex_unlock(spool->mutex);
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4:
+ */
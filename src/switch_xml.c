@@ -55,6 +55,7 @@
  */
 
 #include <switch.h>
+#include "private/switch_core_pvt.h"
 #ifndef WIN32
 #include <sys/wait.h>
 #include <switch_private.h>
@@ -151,6 +152,56 @@ static void *XML_OPEN_ROOT_FUNCTION_USER_DATA = NULL;
 
 static switch_hash_t *CACHE_HASH = NULL;
 
+/*
+  User directory cache, keyed on key+user+domain and guarded by CACHE_MUTEX.
+  An entry with a NULL user is a negative entry.  Entries are kept on an LRU list so the table can be capped.
+  A backend lookup in progress is a flight, kept apart from the entries: callers asking for the same key while
+  it runs wait on that flight's own cond and take its result instead of hitting the backend themselves.
+*/
+typedef struct user_cache_entry_s {
+	char *mega_key;
+	switch_xml_t user;
+	switch_time_t expires;
+	switch_time_t stale_until;
+	uint8_t refreshing;
+	char *key;
+	char *user_name;
+	char *domain_name;
+	char *ip;
+	switch_event_t *params;
+	struct user_cache_entry_s *prev;
+	struct user_cache_entry_s *next;
+} user_cache_entry_t;
+
+typedef struct user_cache_flight_s {
+	char *mega_key;
+	switch_thread_cond_t *cond;
+	uint8_t done;
+	uint32_t waiters;
+	switch_status_t status;
+	switch_xml_t user;
+	struct user_cache_flight_s *next;
+} user_cache_flight_t;
+
+static struct {
+	user_cache_entry_t *head;
+	user_cache_entry_t *tail;
+	uint32_t count;
+	uint32_t generation;
+	switch_hash_t *flights;
+	user_cache_flight_t *free_flights;
+	uint64_t hits;
+	uint64_t negative_hits;
+	uint64_t stale_hits;
+	uint64_t misses;
+	uint64_t coalesced;
+	uint64_t refreshes;
+	uint64_t evictions;
+} USER_CACHE;
+
+/* how long a caller waits on somebody else's lookup before doing its own */
+#define USER_CACHE_COALESCE_WAIT 5000000
+
 struct xml_section_t {
 	const char *name;
 	/* switch_xml_section_t section; */
@@ -1881,32 +1932,337 @@ SWITCH_DECLARE(void) switch_xml_merge_user(switch_xml_t user, switch_xml_t domai
 	do_merge(user, domain, "variables", "variable");
 }
 
+static void user_cache_unlink(user_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		USER_CACHE.head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		USER_CACHE.tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void user_cache_push(user_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = USER_CACHE.head;
+
+	if (USER_CACHE.head) {
+		USER_CACHE.head->prev = entry;
+	} else {
+		USER_CACHE.tail = entry;
+	}
+
+	USER_CACHE.head = entry;
+}
+
+static void user_cache_touch(user_cache_entry_t *entry)
+{
+	if (USER_CACHE.head != entry) {
+		user_cache_unlink(entry);
+		user_cache_push(entry);
+	}
+}
+
+/* CACHE_MUTEX must be held */
+static void user_cache_remove(user_cache_entry_t *entry)
+{
+	switch_core_hash_delete(CACHE_HASH, entry->mega_key);
+	user_cache_unlink(entry);
+	USER_CACHE.count--;
+
+	if (entry->user) {
+		switch_xml_free(entry->user);
+	}
+
+	if (entry->params) {
+		switch_event_destroy(&entry->params);
+	}
+
+	switch_safe_free(entry->mega_key);
+	switch_safe_free(entry->key);
+	switch_safe_free(entry->user_name);
+	switch_safe_free(entry->domain_name);
+	switch_safe_free(entry->ip);
+	free(entry);
+}
+
+/* CACHE_MUTEX must be held */
+static user_cache_entry_t *user_cache_add(const char *mega_key, const char *key, const char *user_name, const char *domain_name, const char *ip)
+{
+	user_cache_entry_t *entry, *victim;
+
+	if (runtime.user_cache_max) {
+		for (victim = USER_CACHE.tail; victim && USER_CACHE.count >= runtime.user_cache_max; ) {
+			user_cache_entry_t *prev = victim->prev;
+
+			if (!victim->refreshing) {
+				user_cache_remove(victim);
+				USER_CACHE.evictions++;
+			}
+
+			victim = prev;
+		}
+	}
+
+	switch_zmalloc(entry, sizeof(*entry));
+	entry->mega_key = strdup(mega_key);
+	entry->key = strdup(key);
+	entry->user_name = user_name ? strdup(user_name) : NULL;
+	entry->domain_name = domain_name ? strdup(domain_name) : NULL;
+	entry->ip = ip ? strdup(ip) : NULL;
+
+	switch_core_hash_insert(CACHE_HASH, entry->mega_key, entry);
+	user_cache_push(entry);
+	USER_CACHE.count++;
+
+	return entry;
+}
+
+/*
+  cacheable="true" on the user (or failing that on the domain) uses user-cache-ttl from switch.conf,
+  a number is the ttl in ms for that user or domain and 0 means until flushed.
+*/
+static switch_bool_t user_cache_ttl(switch_xml_t user, switch_xml_t domain, uint32_t *ttl)
+{
+	const char *cacheable = switch_xml_attr(user, "cacheable");
+
+	if (zstr(cacheable) && domain) {
+		cacheable = switch_xml_attr(domain, "cacheable");
+	}
+
+	if (zstr(cacheable)) {
+		return SWITCH_FALSE;
+	}
+
+	if (switch_is_number(cacheable)) {
+		int tmp = atoi(cacheable);
+		*ttl = tmp > 0 ? (uint32_t) tmp : 0;
+		return SWITCH_TRUE;
+	}
+
+	if (switch_true(cacheable)) {
+		*ttl = runtime.user_cache_ttl;
+		return SWITCH_TRUE;
+	}
+
+	return SWITCH_FALSE;
+}
+
+/* CACHE_MUTEX must be held, user is consumed */
+static void user_cache_fill(user_cache_entry_t *entry, switch_xml_t user, uint32_t ttl)
+{
+	switch_time_t now = switch_micro_time_now();
+
+	if (entry->user) {
+		switch_xml_free(entry->user);
+	}
+
+	entry->user = user;
+	entry->expires = ttl ? now + (switch_time_t) ttl * 1000 : 0;
+	entry->stale_until = entry->expires && user ? entry->expires + (switch_time_t) runtime.user_cache_stale_ttl * 1000 : 0;
+}
+
+/* CACHE_MUTEX must be held, flights are recycled so their conds come from the xml pool only once */
+static user_cache_flight_t *user_cache_flight_new(const char *mega_key)
+{
+	user_cache_flight_t *flight;
+
+	if ((flight = USER_CACHE.free_flights)) {
+		USER_CACHE.free_flights = flight->next;
+	} else {
+		switch_zmalloc(flight, sizeof(*flight));
+		switch_thread_cond_create(&flight->cond, XML_MEMORY_POOL);
+	}
+
+	flight->mega_key = strdup(mega_key);
+	flight->done = 0;
+	flight->waiters = 0;
+	flight->status = SWITCH_STATUS_FALSE;
+	flight->user = NULL;
+	flight->next = NULL;
+
+	switch_core_hash_insert(USER_CACHE.flights, flight->mega_key, flight);
+
+	return flight;
+}
+
+/* CACHE_MUTEX must be held, the flight must be landed or abandoned by everyone */
+static void user_cache_flight_release(user_cache_flight_t *flight)
+{
+	if (flight->user) {
+		switch_xml_free(flight->user);
+		flight->user = NULL;
+	}
+
+	switch_safe_free(flight->mega_key);
+	flight->next = USER_CACHE.free_flights;
+	USER_CACHE.free_flights = flight;
+}
+
+/* CACHE_MUTEX must be held, hands the result to whoever waited and frees the flight once nobody holds it */
+static void user_cache_flight_land(user_cache_flight_t *flight, switch_status_t status, switch_xml_t user)
+{
+	switch_core_hash_delete(USER_CACHE.flights, flight->mega_key);
+
+	flight->status = status;
+	flight->done = 1;
+
+	if (!flight->waiters) {
+		user_cache_flight_release(flight);
+		return;
+	}
+
+	if (status == SWITCH_STATUS_SUCCESS && user) {
+		flight->user = switch_xml_dup(user);
+	}
+
+	switch_thread_cond_broadcast(flight->cond);
+}
+
+static switch_status_t user_cache_lookup(const char *key, const char *user_name, const char *domain_name, const char *ip,
+										 switch_event_t *params, switch_xml_t *user, switch_bool_t *cache, uint32_t *ttl)
+{
+	switch_xml_t xml, domain, group, x_user, x_user_dup;
+	switch_status_t status;
+
+	*cache = SWITCH_FALSE;
+
+	if ((status = switch_xml_locate_user(key, user_name, domain_name, ip, &xml, &domain, &x_user, &group, params)) == SWITCH_STATUS_SUCCESS) {
+		x_user_dup = switch_xml_dup(x_user);
+		switch_xml_merge_user(x_user_dup, domain, group);
+		*cache = user_cache_ttl(x_user_dup, domain, ttl);
+		*user = x_user_dup;
+		switch_xml_free(xml);
+	}
+
+	return status;
+}
+
+struct user_cache_refresh {
+	char *mega_key;
+	switch_memory_pool_t *pool;
+};
+
+static void *SWITCH_THREAD_FUNC user_cache_refresh_thread(switch_thread_t *thread, void *obj)
+{
+	struct user_cache_refresh *ur = (struct user_cache_refresh *) obj;
+	switch_memory_pool_t *pool = ur->pool;
+	char *mega_key = ur->mega_key;
+	user_cache_entry_t *entry;
+	char *key = NULL, *user_name = NULL, *domain_name = NULL, *ip = NULL;
+	switch_event_t *params = NULL;
+	switch_xml_t user = NULL;
+	switch_bool_t cache = SWITCH_FALSE;
+	uint32_t ttl = 0;
+	switch_status_t status;
+
+	switch_mutex_lock(CACHE_MUTEX);
+	if ((entry = switch_core_hash_find(CACHE_HASH, mega_key))) {
+		key = strdup(entry->key);
+		user_name = entry->user_name ? strdup(entry->user_name) : NULL;
+		domain_name = entry->domain_name ? strdup(entry->domain_name) : NULL;
+		ip = entry->ip ? strdup(entry->ip) : NULL;
+		if (entry->params) {
+			switch_event_dup(&params, entry->params);
+		}
+	}
+	switch_mutex_unlock(CACHE_MUTEX);
+
+	if (!key) {
+		goto end;
+	}
+
+	status = user_cache_lookup(key, user_name, domain_name, ip, params, &user, &cache, &ttl);
+
+	switch_mutex_lock(CACHE_MUTEX);
+	if ((entry = switch_core_hash_find(CACHE_HASH, mega_key))) {
+		entry->refreshing = 0;
+
+		if (status == SWITCH_STATUS_SUCCESS && cache) {
+			user_cache_fill(entry, user, ttl);
+			user = NULL;
+		} else if (status == SWITCH_STATUS_SUCCESS) {
+			/* no longer cacheable */
+			user_cache_remove(entry);
+		}
+		/* on failure keep serving the stale copy until its window closes */
+	}
+	switch_mutex_unlock(CACHE_MUTEX);
+
+  end:
+
+	if (user) {
+		switch_xml_free(user);
+	}
+
+	if (params) {
+		switch_event_destroy(&params);
+	}
+
+	switch_safe_free(key);
+	switch_safe_free(user_name);
+	switch_safe_free(domain_name);
+	switch_safe_free(ip);
+	switch_core_destroy_memory_pool(&pool);
+
+	return NULL;
+}
+
+static switch_status_t user_cache_refresh(const char *mega_key)
+{
+	switch_thread_t *thread;
+	switch_threadattr_t *thd_attr;
+	switch_memory_pool_t *pool = NULL;
+	struct user_cache_refresh *ur;
+
+	switch_core_new_memory_pool(&pool);
+
+	ur = switch_core_alloc(pool, sizeof(*ur));
+	ur->pool = pool;
+	ur->mega_key = switch_core_strdup(pool, mega_key);
+
+	switch_threadattr_create(&thd_attr, pool);
+	switch_threadattr_detach_set(thd_attr, 1);
+	switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+	if (switch_thread_create(&thread, thd_attr, user_cache_refresh_thread, ur, pool) != SWITCH_STATUS_SUCCESS) {
+		switch_core_destroy_memory_pool(&pool);
+		return SWITCH_STATUS_FALSE;
+	}
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_DECLARE(uint32_t) switch_xml_clear_user_cache(const char *key, const char *user_name, const char *domain_name)
 {
-	switch_hash_index_t *hi;
-	void *val;
-	const void *var;
 	char mega_key[1024];
 	int r = 0;
-	switch_xml_t lookup;
+	user_cache_entry_t *entry;
 
 	switch_mutex_lock(CACHE_MUTEX);
 
+	/* lookups in flight when the cache is cleared must not put what they find back in */
+	USER_CACHE.generation++;
+
 	if (key && user_name && domain_name) {
 		switch_snprintf(mega_key, sizeof(mega_key), "%s%s%s", key, user_name, domain_name);
 
-		if ((lookup = switch_core_hash_find(CACHE_HASH, mega_key))) {
-			switch_core_hash_delete(CACHE_HASH, mega_key);
-			switch_xml_free(lookup);
+		if ((entry = switch_core_hash_find(CACHE_HASH, mega_key))) {
+			user_cache_remove(entry);
 			r++;
 		}
 		
 	} else {
 		
-		while ((hi = switch_hash_first(NULL, CACHE_HASH))) {
-			switch_hash_this(hi, &var, NULL, &val);
-			switch_xml_free(val);
-			switch_core_hash_delete(CACHE_HASH, var);
+		while ((entry = USER_CACHE.head)) {
+			user_cache_remove(entry);
 			r++;
 		}
 	}
@@ -1917,58 +2273,144 @@ SWITCH_DECLARE(uint32_t) switch_xml_clear_user_cache(const char *key, const char
 	
 }
 
-static switch_status_t switch_xml_locate_user_cache(const char *key, const char *user_name, const char *domain_name, switch_xml_t *user)
+SWITCH_DECLARE(void) switch_xml_user_cache_stats(switch_stream_handle_t *stream)
 {
-	char mega_key[1024];
-	switch_xml_t lookup;
-	switch_status_t status = SWITCH_STATUS_FALSE;
-
-	switch_snprintf(mega_key, sizeof(mega_key), "%s%s%s", key, user_name, domain_name);
+	uint64_t lookups;
 
 	switch_mutex_lock(CACHE_MUTEX);
-	if ((lookup = switch_core_hash_find(CACHE_HASH, mega_key))) {
-		*user = switch_xml_dup(lookup);
-		status = SWITCH_STATUS_SUCCESS;
-	}
+	lookups = USER_CACHE.hits + USER_CACHE.negative_hits + USER_CACHE.stale_hits + USER_CACHE.misses;
+	stream->write_function(stream, "entries: %u/%u\n", USER_CACHE.count, runtime.user_cache_max);
+	stream->write_function(stream, "lookups: %" SWITCH_UINT64_T_FMT "\n", lookups);
+	stream->write_function(stream, "hits: %" SWITCH_UINT64_T_FMT " negative: %" SWITCH_UINT64_T_FMT " stale: %" SWITCH_UINT64_T_FMT "\n",
+						   USER_CACHE.hits, USER_CACHE.negative_hits, USER_CACHE.stale_hits);
+	stream->write_function(stream, "misses: %" SWITCH_UINT64_T_FMT " coalesced: %" SWITCH_UINT64_T_FMT "\n", USER_CACHE.misses, USER_CACHE.coalesced);
+	stream->write_function(stream, "refreshes: %" SWITCH_UINT64_T_FMT " evictions: %" SWITCH_UINT64_T_FMT "\n", USER_CACHE.refreshes, USER_CACHE.evictions);
+	stream->write_function(stream, "hit-ratio: %.2f%%\n",
+						   lookups ? (double) (USER_CACHE.hits + USER_CACHE.negative_hits + USER_CACHE.stale_hits) * 100 / lookups : 0.0);
 	switch_mutex_unlock(CACHE_MUTEX);
-
-	return status;
 }
 
-static void switch_xml_user_cache(const char *key, const char *user_name, const char *domain_name, switch_xml_t user)
+SWITCH_DECLARE(switch_status_t) switch_xml_locate_user_merged(const char *key, const char *user_name, const char *domain_name,
+															  const char *ip, switch_xml_t *user, switch_event_t *params)
 {
 	char mega_key[1024];
-	switch_xml_t lookup;
+	switch_xml_t x_user = NULL;
+	switch_status_t status = SWITCH_STATUS_FALSE;
+	user_cache_entry_t *entry;
+	user_cache_flight_t *flight = NULL;
+	switch_bool_t cache = SWITCH_FALSE;
+	uint32_t ttl = 0, generation;
+	switch_time_t now, deadline;
 
 	switch_snprintf(mega_key, sizeof(mega_key), "%s%s%s", key, user_name, domain_name);
+
 	switch_mutex_lock(CACHE_MUTEX);
-	if ((lookup = switch_core_hash_find(CACHE_HASH, mega_key))) {
-		switch_core_hash_delete(CACHE_HASH, mega_key);
-		switch_xml_free(lookup);
+
+	now = switch_micro_time_now();
+
+	if ((entry = switch_core_hash_find(CACHE_HASH, mega_key))) {
+		if (!entry->expires || now < entry->expires) {
+			user_cache_touch(entry);
+
+			if (entry->user) {
+				USER_CACHE.hits++;
+				*user = switch_xml_dup(entry->user);
+				status = SWITCH_STATUS_SUCCESS;
+			} else {
+				USER_CACHE.negative_hits++;
+			}
+
+			switch_mutex_unlock(CACHE_MUTEX);
+			return status;
+		}
+
+		if (entry->user && now < entry->stale_until) {
+			user_cache_touch(entry);
+			USER_CACHE.stale_hits++;
+			*user = switch_xml_dup(entry->user);
+
+			if (!entry->refreshing) {
+				USER_CACHE.refreshes++;
+				entry->refreshing = user_cache_refresh(mega_key) == SWITCH_STATUS_SUCCESS;
+			}
+
+			switch_mutex_unlock(CACHE_MUTEX);
+			return SWITCH_STATUS_SUCCESS;
+		}
+
+		/* while the refresh thread owns it leave it be, it is replaced below if we find something cacheable */
+		if (!entry->refreshing) {
+			user_cache_remove(entry);
+		}
 	}
-	
-	switch_core_hash_insert(CACHE_HASH, mega_key, switch_xml_dup(user));
+
+	if ((flight = switch_core_hash_find(USER_CACHE.flights, mega_key))) {
+		USER_CACHE.coalesced++;
+		flight->waiters++;
+		deadline = now + USER_CACHE_COALESCE_WAIT;
+
+		while (!flight->done && (now = switch_micro_time_now()) < deadline) {
+			switch_thread_cond_timedwait(flight->cond, CACHE_MUTEX, deadline - now);
+		}
+
+		flight->waiters--;
+
+		if (flight->done) {
+			if ((status = flight->status) == SWITCH_STATUS_SUCCESS) {
+				*user = switch_xml_dup(flight->user);
+			}
+
+			if (!flight->waiters) {
+				user_cache_flight_release(flight);
+			}
+
+			switch_mutex_unlock(CACHE_MUTEX);
+			return status;
+		}
+
+		/* the lookup we waited on is taking too long, do our own without holding anyone else up on it */
+		flight = NULL;
+	} else {
+		flight = user_cache_flight_new(mega_key);
+	}
+
+	USER_CACHE.misses++;
+	generation = USER_CACHE.generation;
+
 	switch_mutex_unlock(CACHE_MUTEX);
-}
 
-SWITCH_DECLARE(switch_status_t) switch_xml_locate_user_merged(const char *key, const char *user_name, const char *domain_name,
-															  const char *ip, switch_xml_t *user, switch_event_t *params)
-{
-	switch_xml_t xml, domain, group, x_user, x_user_dup;
-	switch_status_t status = SWITCH_STATUS_FALSE;
+	status = user_cache_lookup(key, user_name, domain_name, ip, params, &x_user, &cache, &ttl);
 
-	if ((status = switch_xml_locate_user_cache(key, user_name, domain_name, &x_user)) == SWITCH_STATUS_SUCCESS) {
+	if (status == SWITCH_STATUS_SUCCESS) {
 		*user = x_user;
-	} else if ((status = switch_xml_locate_user(key, user_name, domain_name, ip, &xml, &domain, &x_user, &group, params)) == SWITCH_STATUS_SUCCESS) {
-		x_user_dup = switch_xml_dup(x_user);
-		switch_xml_merge_user(x_user_dup, domain, group);
-		if (switch_true(switch_xml_attr(x_user_dup, "cacheable"))) {
-			switch_xml_user_cache(key, user_name, domain_name, x_user_dup);
+	}
+
+	switch_mutex_lock(CACHE_MUTEX);
+
+	/* only results the directory allows to be kept ever become entries, anything flushed meanwhile stays out */
+	if (generation == USER_CACHE.generation &&
+		((status == SWITCH_STATUS_SUCCESS && cache) || (status != SWITCH_STATUS_SUCCESS && runtime.user_cache_negative_ttl))) {
+		if (!(entry = switch_core_hash_find(CACHE_HASH, mega_key))) {
+			entry = user_cache_add(mega_key, key, user_name, domain_name, ip);
+
+			if (params && runtime.user_cache_stale_ttl) {
+				switch_event_dup(&entry->params, params);
+			}
+		}
+
+		if (status == SWITCH_STATUS_SUCCESS) {
+			user_cache_fill(entry, switch_xml_dup(x_user), ttl);
+		} else {
+			user_cache_fill(entry, NULL, runtime.user_cache_negative_ttl);
 		}
-		*user = x_user_dup;
-		switch_xml_free(xml);
 	}
 
+	if (flight) {
+		user_cache_flight_land(flight, status, x_user);
+	}
+
+	switch_mutex_unlock(CACHE_MUTEX);
+
 	return status;
 
 }
@@ -2225,6 +2667,7 @@ SWITCH_DECLARE(switch_status_t) switch_xml_init(switch_memory_pool_t *pool, cons
 	switch_mutex_init(&FILE_LOCK, SWITCH_MUTEX_NESTED, XML_MEMORY_POOL);
 	switch_mutex_init(&XML_GEN_LOCK, SWITCH_MUTEX_NESTED, XML_MEMORY_POOL);
 	switch_core_hash_init(&CACHE_HASH, XML_MEMORY_POOL);
+	switch_core_hash_init(&USER_CACHE.flights, XML_MEMORY_POOL);
 
 	switch_thread_rwlock_create(&B_RWLOCK, XML_MEMORY_POOL);
 
@@ -2259,6 +2702,13 @@ SWITCH_DECLARE(switch_status_t) switch_xml_destroy(void)
 	switch_xml_clear_user_cache(NULL, NULL, NULL);
 
 	switch_core_hash_destroy(&CACHE_HASH);
+	switch_core_hash_destroy(&USER_CACHE.flights);
+
+	while (USER_CACHE.free_flights) {
+		user_cache_flight_t *flight = USER_CACHE.free_flights;
+		USER_CACHE.free_flights = flight->next;
+		free(flight);
+	}
 
 	return status;
 }
@@ -2606,6 +3056,154 @@ SWITCH_DECLARE(char *) switch_xml_toxml_buf(switch_xml_t xml, char *buf, switch_
 	return r;
 }
 
+/* Makes room for at least need more bytes plus a terminator in the writer buffer */
+static void switch_xml_writer_reserve(switch_xml_writer_t *writer, switch_size_t need)
+{
+	char *tmp;
+
+	if (writer->len + need + 1 <= writer->max) {
+		return;
+	}
+
+	while (writer->len + need + 1 > writer->max) {
+		writer->max *= 2;
+	}
+
+	if (!(tmp = (char *) realloc(writer->data, writer->max))) {
+		abort();
+	}
+	writer->data = tmp;
+}
+
+static void switch_xml_writer_put(switch_xml_writer_t *writer, const char *s, switch_size_t slen)
+{
+	switch_xml_writer_reserve(writer, slen);
+	memcpy(writer->data + writer->len, s, slen);
+	writer->len += slen;
+	writer->data[writer->len] = '\0';
+}
+
+static void switch_xml_writer_indent(switch_xml_writer_t *writer)
+{
+	uint32_t i;
+
+	for (i = 0; i < writer->depth; i++) {
+		switch_xml_writer_put(writer, XML_INDENT, sizeof(XML_INDENT) - 1);
+	}
+}
+
+/* Appends s with the same escaping switch_xml_toxml_r() applies.  Plain ascii runs are copied
+   directly, the remainder from the first character that needs attention goes through
+   switch_xml_ampencode() so <! sections and utf-8 are handled identically. */
+static void switch_xml_writer_escape(switch_xml_writer_t *writer, const char *s, short a)
+{
+	const char *p;
+	switch_size_t slen;
+
+	if (zstr(s)) {
+		return;
+	}
+
+	for (p = s; *p && !(*p & 0x80) && !strchr("&<>\"\n\t\r", *p); p++);
+
+	if (p > s) {
+		switch_xml_writer_put(writer, s, p - s);
+	}
+
+	if (*p) {
+		slen = strlen(p);
+		/* worst case expansion is one 6 byte entity per input byte, ampencode wants 10 bytes of slack */
+		switch_xml_writer_reserve(writer, slen * 6 + 10);
+		switch_xml_ampencode(p, 0, &writer->data, &writer->len, &writer->max, a);
+		writer->data[writer->len] = '\0';
+	}
+}
+
+static void switch_xml_writer_end_tag(switch_xml_writer_t *writer)
+{
+	if (writer->in_tag) {
+		switch_xml_writer_put(writer, ">", 1);
+		writer->in_tag = SWITCH_FALSE;
+	}
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_init(switch_xml_writer_t *writer, switch_bool_t prn_header)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->max = SWITCH_XML_BUFSIZE * 4;
+	writer->data = (char *) malloc(writer->max);
+	switch_assert(writer->data);
+	*writer->data = '\0';
+
+	if (prn_header) {
+		switch_xml_writer_put(writer, "<?xml version=\"1.0\"?>\n", 22);
+	}
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_open(switch_xml_writer_t *writer, const char *name)
+{
+	switch_xml_writer_end_tag(writer);
+
+	if (writer->len && writer->data[writer->len - 1] == '>') {
+		switch_xml_writer_put(writer, "\n", 1);
+	}
+	switch_xml_writer_indent(writer);
+	switch_xml_writer_put(writer, "<", 1);
+	switch_xml_writer_put(writer, name, strlen(name));
+	writer->in_tag = SWITCH_TRUE;
+	writer->depth++;
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_attr(switch_xml_writer_t *writer, const char *name, const char *value)
+{
+	switch_assert(writer->in_tag);
+
+	switch_xml_writer_put(writer, " ", 1);
+	switch_xml_writer_put(writer, name, strlen(name));
+	switch_xml_writer_put(writer, "=\"", 2);
+	switch_xml_writer_escape(writer, value, 1);
+	switch_xml_writer_put(writer, "\"", 1);
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_text(switch_xml_writer_t *writer, const char *txt)
+{
+	switch_xml_writer_end_tag(writer);
+	switch_xml_writer_escape(writer, txt, 0);
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_close(switch_xml_writer_t *writer, const char *name)
+{
+	switch_xml_writer_end_tag(writer);
+
+	if (writer->depth) {
+		writer->depth--;
+	}
+
+	if (writer->len && writer->data[writer->len - 1] == '\n') {
+		switch_xml_writer_indent(writer);
+	}
+	switch_xml_writer_put(writer, "</", 2);
+	switch_xml_writer_put(writer, name, strlen(name));
+	switch_xml_writer_put(writer, ">\n", 2);
+}
+
+SWITCH_DECLARE(void) switch_xml_writer_leaf(switch_xml_writer_t *writer, const char *name, const char *txt)
+{
+	switch_xml_writer_open(writer, name);
+	switch_xml_writer_text(writer, txt);
+	switch_xml_writer_close(writer, name);
+}
+
+SWITCH_DECLARE(char *) switch_xml_writer_finish(switch_xml_writer_t *writer)
+{
+	char *r = writer->data;
+
+	writer->data = NULL;
+	writer->len = writer->max = 0;
+
+	return r;
+}
+
 /* free the memory allocated for the switch_xml structure */
 SWITCH_DECLARE(void) switch_xml_free(switch_xml_t xml)
 {
@@ -0,0 +1,459 @@
+/*
+ * Compares switch_ivr_generate_xml_cdr_text() / switch_ivr_generate_json_cdr_text() with the tree builders
+ * serialized by switch_xml_toxml() / cJSON_PrintUnformatted() on randomized channels.  The channel, caller
+ * profile and session accessors the generators use are faked below; see README.
+ */
+#include <switch.h>
+#include <sys/time.h>
+
+static int fail_count;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+/* what the fake channel below reports, rebuilt from the seed by randomize() */
+static switch_event_header_t *vars;
+static switch_caller_profile_t *profile;
+static switch_app_log_t *app_log;
+static switch_hold_record_t *holds;
+static char *flags_str, *caps_str;
+static switch_channel_state_t state = CS_REPORTING;
+static switch_call_direction_t direction = SWITCH_CALL_DIRECTION_INBOUND;
+static uint32_t rnd = 1;
+
+static uint32_t rand_below(uint32_t n)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return (rnd >> 8) % n;
+}
+
+/**
+ * Strings made of the pieces that need escaping in XML, JSON or url encoding
+ */
+static char *rand_str(void)
+{
+	static const char *pieces[] = { "a", "Z", "1", "&", "<", ">", "\"", "'", " ", "\n", "\t", "\r", "%", "+", "=", "\xc3\xa9",
+		"\x01", "\x1f", "]]>", "\\", "/", "{", "}", ",", ":", "\x7f", "@"
+	};
+	char buf[256] = "";
+	int i, n = rand_below(12);
+
+	if (!rand_below(10)) {
+		return strdup("");
+	}
+
+	for (i = 0; i < n; i++) {
+		strcat(buf, pieces[rand_below(sizeof(pieces) / sizeof(pieces[0]))]);
+	}
+
+	return strdup(*buf ? buf : "x");
+}
+
+static char *rand_name(void)
+{
+	static const char *names[] = { "foo", "bar", "sip_from_user", "x-y", "a_b", "variable_1" };
+
+	return strdup(names[rand_below(sizeof(names) / sizeof(names[0]))]);
+}
+
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session)
+{
+	return (switch_channel_t *) session;
+}
+
+switch_event_header_t *switch_channel_variable_first(switch_channel_t *channel)
+{
+	return vars;
+}
+
+void switch_channel_variable_last(switch_channel_t *channel)
+{
+}
+
+switch_caller_profile_t *switch_channel_get_caller_profile(switch_channel_t *channel)
+{
+	return profile;
+}
+
+switch_app_log_t *switch_core_session_get_app_log(switch_core_session_t *session)
+{
+	return app_log;
+}
+
+switch_hold_record_t *switch_channel_get_hold_record(switch_channel_t *channel)
+{
+	return holds;
+}
+
+char *switch_channel_get_flag_string(switch_channel_t *channel)
+{
+	return flags_str ? strdup(flags_str) : NULL;
+}
+
+char *switch_channel_get_cap_string(switch_channel_t *channel)
+{
+	return caps_str ? strdup(caps_str) : NULL;
+}
+
+switch_channel_state_t switch_channel_get_state(switch_channel_t *channel)
+{
+	return state;
+}
+
+const char *switch_channel_state_name(switch_channel_state_t s)
+{
+	return s == CS_REPORTING ? "CS_REPORTING" : "CS_HANGUP";
+}
+
+switch_call_direction_t switch_channel_direction(switch_channel_t *channel)
+{
+	return direction;
+}
+
+char *switch_core_get_uuid(void)
+{
+	return "b2f5ae8e-6d35-4c5e-9f6d-4b1f0c7b2a11";
+}
+
+/* switch_xml.c warns about bad UTF-8 and takes REFLOCK to free a root document; one thread needs neither */
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+					   const char *userdata, switch_log_level_t level, const char *fmt, ...)
+{
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_caller_extension_t *rand_extension(void)
+{
+	switch_caller_extension_t *ext = calloc(1, sizeof(*ext));
+	switch_caller_application_t *ap, **tail = &ext->applications;
+	int i, n = rand_below(5);
+
+	ext->extension_name = rand_str();
+	ext->extension_number = rand_str();
+
+	for (i = 0; i < n; i++) {
+		ap = calloc(1, sizeof(*ap));
+		ap->application_name = rand_str();
+		ap->application_data = rand_below(5) ? rand_str() : NULL;
+		*tail = ap;
+		tail = &ap->next;
+		if (!rand_below(3)) {
+			ext->current_application = ap;
+		}
+	}
+
+	return ext;
+}
+
+static switch_caller_profile_t *rand_profile(int top)
+{
+	switch_caller_profile_t *cp = calloc(1, sizeof(*cp));
+	int i;
+
+	cp->username = rand_str();
+	cp->dialplan = rand_str();
+	cp->caller_id_name = rand_str();
+	cp->caller_id_number = rand_str();
+	cp->callee_id_name = rand_str();
+	cp->callee_id_number = rand_str();
+	cp->ani = rand_str();
+	cp->aniii = rand_str();
+	cp->network_addr = rand_str();
+	cp->rdnis = rand_str();
+	cp->destination_number = rand_str();
+	cp->uuid = rand_str();
+	cp->source = rand_str();
+	cp->context = rand_str();
+	cp->chan_name = rand_str();
+	cp->transfer_source = rand_below(2) ? rand_str() : NULL;
+	cp->uuid_str = rand_below(2) ? rand_str() : NULL;
+	cp->clone_of = rand_below(2) ? rand_str() : NULL;
+	cp->profile_index = rand_below(2) ? rand_str() : NULL;
+
+	for (i = rand_below(3); i > 0; i--) {
+		profile_node_t *pn = calloc(1, sizeof(*pn));
+
+		pn->var = rand_name();
+		pn->val = rand_str();
+		pn->next = cp->soft;
+		cp->soft = pn;
+	}
+
+	if (!top) {
+		return cp;
+	}
+
+	if (rand_below(2)) {
+		switch_caller_profile_t **tail;
+
+		cp->caller_extension = rand_extension();
+		tail = &cp->caller_extension->children;
+
+		/* children without an extension are skipped by both generators */
+		for (i = rand_below(5); i > 0; i--) {
+			switch_caller_profile_t *child = rand_profile(0);
+
+			if (rand_below(2)) {
+				child->caller_extension = rand_extension();
+			}
+			*tail = child;
+			tail = &child->next;
+		}
+	}
+
+	if (rand_below(2)) {
+		cp->originator_caller_profile = rand_profile(0);
+		if (rand_below(2)) {
+			cp->originator_caller_profile->next = rand_profile(0);
+		}
+	}
+
+	if (rand_below(2)) {
+		cp->originatee_caller_profile = rand_profile(0);
+	}
+
+	if (rand_below(2)) {
+		cp->origination_caller_profile = rand_profile(0);
+	}
+
+	if (rand_below(3)) {
+		cp->times = calloc(1, sizeof(*cp->times));
+		cp->times->created = rand_below(1000000);
+		cp->times->answered = rand_below(1000000);
+		cp->times->hungup = 1350000000000000LL + rand_below(1000);
+		cp->times->hold_accum = rand_below(100);
+		cp->times->transferred = rand_below(2);
+	}
+
+	return cp;
+}
+
+/**
+ * Build a new fake channel from the current seed.  The previous one is leaked, it is a test.
+ */
+static void randomize(void)
+{
+	switch_caller_profile_t **tail = &profile;
+	switch_app_log_t **atail = &app_log;
+	switch_hold_record_t **htail = &holds;
+	int i;
+
+	vars = NULL;
+	profile = NULL;
+	app_log = NULL;
+	holds = NULL;
+
+	for (i = rand_below(15); i > 0; i--) {
+		switch_event_header_t *hp = calloc(1, sizeof(*hp));
+
+		hp->name = rand_below(10) ? rand_name() : strdup("");
+		hp->value = rand_str();
+		if (!rand_below(6)) {
+			int j;
+
+			hp->idx = 1 + rand_below(3);
+			hp->array = calloc(hp->idx, sizeof(char *));
+			for (j = 0; j < hp->idx; j++) {
+				hp->array[j] = rand_str();
+			}
+		}
+		hp->next = vars;
+		vars = hp;
+	}
+
+	for (i = rand_below(4); i > 0; i--) {
+		switch_app_log_t *ap = calloc(1, sizeof(*ap));
+
+		ap->app = rand_str();
+		ap->arg = rand_str();
+		ap->stamp = rand_below(1000000);
+		*atail = ap;
+		atail = &ap->next;
+	}
+
+	for (i = rand_below(3); i > 0; i--) {
+		switch_hold_record_t *hr = calloc(1, sizeof(*hr));
+
+		hr->on = rand_below(1000);
+		hr->off = rand_below(1000);
+		hr->uuid = rand_below(2) ? rand_str() : NULL;
+		*htail = hr;
+		htail = &hr->next;
+	}
+
+	for (i = 1 + rand_below(3); i > 0; i--) {
+		*tail = rand_profile(1);
+		tail = &(*tail)->next;
+	}
+
+	flags_str = rand_below(2) ? rand_str() : NULL;
+	caps_str = rand_below(2) ? rand_str() : NULL;
+	state = rand_below(2) ? CS_REPORTING : CS_HANGUP;
+	direction = rand_below(2) ? SWITCH_CALL_DIRECTION_INBOUND : SWITCH_CALL_DIRECTION_OUTBOUND;
+}
+
+static switch_time_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (switch_time_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* the generators only format with it; the real one lives in switch_apr.c */
+int switch_snprintf(char *buf, switch_size_t len, const char *format, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(buf, len, format, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+static void show(const char *what, const char *tree, const char *text)
+{
+	size_t i;
+
+	for (i = 0; tree[i] && tree[i] == text[i]; i++);
+	printf("%s differs at byte %u\n--tree--\n%s\n--text--\n%s\n", what, (unsigned) i, tree + (i > 40 ? i - 40 : 0), text + (i > 40 ? i - 40 : 0));
+}
+
+static void test_xml_cdr(int iterations)
+{
+	switch_core_session_t *session = (switch_core_session_t *) "session";
+	int i, header, before = fail_count;
+
+	for (i = 0; i < iterations; i++) {
+		rnd = i * 7919 + 1;
+		randomize();
+
+		for (header = 0; header < 2; header++) {
+			switch_xml_t cdr = NULL;
+			char *tree_text, *text = NULL;
+
+			CHECK(switch_ivr_generate_xml_cdr(session, &cdr) == SWITCH_STATUS_SUCCESS, "tree seed %d", i);
+			CHECK(switch_ivr_generate_xml_cdr_text(session, &text, header) == SWITCH_STATUS_SUCCESS, "text seed %d", i);
+			tree_text = switch_xml_toxml_nolock(cdr, header);
+			CHECK(!strcmp(tree_text, text), "xml seed %d header %d", i, header);
+			if (strcmp(tree_text, text) && fail_count - before < 3) {
+				show("xml", tree_text, text);
+			}
+			free(tree_text);
+			free(text);
+			switch_xml_free(cdr);
+		}
+	}
+
+	printf("test_xml_cdr() : %s\n", fail_count == before ? "PASS" : "FAIL");
+}
+
+static void test_json_cdr(int iterations)
+{
+	switch_core_session_t *session = (switch_core_session_t *) "session";
+	int i, urlencode, before = fail_count;
+
+	for (i = 0; i < iterations; i++) {
+		rnd = i * 7919 + 1;
+		randomize();
+
+		for (urlencode = 0; urlencode < 2; urlencode++) {
+			cJSON *json = NULL;
+			char *tree_text, *text = NULL;
+
+			CHECK(switch_ivr_generate_json_cdr(session, &json, urlencode) == SWITCH_STATUS_SUCCESS, "tree seed %d", i);
+			CHECK(switch_ivr_generate_json_cdr_text(session, &text, urlencode) == SWITCH_STATUS_SUCCESS, "text seed %d", i);
+			tree_text = cJSON_PrintUnformatted(json);
+			CHECK(!strcmp(tree_text, text), "json seed %d urlencode %d", i, urlencode);
+			if (strcmp(tree_text, text) && fail_count - before < 3) {
+				show("json", tree_text, text);
+			}
+			free(tree_text);
+			free(text);
+			cJSON_Delete(json);
+		}
+	}
+
+	printf("test_json_cdr() : %s\n", fail_count == before ? "PASS" : "FAIL");
+}
+
+static void bench(int iterations)
+{
+	switch_core_session_t *session = (switch_core_session_t *) "session";
+	switch_time_t start;
+	int i;
+
+	rnd = 42;
+	randomize();
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		switch_xml_t cdr = NULL;
+		char *s;
+
+		switch_ivr_generate_xml_cdr(session, &cdr);
+		s = switch_xml_toxml_nolock(cdr, SWITCH_FALSE);
+		free(s);
+		switch_xml_free(cdr);
+	}
+	printf("xml tree + toxml: %.2f us/cdr\n", (double) (now_us() - start) / iterations);
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		char *s = NULL;
+
+		switch_ivr_generate_xml_cdr_text(session, &s, SWITCH_FALSE);
+		free(s);
+	}
+	printf("xml text:         %.2f us/cdr\n", (double) (now_us() - start) / iterations);
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		cJSON *json = NULL;
+		char *s;
+
+		switch_ivr_generate_json_cdr(session, &json, SWITCH_TRUE);
+		s = cJSON_PrintUnformatted(json);
+		free(s);
+		cJSON_Delete(json);
+	}
+	printf("json tree + print: %.2f us/cdr\n", (double) (now_us() - start) / iterations);
+
+	start = now_us();
+	for (i = 0; i < iterations; i++) {
+		char *s = NULL;
+
+		switch_ivr_generate_json_cdr_text(session, &s, SWITCH_TRUE);
+		free(s);
+	}
+	printf("json text:         %.2f us/cdr\n", (double) (now_us() - start) / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = 2000;
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench(argc > 2 ? atoi(argv[2]) : 20000);
+		return 0;
+	}
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+
+	test_xml_cdr(iterations);
+	test_json_cdr(iterations);
+
+	return fail_count ? 1 : 0;
+}
@@ -0,0 +1,426 @@
+/*
+ * Exercises the open addressing switch_core_hash.c: deleting while iterating, growth at the 7/8 load boundary,
+ * switch_core_hash_delete_multi(), inline and heap keys and case insensitive tables.  In bench mode it times
+ * insert, find and delete against the sqlite hash the table used to wrap.  switch_core_hash.c is included and
+ * the pool and event calls it makes are faked below; see README.
+ */
+#include "../switch_core_hash.c"
+#include <sys/time.h>
+
+/* the old table, called the way switch_core_hash.c did; its HashElem is renamed so it does not meet ours */
+#define HashElem sqlite_HashElem
+#include "../../libs/sqlite/src/hash.h"
+#undef HashElem
+
+static int fail_count;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory, const char *file, const char *func, int line)
+{
+	return calloc(1, memory);
+}
+
+/* switch_core_hash_delete_multi() only keeps its list of keys in an event */
+switch_status_t switch_event_create_subclass_detailed(const char *file, const char *func, int line,
+													   switch_event_t **event, switch_event_types_t event_id, const char *subclass_name)
+{
+	*event = calloc(1, sizeof(switch_event_t));
+	(*event)->event_id = event_id;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_event_add_header_string(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *data)
+{
+	switch_event_header_t *header = calloc(1, sizeof(*header));
+
+	header->name = strdup(header_name);
+	header->value = strdup(data);
+
+	if (event->last_header) {
+		event->last_header->next = header;
+	} else {
+		event->headers = header;
+	}
+	event->last_header = header;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_event_destroy(switch_event_t **event)
+{
+	switch_event_header_t *header, *next;
+
+	for (header = (*event)->headers; header; header = next) {
+		next = header->next;
+		free(header->name);
+		free(header->value);
+		free(header);
+	}
+	free(*event);
+	*event = NULL;
+}
+
+/* what libs/sqlite/src/hash.c takes from the rest of sqlite */
+unsigned char sqlite3UpperToLower[256];
+
+void *sqlite3MallocX(int n)
+{
+	return calloc(1, n);
+}
+
+void sqlite3FreeX(void *p)
+{
+	free(p);
+}
+
+int sqlite3StrNICmp(const char *a, const char *b, int n)
+{
+	return strncasecmp(a, b, n);
+}
+
+#define KEY_SIZE 128
+
+static char (*keys)[KEY_SIZE];
+
+static void keys_make(int count, const char *prefix)
+{
+	int x;
+
+	keys = realloc(keys, count * KEY_SIZE);
+	for (x = 0; x < count; x++) {
+		snprintf(keys[x], KEY_SIZE, "%s%08x-%04x-4%03x-a%03x-%012x", prefix, x * 2654435761u, x & 0xffff, x & 0xfff, (x * 7) & 0xfff, x * 40503u);
+	}
+}
+
+#define VAL(x) ((void *) (intptr_t) ((x) + 1))
+
+/* every key present maps to its own value and the entry list holds exactly count entries */
+static int hash_intact(switch_hash_t *hash, int count, int first, int step)
+{
+	switch_hash_index_t *hi;
+	int x, n = 0;
+
+	for (x = first; x < count; x += step) {
+		if (switch_core_hash_find(hash, keys[x]) != VAL(x)) {
+			return 0;
+		}
+		n++;
+	}
+
+	for (hi = switch_core_hash_first(hash); hi; hi = switch_core_hash_next(hi)) {
+		n--;
+	}
+
+	return !n && hash->count == (uint32_t) (count - first + step - 1) / step;
+}
+
+/* deleting the entry the iterator is on, and others, still walks every entry once in insertion order */
+static void test_iterate_delete(void)
+{
+	switch_hash_t *hash;
+	switch_hash_index_t *hi;
+	int x, seen, in_order, fails = fail_count;
+
+	keys_make(1000, "");
+	switch_core_hash_init(&hash, NULL);
+	for (x = 0; x < 1000; x++) {
+		switch_core_hash_insert(hash, keys[x], VAL(x));
+	}
+
+	/* drop every odd key from under the iterator, the way most module cleanup loops do */
+	for (hi = switch_core_hash_first(hash), seen = 0, in_order = 1; hi; hi = switch_core_hash_next(hi), seen++) {
+		const void *key;
+		void *val;
+
+		switch_core_hash_this(hi, &key, NULL, &val);
+		in_order &= val == VAL(seen);
+		if (seen & 1) {
+			switch_core_hash_delete(hash, key);
+		}
+	}
+	CHECK(seen == 1000 && in_order, "walked %d entries deleting the current one, in order %d", seen, in_order);
+	CHECK(hash_intact(hash, 1000, 0, 2), "even keys after deleting the odd ones while iterating");
+
+	/* and the rest, with switch_core_hash_this() on the parked entry after it went */
+	for (hi = switch_core_hash_first(hash), seen = 0; hi; hi = switch_core_hash_next(hi), seen++) {
+		const void *key;
+
+		switch_core_hash_this(hi, &key, NULL, NULL);
+		switch_core_hash_delete(hash, key);
+	}
+	CHECK(seen == 500 && hash->count == 0 && !switch_core_hash_first(hash), "emptied %d, %u left", seen, hash->count);
+
+	/* the freed entries are reused and the table is as good as new */
+	for (x = 0; x < 1000; x++) {
+		switch_core_hash_insert(hash, keys[x], VAL(x));
+	}
+	CHECK(hash_intact(hash, 1000, 0, 1), "refilled after emptying");
+
+	switch_core_hash_destroy(&hash);
+
+	printf("test_iterate_delete() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* the table doubles on the insert that would take it past 7/8 full and never earlier, and finds everything after */
+static void test_resize(void)
+{
+	switch_hash_t *hash;
+	uint32_t size, grown = 0;
+	int x, fails = fail_count;
+
+	keys_make(20000, "");
+	switch_core_hash_init(&hash, NULL);
+
+	for (x = 0; x < 20000; x++) {
+		uint32_t before = hash->buckets ? hash->mask + 1 : 0;
+
+		switch_core_hash_insert(hash, keys[x], VAL(x));
+		size = hash->mask + 1;
+
+		if (!before) {
+			CHECK(size == SWITCH_HASH_INITIAL_BUCKETS, "first insert made %u buckets", size);
+		} else if (size != before) {
+			CHECK(size == before * 2 && (uint32_t) x * 8 <= before * 7 && (uint32_t) (x + 1) * 8 > before * 7,
+				  "grew %u -> %u at %d entries", before, size, x + 1);
+			CHECK(hash_intact(hash, x + 1, 0, 1), "lost keys growing to %u buckets at %d entries", size, x + 1);
+			grown++;
+		}
+		CHECK(hash->count * 8 <= size * 7, "%u entries in %u buckets", hash->count, size);
+	}
+	/* 16 buckets up to 14 entries, 32 to 28 ... 32768 at 20000 */
+	CHECK(grown == 11 && size == 32768, "grew %u times to %u buckets", grown, size);
+
+	/* tables do not shrink; deleting down leaves the rest where probes find them */
+	for (x = 0; x < 20000; x += 2) {
+		switch_core_hash_delete(hash, keys[x]);
+	}
+	CHECK(hash->mask + 1 == size && hash_intact(hash, 20000, 1, 2), "odd keys after deleting the even ones");
+
+	switch_core_hash_destroy(&hash);
+
+	printf("test_resize() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+static switch_bool_t odd_value(const void *key, const void *val, void *pData)
+{
+	(*(int *) pData)++;
+	return ((intptr_t) val - 1) & 1 ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+static void test_delete_multi(void)
+{
+	switch_hash_t *hash;
+	int x, calls = 0, fails = fail_count;
+
+	keys_make(1000, "");
+	switch_core_hash_init(&hash, NULL);
+	for (x = 0; x < 1000; x++) {
+		switch_core_hash_insert(hash, keys[x], VAL(x));
+	}
+
+	CHECK(switch_core_hash_delete_multi(hash, odd_value, &calls) == SWITCH_STATUS_SUCCESS, "delete_multi with a callback");
+	CHECK(calls == 1000, "callback ran %d times", calls);
+	CHECK(hash_intact(hash, 1000, 0, 2), "even keys after deleting the odd values");
+
+	CHECK(switch_core_hash_delete_multi(hash, NULL, NULL) == SWITCH_STATUS_SUCCESS, "delete_multi without a callback");
+	CHECK(hash->count == 0 && !switch_core_hash_first(hash), "%u left after deleting all", hash->count);
+
+	CHECK(switch_core_hash_delete_multi(hash, NULL, NULL) == SWITCH_STATUS_GENERR, "delete_multi on an empty table");
+
+	switch_core_hash_destroy(&hash);
+
+	printf("test_delete_multi() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* keys shorter than SWITCH_HASH_INLINE_KEY live in the entry, longer ones on the heap, both are private copies */
+static void test_key_storage(void)
+{
+	switch_hash_t *hash;
+	switch_hash_index_t *hi;
+	char key[KEY_SIZE];
+	int len, fails = fail_count;
+
+	switch_core_hash_init(&hash, NULL);
+
+	for (len = 0; len < KEY_SIZE; len++) {
+		memset(key, 'a' + len % 26, len);
+		key[len] = '\0';
+		switch_core_hash_insert(hash, key, VAL(len));
+		/* the caller's buffer is reused straight away, as with a stack key */
+		memset(key, '#', len);
+	}
+
+	for (hi = switch_core_hash_first(hash), len = 0; hi; hi = switch_core_hash_next(hi), len++) {
+		const void *k;
+		switch_ssize_t klen;
+
+		switch_core_hash_this(hi, &k, &klen, NULL);
+		CHECK(klen == len + 1 && strlen(k) == (size_t) len, "key %d has length %d", len, (int) klen - 1);
+		CHECK((hi->key == hi->ikey) == (len < SWITCH_HASH_INLINE_KEY), "key of %d chars %s inline", len, hi->key == hi->ikey ? "is" : "is not");
+	}
+	CHECK(len == KEY_SIZE, "%d entries", len);
+
+	for (len = 0; len < KEY_SIZE; len++) {
+		memset(key, 'a' + len % 26, len);
+		key[len] = '\0';
+		CHECK(switch_core_hash_find(hash, key) == VAL(len), "find key of %d chars", len);
+
+		/* replacing keeps the one entry and its key storage */
+		switch_core_hash_insert(hash, key, VAL(len + 1000));
+		CHECK(switch_core_hash_find(hash, key) == VAL(len + 1000) && hash->count == KEY_SIZE, "replace key of %d chars", len);
+	}
+
+	/* a heap key's entry reused for an inline key and the other way round */
+	for (len = SWITCH_HASH_INLINE_KEY - 2; len <= SWITCH_HASH_INLINE_KEY + 1; len++) {
+		memset(key, 'a' + len % 26, len);
+		key[len] = '\0';
+		switch_core_hash_delete(hash, key);
+		CHECK(!switch_core_hash_find(hash, key), "deleted key of %d chars", len);
+	}
+	for (len = SWITCH_HASH_INLINE_KEY + 1; len >= SWITCH_HASH_INLINE_KEY - 2; len--) {
+		memset(key, 'z', len);
+		key[len] = '\0';
+		switch_core_hash_insert(hash, key, VAL(len));
+		CHECK(switch_core_hash_find(hash, key) == VAL(len), "reinserted key of %d chars", len);
+	}
+	CHECK(hash->count == KEY_SIZE, "%u entries after reuse", hash->count);
+
+	switch_core_hash_destroy(&hash);
+
+	printf("test_key_storage() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+static void test_case(void)
+{
+	switch_hash_t *sensitive, *insensitive;
+	const char *long_key = "Sofia/Internal/1000@Example.COM;transport=TCP;fs_path=<sip:10.0.0.1>";
+	const void *key;
+	int fails = fail_count;
+
+	switch_core_hash_init_case(&sensitive, NULL, SWITCH_TRUE);
+	switch_core_hash_init_case(&insensitive, NULL, SWITCH_FALSE);
+
+	switch_core_hash_insert(sensitive, "Foo", VAL(1));
+	switch_core_hash_insert(sensitive, "foo", VAL(2));
+	CHECK(sensitive->count == 2 && switch_core_hash_find(sensitive, "Foo") == VAL(1) && switch_core_hash_find(sensitive, "foo") == VAL(2)
+		  && !switch_core_hash_find(sensitive, "FOO"), "case sensitive keys");
+
+	switch_core_hash_insert(insensitive, "Foo", VAL(1));
+	CHECK(switch_core_hash_find(insensitive, "FOO") == VAL(1) && switch_core_hash_find(insensitive, "foo") == VAL(1), "case insensitive find");
+	switch_core_hash_insert(insensitive, "fOO", VAL(2));
+	switch_core_hash_this(switch_core_hash_first(insensitive), &key, NULL, NULL);
+	CHECK(insensitive->count == 1 && switch_core_hash_find(insensitive, "Foo") == VAL(2) && !strcmp(key, "Foo"),
+		  "replacing in another case keeps the first spelling, %s", (const char *) key);
+	CHECK(!switch_core_hash_find(insensitive, "Fo") && !switch_core_hash_find(insensitive, "Fooo") && !switch_core_hash_find(insensitive, "F0O"),
+		  "case insensitive near misses");
+
+	switch_core_hash_insert(insensitive, long_key, VAL(3));
+	CHECK(switch_core_hash_find(insensitive, "sofia/internal/1000@example.com;TRANSPORT=tcp;FS_PATH=<SIP:10.0.0.1>") == VAL(3),
+		  "case insensitive heap key");
+	CHECK(!switch_core_hash_find(sensitive, long_key), "key only in the other table");
+
+	/* only letters fold, '@' and '`' sit either side of the upper and lower case runs */
+	switch_core_hash_insert(insensitive, "a@", VAL(4));
+	CHECK(!switch_core_hash_find(insensitive, "a`") && switch_core_hash_find(insensitive, "A@") == VAL(4), "punctuation does not fold");
+
+	switch_core_hash_delete(insensitive, "FOO");
+	switch_core_hash_delete(insensitive, "SOFIA/INTERNAL/1000@EXAMPLE.COM;TRANSPORT=TCP;FS_PATH=<SIP:10.0.0.1>");
+	CHECK(insensitive->count == 1 && !switch_core_hash_find(insensitive, "foo") && !switch_core_hash_find(insensitive, long_key),
+		  "case insensitive delete");
+
+	switch_core_hash_destroy(&sensitive);
+	switch_core_hash_destroy(&insensitive);
+
+	printf("test_case() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+static switch_time_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (switch_time_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* nanoseconds per key for inserting, finding and deleting count uuid keys, in the order switch_core_hash.c used sqlite */
+static void bench_keys(int count)
+{
+	switch_hash_t *hash;
+	Hash table;
+	switch_time_t t[4];
+	double ns = 1000.0 / count;
+	int x, found = 0;
+
+	keys_make(count, "");
+
+	t[0] = now_us();
+	switch_core_hash_init(&hash, NULL);
+	for (x = 0; x < count; x++) {
+		switch_core_hash_insert(hash, keys[x], VAL(x));
+	}
+	t[1] = now_us();
+	for (x = 0; x < count; x++) {
+		found += switch_core_hash_find(hash, keys[x]) == VAL(x);
+	}
+	t[2] = now_us();
+	for (x = 0; x < count; x++) {
+		switch_core_hash_delete(hash, keys[x]);
+	}
+	switch_core_hash_destroy(&hash);
+	t[3] = now_us();
+
+	printf("%8d keys  switch_hash insert %6.1f  find %6.1f  delete %6.1f ns/key\n", count, (t[1] - t[0]) * ns, (t[2] - t[1]) * ns, (t[3] - t[2]) * ns);
+
+	t[0] = now_us();
+	sqlite3HashInit(&table, SQLITE_HASH_BINARY, 1);
+	for (x = 0; x < count; x++) {
+		sqlite3HashInsert(&table, keys[x], (int) strlen(keys[x]) + 1, VAL(x));
+	}
+	t[1] = now_us();
+	for (x = 0; x < count; x++) {
+		found += sqlite3HashFind(&table, keys[x], (int) strlen(keys[x]) + 1) == VAL(x);
+	}
+	t[2] = now_us();
+	for (x = 0; x < count; x++) {
+		sqlite3HashInsert(&table, keys[x], (int) strlen(keys[x]) + 1, NULL);
+	}
+	sqlite3HashClear(&table);
+	t[3] = now_us();
+
+	printf("%8d keys  sqlite hash insert %6.1f  find %6.1f  delete %6.1f ns/key\n", count, (t[1] - t[0]) * ns, (t[2] - t[1]) * ns, (t[3] - t[2]) * ns);
+
+	CHECK(found == count * 2, "found %d of %d keys", found, count * 2);
+}
+
+static void bench(void)
+{
+	int counts[] = { 1000, 100000, 1000000 };
+	int x;
+
+	for (x = 0; x < 256; x++) {
+		sqlite3UpperToLower[x] = (unsigned char) tolower(x);
+	}
+
+	for (x = 0; x < 3; x++) {
+		bench_keys(counts[x]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench();
+		printf("%s\n", fail_count ? "FAIL" : "PASS");
+		return fail_count ? 1 : 0;
+	}
+
+	test_iterate_delete();
+	test_resize();
+	test_delete_multi();
+	test_key_storage();
+	test_case();
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+	return fail_count ? 1 : 0;
+}
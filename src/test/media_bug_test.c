@@ -0,0 +1,561 @@
+/*
+ * Drives switch_core_media_bug.c on a fake session: adds and removes bugs, feeds the read and write streams the
+ * way switch_core_session_read_frame() and switch_core_session_write_frame() do and reads the bugs back.
+ * The channel, session pool, events and locks it calls are faked below; see README.
+ */
+#include "../switch_core_media_bug.c"
+#include <malloc.h>
+#include <sys/time.h>
+
+static int fail_count;
+static int verbose;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+#define FRAME_BYTES 320
+
+/* the session pool: nothing is given back before the session ends, so count what goes in, and what it costs the heap */
+static switch_size_t pool_bytes, pool_heap;
+
+static void *pool_track(void *p, switch_size_t memory)
+{
+	pool_bytes += memory;
+	pool_heap += malloc_usable_size(p) + sizeof(size_t);
+	return p;
+}
+
+void *switch_core_perform_session_alloc(switch_core_session_t *session, switch_size_t memory, const char *file, const char *func, int line)
+{
+	return pool_track(calloc(1, memory), memory);
+}
+
+char *switch_core_perform_session_strdup(switch_core_session_t *session, const char *todup, const char *file, const char *func, int line)
+{
+	return pool_track(strdup(todup), strlen(todup) + 1);
+}
+
+switch_status_t switch_core_session_get_read_impl(switch_core_session_t *session, switch_codec_implementation_t *impp)
+{
+	*impp = session->read_impl;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_session_get_write_impl(switch_core_session_t *session, switch_codec_implementation_t *impp)
+{
+	*impp = session->write_impl;
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session)
+{
+	return session->channel;
+}
+
+switch_status_t switch_core_codec_destroy(switch_codec_t *codec)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* the channel is always up and answered, bugs are never paused here */
+
+int switch_channel_test_ready(switch_channel_t *channel, switch_bool_t check_ready, switch_bool_t check_media)
+{
+	return 1;
+}
+
+switch_status_t switch_channel_perform_pre_answer(switch_channel_t *channel, const char *file, const char *func, int line)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+const char *switch_channel_get_variable_dup(switch_channel_t *channel, const char *varname, switch_bool_t dup, int idx)
+{
+	return NULL;
+}
+
+switch_status_t switch_channel_set_variable_var_check(switch_channel_t *channel, const char *varname, const char *value, switch_bool_t var_check)
+{
+	return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_channel_set_flag_value(switch_channel_t *channel, switch_channel_flag_t flag, uint32_t value)
+{
+}
+
+void switch_channel_clear_flag(switch_channel_t *channel, switch_channel_flag_t flag)
+{
+}
+
+char *switch_channel_get_name(switch_channel_t *channel)
+{
+	return "test/channel";
+}
+
+void switch_channel_event_set_data(switch_channel_t *channel, switch_event_t *event)
+{
+}
+
+switch_status_t switch_event_create_subclass_detailed(const char *file, const char *func, int line,
+													  switch_event_t **event, switch_event_types_t event_id, const char *subclass_name)
+{
+	*event = NULL;
+	return SWITCH_STATUS_FALSE;
+}
+
+switch_status_t switch_event_add_header(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *fmt, ...)
+{
+	return SWITCH_STATUS_FALSE;
+}
+
+switch_status_t switch_event_fire_detailed(const char *file, const char *func, int line, switch_event_t **event, void *user_data)
+{
+	return SWITCH_STATUS_FALSE;
+}
+
+time_t switch_epoch_time_now(time_t *t)
+{
+	return time(t);
+}
+
+switch_bool_t switch_is_number(const char *str)
+{
+	return SWITCH_FALSE;
+}
+
+switch_status_t switch_ivr_record_session(switch_core_session_t *session, char *file, uint32_t limit, switch_file_handle_t *fh)
+{
+	return SWITCH_STATUS_FALSE;
+}
+
+switch_status_t switch_ivr_stop_record_session(switch_core_session_t *session, const char *file)
+{
+	return SWITCH_STATUS_FALSE;
+}
+
+void switch_log_printf(switch_text_channel_t channel, const char *file, const char *func, int line,
+					   const char *userdata, switch_log_level_t level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (verbose || level <= SWITCH_LOG_ERROR) {
+		va_start(ap, fmt);
+		printf("[%d] ", level);
+		vprintf(fmt, ap);
+		va_end(ap);
+	}
+}
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *mutex = pool_track(malloc(sizeof(*mutex)), sizeof(*mutex));
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	*lock = (switch_mutex_t *) mutex;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	pthread_mutex_lock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_rdlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_rdlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_wrlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_wrlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_unlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_unlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_thread_id_t switch_thread_self(void)
+{
+	return pthread_self();
+}
+
+/* the session */
+
+static switch_core_session_t *session_new(void)
+{
+	switch_core_session_t *session = calloc(1, sizeof(*session));
+	pthread_rwlock_t *rwlock = malloc(sizeof(*rwlock));
+
+	pthread_rwlock_init(rwlock, NULL);
+	session->bug_rwlock = (switch_thread_rwlock_t *) rwlock;
+	session->channel = (switch_channel_t *) session;
+	session->read_impl.codec_id = 1;
+	session->read_impl.decoded_bytes_per_packet = FRAME_BYTES;
+	session->read_impl.actual_samples_per_second = 8000;
+	session->write_impl = session->read_impl;
+
+	return session;
+}
+
+static switch_bool_t bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
+{
+	return SWITCH_TRUE;
+}
+
+/* a write-replace bug that lifts every sample by 1000, like an effect would change the audio */
+static switch_bool_t replace_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
+{
+	if (type == SWITCH_ABC_TYPE_WRITE_REPLACE) {
+		switch_frame_t *frame = switch_core_media_bug_get_write_replace_frame(bug);
+		int16_t *data = frame->data;
+		uint32_t x;
+
+		for (x = 0; x < frame->datalen / 2; x++) {
+			data[x] += 1000;
+		}
+		switch_core_media_bug_set_write_replace_frame(bug, frame);
+	}
+
+	return SWITCH_TRUE;
+}
+
+static switch_media_bug_t *bug_add(switch_core_session_t *session, switch_media_bug_callback_t callback, switch_media_bug_flag_t flags)
+{
+	switch_media_bug_t *bug = NULL;
+
+	CHECK(switch_core_media_bug_add(session, "test", NULL, callback, NULL, 0, flags, &bug) == SWITCH_STATUS_SUCCESS, "bug add failed");
+
+	return bug;
+}
+
+/* the bug block of switch_core_session_read_frame(), read-replace bugs aside */
+static void feed_read(switch_core_session_t *session, int16_t *data)
+{
+	switch_media_bug_t *bp;
+
+	switch_thread_rwlock_rdlock(session->bug_rwlock);
+	switch_core_media_bug_tap_feed(session, SMBF_READ_STREAM, data, FRAME_BYTES);
+	for (bp = session->bugs; bp; bp = bp->next) {
+		if (bp->ready && switch_test_flag(bp, SMBF_READ_STREAM) && bp->raw_read_buffer) {
+			switch_core_media_bug_ring_write(bp->raw_read_buffer, data, FRAME_BYTES);
+		}
+	}
+	switch_thread_rwlock_unlock(session->bug_rwlock);
+}
+
+/* the bug block of switch_core_session_write_frame(): tap first, then every bug in list order */
+static void feed_write(switch_core_session_t *session, int16_t *data)
+{
+	switch_frame_t frame = { 0 };
+	switch_frame_t *write_frame = &frame;
+	switch_media_bug_t *bp;
+
+	frame.data = data;
+	frame.datalen = FRAME_BYTES;
+
+	switch_thread_rwlock_rdlock(session->bug_rwlock);
+	switch_core_media_bug_tap_feed(session, SMBF_WRITE_STREAM, write_frame->data, write_frame->datalen);
+	for (bp = session->bugs; bp; bp = bp->next) {
+		if (!bp->ready) {
+			continue;
+		}
+		if (switch_test_flag(bp, SMBF_WRITE_STREAM) && bp->raw_write_buffer) {
+			switch_core_media_bug_ring_write(bp->raw_write_buffer, write_frame->data, write_frame->datalen);
+		}
+		if (switch_test_flag(bp, SMBF_WRITE_REPLACE) && bp->callback) {
+			bp->write_replace_frame_in = write_frame;
+			bp->write_replace_frame_out = write_frame;
+			if (bp->callback(bp, bp->user_data, SWITCH_ABC_TYPE_WRITE_REPLACE) == SWITCH_TRUE) {
+				write_frame = bp->write_replace_frame_out;
+			}
+		}
+	}
+	switch_thread_rwlock_unlock(session->bug_rwlock);
+}
+
+static void fill(int16_t *data, int16_t value)
+{
+	int x;
+
+	for (x = 0; x < FRAME_BYTES / 2; x++) {
+		data[x] = value;
+	}
+}
+
+/* reads one stereo frame, left is the read stream and right the write stream; returns the first write sample */
+static int bug_read_write_sample(switch_media_bug_t *bug, int *got)
+{
+	int16_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	switch_frame_t frame = { 0 };
+	switch_status_t status;
+
+	frame.data = data;
+	frame.buflen = sizeof(data);
+	status = switch_core_media_bug_read(bug, &frame, SWITCH_FALSE);
+	*got = status == SWITCH_STATUS_SUCCESS || status == SWITCH_STATUS_BREAK;
+
+	return data[1];
+}
+
+/* heap in use apart from the fake session pool, which never gives anything back */
+static long heap_in_use(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	return (long) (mi.uordblks + mi.hblkhd) - (long) pool_heap;
+}
+
+/* adding and removing bugs through a long call must not keep the rings they used */
+static void test_add_remove(int cycles)
+{
+	switch_core_session_t *session = session_new();
+	switch_media_bug_t *listen, *replace;
+	switch_size_t pool_start, per_cycle;
+	long heap_start;
+	int16_t data[FRAME_BYTES / 2];
+	int x, fails = fail_count;
+
+	fill(data, 1);
+
+	/* the tap hub itself stays with the session, let the first cycle create it */
+	listen = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM);
+	switch_core_media_bug_remove(session, &listen);
+
+	pool_start = pool_bytes;
+	heap_start = heap_in_use();
+
+	for (x = 0; x < cycles; x++) {
+		listen = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO);
+		replace = bug_add(session, replace_callback, SMBF_WRITE_STREAM | SMBF_WRITE_REPLACE | SMBF_READ_PING);
+		feed_read(session, data);
+		feed_write(session, data);
+		switch_core_media_bug_remove(session, &replace);
+		switch_core_media_bug_remove(session, &listen);
+	}
+
+	per_cycle = (pool_bytes - pool_start) / cycles;
+
+	/* what is left per cycle is the two bug structs and their names, as before the rings */
+	CHECK(per_cycle < 2 * sizeof(switch_media_bug_t) + 64, "%u pool bytes per add/remove cycle", (unsigned) per_cycle);
+	CHECK(heap_in_use() < heap_start + 64 * 1024, "heap grew by %ld bytes over %d cycles", heap_in_use() - heap_start, cycles);
+	CHECK(!session->tap->read.data && !session->tap->write.data, "tap buffers kept without subscribers");
+
+	printf("test_add_remove() : %d cycles, %u pool bytes per cycle, heap %+ld bytes : %s\n", cycles, (unsigned) per_cycle,
+		   heap_in_use() - heap_start, fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* a codec change regrows the tap in place and lets go of the old buffer */
+static void test_tap_regrow(void)
+{
+	switch_core_session_t *session = session_new();
+	switch_media_bug_t *bug;
+	uint8_t big[SWITCH_RECOMMENDED_BUFFER_SIZE] = { 0 };
+	long heap_start;
+	uint64_t size;
+	int x, fails = fail_count;
+
+	bug = bug_add(session, bug_callback, SMBF_READ_STREAM);
+	size = session->tap->read.size;
+	heap_start = heap_in_use();
+
+	for (x = 0; x < 4; x++) {
+		switch_core_media_bug_tap_feed(session, SMBF_READ_STREAM, big, FRAME_BYTES * 4);
+	}
+
+	CHECK(session->tap->read.size > size, "tap did not grow for bigger frames");
+	/* only the new buffer less the old one it replaced */
+	CHECK(heap_in_use() - heap_start <= (long) (session->tap->read.size - size) + 4096, "regrow kept the old buffer: heap %+ld, tap %lu -> %lu",
+		  heap_in_use() - heap_start, (unsigned long) size, (unsigned long) session->tap->read.size);
+
+	switch_core_media_bug_remove(session, &bug);
+	CHECK(!session->tap->read.data, "tap buffer kept after the last subscriber left");
+
+	printf("test_tap_regrow() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+/*
+   A listen-only bug hears the write stream as it is at its place in the bug list: a write-replace bug added after it
+   sits ahead of it and changes what it hears, one added before it does not.
+*/
+static void test_write_order(void)
+{
+	switch_core_session_t *session = session_new();
+	switch_media_bug_t *early, *replace, *late;
+	int16_t data[FRAME_BYTES / 2];
+	int x, got, sample, fails = fail_count;
+
+	early = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO);
+
+	/* two frames queued on the tap before the replace bug shows up */
+	for (x = 0; x < 2; x++) {
+		fill(data, 10 + x);
+		feed_read(session, data);
+		fill(data, 10 + x);
+		feed_write(session, data);
+	}
+
+	replace = bug_add(session, replace_callback, SMBF_WRITE_REPLACE);
+	late = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO);
+
+	CHECK(!early->tap_write && early->raw_write_buffer, "bug behind the write-replace bug still reads the write tap");
+	CHECK(late->tap_write && !late->raw_write_buffer, "bug ahead of the write-replace bug left the write tap");
+
+	for (x = 2; x < 4; x++) {
+		fill(data, 10 + x);
+		feed_read(session, data);
+		fill(data, 10 + x);
+		feed_write(session, data);
+	}
+
+	/* the backlog moved to the private ring untouched, what followed went through the replace bug first */
+	for (x = 0; x < 4; x++) {
+		sample = bug_read_write_sample(early, &got);
+		CHECK(got && sample == (x < 2 ? 10 + x : 1010 + x), "bug behind replace, frame %d: got %d write sample %d", x, got, sample);
+	}
+
+	for (x = 2; x < 4; x++) {
+		sample = bug_read_write_sample(late, &got);
+		CHECK(got && sample == 10 + x, "bug ahead of replace, frame %d: got %d write sample %d", x, got, sample);
+	}
+
+	switch_core_media_bug_remove(session, &late);
+	switch_core_media_bug_remove(session, &replace);
+	switch_core_media_bug_remove(session, &early);
+
+	printf("test_write_order() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+/* a second thread asking how much is buffered while the consumer reads must not move the ring tail under it */
+static void test_inuse_guard(void)
+{
+	switch_core_session_t *session = session_new();
+	switch_media_bug_t *listen, *replace;
+	switch_size_t rlen, wlen;
+	int16_t data[FRAME_BYTES / 2];
+	int fails = fail_count;
+
+	listen = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM);
+	replace = bug_add(session, replace_callback, SMBF_WRITE_REPLACE);
+
+	fill(data, 1);
+	feed_read(session, data);
+	feed_write(session, data);
+	switch_core_media_bug_flush(listen);
+
+	/* as if the consumer were inside switch_core_media_bug_read */
+	listen->reader = 1;
+	switch_core_media_bug_inuse(listen, &rlen, &wlen);
+	CHECK(wlen == FRAME_BYTES, "flush applied behind the reader's back, %u write bytes left", (unsigned) wlen);
+	CHECK(listen->raw_write_buffer->tail == 0, "ring tail moved by a non consumer");
+	listen->reader = 0;
+
+	switch_core_media_bug_inuse(listen, &rlen, &wlen);
+	CHECK(wlen == 0, "flush not applied once the reader left, %u write bytes left", (unsigned) wlen);
+	CHECK(!listen->reader, "switch_core_media_bug_inuse left the reader set");
+
+	switch_core_media_bug_remove(session, &replace);
+	switch_core_media_bug_remove(session, &listen);
+
+	printf("test_inuse_guard() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+static switch_time_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (switch_time_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+   What the bugs cost one session per 20ms frame: both streams fed the way the read and write paths do and every bug
+   reading its frame back, with the listeners on the tap hub and again on private rings behind a write-replace bug.
+*/
+static void bench_bugs(int bugs, int frames, switch_bool_t private)
+{
+	switch_core_session_t *session = session_new();
+	switch_media_bug_t *bug[4], *replace = NULL;
+	switch_frame_t frame = { 0 };
+	uint8_t buf[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	int16_t data[FRAME_BYTES / 2];
+	switch_time_t start;
+	int x, y;
+
+	for (x = 0; x < bugs; x++) {
+		bug[x] = bug_add(session, bug_callback, SMBF_READ_STREAM | SMBF_WRITE_STREAM);
+	}
+
+	if (private) {
+		replace = bug_add(session, replace_callback, SMBF_WRITE_REPLACE);
+	}
+
+	frame.data = buf;
+	frame.buflen = sizeof(buf);
+	fill(data, 100);
+
+	start = now_us();
+	for (x = 0; x < frames; x++) {
+		feed_read(session, data);
+		feed_write(session, data);
+		for (y = 0; y < bugs; y++) {
+			switch_core_media_bug_read(bug[y], &frame, SWITCH_FALSE);
+		}
+	}
+
+	printf("%d bugs %-8s %.3f us/frame\n", bugs, private ? "private" : "tap", (double) (now_us() - start) / frames);
+
+	if (replace) {
+		switch_core_media_bug_remove(session, &replace);
+	}
+	for (x = 0; x < bugs; x++) {
+		switch_core_media_bug_remove(session, &bug[x]);
+	}
+}
+
+static void bench(int frames)
+{
+	int bugs;
+
+	for (bugs = 1; bugs <= 4; bugs *= 2) {
+		bench_bugs(bugs, frames, SWITCH_FALSE);
+		bench_bugs(bugs, frames, SWITCH_TRUE);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int cycles = 10000;
+
+	verbose = getenv("MEDIA_BUG_TEST_VERBOSE") != NULL;
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench(argc > 2 ? atoi(argv[2]) : 1000000);
+		return 0;
+	}
+
+	if (argc > 1) {
+		cycles = atoi(argv[1]);
+	}
+
+	test_add_remove(cycles);
+	test_tap_regrow();
+	test_write_order();
+	test_inuse_guard();
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+	return fail_count ? 1 : 0;
+}
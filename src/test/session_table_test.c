@@ -0,0 +1,276 @@
+/*
+ * Times switch_core_session_locate() on the striped session table from 1, 8 and 32 threads, with a session created
+ * and destroyed now and then the way call setup and hangup do, against the single mutex guarded table it replaced.
+ * switch_core_session.c is included; the locks and session read locks it takes are faked below, see README.
+ */
+#include "../switch_core_session.c"
+#include <sys/time.h>
+
+static int fail_count;
+
+#define CHECK(expr, ...) do { if (!(expr)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); fail_count++; } } while (0)
+
+struct switch_runtime runtime;
+
+/* apr_hashfunc_default() for NUL terminated keys, which is all switch_hashfunc_default() is; it picks the stripe */
+unsigned int switch_hashfunc_default(const char *key, switch_ssize_t *klen)
+{
+	const unsigned char *p;
+	unsigned int hash = 0;
+
+	for (p = (const unsigned char *) key; *p; p++) {
+		hash = hash * 33 + *p;
+	}
+	*klen = p - (const unsigned char *) key;
+
+	return hash;
+}
+
+void *switch_core_perform_alloc(switch_memory_pool_t *pool, switch_size_t memory, const char *file, const char *func, int line)
+{
+	return calloc(1, memory);
+}
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool)
+{
+	pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+
+	pthread_mutex_init(mutex, NULL);
+	*lock = (switch_mutex_t *) mutex;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock)
+{
+	pthread_mutex_lock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) lock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_create(switch_thread_rwlock_t **rwlock, switch_memory_pool_t *pool)
+{
+	pthread_rwlock_t *lock = malloc(sizeof(*lock));
+
+	pthread_rwlock_init(lock, NULL);
+	*rwlock = (switch_thread_rwlock_t *) lock;
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_rdlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_rdlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_tryrdlock(switch_thread_rwlock_t *rwlock)
+{
+	return pthread_rwlock_tryrdlock((pthread_rwlock_t *) rwlock) ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_wrlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_wrlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_rwlock_unlock(switch_thread_rwlock_t *rwlock)
+{
+	pthread_rwlock_unlock((pthread_rwlock_t *) rwlock);
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* the session read lock is what switch_core_session_locate() hands back, the channel checks around it are left out */
+#ifdef SWITCH_DEBUG_RWLOCKS
+switch_status_t switch_core_session_perform_read_lock(switch_core_session_t *session, const char *file, const char *func, int line)
+#else
+switch_status_t switch_core_session_read_lock(switch_core_session_t *session)
+#endif
+{
+	return switch_thread_rwlock_tryrdlock(session->rwlock);
+}
+
+#ifdef SWITCH_DEBUG_RWLOCKS
+void switch_core_session_perform_rwunlock(switch_core_session_t *session, const char *file, const char *func, int line)
+#else
+void switch_core_session_rwunlock(switch_core_session_t *session)
+#endif
+{
+	switch_thread_rwlock_unlock(session->rwlock);
+}
+
+#define BENCH_SESSIONS 1000
+/* one operation in CHURN_EVERY hangs a session up and creates its replacement */
+#define CHURN_EVERY 64
+
+static switch_core_session_t *sessions[BENCH_SESSIONS];
+
+/* the table before it was striped: one hash, every lookup and change under runtime.session_hash_mutex */
+static switch_hash_t *single_table;
+
+static switch_core_session_t *single_locate(const char *uuid_str)
+{
+	switch_core_session_t *session;
+
+	switch_mutex_lock(runtime.session_hash_mutex);
+	if ((session = switch_core_hash_find(single_table, uuid_str))) {
+		if (switch_thread_rwlock_tryrdlock(session->rwlock) != SWITCH_STATUS_SUCCESS) {
+			session = NULL;
+		}
+	}
+	switch_mutex_unlock(runtime.session_hash_mutex);
+
+	return session;
+}
+
+static void single_churn(switch_core_session_t *session)
+{
+	switch_mutex_lock(runtime.session_hash_mutex);
+	switch_core_hash_delete(single_table, session->uuid_str);
+	switch_mutex_unlock(runtime.session_hash_mutex);
+
+	switch_mutex_lock(runtime.session_hash_mutex);
+	switch_core_hash_insert(single_table, session->uuid_str, session);
+	switch_mutex_unlock(runtime.session_hash_mutex);
+}
+
+/* the same steps switch_core_session_perform_destroy() and switch_core_session_request_uuid() take on the stripes */
+static void striped_churn(switch_core_session_t *session)
+{
+	struct switch_session_stripe *stripe = session_stripe(session->uuid_str);
+
+	switch_core_hash_delete_wrlock(stripe->table, session->uuid_str, stripe->rwlock);
+	switch_core_hash_insert_wrlock(stripe->table, session->uuid_str, session, stripe->rwlock);
+}
+
+typedef struct {
+	int striped;
+	int ops;
+	uint32_t seed;
+} bench_thread_t;
+
+static void *bench_thread(void *obj)
+{
+	bench_thread_t *bt = (bench_thread_t *) obj;
+	switch_core_session_t *session;
+	int x;
+
+	for (x = 0; x < bt->ops; x++) {
+		const char *uuid;
+
+		bt->seed = bt->seed * 1103515245 + 12345;
+		uuid = sessions[(bt->seed >> 8) % BENCH_SESSIONS]->uuid_str;
+
+		if (!(x % CHURN_EVERY)) {
+			if (bt->striped) {
+				striped_churn(sessions[(bt->seed >> 8) % BENCH_SESSIONS]);
+			} else {
+				single_churn(sessions[(bt->seed >> 8) % BENCH_SESSIONS]);
+			}
+			continue;
+		}
+
+		/* a locate racing the churn of the same uuid may miss it, as with a real hangup */
+		if ((session = bt->striped ? switch_core_session_locate(uuid) : single_locate(uuid))) {
+			switch_core_session_rwunlock(session);
+		}
+	}
+
+	return NULL;
+}
+
+static double bench_run(int striped, int threads, int ops)
+{
+	pthread_t tid[32];
+	bench_thread_t bt[32];
+	struct timeval start, end;
+	int x;
+
+	gettimeofday(&start, NULL);
+	for (x = 0; x < threads; x++) {
+		bt[x].striped = striped;
+		bt[x].ops = ops / threads;
+		bt[x].seed = x + 1;
+		pthread_create(&tid[x], NULL, bench_thread, &bt[x]);
+	}
+	for (x = 0; x < threads; x++) {
+		pthread_join(tid[x], NULL);
+	}
+	gettimeofday(&end, NULL);
+
+	return ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / ops;
+}
+
+static void tables_init(void)
+{
+	int x, i;
+
+	switch_mutex_init(&runtime.session_hash_mutex, SWITCH_MUTEX_NESTED, NULL);
+	switch_core_hash_init(&single_table, NULL);
+
+	for (i = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+		switch_thread_rwlock_create(&session_manager.stripes[i].rwlock, NULL);
+		switch_core_hash_init(&session_manager.stripes[i].table, NULL);
+	}
+
+	for (x = 0; x < BENCH_SESSIONS; x++) {
+		sessions[x] = calloc(1, sizeof(switch_core_session_t));
+		snprintf(sessions[x]->uuid_str, sizeof(sessions[x]->uuid_str), "%08x-%04x-4%03x-a%03x-%012x", x * 2654435761u, x & 0xffff,
+				 x & 0xfff, (x * 7) & 0xfff, x * 40503u);
+		switch_thread_rwlock_create(&sessions[x]->rwlock, NULL);
+		striped_churn(sessions[x]);
+		single_churn(sessions[x]);
+	}
+}
+
+/* every session is found in the stripe its uuid hashes to and in no other */
+static void test_locate(void)
+{
+	switch_core_session_t *session;
+	int x, i, found, fails = fail_count;
+
+	for (x = 0; x < BENCH_SESSIONS; x++) {
+		session = switch_core_session_locate(sessions[x]->uuid_str);
+		CHECK(session == sessions[x], "locate %s", sessions[x]->uuid_str);
+		if (session) {
+			switch_core_session_rwunlock(session);
+		}
+
+		for (i = 0, found = 0; i < SWITCH_SESSION_TABLE_STRIPES; i++) {
+			found += switch_core_hash_find(session_manager.stripes[i].table, sessions[x]->uuid_str) != NULL;
+		}
+		CHECK(found == 1, "%s is in %d stripes", sessions[x]->uuid_str, found);
+	}
+
+	CHECK(!switch_core_session_locate("not-a-session"), "located a uuid that was never added");
+
+	printf("test_locate() : %s\n", fail_count == fails ? "PASS" : "FAIL");
+}
+
+int main(int argc, char **argv)
+{
+	int threads[] = { 1, 8, 32 };
+	int ops = 2000000, x;
+
+	if (argc > 1) {
+		ops = atoi(argv[1]);
+	}
+
+	tables_init();
+	test_locate();
+
+	for (x = 0; x < 3; x++) {
+		double single = bench_run(0, threads[x], ops), striped = bench_run(1, threads[x], ops);
+
+		printf("%2d threads: single mutex %.3f us/op, %d stripes %.3f us/op\n", threads[x], single, SWITCH_SESSION_TABLE_STRIPES, striped);
+	}
+
+	printf("%s\n", fail_count ? "FAIL" : "PASS");
+	return fail_count ? 1 : 0;
+}